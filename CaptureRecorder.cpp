@@ -0,0 +1,288 @@
+#include "CaptureRecorder.h"
+#include "FramePacer.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+////////////////////////////////////////////
+// RecorderThread
+////////////////////////////////////////////
+
+class RecorderThread : public QThread
+{
+public:
+    RecorderThread(CaptureRecorder* recorder) : mRecorder(recorder) {}
+
+protected:
+    virtual void run() { mRecorder->run(); }
+
+private:
+    CaptureRecorder*        mRecorder;
+};
+
+////////////////////////////////////////////
+// CaptureRecorder
+////////////////////////////////////////////
+
+CaptureRecorder::CaptureRecorder(const std::string& path, int queueDepth) :
+    mPath(path),
+    mQueueDepth(queueDepth),
+    mFd(-1),
+    mDirect(false),
+    mIndex(NULL),
+    mBounce(NULL),
+    mQueue(queueDepth, FrameQueue::PolicyDropNewest),
+    mThread(NULL),
+    mRecording(0),
+    mStop(0),
+    mWritten(0),
+    mAllocated(0),
+    mRejected(0),
+    mFailed(false),
+    mStartTime(0)
+{
+}
+
+CaptureRecorder::~CaptureRecorder()
+{
+    Close();
+}
+
+bool CaptureRecorder::Open(unsigned width, unsigned height, BMDTimeValue frameDuration, BMDTimeScale timeScale)
+{
+    Close();
+
+    mInfo.width = width;
+    mInfo.height = height;
+    mInfo.rowBytes = width * 2;
+    mInfo.frameBytes = mInfo.rowBytes * height;
+    mInfo.slotBytes = (mInfo.frameBytes + RecordingInfo::Alignment - 1) / RecordingInfo::Alignment * RecordingInfo::Alignment;
+    mInfo.frameDuration = frameDuration;
+    mInfo.timeScale = timeScale;
+
+    // Some file systems, e.g. tmpfs, refuse O_DIRECT; the recording still works through the page cache
+    mDirect = true;
+    mFd = open(mPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+    if (mFd < 0 && errno == EINVAL)
+    {
+        mDirect = false;
+        mFd = open(mPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    }
+    if (mFd < 0)
+    {
+        fprintf(stderr, "Recorder: cannot open %s: %s\n", mPath.c_str(), strerror(errno));
+        return false;
+    }
+
+    std::string indexPath = RecordingInfo::indexPath(mPath);
+    mIndex = fopen(indexPath.c_str(), "w");
+    if (! mIndex)
+    {
+        fprintf(stderr, "Recorder: cannot open %s: %s\n", indexPath.c_str(), strerror(errno));
+        Close();
+        return false;
+    }
+    if (posix_memalign((void**)&mBounce, RecordingInfo::Alignment, mInfo.slotBytes) != 0)
+    {
+        mBounce = NULL;
+        Close();
+        return false;
+    }
+
+    fprintf(mIndex, "cam2vr-raw-capture 1\n");
+    fprintf(mIndex, "width %u\nheight %u\nrow_bytes %u\nframe_bytes %u\nslot_bytes %u\n",
+            mInfo.width, mInfo.height, mInfo.rowBytes, mInfo.frameBytes, mInfo.slotBytes);
+    fprintf(mIndex, "frame_duration %lld\ntime_scale %lld\nframes\n", (long long)mInfo.frameDuration, (long long)mInfo.timeScale);
+
+    mWritten = 0;
+    mAllocated = 0;
+    mRejected = 0;
+    mFailed = false;
+    mStartTime = FramePacer::now();
+    if (! preallocate((unsigned long long)mInfo.slotBytes * (PreallocateSeconds * timeScale / frameDuration + 1)))
+    {
+        Close();
+        return false;
+    }
+
+    mQueue.configure(mQueueDepth, FrameQueue::PolicyDropNewest);
+    mQueue.resetCounters();
+    mDoorbell.tryAcquire(mDoorbell.available());
+    mStop.storeRelease(0);
+    mThread = new RecorderThread(this);
+    mThread->start();
+    mRecording.storeRelease(1);
+
+    fprintf(stderr, "Recorder: writing %ux%u frames to %s%s\n", width, height, mPath.c_str(),
+            mDirect ? "" : " through the page cache, O_DIRECT is not supported there");
+    return true;
+}
+
+void CaptureRecorder::Close()
+{
+    mRecording.storeRelease(0);
+
+    if (mThread)
+    {
+        // The writer drains the queue before it returns
+        mStop.storeRelease(1);
+        mDoorbell.release();
+        mThread->wait();
+        delete mThread;
+        mThread = NULL;
+
+        double seconds = (FramePacer::now() - mStartTime) / 1e9;
+        double megabytes = (double)mWritten * mInfo.slotBytes / 1e6;
+        fprintf(stderr, "Recorder: %llu frames (%.0f MB, %.0f MB/s) written to %s, %u dropped while the disk was behind%s\n",
+                mWritten, megabytes, seconds > 0 ? megabytes / seconds : 0.0, mPath.c_str(), mQueue.droppedCount(),
+                mFailed ? ", stopped by an error" : "");
+        if (mRejected)
+            fprintf(stderr, "Recorder: %llu frames of another size were not recorded\n", mRejected);
+    }
+
+    if (mFd >= 0)
+    {
+        // Drop what was preallocated beyond the last frame
+        if (ftruncate(mFd, (off_t)mWritten * mInfo.slotBytes) != 0)
+            fprintf(stderr, "Recorder: cannot trim %s: %s\n", mPath.c_str(), strerror(errno));
+        close(mFd);
+        mFd = -1;
+    }
+    if (mIndex)
+    {
+        fclose(mIndex);
+        mIndex = NULL;
+    }
+    free(mBounce);
+    mBounce = NULL;
+}
+
+void CaptureRecorder::recordFrame(IDeckLinkVideoInputFrame* frame)
+{
+    if (! mRecording.loadAcquire())
+        return;
+
+    CapturedFrame captured;
+    captured.frame = frame;
+    captured.hasNoInputSource = frame->GetFlags() & bmdFrameHasNoInputSource;
+    captured.arrivalTime = FramePacer::now();
+
+    // A full queue refuses the frame rather than waiting for the disk
+    frame->AddRef();
+    if (mQueue.push(captured))
+        mDoorbell.release();
+}
+
+void CaptureRecorder::run()
+{
+    for (;;)
+    {
+        mDoorbell.tryAcquire(1, 100);
+
+        CapturedFrame captured;
+        bool popped = false;
+        while (mQueue.pop(captured))
+        {
+            popped = true;
+            // After an error, e.g. a full disk, frames are only returned
+            if (! mFailed)
+                mFailed = ! writeFrame(captured);
+            captured.frame->Release();
+        }
+
+        if (! popped && mStop.loadAcquire())
+            break;
+    }
+    fflush(mIndex);
+}
+
+bool CaptureRecorder::writeFrame(const CapturedFrame& captured)
+{
+    IDeckLinkVideoInputFrame* frame = captured.frame;
+    if ((unsigned)(frame->GetRowBytes() * frame->GetHeight()) != mInfo.frameBytes)
+    {
+        mRejected++;
+        return true;
+    }
+
+    unsigned long long offset = mWritten * mInfo.slotBytes;
+    if (offset + mInfo.slotBytes > mAllocated
+        && ! preallocate(mAllocated + (unsigned long long)mInfo.slotBytes * (PreallocateSeconds * mInfo.timeScale / mInfo.frameDuration + 1)))
+        return false;
+
+    void* pixels;
+    frame->GetBytes(&pixels);
+    const unsigned char* bytes = (const unsigned char*)pixels;
+
+    bool written;
+    if (((uintptr_t)bytes % RecordingInfo::Alignment) == 0)
+    {
+        // Whole pages straight from the capture buffer, the rest of the last one padded
+        unsigned direct = mInfo.frameBytes / RecordingInfo::Alignment * RecordingInfo::Alignment;
+        written = writeFully(bytes, direct, offset);
+        if (written && direct < mInfo.frameBytes)
+        {
+            memcpy(mBounce, bytes + direct, mInfo.frameBytes - direct);
+            memset(mBounce + (mInfo.frameBytes - direct), 0, mInfo.slotBytes - mInfo.frameBytes);
+            written = writeFully(mBounce, mInfo.slotBytes - direct, offset + direct);
+        }
+    }
+    else
+    {
+        memcpy(mBounce, bytes, mInfo.frameBytes);
+        memset(mBounce + mInfo.frameBytes, 0, mInfo.slotBytes - mInfo.frameBytes);
+        written = writeFully(mBounce, mInfo.slotBytes, offset);
+    }
+    if (! written)
+        return false;
+
+    BMDTimeValue hardwareTime = 0, streamTime = 0, duration;
+    if (frame->GetHardwareReferenceTimestamp(1000000000LL, &hardwareTime, &duration) != S_OK)
+        hardwareTime = 0;
+    if (frame->GetStreamTime(&streamTime, &duration, mInfo.timeScale) != S_OK)
+        streamTime = 0;
+    fprintf(mIndex, "%llu,%lld,%lld,%lld,%d\n", mWritten, (long long)hardwareTime, (long long)streamTime,
+            (long long)captured.arrivalTime, captured.hasNoInputSource ? 1 : 0);
+
+    // The index of a recording cut short by a crash should still cover most of it
+    if (++mWritten % 64 == 0)
+        fflush(mIndex);
+    return true;
+}
+
+// Reserve the file up to size, so the writes never wait for block allocation
+bool CaptureRecorder::preallocate(unsigned long long size)
+{
+    int result = posix_fallocate(mFd, (off_t)mAllocated, (off_t)(size - mAllocated));
+    if (result != 0)
+    {
+        fprintf(stderr, "Recorder: cannot extend %s to %llu MB: %s\n", mPath.c_str(), size / 1000000, strerror(result));
+        return false;
+    }
+    mAllocated = size;
+    return true;
+}
+
+bool CaptureRecorder::writeFully(const void* buffer, size_t length, unsigned long long offset)
+{
+    const unsigned char* bytes = (const unsigned char*)buffer;
+    while (length > 0)
+    {
+        ssize_t written = pwrite(mFd, bytes, length, (off_t)offset);
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written <= 0)
+        {
+            fprintf(stderr, "Recorder: write to %s failed after %llu frames: %s\n", mPath.c_str(), mWritten,
+                    written < 0 ? strerror(errno) : "nothing written");
+            return false;
+        }
+        bytes += written;
+        length -= written;
+        offset += written;
+    }
+    return true;
+}
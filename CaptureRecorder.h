@@ -0,0 +1,105 @@
+#ifndef CAPTURE_RECORDER_H
+#define CAPTURE_RECORDER_H
+
+#include "DeckLinkAPI.h"
+#include "FrameQueue.h"
+
+#include <QSemaphore>
+#include <QThread>
+#include <stdio.h>
+#include <string>
+
+class RecorderThread;
+
+////////////////////////////////////////////
+// RecordingInfo
+////////////////////////////////////////////
+
+// Layout of a raw capture recording.  The data file holds the UYVY frames back to back, each in a
+// slot of slotBytes, frameBytes rounded up to 4 KiB, so every frame starts page aligned.  Next to it
+// the index file, <data file>.idx, is text: a header of "key value" lines, a "frames" line, then a
+// CSV line per recorded frame:
+//   slot,hardware_ns,stream_time,arrival_ns,no_input
+// with the hardware reference timestamp in ns, the stream time in timeScale units, the monotonic
+// arrival time of the capture callback and whether the input had no signal.  Slots follow each
+// other without gaps; frames dropped while recording only show as gaps in the timestamps.
+struct RecordingInfo
+{
+    RecordingInfo() : width(0), height(0), rowBytes(0), frameBytes(0), slotBytes(0), frameDuration(0), timeScale(0) {}
+
+    unsigned        width;
+    unsigned        height;
+    unsigned        rowBytes;
+    unsigned        frameBytes;
+    unsigned        slotBytes;
+    BMDTimeValue    frameDuration;
+    BMDTimeScale    timeScale;
+
+    enum { Alignment = 4096 };
+
+    static std::string indexPath(const std::string& dataPath) { return dataPath + ".idx"; }
+};
+
+////////////////////////////////////////////
+// CaptureRecorder
+////////////////////////////////////////////
+
+// Records the raw UYVY frames as they arrive in VideoInputFrameArrived(), to look into artefacts
+// after a show; RecordedFrameSource plays such a recording back.  At 1080p60 that is 250 MB/s, far
+// more at 2160p, so the page cache is bypassed: the file is opened with O_DIRECT and written with
+// pwrite() on a thread of the recorder, straight from the capture buffers, which
+// PinnedMemoryAllocator aligns to 4 KiB; only the partial page at the end of a frame, or a frame in
+// memory that is not aligned, goes through a bounce buffer.  The file is preallocated ahead of the
+// writes and trimmed to the recorded frames on Close().
+//
+// The capture callback is never blocked: recordFrame() only queues a reference to the frame on a
+// lock-free queue and refuses the frame when the queue is full, that is when the disk falls behind.
+// Held frames keep their capture buffer, so the queue depth is memory the allocator has to provide.
+//
+// Open() and Close() must not overlap recordFrame(), i.e. they are called while capture is stopped.
+class CaptureRecorder
+{
+public:
+    enum { DefaultQueueDepth = 8, PreallocateSeconds = 10 };
+
+    CaptureRecorder(const std::string& path, int queueDepth = DefaultQueueDepth);
+    ~CaptureRecorder();
+
+    // Start a new recording of frames of the given size and rate, replacing the file
+    bool Open(unsigned width, unsigned height, BMDTimeValue frameDuration, BMDTimeScale timeScale);
+    void Close();
+
+    // Capture callback thread
+    void recordFrame(IDeckLinkVideoInputFrame* frame);
+
+private:
+    friend class RecorderThread;
+
+    // Writer thread
+    void run();
+    bool writeFrame(const CapturedFrame& captured);
+    bool preallocate(unsigned long long size);
+    bool writeFully(const void* buffer, size_t length, unsigned long long offset);
+
+    std::string             mPath;
+    int                     mQueueDepth;
+    RecordingInfo           mInfo;
+    int                     mFd;
+    bool                    mDirect;        // O_DIRECT, otherwise buffered writes
+    FILE*                   mIndex;
+    unsigned char*          mBounce;        // slotBytes, aligned
+    FrameQueue              mQueue;
+    QSemaphore              mDoorbell;      // released for every queued frame
+    RecorderThread*         mThread;
+    QAtomicInt              mRecording;
+    QAtomicInt              mStop;
+
+    // Writer thread while recording
+    unsigned long long      mWritten;       // frames
+    unsigned long long      mAllocated;     // bytes preallocated
+    unsigned long long      mRejected;      // of the wrong size
+    bool                    mFailed;
+    BMDTimeValue            mStartTime;
+};
+
+#endif
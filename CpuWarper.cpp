@@ -0,0 +1,215 @@
+#include "CpuWarper.h"
+
+#include <QRunnable>
+#include <QThread>
+#include <math.h>
+#include <stddef.h>
+
+namespace {
+
+enum Phase {
+    PhaseConvert = 0,
+    PhaseRemap
+};
+
+// Blend two RGBA pixels, w/256 of b; two channels per multiply, each in its own 16 bits
+inline uint32_t lerpPixel(uint32_t a, uint32_t b, uint32_t w)
+{
+    uint32_t rb = (((a & 0x00ff00ff) * (256 - w) + (b & 0x00ff00ff) * w + 0x00800080) >> 8) & 0x00ff00ff;
+    uint32_t ag = (((a >> 8) & 0x00ff00ff) * (256 - w) + ((b >> 8) & 0x00ff00ff) * w + 0x00800080) & 0xff00ff00;
+    return rb | ag;
+}
+
+} // namespace
+
+////////////////////////////////////////////
+// CpuWarpBand
+////////////////////////////////////////////
+
+// One band of rows of one phase of CpuWarper::warp()
+class CpuWarpBand : public QRunnable
+{
+public:
+    CpuWarpBand(CpuWarper* warper, int phase, unsigned first, unsigned last) :
+        mWarper(warper), mPhase(phase), mFirst(first), mLast(last)
+    {
+    }
+
+    virtual void run()
+    {
+        if (mPhase == PhaseConvert)
+            mWarper->convertRows(mFirst, mLast);
+        else
+            mWarper->remapRows(mFirst, mLast);
+    }
+
+private:
+    CpuWarper*  mWarper;
+    int         mPhase;
+    unsigned    mFirst;
+    unsigned    mLast;
+};
+
+////////////////////////////////////////////
+// CpuWarper
+////////////////////////////////////////////
+
+CpuWarper::CpuWarper() :
+    mWidth(0), mHeight(0),
+    mSrc(NULL), mSrcRowBytes(0),
+    mDst(NULL), mDstRowBytes(0)
+{
+    mPool.setMaxThreadCount(QThread::idealThreadCount());
+}
+
+CpuWarper::~CpuWarper()
+{
+    mPool.waitForDone();
+}
+
+void CpuWarper::setThreadCount(int threads)
+{
+    mPool.setMaxThreadCount(threads > 0 ? threads : QThread::idealThreadCount());
+}
+
+// Inverse of the vertex placement in WarpRenderer::computeMeshVertices(): from a point on the screen
+// back through the viewport, the undistorted tan-angles and the lens to the point of the eye's half
+// of the video frame.
+void CpuWarper::init(DeviceInfo& deviceInfo, unsigned width, unsigned height)
+{
+    mWidth = width;
+    mHeight = height;
+    mTable.resize((size_t)width * height);
+    mRgba.resize((size_t)width * height);
+
+    float lensFrustum[4];
+    deviceInfo.getLeftEyeVisibleTanAngles(lensFrustum);
+
+    float noLensFrustum[4];
+    deviceInfo.getLeftEyeNoLensTanAngles(noLensFrustum);
+
+    float viewport[4];
+    deviceInfo.getLeftEyeVisibleScreenRect(noLensFrustum, viewport);
+
+    // Each eye covers its half of the screen; the right eye's frusta and viewport are the left eye's mirrored
+    for (int e = 0; e < 2; e++)
+    {
+        unsigned firstColumn = e == 0 ? 0 : width / 2;
+        unsigned lastColumn = e == 0 ? width / 2 : width;
+
+        for (unsigned row = 0; row < height; row++)
+        {
+            RemapEntry* entry = &mTable[(size_t)row * width + firstColumn];
+
+            // Screen rows run top-down, normalised device coordinates bottom-up
+            float ndcY = 1.0f - 2.0f * (row + 0.5f) / height;
+            float v = ((ndcY / 2.0f + 0.5f) - viewport[1]) / viewport[3];
+            float q = noLensFrustum[3] + v * (noLensFrustum[1] - noLensFrustum[3]);
+
+            for (unsigned column = firstColumn; column < lastColumn; column++, entry++)
+            {
+                float ndcX = 2.0f * (column + 0.5f) / width - 1.0f;
+                float u = ((ndcX / 2.0f + 0.5f) - viewport[0]) / viewport[2];
+                float p = noLensFrustum[0] + u * (noLensFrustum[2] - noLensFrustum[0]);
+
+                float r = sqrtf(p * p + q * q);
+                float scale = r > 0 ? deviceInfo.distort(r) / r : 1.0f;
+                float s = (p * scale - lensFrustum[0]) / (lensFrustum[2] - lensFrustum[0]);
+                float t = (q * scale - lensFrustum[3]) / (lensFrustum[1] - lensFrustum[3]);
+
+                // Outside the mesh nothing is drawn
+                if (s < 0 || s > 1 || t < 0 || t > 1)
+                {
+                    entry->offset = -1;
+                    entry->weightX = 0;
+                    entry->weightY = 0;
+                    continue;
+                }
+
+                // Texture coordinates as in the vertex shader, then pixel centres of the source frame
+                float x = (s * 0.5f + 0.5f * e) * width - 0.5f;
+                float y = (1.0f - t) * height - 0.5f;
+                x = x < 0 ? 0 : (x > width - 1 ? width - 1 : x);
+                y = y < 0 ? 0 : (y > height - 1 ? height - 1 : y);
+
+                // The bottom and right samples stay inside the frame, with full weight on the last pixel
+                unsigned x0 = (unsigned)x;
+                unsigned y0 = (unsigned)y;
+                if (x0 > width - 2)
+                    x0 = width - 2;
+                if (height > 1 && y0 > height - 2)
+                    y0 = height - 2;
+
+                entry->offset = (int32_t)(y0 * width + x0);
+                entry->weightX = (uint16_t)floorf((x - x0) * 256.0f + 0.5f);
+                entry->weightY = (uint16_t)floorf((y - y0) * 256.0f + 0.5f);
+            }
+        }
+
+        float w = lensFrustum[2] - lensFrustum[0];
+        lensFrustum[0] = -(w + lensFrustum[0]);
+        lensFrustum[2] = w - lensFrustum[2];
+        w = noLensFrustum[2] - noLensFrustum[0];
+        noLensFrustum[0] = -(w + noLensFrustum[0]);
+        noLensFrustum[2] = w - noLensFrustum[2];
+        viewport[0] = 1 - (viewport[0] + viewport[2]);
+    }
+}
+
+void CpuWarper::warp(const unsigned char* src, unsigned srcRowBytes, unsigned char* dst, int dstRowBytes)
+{
+    if (mTable.empty())
+        return;
+
+    mSrc = src;
+    mSrcRowBytes = srcRowBytes;
+    mDst = dst;
+    mDstRowBytes = dstRowBytes;
+
+    // The remap gathers from anywhere in the frame, so conversion has to finish first
+    runBands(PhaseConvert);
+    runBands(PhaseRemap);
+}
+
+void CpuWarper::runBands(int phase)
+{
+    unsigned bands = (unsigned)mPool.maxThreadCount();
+    if (bands > mHeight)
+        bands = mHeight;
+
+    for (unsigned i = 0; i < bands; i++)
+        mPool.start(new CpuWarpBand(this, phase, mHeight * i / bands, mHeight * (i + 1) / bands));
+    mPool.waitForDone();
+}
+
+void CpuWarper::convertRows(unsigned first, unsigned last)
+{
+    mConverter.toRGBA(mSrc + (size_t)first * mSrcRowBytes, mSrcRowBytes, mWidth, last - first,
+                      (unsigned char*)&mRgba[(size_t)first * mWidth], mWidth * 4);
+}
+
+void CpuWarper::remapRows(unsigned first, unsigned last)
+{
+    const uint32_t* rgba = &mRgba[0];
+    unsigned stride = mHeight > 1 ? mWidth : 0;
+
+    for (unsigned row = first; row < last; row++)
+    {
+        const RemapEntry* entry = &mTable[(size_t)row * mWidth];
+        uint32_t* out = (uint32_t*)(mDst + (ptrdiff_t)row * mDstRowBytes);
+
+        for (unsigned column = 0; column < mWidth; column++, entry++)
+        {
+            if (entry->offset < 0)
+            {
+                out[column] = 0;
+                continue;
+            }
+
+            const uint32_t* p = rgba + entry->offset;
+            uint32_t top = lerpPixel(p[0], p[1], entry->weightX);
+            uint32_t bottom = lerpPixel(p[stride], p[stride + 1], entry->weightX);
+            out[column] = lerpPixel(top, bottom, entry->weightY);
+        }
+    }
+}
@@ -0,0 +1,77 @@
+#ifndef CPU_WARPER_H
+#define CPU_WARPER_H
+
+#include "DeviceInfo.h"
+#include "UyvyConverter.h"
+
+#include <QThreadPool>
+#include <stdint.h>
+#include <vector>
+
+using namespace cam2vr;
+
+////////////////////////////////////////////
+// CpuWarper
+////////////////////////////////////////////
+
+// Lens-distortion warp on the CPU, for hosts where OpenGL is software only.  Produces the same image
+// as WarpRenderer's distortion mesh: each eye's half of the side-by-side frame is barrel distorted
+// into its viewport of an output frame of the same size.
+//
+// init() builds a remap table holding, for every output pixel, the source position to sample with
+// bilinear weights.  The table is computed from the mapping the mesh approximates, in the direction
+// the warp needs it: screen to lens tan-angles uses DeviceInfo::distort(), the closed-form inverse of
+// the distortInverse() the mesh vertices are solved with, so no secant solves are left in the loop.
+// warp() then converts the frame to RGBA and gathers every output pixel from the table, both split
+// into bands of rows run on a thread pool.
+class CpuWarper
+{
+public:
+    CpuWarper();
+    ~CpuWarper();
+
+    // Worker threads; defaults to one per core
+    void setThreadCount(int threads);
+    int threadCount() const { return mPool.maxThreadCount(); }
+
+    // Build the remap table for frames of the given size and viewer/device.  Again whenever either changes.
+    void init(DeviceInfo& deviceInfo, unsigned width, unsigned height);
+    bool isInitialised() const { return ! mTable.empty(); }
+
+    // Warp one UYVY frame into RGBA.  A negative dstRowBytes with dst on the last row writes the
+    // image bottom-up, as OpenGL stores it.  Returns once the whole frame is done.
+    void warp(const unsigned char* src, unsigned srcRowBytes, unsigned char* dst, int dstRowBytes);
+
+    unsigned width() const { return mWidth; }
+    unsigned height() const { return mHeight; }
+    const UyvyConverter& converter() const { return mConverter; }
+
+private:
+    friend class CpuWarpBand;
+
+    // Output pixels sample the converted frame at offset and the three pixels right and below it
+    struct RemapEntry {
+        int32_t     offset;         // pixel index of the top left sample, -1 outside the lens
+        uint16_t    weightX;        // 0..256
+        uint16_t    weightY;
+    };
+
+    void runBands(int phase);
+    void convertRows(unsigned first, unsigned last);
+    void remapRows(unsigned first, unsigned last);
+
+    QThreadPool                 mPool;
+    UyvyConverter               mConverter;
+    unsigned                    mWidth;
+    unsigned                    mHeight;
+    std::vector<RemapEntry>     mTable;
+    std::vector<uint32_t>       mRgba;          // the frame being warped, converted
+
+    // Frame of the current warp() call
+    const unsigned char*        mSrc;
+    unsigned                    mSrcRowBytes;
+    unsigned char*              mDst;
+    int                         mDstRowBytes;
+};
+
+#endif
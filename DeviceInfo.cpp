@@ -3,6 +3,12 @@
 #include <algorithm>
 #include <math.h>
 #include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define DEVICE_INFO_X86
+#include <emmintrin.h>
+#endif
 
 namespace cam2vr {
 
@@ -12,14 +18,134 @@ namespace cam2vr {
 
 #define DEG2RAG PI/180
 #define RAG2DEG 180/PI
+
+// Intervals of the inverse table, and error samples per interval
+#define INVERSE_TABLE_SIZE 256
+#define INVERSE_ERROR_SAMPLES 8
+// Radii fitted by fitInverseCoefficients()
+#define INVERSE_FIT_SAMPLES 1024
+
+// The lens distortion r * (1 + k1 r^2 + k2 r^4), with the coefficients in the Cardboard SDK's order.
+// distort() evaluates it in float; the inverses are built and checked against it in double precision,
+// so every path uses the same order.
+template <typename T>
+static T distortRadius(const float* k, T r) {
+	T r2 = r * r;
+	return r * (1 + r2 * (k[0] + r2 * k[1]));
+}
+
+static double distortRadiusSlope(const float* k, double r) {
+	double r2 = r * r;
+	return 1 + r2 * (3 * k[0] + r2 * 5 * k[1]);
+}
+
+// Newton's method from r = radius, in double precision
+static double invertRadius(const float* k, double radius) {
+	double r = radius;
+	for (int i = 0; i < 32; i++) {
+		double step = (distortRadius(k, r) - radius) / distortRadiusSlope(k, r);
+		r -= step;
+		if (fabs(step) < 1e-12)
+			break;
+	}
+	return r;
+}
+
+// Distorted radii any mesh may invert: up to just beyond the corner of the field of view.  The phone's
+// screen usually cuts the mesh off well before.
+static double meshRange(const CardboardViewer& viewer) {
+	return 1.1 * sqrt(2.0) * tan(DEG2RAG * viewer.fov);
+}
+
+// Distorted radii to invert: meshRange(), but short of where a lens with a negative coefficient folds
+// back (the distortion stops growing), as no inverse exists past it
+static double inverseRange(const CardboardViewer& viewer) {
+	const float* k = viewer.distortionCoefficients;
+	double range = meshRange(viewer);
+	for (double r = 0; r < 100 && distortRadius(k, r) < range; r += 0.01) {
+		if (distortRadiusSlope(k, r + 0.01) > 0)
+			continue;
+		double low = r, high = r + 0.01;
+		for (int i = 0; i < 32; i++) {
+			double mid = (low + high) / 2;
+			if (distortRadiusSlope(k, mid) > 0)
+				low = mid;
+			else
+				high = mid;
+		}
+		// Keep clear of the fold, where Newton's method converges slowly
+		return std::min(range, distortRadius(k, 0.95 * low));
+	}
+	return range;
+}
+
+// The inverse polynomial of distortInversePolynomial() with its first terms coefficients
+static double invertRadiusPolynomial(const float* k, int terms, double radius) {
+	double r2 = radius * radius;
+	double ret = 0;
+	for (int i = terms - 1; i >= 0; i--) {
+		ret = r2 * (ret + k[i]);
+	}
+	return (ret + 1) * radius;
+}
+
+// Least squares solution x of a x = b for a rows x cols matrix a (row-major, rows >= cols) by
+// Householder QR; a and b are overwritten.  The powers of the radius are far too close to collinear
+// for the normal equations.
+static void solveLeastSquares(std::vector<double>& a, std::vector<double>& b, int rows, int cols, double* x) {
+	std::vector<double> diagonal(cols);
+	for (int j = 0; j < cols; j++) {
+		double norm = 0;
+		for (int i = j; i < rows; i++)
+			norm += a[i * cols + j] * a[i * cols + j];
+		norm = sqrt(norm);
+		diagonal[j] = a[j * cols + j] > 0 ? -norm : norm;
+		if (norm == 0)
+			continue;
+
+		// Reflect column j onto diagonal[j] * e_j with v = column - diagonal[j] * e_j, kept in column j
+		a[j * cols + j] -= diagonal[j];
+		double vv = 0;
+		for (int i = j; i < rows; i++)
+			vv += a[i * cols + j] * a[i * cols + j];
+		for (int c = j + 1; c <= cols; c++) {
+			// Column cols stands for b
+			double dot = 0;
+			for (int i = j; i < rows; i++)
+				dot += a[i * cols + j] * (c < cols ? a[i * cols + c] : b[i]);
+			double f = 2 * dot / vv;
+			for (int i = j; i < rows; i++) {
+				if (c < cols)
+					a[i * cols + c] -= f * a[i * cols + j];
+				else
+					b[i] -= f * a[i * cols + j];
+			}
+		}
+	}
+
+	for (int j = cols - 1; j >= 0; j--) {
+		double sum = b[j];
+		for (int c = j + 1; c < cols; c++)
+			sum -= a[j * cols + c] * x[c];
+		x[j] = diagonal[j] != 0 ? sum / diagonal[j] : 0;
+	}
+}
  	
 
 DeviceInfo::DeviceInfo() 
 {
 	//device
 	DefaultAndroid = Device(0.110, 0.062, 0.004);
+	DefaultAndroid.id = "DefaultAndroid";
+	DefaultAndroid.label = "Android phone";
 	DefaultIOS = Device(0.1038, 0.0584, 0.004);
+	DefaultIOS.id = "DefaultIOS";
+	DefaultIOS.label = "iPhone";
 	m_device = DefaultAndroid;
+	m_devices.push_back(DefaultAndroid);
+	m_devices.push_back(DefaultIOS);
+	m_width = m_height = 0;
+	m_widthMeters = m_heightMeters = m_bevelMeters = 0;
 
 	//viewer
 	CardboardV1 = CardboardViewer();
@@ -53,6 +179,11 @@ DeviceInfo::DeviceInfo()
         CardboardV2.inverseCoefficients[i] = v2_ic[i];
     
     m_viewer = CardboardV2;
+    m_viewers.push_back(CardboardV1);
+    m_viewers.push_back(CardboardV2);
+
+    m_inverseMode = InverseTable;
+    updateInverse();
 
     // others
 
@@ -63,16 +194,68 @@ DeviceInfo::~DeviceInfo()
 
 }
 
-float DeviceInfo::distort(float radius) {
-	float r2 = radius * radius;
-	float ret = 0;
-	for (int i = 0; i < 2; i++) {
-		ret = r2 * (ret + m_viewer.distortionCoefficients[i]);
+void DeviceInfo::setViewer(const CardboardViewer& viewer) {
+	m_viewer = viewer;
+	updateInverse();
+}
+
+void DeviceInfo::setDevice(const Device& device) {
+	m_device = device;
+	updateInverseError();
+}
+
+void DeviceInfo::addViewer(const CardboardViewer& viewer) {
+	for (size_t i = 0; i < m_viewers.size(); i++) {
+		if (m_viewers[i].id == viewer.id) {
+			m_viewers[i] = viewer;
+			return;
+		}
 	}
-	return (ret + 1) * radius;
+	m_viewers.push_back(viewer);
+}
+
+void DeviceInfo::addDevice(const Device& device) {
+	for (size_t i = 0; i < m_devices.size(); i++) {
+		if (m_devices[i].id == device.id) {
+			m_devices[i] = device;
+			return;
+		}
+	}
+	m_devices.push_back(device);
+}
+
+const CardboardViewer* DeviceInfo::findViewer(const std::string& id) const {
+	for (size_t i = 0; i < m_viewers.size(); i++) {
+		if (m_viewers[i].id == id)
+			return &m_viewers[i];
+	}
+	return NULL;
+}
+
+const Device* DeviceInfo::findDevice(const std::string& id) const {
+	for (size_t i = 0; i < m_devices.size(); i++) {
+		if (m_devices[i].id == id)
+			return &m_devices[i];
+	}
+	return NULL;
+}
+
+float DeviceInfo::distort(float radius) {
+	return distortRadius(m_viewer.distortionCoefficients, radius);
 }
 
 float DeviceInfo::distortInverse(float radius) {
+	switch (m_inverseMode) {
+	case InversePolynomial:
+		return distortInversePolynomial(radius);
+	case InverseTable:
+		return distortInverseTable(radius);
+	default:
+		return distortInverseSecant(radius);
+	}
+}
+
+float DeviceInfo::distortInverseSecant(float radius) {
 	// Secant method.
 	float r0 = 0;
 	float r1 = 1;
@@ -87,6 +270,225 @@ float DeviceInfo::distortInverse(float radius) {
 	return r1;
 }
 
+// r * (1 + k1 r^2 + k2 r^4 + ... + k12 r^24)
+float DeviceInfo::distortInversePolynomial(float radius) {
+	float r2 = radius * radius;
+	float ret = 0;
+	for (int i = 11; i >= 0; i--) {
+		ret = r2 * (ret + m_viewer.inverseCoefficients[i]);
+	}
+	return (ret + 1) * radius;
+}
+
+// Cubic Hermite interpolation between nodes evenly spaced in distorted radius.  The inverse is odd,
+// so only positive radii are tabulated; beyond the table the exact inverse is solved.
+float DeviceInfo::distortInverseTable(float radius) {
+	float a = fabs(radius);
+	float x = a / m_inverseTableStep;
+	if (! (x < INVERSE_TABLE_SIZE))
+		return (float)distortInverseExact(radius);
+
+	int j = (int)x;
+	float t = x - j;
+	const float* node = &m_inverseTable[2 * j];
+	float t2 = t * t;
+	float t3 = t2 * t;
+	float r = (2 * t3 - 3 * t2 + 1) * node[0] + (t3 - 2 * t2 + t) * node[1]
+			+ (3 * t2 - 2 * t3) * node[2] + (t3 - t2) * node[3];
+	return radius < 0 ? -r : r;
+}
+
+double DeviceInfo::distortInverseExact(double radius) {
+	return invertRadius(m_viewer.distortionCoefficients, radius);
+}
+
+#ifdef DEVICE_INFO_X86
+__attribute__((target("sse2")))
+static void distortInverseTableSSE2(const float* table, float step, const float* radii, float* result, int count, int& done) {
+	const __m128 signMask = _mm_set1_ps(-0.0f);
+	const __m128 invStep = _mm_set1_ps(1.0f / step);
+	const __m128 limit = _mm_set1_ps((float)INVERSE_TABLE_SIZE);
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 two = _mm_set1_ps(2.0f);
+	const __m128 three = _mm_set1_ps(3.0f);
+
+	for (done = 0; done + 4 <= count; done += 4) {
+		__m128 d = _mm_loadu_ps(radii + done);
+		__m128 sign = _mm_and_ps(d, signMask);
+		__m128 x = _mm_mul_ps(_mm_andnot_ps(signMask, d), invStep);
+			// Radii beyond the table (or NaN) go the scalar way
+		if (_mm_movemask_ps(_mm_cmpnlt_ps(x, limit)))
+			break;
+
+		__m128i j = _mm_cvttps_epi32(x);
+		__m128 t = _mm_sub_ps(x, _mm_cvtepi32_ps(j));
+		int index[4];
+		_mm_storeu_si128((__m128i*)index, j);
+		const float* n0 = table + 2 * index[0];
+		const float* n1 = table + 2 * index[1];
+		const float* n2 = table + 2 * index[2];
+		const float* n3 = table + 2 * index[3];
+		__m128 r0 = _mm_setr_ps(n0[0], n1[0], n2[0], n3[0]);
+		__m128 s0 = _mm_setr_ps(n0[1], n1[1], n2[1], n3[1]);
+		__m128 r1 = _mm_setr_ps(n0[2], n1[2], n2[2], n3[2]);
+		__m128 s1 = _mm_setr_ps(n0[3], n1[3], n2[3], n3[3]);
+
+		__m128 t2 = _mm_mul_ps(t, t);
+		__m128 t3 = _mm_mul_ps(t2, t);
+		__m128 h00 = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(two, t3), _mm_mul_ps(three, t2)), one);
+		__m128 h10 = _mm_add_ps(_mm_sub_ps(t3, _mm_mul_ps(two, t2)), t);
+		__m128 h01 = _mm_sub_ps(_mm_mul_ps(three, t2), _mm_mul_ps(two, t3));
+		__m128 h11 = _mm_sub_ps(t3, t2);
+		__m128 r = _mm_add_ps(_mm_add_ps(_mm_mul_ps(h00, r0), _mm_mul_ps(h10, s0)),
+							  _mm_add_ps(_mm_mul_ps(h01, r1), _mm_mul_ps(h11, s1)));
+		_mm_storeu_ps(result + done, _mm_or_ps(r, sign));
+	}
+}
+
+__attribute__((target("sse2")))
+static void distortInversePolynomialSSE2(const float* k, const float* radii, float* result, int count, int& done) {
+	const __m128 one = _mm_set1_ps(1.0f);
+
+	for (done = 0; done + 4 <= count; done += 4) {
+		__m128 d = _mm_loadu_ps(radii + done);
+		__m128 r2 = _mm_mul_ps(d, d);
+		__m128 ret = _mm_setzero_ps();
+		for (int i = 11; i >= 0; i--)
+			ret = _mm_mul_ps(r2, _mm_add_ps(ret, _mm_set1_ps(k[i])));
+		_mm_storeu_ps(result + done, _mm_mul_ps(_mm_add_ps(ret, one), d));
+	}
+}
+#endif
+
+void DeviceInfo::distortInverse(const float* radii, float* result, int count) {
+	int done = 0;
+#ifdef DEVICE_INFO_X86
+	if (m_inverseMode == InverseTable)
+		distortInverseTableSSE2(&m_inverseTable[0], m_inverseTableStep, radii, result, count, done);
+	else if (m_inverseMode == InversePolynomial)
+		distortInversePolynomialSSE2(m_viewer.inverseCoefficients, radii, result, count, done);
+#endif
+	for (int i = done; i < count; i++) {
+		result[i] = distortInverse(radii[i]);
+	}
+}
+
+void DeviceInfo::setInverseMode(InverseMode mode) {
+	m_inverseMode = mode;
+	updateInverse();
+}
+
+// Rebuild the table for the current viewer and measure the current mode's error
+void DeviceInfo::updateInverse() {
+	m_inverseRange = inverseRange(m_viewer);
+	m_inverseTableStep = m_inverseRange / INVERSE_TABLE_SIZE;
+
+	m_inverseTable.resize(2 * (INVERSE_TABLE_SIZE + 1));
+	for (int j = 0; j <= INVERSE_TABLE_SIZE; j++) {
+		double r = distortInverseExact(j * (double)m_inverseTableStep);
+		m_inverseTable[2 * j] = r;
+		m_inverseTable[2 * j + 1] = m_inverseTableStep / distortRadiusSlope(m_viewer.distortionCoefficients, r);
+	}
+
+	updateInverseError();
+}
+
+// Measure the current mode's error over the radii computeMeshVertices() inverts, which end at the
+// corner of the lens frustum and so depend on the phone too, and over the table's whole range
+void DeviceInfo::updateInverseError() {
+	float frustum[4];
+	getLeftEyeVisibleTanAngles(frustum);
+	double x = std::max(fabs(frustum[0]), fabs(frustum[2]));
+	double y = std::max(fabs(frustum[1]), fabs(frustum[3]));
+	m_meshRadius = sqrt(x * x + y * y);
+
+	double meshError = 0, rangeError = 0;
+	for (int i = 0; i <= INVERSE_TABLE_SIZE * INVERSE_ERROR_SAMPLES; i++) {
+		double radius = i * (double)m_meshRadius / (INVERSE_TABLE_SIZE * INVERSE_ERROR_SAMPLES);
+		meshError = std::max(meshError, fabs(distortInverse(radius) - distortInverseExact(radius)));
+		radius = i * (double)m_inverseRange / (INVERSE_TABLE_SIZE * INVERSE_ERROR_SAMPLES);
+		rangeError = std::max(rangeError, fabs(distortInverse(radius) - distortInverseExact(radius)));
+	}
+	m_inverseErrorBound = meshError;
+	m_inverseRangeErrorBound = rangeError;
+}
+
+const char* DeviceInfo::inverseModeName(InverseMode mode) {
+	switch (mode) {
+	case InversePolynomial:		return "polynomial";
+	case InverseTable:			return "table";
+	default:					return "secant";
+	}
+}
+
+bool DeviceInfo::inverseModeFromName(const char* name, InverseMode& mode) {
+	for (int i = InverseSecant; i <= InverseTable; i++) {
+		if (strcmp(name, inverseModeName((InverseMode)i)) == 0) {
+			mode = (InverseMode)i;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool DeviceInfo::isInvertible(const CardboardViewer& viewer) {
+	return inverseRange(viewer) >= meshRange(viewer);
+}
+
+// Fit r(d) = d (1 + k1 d^2 + ... + kn d^2n) to the exact inverse at INVERSE_FIT_SAMPLES radii up to the
+// range updateInverse() uses, for n = 1 to 12.  The radii are scaled to [0, 1] for the solve.  More
+// terms fit better in double precision, but their alternating coefficients cancel, and once rounded to
+// float a shorter polynomial can be the more accurate one, so the n with the smallest error with the
+// coefficients rounded is kept and the higher coefficients are zero.
+float DeviceInfo::fitInverseCoefficients(CardboardViewer& viewer) {
+	const float* k = viewer.distortionCoefficients;
+	double range = inverseRange(viewer);
+
+	std::vector<double> radii(INVERSE_FIT_SAMPLES);
+	std::vector<double> exact(INVERSE_FIT_SAMPLES);
+	for (int j = 0; j < INVERSE_FIT_SAMPLES; j++) {
+		radii[j] = range * (j + 1) / INVERSE_FIT_SAMPLES;
+		exact[j] = invertRadius(k, radii[j]);
+	}
+
+	float best[12];
+	double bestError = HUGE_VAL;
+	for (int terms = 1; terms <= 12; terms++) {
+		std::vector<double> a(INVERSE_FIT_SAMPLES * terms);
+		std::vector<double> b(INVERSE_FIT_SAMPLES);
+		for (int j = 0; j < INVERSE_FIT_SAMPLES; j++) {
+			double x2 = (radii[j] / range) * (radii[j] / range);
+			double power = x2;
+			for (int i = 0; i < terms; i++) {
+				a[j * terms + i] = power;
+				power *= x2;
+			}
+			b[j] = exact[j] / radii[j] - 1;
+		}
+		double solution[12];
+		solveLeastSquares(a, b, INVERSE_FIT_SAMPLES, terms, solution);
+
+		float coefficients[12];
+		double scale = 1 / (range * range);
+		double power = scale;
+		for (int i = 0; i < 12; i++) {
+			coefficients[i] = i < terms ? (float)(solution[i] * power) : 0;
+			power *= scale;
+		}
+
+		double error = 0;
+		for (int j = 0; j < INVERSE_FIT_SAMPLES; j++)
+			error = std::max(error, fabs(invertRadiusPolynomial(coefficients, 12, (float)radii[j]) - exact[j]));
+		if (error < bestError) {
+			bestError = error;
+			memcpy(best, coefficients, sizeof(best));
+		}
+	}
+
+	memcpy(viewer.inverseCoefficients, best, sizeof(best));
+	return (float)bestError;
+}
+
 void DeviceInfo::getLeftEyeVisibleTanAngles(float* result) {
 	
 	// Tan-angles from the max FOV.
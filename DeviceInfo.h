@@ -2,6 +2,7 @@
 #define DEVICE_INFO_H
 
 #include  <string>
+#include  <vector>
 using namespace std;
 
 namespace cam2vr {
@@ -9,6 +10,8 @@ namespace cam2vr {
 
 
 	struct Device {
+		std::string id;
+		std::string label;
 		float widthMeters;
   		float heightMeters;
   		float bevelMeters;
@@ -35,6 +38,13 @@ namespace cam2vr {
 
 	class DeviceInfo {
 	public:
+		// How distortInverse() undoes the lens distortion
+		enum InverseMode {
+			InverseSecant = 0,		// secant iteration on distort(), to 0.1mm
+			InversePolynomial,		// the viewer's inverseCoefficients, a 12 term odd polynomial
+			InverseTable			// cubic Hermite table from Newton solves (the default)
+		};
+
 		DeviceInfo();
 		~DeviceInfo();
 
@@ -42,11 +52,48 @@ namespace cam2vr {
 		float getHeight() { return m_height; }
 		float getWidthMeters() { return m_widthMeters; }
 		float getHeightMeters() { return m_heightMeters; }
-		Device getDevice() { return m_device; }
-		CardboardViewer getViewer() { return m_viewer; }
+		Device getDevice() const { return m_device; }
+		CardboardViewer getViewer() const { return m_viewer; }
+
+		// Switch to another viewer or phone; meshes and remap tables computed before are stale
+		void setViewer(const CardboardViewer& viewer);
+		void setDevice(const Device& device);
+
+		// Profiles to choose from: the built-in ones and those added since.  Adding a profile
+		// replaces the one with the same id.
+		const std::vector<CardboardViewer>& getViewers() const { return m_viewers; }
+		const std::vector<Device>& getDevices() const { return m_devices; }
+		void addViewer(const CardboardViewer& viewer);
+		void addDevice(const Device& device);
+		// The profile with the given id, or NULL
+		const CardboardViewer* findViewer(const std::string& id) const;
+		const Device* findDevice(const std::string& id) const;
 
 		float distort(float radius);
 		float distortInverse(float radius);
+		// Invert count radii at once, vectorised where the mode allows; result may alias radii
+		void distortInverse(const float* radii, float* result, int count);
+
+		void setInverseMode(InverseMode mode);
+		InverseMode getInverseMode() { return m_inverseMode; }
+		// Largest error of the current mode against an exact inverse, measured when the mode, viewer
+		// or phone was set: over the radii the mesh inverts, up to the corner of the lens frustum at
+		// getMeshRadius(), and over all the radii of the table, up to getInverseRange()
+		float getInverseErrorBound() { return m_inverseErrorBound; }
+		float getInverseRangeErrorBound() { return m_inverseRangeErrorBound; }
+		float getMeshRadius() { return m_meshRadius; }
+		float getInverseRange() { return m_inverseRange; }
+
+		// Fit the viewer's inverseCoefficients to its distortionCoefficients, for viewers that come
+		// without them.  Returns the largest error of the fit over the radii of the inverse table,
+		// which include those of any mesh.
+		static float fitInverseCoefficients(CardboardViewer& viewer);
+		// Whether the viewer's distortion keeps growing over all the radii the mesh inverts.  Past
+		// the fold of a lens with a negative coefficient there is no inverse, and the mesh would be wrong.
+		static bool isInvertible(const CardboardViewer& viewer);
+
+		static const char* inverseModeName(InverseMode mode);
+		static bool inverseModeFromName(const char* name, InverseMode& mode);
 
 		void getLeftEyeVisibleTanAngles(float* result);
 		void getLeftEyeNoLensTanAngles(float* result);
@@ -56,11 +103,30 @@ namespace cam2vr {
 		CardboardViewer CardboardV1, CardboardV2;
 		Device DefaultIOS, DefaultAndroid;
 
+	private:
+		float distortInverseSecant(float radius);
+		float distortInversePolynomial(float radius);
+		float distortInverseTable(float radius);
+		double distortInverseExact(double radius);
+		void updateInverse();
+		void updateInverseError();
+
 	private:
 		float m_width, m_height;
 		float m_widthMeters, m_heightMeters, m_bevelMeters;
 		Device m_device;
 		CardboardViewer m_viewer;  		
+		std::vector<Device> m_devices;
+		std::vector<CardboardViewer> m_viewers;
+
+		// Inverse distortion
+		InverseMode m_inverseMode;
+		float m_inverseRange;
+		float m_inverseErrorBound;
+		float m_inverseRangeErrorBound;
+		float m_meshRadius;
+		float m_inverseTableStep;
+		std::vector<float> m_inverseTable;	// per node: undistorted radius, slope * step
 	};
 
 }; //namespace
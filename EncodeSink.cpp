@@ -0,0 +1,546 @@
+#include "EncodeSink.h"
+#include "FramePacer.h"
+
+extern "C" {
+#include <libavutil/imgutils.h>
+#include <libavutil/opt.h>
+}
+
+#include <QDir>
+#include <QFileInfo>
+#include <stdio.h>
+#include <string.h>
+
+// Seconds between the periodic reports, and of a GOP so HLS segments can start at every one
+#define REPORT_INTERVAL_NS  10000000000LL
+#define GOP_SECONDS         2
+
+namespace {
+
+std::string avError(int error)
+{
+    char message[AV_ERROR_MAX_STRING_SIZE];
+    av_strerror(error, message, sizeof(message));
+    return message;
+}
+
+bool startsWith(const std::string& text, const char* prefix)
+{
+    return text.compare(0, strlen(prefix), prefix) == 0;
+}
+
+bool endsWith(const std::string& text, const char* suffix)
+{
+    size_t length = strlen(suffix);
+    return text.size() >= length && text.compare(text.size() - length, length, suffix) == 0;
+}
+
+bool supportsPixelFormat(const AVCodec* codec, AVPixelFormat format)
+{
+    for (const AVPixelFormat* p = codec->pix_fmts; p && *p != AV_PIX_FMT_NONE; p++)
+    {
+        if (*p == format)
+            return true;
+    }
+    return false;
+}
+
+} // namespace
+
+////////////////////////////////////////////
+// EncodeThread
+////////////////////////////////////////////
+
+class EncodeThread : public QThread
+{
+public:
+    EncodeThread(EncodeSink* sink) : mSink(sink) {}
+
+protected:
+    virtual void run() { mSink->run(); }
+
+private:
+    EncodeSink*             mSink;
+};
+
+////////////////////////////////////////////
+// EncodeSink
+////////////////////////////////////////////
+
+EncodeSink::EncodeSink(Codec codec, const std::string& url, int queueDepth) :
+    mCodec(codec),
+    mUrl(url),
+    mQueueDepth(queueDepth < 1 ? 1 : queueDepth),
+    mStats(NULL),
+    mThread(NULL),
+    mOpen(false),
+    mEncoder(NULL),
+    mOutput(NULL),
+    mStream(NULL),
+    mScaler(NULL),
+    mConverted(NULL),
+    mPacket(NULL),
+    mFormat(WarpedFrame::FormatRGBA),
+    mPassThrough(false),
+    mFrameDurationNs(0),
+    mFirstTime(0),
+    mLastPts(-1),
+    mFailed(false),
+    mEncoded(0), mBytes(0),
+    mWindowEncoded(0), mWindowBytes(0),
+    mWindowLatency(0), mWindowMaxLatency(0),
+    mWindowStart(0),
+    mStop(false),
+    mDropped(0),
+    mMaxQueued(0)
+{
+}
+
+EncodeSink::~EncodeSink()
+{
+    Close();
+}
+
+bool EncodeSink::Open(unsigned width, unsigned height, WarpedFrame::Format format, BMDTimeValue frameDuration, BMDTimeScale timeScale)
+{
+    // A new size or rate starts a new stream
+    Close();
+
+    if (! openStream(width, height, format, frameDuration, timeScale))
+    {
+        freeStream();
+        return false;
+    }
+
+    mFormat = format;
+    mFrameDurationNs = frameDuration * 1000000000LL / timeScale;
+    mFirstTime = 0;
+    mLastPts = -1;
+    mFailed = false;
+    mEncoded = 0;
+    mBytes = 0;
+    mWindowEncoded = 0;
+    mWindowBytes = 0;
+    mWindowLatency = 0;
+    mWindowMaxLatency = 0;
+    mWindowStart = FramePacer::now();
+    mStop = false;
+    mDropped = 0;
+    mMaxQueued = 0;
+
+    mThread = new EncodeThread(this);
+    mThread->start();
+    mOpen = true;
+
+    fprintf(stderr, "%s sink: encoding %ux%u %s frames with %s at %lld kbit/s to %s%s\n", getName(), width, height,
+            WarpedFrame::formatName(format), mEncoder->codec->name, (long long)(mEncoder->bit_rate / 1000), mUrl.c_str(),
+            mPassThrough ? ", without conversion" : "");
+    return true;
+}
+
+bool EncodeSink::openStream(unsigned width, unsigned height, WarpedFrame::Format format, BMDTimeValue frameDuration, BMDTimeScale timeScale)
+{
+    static bool networkInitialised = false;
+    if (! networkInitialised)
+    {
+        avformat_network_init();
+        networkInitialised = true;
+    }
+
+    // Network protocols name no container, so pick the one they carry
+    const char* muxer = NULL;
+    bool hls = endsWith(mUrl, ".m3u8");
+    if (startsWith(mUrl, "rtmp://") || startsWith(mUrl, "rtmps://"))
+        muxer = "flv";
+    else if (startsWith(mUrl, "srt://") || startsWith(mUrl, "udp://"))
+        muxer = "mpegts";
+    else if (hls)
+        muxer = "hls";
+
+    int result = avformat_alloc_output_context2(&mOutput, NULL, muxer, mUrl.c_str());
+    if (! mOutput)
+    {
+        fprintf(stderr, "%s sink: no muxer for %s: %s\n", getName(), mUrl.c_str(), avError(result).c_str());
+        return false;
+    }
+
+    // Software encoders first, they take NV12 and know the zero latency tuning
+    const AVCodec* codec = avcodec_find_encoder_by_name(mCodec == CodecHEVC ? "libx265" : "libx264");
+    if (! codec)
+        codec = avcodec_find_encoder(mCodec == CodecHEVC ? AV_CODEC_ID_HEVC : AV_CODEC_ID_H264);
+    if (! codec)
+    {
+        fprintf(stderr, "%s sink: FFmpeg has no %s encoder\n", getName(), getName());
+        return false;
+    }
+
+    mEncoder = avcodec_alloc_context3(codec);
+    mEncoder->width = width;
+    mEncoder->height = height;
+    mEncoder->time_base = av_make_q((int)frameDuration, (int)timeScale);
+    mEncoder->framerate = av_make_q((int)timeScale, (int)frameDuration);
+    mEncoder->gop_size = (int)(GOP_SECONDS * timeScale / frameDuration);
+    mEncoder->max_b_frames = 0;
+    mEncoder->color_range = AVCOL_RANGE_MPEG;
+    mEncoder->colorspace = AVCOL_SPC_BT709;
+    mEncoder->color_primaries = AVCOL_PRI_BT709;
+    mEncoder->color_trc = AVCOL_TRC_BT709;
+    // Slices rather than frames per thread: frame threads add a frame of delay each
+    mEncoder->thread_count = 0;
+    mEncoder->thread_type = FF_THREAD_SLICE;
+
+    // About 0.1 bit per pixel for H.264 and 0.06 for HEVC, e.g. 12 and 7.5 Mbit/s at 1080p60
+    double bitsPerPixel = mCodec == CodecHEVC ? 0.06 : 0.1;
+    mEncoder->bit_rate = (int64_t)(bitsPerPixel * width * height * timeScale / frameDuration);
+
+    mPassThrough = format == WarpedFrame::FormatNV12 && supportsPixelFormat(codec, AV_PIX_FMT_NV12);
+    if (mPassThrough)
+        mEncoder->pix_fmt = AV_PIX_FMT_NV12;
+    else if (supportsPixelFormat(codec, AV_PIX_FMT_YUV420P) || ! codec->pix_fmts)
+        mEncoder->pix_fmt = AV_PIX_FMT_YUV420P;
+    else
+        mEncoder->pix_fmt = codec->pix_fmts[0];
+
+    if (mOutput->oformat->flags & AVFMT_GLOBALHEADER)
+        mEncoder->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+
+    AVDictionary* codecOptions = NULL;
+    if (startsWith(codec->name, "libx26"))
+    {
+        av_dict_set(&codecOptions, "preset", "veryfast", 0);
+        av_dict_set(&codecOptions, "tune", "zerolatency", 0);
+    }
+    result = avcodec_open2(mEncoder, codec, &codecOptions);
+    av_dict_free(&codecOptions);
+    if (result < 0)
+    {
+        fprintf(stderr, "%s sink: cannot open the %s encoder: %s\n", getName(), codec->name, avError(result).c_str());
+        return false;
+    }
+
+    if (! mPassThrough)
+    {
+        AVPixelFormat source = format == WarpedFrame::FormatUYVY ? AV_PIX_FMT_UYVY422
+                             : format == WarpedFrame::FormatNV12 ? AV_PIX_FMT_NV12 : AV_PIX_FMT_RGBA;
+        mScaler = sws_getContext(width, height, source, width, height, mEncoder->pix_fmt, SWS_BILINEAR, NULL, NULL, NULL);
+        if (! mScaler)
+        {
+            fprintf(stderr, "%s sink: cannot convert %s frames for the encoder\n", getName(), WarpedFrame::formatName(format));
+            return false;
+        }
+        // RGB is full range, the YUV read back limited range like the stream
+        const int* bt709 = sws_getCoefficients(SWS_CS_ITU709);
+        sws_setColorspaceDetails(mScaler, bt709, format == WarpedFrame::FormatRGBA ? 1 : 0, bt709, 0, 0, 1 << 16, 1 << 16);
+
+        mConverted = av_frame_alloc();
+        mConverted->format = mEncoder->pix_fmt;
+        mConverted->width = width;
+        mConverted->height = height;
+        result = av_frame_get_buffer(mConverted, 0);
+        if (result < 0)
+        {
+            fprintf(stderr, "%s sink: cannot allocate a frame: %s\n", getName(), avError(result).c_str());
+            return false;
+        }
+    }
+
+    mStream = avformat_new_stream(mOutput, NULL);
+    avcodec_parameters_from_context(mStream->codecpar, mEncoder);
+    mStream->time_base = mEncoder->time_base;
+    mPacket = av_packet_alloc();
+
+    if (hls)
+    {
+        // Segments are written next to the playlist
+        QString directory = QFileInfo(QString::fromStdString(mUrl)).absolutePath();
+        if (! QDir().mkpath(directory))
+        {
+            fprintf(stderr, "%s sink: cannot create %s\n", getName(), qPrintable(directory));
+            return false;
+        }
+    }
+
+    if (! (mOutput->oformat->flags & AVFMT_NOFILE))
+    {
+        result = avio_open2(&mOutput->pb, mUrl.c_str(), AVIO_FLAG_WRITE, NULL, NULL);
+        if (result < 0)
+        {
+            fprintf(stderr, "%s sink: cannot open %s: %s\n", getName(), mUrl.c_str(), avError(result).c_str());
+            return false;
+        }
+    }
+
+    AVDictionary* muxOptions = NULL;
+    if (hls)
+    {
+        av_dict_set_int(&muxOptions, "hls_time", GOP_SECONDS, 0);
+        av_dict_set_int(&muxOptions, "hls_list_size", 6, 0);
+        av_dict_set(&muxOptions, "hls_flags", "delete_segments", 0);
+    }
+    result = avformat_write_header(mOutput, &muxOptions);
+    av_dict_free(&muxOptions);
+    if (result < 0)
+    {
+        fprintf(stderr, "%s sink: cannot start the stream to %s: %s\n", getName(), mUrl.c_str(), avError(result).c_str());
+        return false;
+    }
+    return true;
+}
+
+void EncodeSink::freeStream()
+{
+    if (mOutput)
+    {
+        if (! (mOutput->oformat->flags & AVFMT_NOFILE))
+            avio_closep(&mOutput->pb);
+        avformat_free_context(mOutput);
+        mOutput = NULL;
+    }
+    mStream = NULL;
+    avcodec_free_context(&mEncoder);
+    sws_freeContext(mScaler);
+    mScaler = NULL;
+    av_frame_free(&mConverted);
+    av_packet_free(&mPacket);
+    mQueuedTimes.clear();
+}
+
+void EncodeSink::WriteFrame(WarpedFrame* frame)
+{
+    if (! mOpen)
+        return;
+
+    QueuedFrame queued;
+    queued.frame = frame;
+    queued.queuedTime = FramePacer::now();
+    frame->AddRef();
+
+    QMutexLocker locker(&mMutex);
+    if ((int)mQueue.size() >= mQueueDepth)
+    {
+        mQueue.front().frame->Release();
+        mQueue.pop_front();
+        mDropped++;
+        if (mStats)
+            mStats->count(LatencyStats::EventEncodeDropped);
+    }
+    mQueue.push_back(queued);
+    if ((int)mQueue.size() > mMaxQueued)
+        mMaxQueued = mQueue.size();
+    mQueued.wakeOne();
+}
+
+void EncodeSink::Close()
+{
+    if (! mOpen)
+        return;
+
+    // The frames still queued are encoded before the stream is finished
+    mMutex.lock();
+    mStop = true;
+    mQueued.wakeAll();
+    mMutex.unlock();
+
+    mThread->wait();
+    delete mThread;
+    mThread = NULL;
+
+    freeStream();
+    mOpen = false;
+
+    fprintf(stderr, "%s sink: %llu frames encoded, %llu dropped from the queue, %.1f MB written\n",
+            getName(), mEncoded, mDropped, mBytes / 1e6);
+}
+
+void EncodeSink::run()
+{
+    for (;;)
+    {
+        QueuedFrame queued;
+        queued.frame = NULL;
+
+        mMutex.lock();
+        if (mQueue.empty() && ! mStop)
+            mQueued.wait(&mMutex, 1000);
+        if (! mQueue.empty())
+        {
+            queued = mQueue.front();
+            mQueue.pop_front();
+        }
+        bool stop = mStop && queued.frame == NULL;
+        mMutex.unlock();
+
+        if (stop)
+            break;
+
+        if (queued.frame)
+        {
+            // After an error, e.g. a lost connection, frames are only returned
+            if (! mFailed)
+                mFailed = ! encodeFrame(queued) || ! drainPackets();
+            queued.frame->Release();
+        }
+
+        BMDTimeValue now = FramePacer::now();
+        if (now - mWindowStart >= REPORT_INTERVAL_NS)
+            report(now);
+    }
+
+    if (! mFailed)
+    {
+        avcodec_send_frame(mEncoder, NULL);
+        drainPackets();
+    }
+    av_write_trailer(mOutput);
+}
+
+// Free callback of the buffers lent to the encoder, on whichever thread it drops the last reference
+void EncodeSink::releaseWarpedFrame(void* opaque, uint8_t* /*data*/)
+{
+    ((WarpedFrame*)opaque)->Release();
+}
+
+bool EncodeSink::encodeFrame(const QueuedFrame& queued)
+{
+    WarpedFrame* frame = queued.frame;
+    const unsigned width = frame->width();
+    const unsigned height = frame->height();
+
+    // In frame durations from the first frame, so frames dropped anywhere leave gaps rather than
+    // speeding the stream up
+    BMDTimeValue arrival = frame->times().arrivalTime;
+    if (mLastPts < 0)
+        mFirstTime = arrival;
+    int64_t pts = (arrival - mFirstTime + mFrameDurationNs / 2) / mFrameDurationNs;
+    if (pts <= mLastPts)
+        pts = mLastPts + 1;
+    mLastPts = pts;
+
+    AVFrame* input;
+    AVFrame* lent = NULL;
+    if (mPassThrough)
+    {
+        // The encoder gets a reference to the frame itself, released once it is done with it
+        lent = av_frame_alloc();
+        frame->AddRef();
+        lent->buf[0] = av_buffer_create(frame->bytes(), frame->byteCount(), releaseWarpedFrame, frame, AV_BUFFER_FLAG_READONLY);
+        if (! lent->buf[0])
+        {
+            frame->Release();
+            av_frame_free(&lent);
+            fprintf(stderr, "%s sink: out of memory\n", getName());
+            return false;
+        }
+        lent->format = AV_PIX_FMT_NV12;
+        lent->width = width;
+        lent->height = height;
+        lent->data[0] = frame->bytes();
+        lent->data[1] = frame->bytes() + (size_t)frame->rowBytes() * height;
+        lent->linesize[0] = frame->rowBytes();
+        lent->linesize[1] = frame->rowBytes();
+        input = lent;
+    }
+    else
+    {
+        // The encoder may still hold the previous picture
+        int result = av_frame_make_writable(mConverted);
+        if (result < 0)
+        {
+            fprintf(stderr, "%s sink: cannot allocate a frame: %s\n", getName(), avError(result).c_str());
+            return false;
+        }
+
+        const uint8_t* source[4] = { frame->bytes(), NULL, NULL, NULL };
+        int sourceStride[4] = { (int)frame->rowBytes(), 0, 0, 0 };
+        if (mFormat == WarpedFrame::FormatRGBA)
+        {
+            // Bottom-up rows: start at the top one and step backwards
+            source[0] = frame->bytes() + (size_t)(height - 1) * frame->rowBytes();
+            sourceStride[0] = -(int)frame->rowBytes();
+        }
+        else if (mFormat == WarpedFrame::FormatNV12)
+        {
+            source[1] = frame->bytes() + (size_t)frame->rowBytes() * height;
+            sourceStride[1] = frame->rowBytes();
+        }
+        sws_scale(mScaler, source, sourceStride, 0, height, mConverted->data, mConverted->linesize);
+        input = mConverted;
+    }
+
+    input->pts = pts;
+    mQueuedTimes[pts] = queued.queuedTime;
+    int result = avcodec_send_frame(mEncoder, input);
+    av_frame_free(&lent);
+    if (result < 0)
+    {
+        fprintf(stderr, "%s sink: encoding failed: %s\n", getName(), avError(result).c_str());
+        return false;
+    }
+    return true;
+}
+
+bool EncodeSink::drainPackets()
+{
+    for (;;)
+    {
+        int result = avcodec_receive_packet(mEncoder, mPacket);
+        if (result == AVERROR(EAGAIN) || result == AVERROR_EOF)
+            return true;
+        if (result < 0)
+        {
+            fprintf(stderr, "%s sink: encoding failed: %s\n", getName(), avError(result).c_str());
+            return false;
+        }
+
+        int64_t pts = mPacket->pts;
+        int size = mPacket->size;
+        av_packet_rescale_ts(mPacket, mEncoder->time_base, mStream->time_base);
+        mPacket->stream_index = mStream->index;
+        result = av_interleaved_write_frame(mOutput, mPacket);
+        if (result < 0)
+        {
+            fprintf(stderr, "%s sink: writing to %s failed after %llu frames: %s\n", getName(), mUrl.c_str(), mEncoded, avError(result).c_str());
+            return false;
+        }
+
+        // Frames the encoder dropped or merged leave older entries behind; they go with this one
+        std::map<int64_t, BMDTimeValue>::iterator found = mQueuedTimes.find(pts);
+        if (found != mQueuedTimes.end())
+        {
+            BMDTimeValue latency = FramePacer::now() - found->second;
+            if (mStats)
+                mStats->record(LatencyStats::StageEncode, latency);
+            mWindowLatency += latency;
+            if (latency > mWindowMaxLatency)
+                mWindowMaxLatency = latency;
+            mWindowEncoded++;
+        }
+        mQueuedTimes.erase(mQueuedTimes.begin(), mQueuedTimes.upper_bound(pts));
+
+        mEncoded++;
+        mBytes += size;
+        mWindowBytes += size;
+    }
+}
+
+void EncodeSink::report(BMDTimeValue now)
+{
+    mMutex.lock();
+    int queued = mQueue.size();
+    int maxQueued = mMaxQueued;
+    mMaxQueued = queued;
+    unsigned long long dropped = mDropped;
+    mMutex.unlock();
+
+    double seconds = (now - mWindowStart) / 1e9;
+    fprintf(stderr, "%s sink: %.1f fps, encode latency %.1f ms mean, %.1f ms max, queue %d of %d (at most %d), "
+            "%llu dropped, %.0f kbit/s\n", getName(), mWindowEncoded / seconds,
+            mWindowEncoded ? mWindowLatency / 1e6 / mWindowEncoded : 0.0, mWindowMaxLatency / 1e6,
+            queued, mQueueDepth, maxQueued, dropped, mWindowBytes * 8 / seconds / 1000);
+
+    mWindowEncoded = 0;
+    mWindowBytes = 0;
+    mWindowLatency = 0;
+    mWindowMaxLatency = 0;
+    mWindowStart = now;
+}
@@ -0,0 +1,120 @@
+#ifndef ENCODE_SINK_H
+#define ENCODE_SINK_H
+
+#include "FrameSink.h"
+
+#include <QMutex>
+#include <QThread>
+#include <QWaitCondition>
+#include <deque>
+#include <map>
+#include <string>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libswscale/swscale.h>
+}
+
+class EncodeThread;
+
+////////////////////////////////////////////
+// EncodeSink
+////////////////////////////////////////////
+
+// Encodes warped frames to H.264 or HEVC with FFmpeg and publishes them, in place of a hardware
+// encoder such as a Web Presenter behind the playout sink.  The URL selects the output:
+//   rtmp://host/app/stream     FLV over RTMP
+//   srt://host:port, udp://... MPEG-TS
+//   dir/stream.m3u8            HLS, 2 s segments next to the playlist, the last 6 kept
+//   anything else              the muxer FFmpeg guesses from the name, e.g. out.mp4 or out.mkv
+//
+// WriteFrame() only queues a reference to the frame, so the presenting thread never waits for the
+// encoder.  An encode thread of the sink's own takes frames off the bounded queue, dropping the
+// oldest when it is full to keep the latency down, and encodes them with the encoder's slice threads
+// tuned for zero latency: no B-frames and no lookahead, one packet per frame.  NV12 frames are handed
+// to the encoder as they are, pointing into the readback buffer; RGBA and UYVY ones are converted
+// with swscale on the encode thread first.  The stream is tagged BT.709, limited range.
+//
+// Encode latency, from WriteFrame() to the packet being muxed, is recorded as the encode stage of
+// the latency statistics, and every 10 seconds the queue depth, latency and bit rate are printed.
+class EncodeSink : public FrameSink
+{
+public:
+    enum Codec {
+        CodecH264,
+        CodecHEVC
+    };
+
+    enum { DefaultQueueDepth = 4 };
+
+    EncodeSink(Codec codec, const std::string& url, int queueDepth = DefaultQueueDepth);
+    virtual ~EncodeSink();
+
+    virtual const char* getName() { return mCodec == CodecHEVC ? "hevc" : "h264"; }
+
+    virtual bool Open(unsigned width, unsigned height, WarpedFrame::Format format, BMDTimeValue frameDuration, BMDTimeScale timeScale);
+    virtual void WriteFrame(WarpedFrame* frame);
+    virtual void Close();
+
+    virtual void setLatencyStats(LatencyStats* stats) { mStats = stats; }
+
+private:
+    friend class EncodeThread;
+
+    struct QueuedFrame {
+        WarpedFrame*    frame;
+        BMDTimeValue    queuedTime;
+    };
+
+    bool openStream(unsigned width, unsigned height, WarpedFrame::Format format, BMDTimeValue frameDuration, BMDTimeScale timeScale);
+    void freeStream();
+
+    // Encode thread
+    void run();
+    bool encodeFrame(const QueuedFrame& queued);
+    bool drainPackets();
+    void report(BMDTimeValue now);
+
+    static void releaseWarpedFrame(void* opaque, uint8_t* data);
+
+    Codec                       mCodec;
+    std::string                 mUrl;
+    int                         mQueueDepth;
+    LatencyStats*               mStats;
+    EncodeThread*               mThread;
+    bool                        mOpen;
+
+    // Encode thread only while open
+    AVCodecContext*             mEncoder;
+    AVFormatContext*            mOutput;
+    AVStream*                   mStream;
+    SwsContext*                 mScaler;
+    AVFrame*                    mConverted;     // frames not encoded as they are
+    AVPacket*                   mPacket;
+    WarpedFrame::Format         mFormat;
+    bool                        mPassThrough;   // NV12 frames go to the encoder without conversion
+    BMDTimeValue                mFrameDurationNs;
+    BMDTimeValue                mFirstTime;
+    int64_t                     mLastPts;
+    std::map<int64_t, BMDTimeValue> mQueuedTimes;   // of frames in the encoder, by pts
+    bool                        mFailed;
+
+    // Reported
+    unsigned long long          mEncoded;
+    unsigned long long          mBytes;
+    unsigned long long          mWindowEncoded;
+    unsigned long long          mWindowBytes;
+    BMDTimeValue                mWindowLatency;
+    BMDTimeValue                mWindowMaxLatency;
+    BMDTimeValue                mWindowStart;
+
+    QMutex                      mMutex;         // protects the members below
+    QWaitCondition              mQueued;
+    std::deque<QueuedFrame>     mQueue;
+    bool                        mStop;
+    unsigned long long          mDropped;
+    int                         mMaxQueued;     // since the last report
+};
+
+#endif
@@ -0,0 +1,224 @@
+#include "FramePacer.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <time.h>
+
+// Window over which the smallest capture to monotonic offset is taken
+#define OFFSET_WINDOW_NS        2000000000LL
+// Part of a refresh period around a vsync boundary within which the previous cadence is kept
+#define CADENCE_HYSTERESIS      0.15
+// Swap intervals further than this (in periods) from a whole number of periods are not vsyncs
+#define VSYNC_TOLERANCE         0.2
+
+FramePacer::FramePacer() :
+    mRefreshPeriod(0),
+    mNominalPeriod(0),
+    mVsyncPhase(0),
+    mLastSwap(0),
+    mVsyncSamples(0),
+    mDeliveryJitter(0),
+    mFramePeriod(0),
+    mRenderTime(0),
+    mLastVsync(0),
+    mLastCapture(0),
+    mHaveLast(false),
+    mEnabled(true),
+    mVerbose(false)
+{
+    reset(0);
+}
+
+BMDTimeValue FramePacer::now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (BMDTimeValue)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+const char* FramePacer::decisionName(Decision decision)
+{
+    switch (decision)
+    {
+    case DecisionPresent:       return "present";
+    case DecisionLate:          return "late";
+    case DecisionSuperseded:    return "superseded";
+    default:                    return "?";
+    }
+}
+
+void FramePacer::reset(BMDTimeValue framePeriod)
+{
+    // The refresh estimate belongs to the display and survives a change of video mode
+    mOffsets.clear();
+    mDeliveryJitter = 0;
+    mFramePeriod = framePeriod;
+    mRenderTime = 0;
+    mLastVsync = 0;
+    mLastCapture = 0;
+    mHaveLast = false;
+
+    for (int i = 0; i < DecisionCount; i++)
+        mDecisions[i] = 0;
+    for (int i = 0; i < 4; i++)
+        mCadence[i] = 0;
+}
+
+void FramePacer::setNominalRefresh(double hz)
+{
+    QMutexLocker locker(&mVsyncMutex);
+    mNominalPeriod = hz > 0 ? 1e9 / hz : 0;
+}
+
+double FramePacer::refreshPeriod()
+{
+    QMutexLocker locker(&mVsyncMutex);
+    return mRefreshPeriod;
+}
+
+void FramePacer::onVsync(BMDTimeValue time)
+{
+    QMutexLocker locker(&mVsyncMutex);
+
+    if (mLastSwap > 0)
+    {
+        double delta = (double)(time - mLastSwap);
+        double period = mRefreshPeriod > 0 ? mRefreshPeriod : mNominalPeriod;
+
+        if (period <= 0)
+        {
+            // No prior at all: take the first plausible interval (20..250 Hz)
+            if (delta > 4e6 && delta < 50e6)
+            {
+                mRefreshPeriod = delta;
+                mVsyncSamples = 1;
+            }
+        }
+        else
+        {
+            // Swaps may skip vsyncs when nothing new was rendered, so accept whole multiples
+            double periods = floor(delta / period + 0.5);
+            if (periods >= 1 && periods <= 8 && fabs(delta - periods * period) < VSYNC_TOLERANCE * period)
+            {
+                double weight = mVsyncSamples < 16 ? 1.0 / (mVsyncSamples + 1) : 1.0 / 16;
+                mRefreshPeriod = period + (delta / periods - period) * weight;
+                mVsyncSamples++;
+            }
+        }
+    }
+
+    mLastSwap = time;
+    mVsyncPhase = time;
+}
+
+BMDTimeValue FramePacer::captureToMonotonic(BMDTimeValue captureTime, BMDTimeValue arrivalTime)
+{
+    Offset sample;
+    sample.arrival = arrivalTime;
+    sample.offset = arrivalTime - captureTime;
+
+    // Sliding window minimum: candidates stay sorted by offset, larger ones can never become the minimum
+    while (! mOffsets.empty() && mOffsets.back().offset >= sample.offset)
+        mOffsets.pop_back();
+    mOffsets.push_back(sample);
+    while (mOffsets.front().arrival < arrivalTime - OFFSET_WINDOW_NS)
+        mOffsets.pop_front();
+
+    return captureTime + mOffsets.front().offset;
+}
+
+// Index of the first vsync at or after time; fraction receives time's position within its refresh interval
+long long FramePacer::vsyncIndex(BMDTimeValue time, double period, BMDTimeValue phase, double* fraction)
+{
+    double position = (double)(time - phase) / period;
+    double index = ceil(position);
+
+    if (fraction)
+        *fraction = position - floor(position);
+    return (long long)index;
+}
+
+FramePacer::Decision FramePacer::decide(BMDTimeValue captureTime, BMDTimeValue arrivalTime, BMDTimeValue next)
+{
+    BMDTimeValue mapped = captureToMonotonic(captureTime, arrivalTime);
+    BMDTimeValue offset = mapped - captureTime;
+    mDeliveryJitter = arrivalTime - mapped;
+
+    double period;
+    BMDTimeValue phase;
+    mVsyncMutex.lock();
+    period = mRefreshPeriod > 0 ? mRefreshPeriod : mNominalPeriod;
+    phase = mVsyncPhase;
+    mVsyncMutex.unlock();
+
+    if (! mEnabled || period <= 0 || phase == 0)
+    {
+        // Pacing off or nothing known about the display yet: render everything
+        mDecisions[DecisionPresent]++;
+        return DecisionPresent;
+    }
+
+    // Earliest vsync at which the frame can be on screen, keeping the previous cadence near a boundary
+    double fraction;
+    long long index = vsyncIndex(mapped + (BMDTimeValue)mRenderTime, period, phase, &fraction);
+    if (mHaveLast)
+    {
+        long long expected = mLastVsync + (long long)floor((captureTime - mLastCapture) / period + 0.5);
+        if ((index == expected - 1 && fraction > 1.0 - CADENCE_HYSTERESIS) ||
+            (index == expected + 1 && fraction < CADENCE_HYSTERESIS))
+            index = expected;
+    }
+
+    Decision decision = DecisionPresent;
+
+    if (next >= 0 && vsyncIndex(next + offset + (BMDTimeValue)mRenderTime, period, phase, NULL) <= index)
+    {
+        decision = DecisionSuperseded;
+    }
+    else
+    {
+        BMDTimeValue deadline = phase + (BMDTimeValue)(index * period) - (BMDTimeValue)mRenderTime;
+        BMDTimeValue current = now();
+        if (current > deadline)
+        {
+            decision = DecisionLate;
+            index = vsyncIndex(current + (BMDTimeValue)mRenderTime, period, phase, NULL);
+        }
+
+        if (mHaveLast)
+        {
+            long long gap = index - mLastVsync;
+            mCadence[gap < 0 ? 0 : (gap > 3 ? 3 : gap)]++;
+        }
+        mLastVsync = index;
+        mLastCapture = captureTime;
+        mHaveLast = true;
+    }
+
+    mDecisions[decision]++;
+
+    if (mVerbose)
+        fprintf(stderr, "pacer: capture %.3f ms, delivery jitter %.3f ms -> vsync %lld (%s)\n",
+                captureTime / 1e6, mDeliveryJitter / 1e6, index, decisionName(decision));
+
+    return decision;
+}
+
+void FramePacer::rendered(BMDTimeValue duration)
+{
+    if (mRenderTime == 0)
+        mRenderTime = (double)duration;
+    else
+        mRenderTime += ((double)duration - mRenderTime) * 0.1;
+}
+
+void FramePacer::printSummary()
+{
+    double period = refreshPeriod();
+
+    fprintf(stderr, "Frame pacer: refresh %.3f Hz, frames %.3f Hz, render %.3f ms; %llu presented, %llu late, %llu superseded\n",
+            period > 0 ? 1e9 / period : 0.0, mFramePeriod > 0 ? 1e9 / mFramePeriod : 0.0, mRenderTime / 1e6,
+            mDecisions[DecisionPresent], mDecisions[DecisionLate], mDecisions[DecisionSuperseded]);
+    fprintf(stderr, "Frame pacer: vsyncs between presented frames 0:%llu 1:%llu 2:%llu 3+:%llu\n",
+            mCadence[0], mCadence[1], mCadence[2], mCadence[3]);
+}
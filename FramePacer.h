@@ -0,0 +1,105 @@
+#ifndef FRAME_PACER_H
+#define FRAME_PACER_H
+
+#include "DeckLinkAPI.h"
+
+#include <QMutex>
+#include <deque>
+
+////////////////////////////////////////////
+// FramePacer
+////////////////////////////////////////////
+
+// Decides which captured frames are worth rendering, from their hardware timestamps and the
+// display's refresh.  Three clocks are involved, all reduced to nanoseconds:
+//  - the capture clock of the hardware reference timestamps,
+//  - CLOCK_MONOTONIC, on which frames are stamped when the capture callback receives them,
+//  - the display refresh, observed as monotonic timestamps of buffer swaps.
+//
+// The capture clock is mapped onto the monotonic clock by the smallest (arrival - capture) offset
+// seen over a sliding window: delivery jitter only ever delays a frame, so the minimum tracks the
+// true offset and follows slow drift between the clocks.  The refresh period and phase are fitted
+// to the swap timestamps, accepting gaps of several periods when frames were missed.
+//
+// Each frame is then assigned the first vsync at which it can be shown once rendered.  A frame
+// that would be replaced at the same vsync by the next queued frame is superseded and not
+// rendered; a frame whose vsync has passed is late but still rendered if nothing newer exists.
+// Near a vsync boundary the previous cadence is kept, so that capture jitter does not make
+// frames alternate between two vsyncs (judder).
+//
+// onVsync() is called from the presenting thread, everything else from the render thread.
+class FramePacer
+{
+public:
+    enum Decision {
+        DecisionPresent,        // render, on time for its vsync
+        DecisionLate,           // render, but its vsync has already passed
+        DecisionSuperseded,     // skip, the next frame is shown at the same vsync
+        DecisionCount
+    };
+
+    FramePacer();
+
+    // Forget all clock state, e.g. when the video mode changes.  framePeriod in ns.
+    void reset(BMDTimeValue framePeriod);
+
+    // Presenting thread: a buffer swap completed at time (monotonic ns)
+    void onVsync(BMDTimeValue time);
+    // Optional prior for the refresh period before swaps have been observed, e.g. from QScreen
+    void setNominalRefresh(double hz);
+
+    // Render thread: decide about a frame captured at captureTime (capture clock, ns) and received
+    // at arrivalTime (monotonic ns).  next is the capture time of the following queued frame, or
+    // negative when there is none.
+    Decision decide(BMDTimeValue captureTime, BMDTimeValue arrivalTime, BMDTimeValue next);
+
+    // Render thread: a frame decided on was rendered in duration ns
+    void rendered(BMDTimeValue duration);
+
+    void setVerbose(bool verbose) { mVerbose = verbose; }
+    // When disabled every frame is rendered, e.g. to measure throughput rather than display timing
+    void setEnabled(bool enabled) { mEnabled = enabled; }
+    void printSummary();
+
+    unsigned long long decisionCount(Decision decision) const { return mDecisions[decision]; }
+    // Delivery delay of the last frame decided on above the smallest one in the window, ns
+    BMDTimeValue deliveryJitter() const { return mDeliveryJitter; }
+    double refreshPeriod();     // ns, 0 when unknown
+
+    static const char* decisionName(Decision decision);
+    static BMDTimeValue now();  // CLOCK_MONOTONIC in ns
+
+private:
+    struct Offset {
+        BMDTimeValue    arrival;
+        BMDTimeValue    offset;
+    };
+
+    BMDTimeValue captureToMonotonic(BMDTimeValue captureTime, BMDTimeValue arrivalTime);
+    long long vsyncIndex(BMDTimeValue time, double period, BMDTimeValue phase, double* fraction);
+
+    // Refresh estimate, shared with the presenting thread
+    QMutex                      mVsyncMutex;
+    double                      mRefreshPeriod;     // ns, 0 when unknown
+    double                      mNominalPeriod;
+    BMDTimeValue                mVsyncPhase;        // time of the last observed vsync
+    BMDTimeValue                mLastSwap;
+    unsigned                    mVsyncSamples;
+
+    // Capture to monotonic clock mapping
+    std::deque<Offset>          mOffsets;           // ascending offset candidates within the window
+    BMDTimeValue                mDeliveryJitter;
+
+    BMDTimeValue                mFramePeriod;
+    double                      mRenderTime;        // running estimate of upload + warp time, ns
+    long long                   mLastVsync;         // vsync index of the last presented frame
+    BMDTimeValue                mLastCapture;
+    bool                        mHaveLast;
+
+    bool                        mEnabled;
+    bool                        mVerbose;
+    unsigned long long          mDecisions[DecisionCount];
+    unsigned long long          mCadence[4];        // vsyncs between presented frames: 0, 1, 2, 3+
+};
+
+#endif
@@ -0,0 +1,144 @@
+#include "FrameQueue.h"
+
+#include <QThread>
+#include <string.h>
+
+// Indices run freely and wrap; the number of queued items is always (head - tail) computed
+// in unsigned arithmetic, and the slot is the index modulo the (power of two) slot count.
+
+FrameQueue::FrameQueue(int capacity, Policy policy) :
+    mCapacity(1),
+    mPolicy(policy),
+    mBlockTimeout(100),
+    mHead(0),
+    mTail(0),
+    mEnqueued(0),
+    mDropped(0),
+    mConsumed(0)
+{
+    configure(capacity, policy);
+}
+
+void FrameQueue::configure(int capacity, Policy policy)
+{
+    mCapacity = capacity < 1 ? 1 : capacity;
+    mPolicy = policy;
+
+    // Keep at least one spare slot, so the slot the producer writes next is never one the
+    // consumer may still be copying out of
+    unsigned slotCount = 1;
+    while (slotCount <= mCapacity)
+        slotCount <<= 1;
+    mSlots.assign(slotCount, CapturedFrame());
+
+    mHead.storeRelease(0);
+    mTail.storeRelease(0);
+}
+
+void FrameQueue::resetCounters()
+{
+    mEnqueued.storeRelease(0);
+    mDropped.storeRelease(0);
+    mConsumed.storeRelease(0);
+}
+
+int FrameQueue::size() const
+{
+    return (int)((unsigned)mHead.loadAcquire() - (unsigned)mTail.loadAcquire());
+}
+
+const char* FrameQueue::policyName(Policy policy)
+{
+    switch (policy)
+    {
+    case PolicyDropNewest:  return "drop-newest";
+    case PolicyBlock:       return "block";
+    default:                return "drop-oldest";
+    }
+}
+
+bool FrameQueue::policyFromName(const char* name, Policy& policy)
+{
+    if (strcmp(name, "drop-oldest") == 0)
+        policy = PolicyDropOldest;
+    else if (strcmp(name, "drop-newest") == 0)
+        policy = PolicyDropNewest;
+    else if (strcmp(name, "block") == 0)
+        policy = PolicyBlock;
+    else
+        return false;
+    return true;
+}
+
+// Copy the item at tail and try to take it off the queue.  Fails when the other side got there
+// first, in which case the copy must be ignored.
+bool FrameQueue::claimTail(unsigned tail, CapturedFrame& item)
+{
+    item = mSlots[tail & (mSlots.size() - 1)];
+    return mTail.testAndSetOrdered((int)tail, (int)(tail + 1));
+}
+
+void FrameQueue::drop(const CapturedFrame& item)
+{
+    item.frame->Release();
+    mDropped.fetchAndAddOrdered(1);
+}
+
+bool FrameQueue::push(const CapturedFrame& item)
+{
+    unsigned head = (unsigned)mHead.load();
+    int waited = 0;     // microseconds
+
+    for (;;)
+    {
+        unsigned tail = (unsigned)mTail.loadAcquire();
+        if (head - tail < mCapacity)
+            break;
+
+        if (mPolicy == PolicyDropOldest)
+        {
+            // Evict the oldest frame; if the consumer took it meanwhile there is room anyway
+            CapturedFrame oldest;
+            if (claimTail(tail, oldest))
+                drop(oldest);
+            continue;
+        }
+
+        if (mPolicy == PolicyBlock && waited < mBlockTimeout * 1000)
+        {
+            QThread::usleep(100);
+            waited += 100;
+            continue;
+        }
+
+        drop(item);
+        return false;
+    }
+
+    mSlots[head & (mSlots.size() - 1)] = item;
+
+    // Publish the slot contents before the consumer can see the new head
+    mHead.storeRelease((int)(head + 1));
+    mEnqueued.fetchAndAddOrdered(1);
+    return true;
+}
+
+bool FrameQueue::pop(CapturedFrame& item)
+{
+    for (;;)
+    {
+        unsigned tail = (unsigned)mTail.loadAcquire();
+        unsigned head = (unsigned)mHead.loadAcquire();
+
+        if (head == tail)
+            return false;
+
+        if (claimTail(tail, item))
+        {
+            mConsumed.fetchAndAddOrdered(1);
+            return true;
+        }
+
+        // The producer evicted this frame, try the next one
+    }
+}
@@ -0,0 +1,85 @@
+#ifndef FRAME_QUEUE_H
+#define FRAME_QUEUE_H
+
+#include "DeckLinkAPI.h"
+
+#include <QAtomicInt>
+#include <vector>
+
+// A captured frame on its way from the capture callback to the render thread
+struct CapturedFrame
+{
+    CapturedFrame() : frame(NULL), hasNoInputSource(true), arrivalTime(0) {}
+
+    IDeckLinkVideoInputFrame*   frame;              // holds a reference
+    bool                        hasNoInputSource;
+    BMDTimeValue                arrivalTime;        // CLOCK_MONOTONIC ns when the capture callback got it
+};
+
+////////////////////////////////////////////
+// FrameQueue
+////////////////////////////////////////////
+
+// Bounded lock-free single-producer/single-consumer queue.  push() is only called from the
+// capture callback thread and pop() only from the render thread, so no locks are taken on the
+// capture path.  The head index is owned by the producer; the tail index is advanced by the
+// consumer and, under the drop-oldest policy, by the producer evicting a frame, so both sides
+// claim the tail with a compare-and-swap.
+//
+// What happens when the queue is full is set by the policy:
+//  - drop-oldest: evict the oldest queued frame, so the consumer always gets the newest ones
+//  - drop-newest: refuse the new frame
+//  - block:       wait for the consumer to make room, at most blockTimeout, then refuse the frame
+class FrameQueue
+{
+public:
+    enum Policy {
+        PolicyDropOldest,
+        PolicyDropNewest,
+        PolicyBlock
+    };
+
+    FrameQueue(int capacity = 2, Policy policy = PolicyDropOldest);
+
+    // Not thread safe: only while neither side is using the queue
+    void configure(int capacity, Policy policy);
+
+    // Producer side.  Always takes over the caller's reference on item.frame: frames refused or
+    // evicted are released here and counted as dropped.  Returns false when item was refused.
+    bool push(const CapturedFrame& item);
+
+    // Consumer side.  Returns false when the queue is empty.
+    bool pop(CapturedFrame& item);
+
+    int capacity() const { return (int)mCapacity; }
+    Policy policy() const { return mPolicy; }
+    int size() const;
+
+    void setBlockTimeout(int milliseconds) { mBlockTimeout = milliseconds; }
+
+    // Counters since construction or the last resetCounters()
+    unsigned enqueuedCount() const { return (unsigned)mEnqueued.loadAcquire(); }
+    unsigned droppedCount() const { return (unsigned)mDropped.loadAcquire(); }
+    unsigned consumedCount() const { return (unsigned)mConsumed.loadAcquire(); }
+    void resetCounters();
+
+    static const char* policyName(Policy policy);
+    static bool policyFromName(const char* name, Policy& policy);
+
+private:
+    bool claimTail(unsigned tail, CapturedFrame& item);
+    void drop(const CapturedFrame& item);
+
+    std::vector<CapturedFrame>  mSlots;     // power of two above capacity so indices stay continuous when they wrap
+    unsigned                    mCapacity;
+    Policy                      mPolicy;
+    int                         mBlockTimeout;
+    QAtomicInt                  mHead;      // next slot to write, only advanced by the producer
+    QAtomicInt                  mTail;      // next slot to read
+
+    QAtomicInt                  mEnqueued;
+    QAtomicInt                  mDropped;
+    QAtomicInt                  mConsumed;
+};
+
+#endif
@@ -0,0 +1,216 @@
+#include "FrameSink.h"
+#include "PlayoutSink.h"
+#ifdef CAM2VR_HAVE_FFMPEG
+#include "EncodeSink.h"
+#endif
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+////////////////////////////////////////////
+// WarpedFrame
+////////////////////////////////////////////
+
+WarpedFrame::WarpedFrame(unsigned width, unsigned height, const FrameTimes& times) :
+    mRefCount(1),
+    mWidth(width),
+    mHeight(height),
+    mFormat(FormatRGBA),
+    mBytes((size_t)width * height * 4),
+    mData(&mBytes[0]),
+    mTimes(times),
+    mOwner(NULL),
+    mSlot(0)
+{
+}
+
+WarpedFrame::WarpedFrame(unsigned width, unsigned height, Format format, unsigned char* bytes, const FrameTimes& times,
+                         Owner* owner, int slot) :
+    mRefCount(1),
+    mWidth(width),
+    mHeight(height),
+    mFormat(format),
+    mData(bytes),
+    mTimes(times),
+    mOwner(owner),
+    mSlot(slot)
+{
+}
+
+WarpedFrame::~WarpedFrame()
+{
+    if (mOwner)
+        mOwner->frameReleased(mSlot);
+}
+
+ULONG WarpedFrame::AddRef()
+{
+    int oldValue = mRefCount.fetchAndAddAcquire(1);
+    return (ULONG)(oldValue + 1);
+}
+
+ULONG WarpedFrame::Release()
+{
+    int oldValue = mRefCount.fetchAndAddAcquire(-1);
+    if (oldValue == 1)      // i.e. current value will be 0
+        delete this;
+
+    return (ULONG)(oldValue - 1);
+}
+
+unsigned WarpedFrame::rowBytes(unsigned width, Format format)
+{
+    switch (format)
+    {
+    case FormatUYVY:    return width * 2;
+    case FormatNV12:    return width;
+    default:            return width * 4;
+    }
+}
+
+unsigned WarpedFrame::byteCount(unsigned width, unsigned height, Format format)
+{
+    if (format == FormatNV12)
+        return width * height + width * (height / 2);
+    return rowBytes(width, format) * height;
+}
+
+const char* WarpedFrame::formatName(Format format)
+{
+    switch (format)
+    {
+    case FormatUYVY:    return "uyvy";
+    case FormatNV12:    return "nv12";
+    default:            return "rgba";
+    }
+}
+
+bool WarpedFrame::formatFromName(const char* name, Format& format)
+{
+    if (strcmp(name, "rgba") == 0)
+        format = FormatRGBA;
+    else if (strcmp(name, "uyvy") == 0)
+        format = FormatUYVY;
+    else if (strcmp(name, "nv12") == 0)
+        format = FormatNV12;
+    else
+        return false;
+    return true;
+}
+
+////////////////////////////////////////////
+// FrameSink
+////////////////////////////////////////////
+
+FrameSink* FrameSink::create(const std::string& spec)
+{
+    if (spec == "null")
+        return new NullFrameSink();
+    if (spec.compare(0, 4, "raw:") == 0 && spec.size() > 4)
+        return new RawFileSink(spec.substr(4));
+    if (spec.compare(0, 9, "decklink:") == 0 && spec.size() > 9)
+        return new PlayoutSink(new DeckLinkPlayoutDevice(atoi(spec.c_str() + 9)));
+    if (spec == "playout-sim")
+        return new PlayoutSink(new SimulatedPlayoutDevice(""));
+    if (spec.compare(0, 12, "playout-sim:") == 0 && spec.size() > 12)
+        return new PlayoutSink(new SimulatedPlayoutDevice(spec.substr(12)));
+#ifdef CAM2VR_HAVE_FFMPEG
+    if (spec.compare(0, 5, "h264:") == 0 && spec.size() > 5)
+        return new EncodeSink(EncodeSink::CodecH264, spec.substr(5));
+    if (spec.compare(0, 5, "hevc:") == 0 && spec.size() > 5)
+        return new EncodeSink(EncodeSink::CodecHEVC, spec.substr(5));
+#endif
+    return NULL;
+}
+
+////////////////////////////////////////////
+// NullFrameSink
+////////////////////////////////////////////
+
+bool NullFrameSink::Open(unsigned /*width*/, unsigned /*height*/, WarpedFrame::Format /*format*/, BMDTimeValue /*frameDuration*/, BMDTimeScale /*timeScale*/)
+{
+    mFrames = 0;
+    return true;
+}
+
+void NullFrameSink::WriteFrame(WarpedFrame* /*frame*/)
+{
+    mFrames++;
+}
+
+void NullFrameSink::Close()
+{
+    fprintf(stderr, "Null sink: %llu frames\n", mFrames);
+}
+
+////////////////////////////////////////////
+// RawFileSink
+////////////////////////////////////////////
+
+RawFileSink::RawFileSink(const std::string& path) :
+    mPath(path),
+    mFile(NULL),
+    mFrames(0)
+{
+}
+
+RawFileSink::~RawFileSink()
+{
+    Close();
+}
+
+bool RawFileSink::Open(unsigned width, unsigned height, WarpedFrame::Format format, BMDTimeValue /*frameDuration*/, BMDTimeScale /*timeScale*/)
+{
+    // A size change starts a new stream; frames of different sizes cannot share one file
+    Close();
+
+    mFile = mPath == "-" ? stdout : fopen(mPath.c_str(), "wb");
+    if (! mFile)
+    {
+        fprintf(stderr, "Raw sink: cannot open %s: %s\n", mPath.c_str(), strerror(errno));
+        return false;
+    }
+
+    mFrames = 0;
+    fprintf(stderr, "Raw sink: writing %ux%u %s frames to %s\n", width, height, WarpedFrame::formatName(format), mPath == "-" ? "stdout" : mPath.c_str());
+    return true;
+}
+
+void RawFileSink::WriteFrame(WarpedFrame* frame)
+{
+    if (! mFile)
+        return;
+
+    // OpenGL rows are bottom-up, raw video is top-down; the YUV formats already are
+    bool written = true;
+    if (frame->format() == WarpedFrame::FormatRGBA)
+    {
+        for (int y = (int)frame->height() - 1; y >= 0 && written; y--)
+            written = fwrite(frame->bytes() + (size_t)y * frame->rowBytes(), frame->rowBytes(), 1, mFile) == 1;
+    }
+    else
+    {
+        written = fwrite(frame->bytes(), frame->byteCount(), 1, mFile) == 1;
+    }
+
+    if (! written)
+    {
+        fprintf(stderr, "Raw sink: write to %s failed after %llu frames: %s\n", mPath.c_str(), mFrames, strerror(errno));
+        Close();
+        return;
+    }
+    mFrames++;
+}
+
+void RawFileSink::Close()
+{
+    if (! mFile)
+        return;
+
+    if (mFile == stdout)
+        fflush(mFile);
+    else
+        fclose(mFile);
+    mFile = NULL;
+}
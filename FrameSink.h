@@ -0,0 +1,150 @@
+#ifndef FRAME_SINK_H
+#define FRAME_SINK_H
+
+#include "DeckLinkAPI.h"
+#include "LatencyStats.h"
+
+#include <QAtomicInt>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+////////////////////////////////////////////
+// WarpedFrame
+////////////////////////////////////////////
+
+// A warped frame read back to host memory.  Reference counted like the DeckLink frames, so a sink
+// can keep a frame beyond FrameSink::WriteFrame(), e.g. to hand it to a thread of its own.  The
+// memory is either the frame's own or lent by an Owner, e.g. a mapped ReadbackRing buffer, which
+// gets it back when the last reference is released.
+class WarpedFrame
+{
+public:
+    enum Format {
+        FormatRGBA = 0,     // 8 bits per channel, rows bottom-up as OpenGL stores them
+        FormatUYVY,         // 4:2:2 like captured frames, rows top-down
+        FormatNV12,         // 4:2:0, the luma plane followed by a plane of Cb Cr pairs, rows top-down
+        FormatCount
+    };
+
+    // Lender of frame memory; frameReleased() is called on whichever thread releases the last reference
+    class Owner
+    {
+    public:
+        virtual ~Owner() {}
+        virtual void frameReleased(int slot) = 0;
+    };
+
+    // RGBA frame in memory of its own
+    WarpedFrame(unsigned width, unsigned height, const FrameTimes& times);
+    // Frame in bytes lent by owner, returned with slot
+    WarpedFrame(unsigned width, unsigned height, Format format, unsigned char* bytes, const FrameTimes& times,
+                Owner* owner, int slot);
+
+    ULONG AddRef();
+    ULONG Release();
+
+    unsigned width() const { return mWidth; }
+    unsigned height() const { return mHeight; }
+    Format format() const { return mFormat; }
+    // Of the luma plane for NV12; its chroma plane has height / 2 rows of the same size
+    unsigned rowBytes() const { return rowBytes(mWidth, mFormat); }
+    unsigned byteCount() const { return byteCount(mWidth, mHeight, mFormat); }
+    unsigned char* bytes() { return mData; }
+    const FrameTimes& times() const { return mTimes; }
+    void setPublishTime(BMDTimeValue time) { mTimes.publishTime = time; }
+
+    static unsigned rowBytes(unsigned width, Format format);
+    static unsigned byteCount(unsigned width, unsigned height, Format format);
+    static const char* formatName(Format format);
+    static bool formatFromName(const char* name, Format& format);
+
+private:
+    ~WarpedFrame();
+
+    QAtomicInt                  mRefCount;
+    unsigned                    mWidth;
+    unsigned                    mHeight;
+    Format                      mFormat;
+    std::vector<unsigned char>  mBytes;     // own memory
+    unsigned char*              mData;
+    FrameTimes                  mTimes;
+    Owner*                      mOwner;
+    int                         mSlot;
+};
+
+////////////////////////////////////////////
+// FrameSink
+////////////////////////////////////////////
+
+// Destination of warped frames when running without a window, the counterpart of FrameSource.
+// All methods are called from the presenting thread.
+class FrameSink
+{
+public:
+    virtual ~FrameSink() {}
+
+    virtual const char* getName() = 0;
+
+    // Called before the first frame and again whenever the frame size, format or rate changes; frames
+    // come at the rate of frameDuration / timeScale seconds, the capture's
+    virtual bool Open(unsigned width, unsigned height, WarpedFrame::Format format,
+                      BMDTimeValue frameDuration, BMDTimeScale timeScale) = 0;
+    // The frame is only valid during the call unless the sink AddRef()s it
+    virtual void WriteFrame(WarpedFrame* frame) = 0;
+    virtual void Close() = 0;
+
+    // Where a sink with stages of its own records them; before Open()
+    virtual void setLatencyStats(LatencyStats* /*stats*/) {}
+
+    // "null", "raw:<file>" with "-" for stdout, "decklink:<device index>" or "playout-sim[:<log file>]"
+    // (see PlayoutSink), with FFmpeg "h264:<url>" or "hevc:<url>" (see EncodeSink); NULL for anything else
+    static FrameSink* create(const std::string& spec);
+};
+
+////////////////////////////////////////////
+// NullFrameSink
+////////////////////////////////////////////
+
+// Discards frames, only counting them; for tests and measurements
+class NullFrameSink : public FrameSink
+{
+public:
+    NullFrameSink() : mFrames(0) {}
+
+    virtual const char* getName() { return "null"; }
+
+    virtual bool Open(unsigned width, unsigned height, WarpedFrame::Format format, BMDTimeValue frameDuration, BMDTimeScale timeScale);
+    virtual void WriteFrame(WarpedFrame* frame);
+    virtual void Close();
+
+private:
+    unsigned long long  mFrames;
+};
+
+////////////////////////////////////////////
+// RawFileSink
+////////////////////////////////////////////
+
+// Writes frames back to back as raw video, top row first, e.g. for
+//   cam2vr --headless --sink raw:- | ffmpeg -f rawvideo -pix_fmt rgba -s 1920x1080 -i - ...
+// with uyvy422 or nv12 as pix_fmt for the other formats
+class RawFileSink : public FrameSink
+{
+public:
+    RawFileSink(const std::string& path);
+    virtual ~RawFileSink();
+
+    virtual const char* getName() { return "raw"; }
+
+    virtual bool Open(unsigned width, unsigned height, WarpedFrame::Format format, BMDTimeValue frameDuration, BMDTimeScale timeScale);
+    virtual void WriteFrame(WarpedFrame* frame);
+    virtual void Close();
+
+private:
+    std::string         mPath;
+    FILE*               mFile;
+    unsigned long long  mFrames;
+};
+
+#endif
@@ -0,0 +1,338 @@
+#include "FrameSource.h"
+
+#include <QMessageBox>
+#include <string>
+#include <sstream>
+#include <stdio.h>
+#include <stdlib.h>
+
+namespace patch
+{
+    template < typename T > std::string to_string( const T& n )
+    {
+        std::ostringstream stm ;
+        stm << n ;
+        return stm.str() ;
+    }
+}
+
+////////////////////////////////////////////
+// DeckLinkFrameSource
+////////////////////////////////////////////
+DeckLinkFrameSource::DeckLinkFrameSource() :
+    mDLInput(NULL),
+    mDisplayMode(bmdModeHD1080i6000)
+{
+}
+
+DeckLinkFrameSource::~DeckLinkFrameSource()
+{
+    if (mDLInput != NULL)
+    {
+        // Cleanup for Capture
+        mDLInput->SetCallback(NULL);
+        releaseInput();
+    }
+}
+
+void DeckLinkFrameSource::releaseInput()
+{
+    mDLInput->Release();
+    mDLInput = NULL;
+}
+
+int DeckLinkFrameSource::getDefaultMode()
+{
+    return DEFAULT_MODE;
+}
+
+int DeckLinkFrameSource::getDeviceList(std::vector<std::string>& devices)
+{
+    devices.clear();
+
+    HRESULT result = E_FAIL;
+    IDeckLinkIterator* deckLinkIterator = CreateDeckLinkIteratorInstance();
+
+    IDeckLink* deckLink = NULL;
+    char* deckLinkName = NULL;
+
+    // No DeckLink drivers installed
+    if (deckLinkIterator == NULL)
+        return 1;
+
+    // Loop through all available devices
+    while (deckLinkIterator->Next(&deckLink) == S_OK)
+    {
+        result = deckLink->GetModelName((const char**)&deckLinkName);
+        if (result == S_OK)
+        {
+            devices.push_back(deckLinkName);
+            free(deckLinkName);
+        }
+        deckLink->Release();
+    }
+
+    deckLinkIterator->Release();
+
+    return 0;
+}
+
+IDeckLink* DeckLinkFrameSource::getDeckLink(int idx)
+{
+    HRESULT             result;
+    IDeckLink*          deckLink;
+    IDeckLinkIterator*  deckLinkIterator = CreateDeckLinkIteratorInstance();
+    int                 i = idx;
+
+    if (deckLinkIterator == NULL)
+        return NULL;
+
+    while((result = deckLinkIterator->Next(&deckLink)) == S_OK)
+    {
+        if (i == 0)
+            break;
+        --i;
+
+        deckLink->Release();
+    }
+
+    deckLinkIterator->Release();
+
+    if (result != S_OK)
+        return NULL;
+
+    return deckLink;
+}
+
+IDeckLinkDisplayMode* DeckLinkFrameSource::getDeckLinkDisplayMode(IDeckLink* deckLink, int idx)
+{
+    HRESULT                         result;
+    IDeckLinkDisplayMode*           displayMode = NULL;
+    IDeckLinkInput*                 deckLinkInput = NULL;
+    IDeckLinkDisplayModeIterator*   displayModeIterator = NULL;
+    int                             i = idx;
+
+    result = deckLink->QueryInterface(IID_IDeckLinkInput, (void**)&deckLinkInput);
+    if (result != S_OK)
+        goto bail;
+
+    result = deckLinkInput->GetDisplayModeIterator(&displayModeIterator);
+    if (result != S_OK)
+        goto bail;
+
+    while ((result = displayModeIterator->Next(&displayMode)) == S_OK)
+    {
+        if (i == 0)
+            break;
+        --i;
+
+        displayMode->Release();
+    }
+
+    if (result != S_OK)
+        displayMode = NULL;
+
+bail:
+    if (displayModeIterator)
+        displayModeIterator->Release();
+
+    if (deckLinkInput)
+        deckLinkInput->Release();
+
+    return displayMode;
+}
+
+int DeckLinkFrameSource::getModeList(int device, std::vector<std::string>& modes)
+{
+    HRESULT result =                E_FAIL;
+    IDeckLinkDisplayModeIterator*   displayModeIterator = NULL;
+    IDeckLinkAttributes*            deckLinkAttributes = NULL;
+    bool                            formatDetectionSupported;
+    IDeckLinkInput*                 deckLinkInput = NULL;
+    IDeckLinkDisplayMode*           displayModeUsage;
+    int                             displayModeCount = 0;
+    char*                           displayModeName;
+
+    IDeckLink* deckLinkSelected = getDeckLink(device);
+
+    if(!deckLinkSelected)
+        return 1;
+
+    modes.clear();
+
+    result = deckLinkSelected->QueryInterface(IID_IDeckLinkAttributes, (void**)&deckLinkAttributes);
+    if (result == S_OK)
+    {
+        result = deckLinkAttributes->GetFlag(BMDDeckLinkSupportsInputFormatDetection, &formatDetectionSupported);
+        if (result == S_OK && formatDetectionSupported)
+            fprintf(stderr, "        -1:  auto detect format\n");
+    }
+
+    result = deckLinkSelected->QueryInterface(IID_IDeckLinkInput, (void**)&deckLinkInput);
+    if (result != S_OK)
+        goto bail;
+
+    result = deckLinkInput->GetDisplayModeIterator(&displayModeIterator);
+    if (result != S_OK)
+        goto bail;
+
+    while (displayModeIterator->Next(&displayModeUsage) == S_OK)
+    {
+        result = displayModeUsage->GetName((const char **)&displayModeName);
+        if (result == S_OK)
+        {
+            BMDTimeValue frameRateDuration;
+            BMDTimeValue frameRateScale;
+
+            displayModeUsage->GetFrameRate(&frameRateDuration, &frameRateScale);
+            std::string tmp = displayModeName;
+            tmp.append(" ");
+            tmp.append(patch::to_string(displayModeUsage->GetWidth()));
+            tmp.append("x");
+            tmp.append(patch::to_string(displayModeUsage->GetHeight()));
+            double fps = (double)frameRateScale / (double)frameRateDuration;
+            tmp.append(" ");
+            tmp.append(patch::to_string(fps));
+            tmp.append("fps");
+            modes.push_back(tmp);
+
+            free(displayModeName);
+        }
+
+        displayModeUsage->Release();
+        ++displayModeCount;
+    }
+
+    return 0;
+
+    bail:
+        if (displayModeIterator != NULL)
+            displayModeIterator->Release();
+
+        if (deckLinkInput != NULL)
+            deckLinkInput->Release();
+
+        if (deckLinkAttributes != NULL)
+            deckLinkAttributes->Release();
+
+        if (deckLinkSelected != NULL)
+            deckLinkSelected->Release();
+
+        return 1;
+}
+
+bool DeckLinkFrameSource::Open(int device, int mode)
+{
+    bool                            bSuccess = false;
+    IDeckLinkIterator*              pDLIterator = NULL;
+    IDeckLink*                      pDL = NULL;
+    IDeckLinkDisplayModeIterator*   pDLDisplayModeIterator = NULL;
+    IDeckLinkDisplayMode*           pDLDisplayMode = NULL;
+
+    pDLIterator = CreateDeckLinkIteratorInstance();
+    if (pDLIterator == NULL)
+    {
+        QMessageBox::critical(NULL, "This application requires the DeckLink drivers installed.", "Please install the Blackmagic DeckLink drivers to use the features of this application.");
+        return false;
+    }
+
+    pDL = getDeckLink(device);
+    if (pDL == NULL)
+    {
+        QMessageBox::critical(NULL, "Expected Input DeckLink devices", "This application requires DeckLink device.");
+        goto error;
+    }
+
+    if (mDLInput)
+    {
+        mDLInput->StopStreams();
+        mDLInput->DisableVideoInput();
+        releaseInput();
+    }
+
+    pDL->QueryInterface(IID_IDeckLinkInput, (void**)&mDLInput);
+    if (! mDLInput)
+    {
+        QMessageBox::critical(NULL, "Expected Input DeckLink devices", "This application requires DeckLink device.");
+        goto error;
+    }
+
+    if (mDLInput->GetDisplayModeIterator(&pDLDisplayModeIterator) != S_OK)
+    {
+        QMessageBox::critical(NULL, "Cannot get Display Mode Iterator.", "DeckLink error.");
+        goto error;
+    }
+
+    pDLDisplayMode = getDeckLinkDisplayMode(pDL, mode);
+    if (pDLDisplayMode == NULL)
+    {
+        QMessageBox::critical(NULL, "Cannot get specified BMDDisplayMode.", "DeckLink error.");
+        goto error;
+    }
+
+    mDisplayMode = pDLDisplayMode->GetDisplayMode();
+
+    mFrameWidth = pDLDisplayMode->GetWidth();
+    mFrameHeight = pDLDisplayMode->GetHeight();
+    pDLDisplayMode->GetFrameRate(&mFrameDuration, &mFrameTimescale);
+
+    bSuccess = true;
+
+error:
+    if (!bSuccess)
+    {
+        if (mDLInput != NULL)
+            releaseInput();
+    }
+
+    if (pDLDisplayMode != NULL)
+        pDLDisplayMode->Release();
+
+    if (pDLDisplayModeIterator != NULL)
+        pDLDisplayModeIterator->Release();
+
+    if (pDL != NULL)
+        pDL->Release();
+
+    pDLIterator->Release();
+
+    return bSuccess;
+}
+
+bool DeckLinkFrameSource::EnableVideoInput(IDeckLinkMemoryAllocator* allocator, IDeckLinkInputCallback* callback)
+{
+    if (mDLInput == NULL)
+        return false;
+
+    if (mDLInput->SetVideoInputFrameMemoryAllocator(allocator) != S_OK)
+        return false;
+
+    if (mDLInput->EnableVideoInput(mDisplayMode, bmdFormat8BitYUV, bmdVideoInputFlagDefault) != S_OK)
+        return false;
+
+    if (mDLInput->SetCallback(callback) != S_OK)
+        return false;
+
+    return true;
+}
+
+bool DeckLinkFrameSource::Start()
+{
+    if (mDLInput == NULL)
+        return false;
+
+    mDLInput->StartStreams();
+
+    return true;
+}
+
+bool DeckLinkFrameSource::Stop()
+{
+    if (mDLInput == NULL)
+        return false;
+
+    mDLInput->StopStreams();
+    mDLInput->DisableVideoInput();
+
+    return true;
+}
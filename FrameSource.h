@@ -0,0 +1,84 @@
+#ifndef FRAME_SOURCE_H
+#define FRAME_SOURCE_H
+
+#include "DeckLinkAPI.h"
+
+#include <vector>
+#include <string>
+
+#define DEFAULT_DEVICE 0
+#define DEFAULT_MODE 15
+
+////////////////////////////////////////////
+// FrameSource
+////////////////////////////////////////////
+
+// A FrameSource delivers UYVY video frames to an IDeckLinkInputCallback, exactly as an
+// IDeckLinkInput does.  OpenGLCapture only talks to this interface so the rest of the
+// pipeline (CaptureDelegate -> RenderThread) is the same whether frames come from a
+// DeckLink card or are generated in software.
+class FrameSource
+{
+public:
+    FrameSource() : mFrameWidth(0), mFrameHeight(0), mFrameDuration(0), mFrameTimescale(0) {}
+    virtual ~FrameSource() {}
+
+    virtual const char* getName() = 0;
+
+    virtual int getDeviceList(std::vector<std::string>& devices) = 0;
+    virtual int getModeList(int device, std::vector<std::string>& modes) = 0;
+    virtual int getDefaultMode() = 0;
+
+    // Select the device and mode; on success the frame size and rate below are valid
+    virtual bool Open(int device, int mode) = 0;
+
+    // Frames are allocated from allocator and delivered to callback once Start() is called
+    virtual bool EnableVideoInput(IDeckLinkMemoryAllocator* allocator, IDeckLinkInputCallback* callback) = 0;
+
+    virtual bool Start() = 0;
+    virtual bool Stop() = 0;
+
+    unsigned getFrameWidth() const { return mFrameWidth; }
+    unsigned getFrameHeight() const { return mFrameHeight; }
+    BMDTimeValue getFrameDuration() const { return mFrameDuration; }
+    BMDTimeScale getFrameTimescale() const { return mFrameTimescale; }
+
+protected:
+    unsigned        mFrameWidth;
+    unsigned        mFrameHeight;
+    BMDTimeValue    mFrameDuration;
+    BMDTimeScale    mFrameTimescale;
+};
+
+////////////////////////////////////////////
+// DeckLinkFrameSource
+////////////////////////////////////////////
+class DeckLinkFrameSource : public FrameSource
+{
+public:
+    DeckLinkFrameSource();
+    virtual ~DeckLinkFrameSource();
+
+    virtual const char* getName() { return "decklink"; }
+
+    virtual int getDeviceList(std::vector<std::string>& devices);
+    virtual int getModeList(int device, std::vector<std::string>& modes);
+    virtual int getDefaultMode();
+
+    virtual bool Open(int device, int mode);
+    virtual bool EnableVideoInput(IDeckLinkMemoryAllocator* allocator, IDeckLinkInputCallback* callback);
+
+    virtual bool Start();
+    virtual bool Stop();
+
+private:
+    IDeckLink* getDeckLink(int idx);
+    IDeckLinkDisplayMode* getDeckLinkDisplayMode(IDeckLink* deckLink, int idx);
+    void releaseInput();
+
+private:
+    IDeckLinkInput*     mDLInput;
+    BMDDisplayMode      mDisplayMode;
+};
+
+#endif
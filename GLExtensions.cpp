@@ -27,6 +27,7 @@
 
 
 #include "GLExtensions.h"
+#include <QOpenGLContext>
 
 PFNGLGENFRAMEBUFFERSEXTPROC glGenFramebuffersEXT;
 PFNGLGENRENDERBUFFERSEXTPROC glGenRenderbuffersEXT;
@@ -42,6 +43,7 @@ PFNGLBLITFRAMEBUFFEREXTPROC glBlitFramebufferEXT;
 PFNGLFENCESYNCPROC glFenceSync;
 PFNGLCLIENTWAITSYNCPROC glClientWaitSync;
 PFNGLDELETESYNCPROC glDeleteSync;
+PFNGLWAITSYNCPROC glWaitSync;
 PFNGLGENBUFFERSPROC glGenBuffers;
 PFNGLDELETEBUFFERSPROC glDeleteBuffers;
 PFNGLBINDBUFFERPROC glBindBuffer;
@@ -63,11 +65,33 @@ PFNGLUNIFORM1FPROC glUniform1f;
 
 // Added
 PFNGLGETATTRIBLOCATIONPROC glGetAttribLocation;
+PFNGLBINDATTRIBLOCATIONPROC glBindAttribLocation;
+PFNGLDELETEPROGRAMPROC glDeleteProgram;
+PFNGLDELETESHADERPROC glDeleteShader;
+PFNGLDETACHSHADERPROC glDetachShader;
 PFNGLENABLEVERTEXATTRIBARRAYPROC glEnableVertexAttribArray;
 PFNGLVERTEXATTRIBPOINTERPROC glVertexAttribPointer;
 PFNGLUNIFORM4FVPROC glUniform4fv;
+PFNGLBUFFERSUBDATAPROC glBufferSubData;
+PFNGLMAPBUFFERRANGEPROC glMapBufferRange;
+PFNGLUNMAPBUFFERPROC glUnmapBuffer;
 
-bool ResolveGLExtensions(const QGLContext* context)
+// Optional
+PFNGLBUFFERSTORAGEPROC glBufferStorage;
+PFNGLGENQUERIESPROC glGenQueries;
+PFNGLDELETEQUERIESPROC glDeleteQueries;
+PFNGLBEGINQUERYPROC glBeginQuery;
+PFNGLENDQUERYPROC glEndQuery;
+PFNGLGETQUERYOBJECTUIVPROC glGetQueryObjectuiv;
+PFNGLGETQUERYOBJECTUI64VPROC glGetQueryObjectui64v;
+PFNGLPRIMITIVERESTARTINDEXPROC glPrimitiveRestartIndex;
+PFNGLGETPROGRAMBINARYPROC glGetProgramBinary;
+PFNGLPROGRAMBINARYPROC glProgramBinary;
+PFNGLPROGRAMPARAMETERIPROC glProgramParameteri;
+
+// Context is a QGLContext or a QOpenGLContext, both resolve entry points with getProcAddress()
+template <class Context>
+static bool resolveGLExtensions(const Context* context)
 {
 	glGenFramebuffersEXT = (PFNGLGENFRAMEBUFFERSEXTPROC) context->getProcAddress("glGenFramebuffersEXT");
 	glGenRenderbuffersEXT = (PFNGLGENRENDERBUFFERSEXTPROC) context->getProcAddress("glGenRenderbuffersEXT");
@@ -83,6 +107,7 @@ bool ResolveGLExtensions(const QGLContext* context)
 	glFenceSync = (PFNGLFENCESYNCPROC) context->getProcAddress("glFenceSync");
 	glClientWaitSync = (PFNGLCLIENTWAITSYNCPROC) context->getProcAddress("glClientWaitSync");
 	glDeleteSync = (PFNGLDELETESYNCPROC) context->getProcAddress("glDeleteSync");
+	glWaitSync = (PFNGLWAITSYNCPROC) context->getProcAddress("glWaitSync");
 	glGenBuffers = (PFNGLGENBUFFERSPROC) context->getProcAddress("glGenBuffers");
 	glDeleteBuffers = (PFNGLDELETEBUFFERSPROC) context->getProcAddress("glDeleteBuffers");
 	glBindBuffer = (PFNGLBINDBUFFERPROC) context->getProcAddress("glBindBuffer");
@@ -104,9 +129,29 @@ bool ResolveGLExtensions(const QGLContext* context)
 
     //added
     glGetAttribLocation = (PFNGLGETATTRIBLOCATIONPROC) context->getProcAddress("glGetAttribLocation");
+    glBindAttribLocation = (PFNGLBINDATTRIBLOCATIONPROC) context->getProcAddress("glBindAttribLocation");
+    glDeleteProgram = (PFNGLDELETEPROGRAMPROC) context->getProcAddress("glDeleteProgram");
+    glDeleteShader = (PFNGLDELETESHADERPROC) context->getProcAddress("glDeleteShader");
+    glDetachShader = (PFNGLDETACHSHADERPROC) context->getProcAddress("glDetachShader");
     glEnableVertexAttribArray = (PFNGLENABLEVERTEXATTRIBARRAYPROC) context->getProcAddress("glEnableVertexAttribArray");
     glVertexAttribPointer = (PFNGLVERTEXATTRIBPOINTERPROC) context->getProcAddress("glVertexAttribPointer");
     glUniform4fv = (PFNGLUNIFORM4FVPROC) context->getProcAddress("glUniform4fv");
+    glBufferSubData = (PFNGLBUFFERSUBDATAPROC) context->getProcAddress("glBufferSubData");
+    glMapBufferRange = (PFNGLMAPBUFFERRANGEPROC) context->getProcAddress("glMapBufferRange");
+    glUnmapBuffer = (PFNGLUNMAPBUFFERPROC) context->getProcAddress("glUnmapBuffer");
+
+    //optional
+    glBufferStorage = (PFNGLBUFFERSTORAGEPROC) context->getProcAddress("glBufferStorage");
+    glGenQueries = (PFNGLGENQUERIESPROC) context->getProcAddress("glGenQueries");
+    glDeleteQueries = (PFNGLDELETEQUERIESPROC) context->getProcAddress("glDeleteQueries");
+    glBeginQuery = (PFNGLBEGINQUERYPROC) context->getProcAddress("glBeginQuery");
+    glEndQuery = (PFNGLENDQUERYPROC) context->getProcAddress("glEndQuery");
+    glGetQueryObjectuiv = (PFNGLGETQUERYOBJECTUIVPROC) context->getProcAddress("glGetQueryObjectuiv");
+    glGetQueryObjectui64v = (PFNGLGETQUERYOBJECTUI64VPROC) context->getProcAddress("glGetQueryObjectui64v");
+    glPrimitiveRestartIndex = (PFNGLPRIMITIVERESTARTINDEXPROC) context->getProcAddress("glPrimitiveRestartIndex");
+    glGetProgramBinary = (PFNGLGETPROGRAMBINARYPROC) context->getProcAddress("glGetProgramBinary");
+    glProgramBinary = (PFNGLPROGRAMBINARYPROC) context->getProcAddress("glProgramBinary");
+    glProgramParameteri = (PFNGLPROGRAMPARAMETERIPROC) context->getProcAddress("glProgramParameteri");
 
 
 	return	glGenFramebuffersEXT
@@ -123,6 +168,7 @@ bool ResolveGLExtensions(const QGLContext* context)
 			&& glFenceSync
 			&& glClientWaitSync
 			&& glDeleteSync
+			&& glWaitSync
 			&& glGenBuffers
 			&& glDeleteBuffers
 			&& glBindBuffer
@@ -142,8 +188,25 @@ bool ResolveGLExtensions(const QGLContext* context)
 			&& glUniform1i
 			&& glUniform1f
             && glGetAttribLocation
+            && glBindAttribLocation
+            && glDeleteProgram
+            && glDeleteShader
+            && glDetachShader
             && glEnableVertexAttribArray
             && glVertexAttribPointer
             && glUniform4fv
+            && glBufferSubData
+            && glMapBufferRange
+            && glUnmapBuffer
 			;
 }
+
+bool ResolveGLExtensions(const QGLContext* context)
+{
+	return resolveGLExtensions(context);
+}
+
+bool ResolveGLExtensions(const QOpenGLContext* context)
+{
+	return resolveGLExtensions(context);
+}
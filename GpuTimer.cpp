@@ -0,0 +1,95 @@
+#include "GpuTimer.h"
+
+GpuTimer::GpuTimer() :
+    mNext(0),
+    mOldest(0),
+    mActive(false),
+    mSkipped(0)
+{
+}
+
+GpuTimer::~GpuTimer()
+{
+    // The GL context may already be gone; cleanup() must be called while it is current
+}
+
+bool GpuTimer::init(int depth)
+{
+    cleanup();
+
+    if (! glGenQueries || ! glDeleteQueries || ! glBeginQuery || ! glEndQuery ||
+        ! glGetQueryObjectuiv || ! glGetQueryObjectui64v)
+        return false;
+
+    mQueries.resize(depth);
+    glGenQueries(depth, &mQueries[0]);
+    mSections.assign(depth, -1);
+    return true;
+}
+
+void GpuTimer::cleanup()
+{
+    if (mActive)
+        end();
+
+    if (! mQueries.empty())
+        glDeleteQueries((GLsizei)mQueries.size(), &mQueries[0]);
+
+    mQueries.clear();
+    mSections.clear();
+    mNext = 0;
+    mOldest = 0;
+    mSkipped = 0;
+}
+
+void GpuTimer::begin(int section)
+{
+    if (mQueries.empty())
+        return;
+
+    // Never reuse a query whose result has not been read: that would wait for the GPU
+    unsigned index = mNext % mQueries.size();
+    if (mSections[index] >= 0)
+    {
+        mSkipped++;
+        return;
+    }
+
+    glBeginQuery(GL_TIME_ELAPSED, mQueries[index]);
+    mSections[index] = section;
+    mActive = true;
+}
+
+void GpuTimer::end()
+{
+    if (! mActive)
+        return;
+
+    glEndQuery(GL_TIME_ELAPSED);
+    mNext++;
+    mActive = false;
+}
+
+void GpuTimer::poll(std::vector<Sample>& samples)
+{
+    // Queries complete in the order they were issued, so stop at the first one still in flight
+    while (mOldest != mNext)
+    {
+        unsigned index = mOldest % mQueries.size();
+        GLuint available = 0;
+        glGetQueryObjectuiv(mQueries[index], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (! available)
+            break;
+
+        GLuint64 elapsed = 0;
+        glGetQueryObjectui64v(mQueries[index], GL_QUERY_RESULT, &elapsed);
+
+        Sample sample;
+        sample.section = mSections[index];
+        sample.duration = (BMDTimeValue)elapsed;
+        samples.push_back(sample);
+
+        mSections[index] = -1;
+        mOldest++;
+    }
+}
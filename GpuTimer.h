@@ -0,0 +1,52 @@
+#ifndef GPU_TIMER_H
+#define GPU_TIMER_H
+
+#include "DeckLinkAPI.h"
+#include "GLExtensions.h"
+
+#include <vector>
+
+////////////////////////////////////////////
+// GpuTimer
+////////////////////////////////////////////
+
+// Measures how long the GPU spends on sections of a frame with GL_TIME_ELAPSED queries, without
+// ever stalling the pipeline: queries are taken from a ring and their results are only read once
+// the GPU reports them available, a few frames later.  When every query of the ring is still in
+// flight the section is simply not measured.  Sections are numbered by the caller and may not nest.
+//
+// All methods must be called with the GL context the timer was initialised in current.
+class GpuTimer
+{
+public:
+    struct Sample {
+        int             section;
+        BMDTimeValue    duration;   // ns
+    };
+
+    GpuTimer();
+    ~GpuTimer();
+
+    // depth queries, a power of two.  false when the driver has no timer queries; the timer then does nothing
+    bool init(int depth = 8);
+    void cleanup();
+    bool available() const { return ! mQueries.empty(); }
+
+    void begin(int section);
+    void end();
+
+    // Append the durations the GPU has finished measuring, oldest first
+    void poll(std::vector<Sample>& samples);
+
+    unsigned skippedCount() const { return mSkipped; }
+
+private:
+    std::vector<GLuint>     mQueries;
+    std::vector<int>        mSections;  // per query, -1 when it has no pending result
+    unsigned                mNext;      // next query to begin
+    unsigned                mOldest;    // oldest query with a pending result
+    bool                    mActive;
+    unsigned                mSkipped;
+};
+
+#endif
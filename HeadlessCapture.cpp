@@ -0,0 +1,523 @@
+#include "HeadlessCapture.h"
+#include "CaptureRecorder.h"
+#include "FrameSink.h"
+#include "LatencyStats.h"
+#include "OpenGLCapture.h"
+#include "RenderThread.h"
+
+#include <QOffscreenSurface>
+#include <QOpenGLContext>
+#include <QTimer>
+#include <stdio.h>
+#include <string.h>
+
+HeadlessCapture::HeadlessCapture(QObject* parent) :
+    QObject(parent),
+    mSurface(NULL),
+    mContext(NULL),
+    mCaptureDelegate(NULL),
+    mRecorder(NULL),
+    mRenderThread(NULL),
+    mFrameSource(new DeckLinkFrameSource()),
+    mCaptureAllocator(NULL),
+    mFrameWidth(0), mFrameHeight(0),
+    mReadbackFormat(WarpedFrame::FormatRGBA),
+    mReadbackDepth(3),
+    mColourMatrix(WarpRenderer::ColourRec709),
+    mCollectPending(false),
+    mCpuWarp(false),
+    mCpuCaptureDelegate(NULL),
+    mQueueDepth(2),
+    mQueuePolicy(FrameQueue::PolicyDropOldest)
+{
+    mRenderThread = new RenderThread();
+    mRenderThread->framePacer().setEnabled(false);
+
+    // The render thread only asks for the latest frame to be read back, which happens on our thread
+    connect(mRenderThread, SIGNAL(frameRendered()), this, SLOT(presentFrame()), Qt::QueuedConnection);
+
+    mCaptureAllocator = new PinnedMemoryAllocator("Capture", 2);
+    mCaptureDelegate = new CaptureDelegate(mRenderThread);
+    mCpuCaptureDelegate = new CpuCaptureDelegate(this);
+}
+
+HeadlessCapture::~HeadlessCapture()
+{
+    mFrameSource->Stop();
+    mRenderThread->stopRendering();
+    stopCpuWarp();
+
+    delete mFrameSource;
+    delete mCaptureDelegate;
+    delete mCpuCaptureDelegate;
+    delete mRecorder;
+    delete mRenderThread;
+
+    // Sinks release the frames they hold on Close(), before the ring's buffers go
+    for (size_t i = 0; i < mSinks.size(); i++)
+    {
+        if (mSinkOpen[i])
+            mSinks[i]->Close();
+        delete mSinks[i];
+    }
+
+    if (mContext)
+    {
+        // Cached buffers may still be pinned; our context shares their buffer objects
+        mContext->makeCurrent(mSurface);
+        mCaptureAllocator->Decommit();
+        mCaptureAllocator->releaseUnpinnedBuffers();
+        mReadback.cleanup();
+        mContext->doneCurrent();
+    }
+    else
+    {
+        // Nothing was pinned without a context
+        mCaptureAllocator->Decommit();
+    }
+    mCaptureAllocator->Release();
+
+    delete mContext;
+    if (mSurface)
+        mSurface->destroy();
+    delete mSurface;
+}
+
+void HeadlessCapture::setCpuWarp(bool enable, int threads)
+{
+    mCpuWarp = enable;
+    mCpuWarper.setThreadCount(threads);
+}
+
+bool HeadlessCapture::init(QString& error)
+{
+    if (mCpuWarp)
+    {
+        fprintf(stderr, "Warping on the CPU with %d threads, %s colour conversion\n",
+                mCpuWarper.threadCount(), UyvyConverter::isaName(mCpuWarper.converter().isa()));
+        return true;
+    }
+
+    mSurface = new QOffscreenSurface();
+    mSurface->create();
+    if (! mSurface->isValid())
+    {
+        error = "Cannot create an offscreen surface.";
+        return false;
+    }
+
+    mContext = new QOpenGLContext();
+    if (! mContext->create() || ! mContext->makeCurrent(mSurface))
+    {
+        error = "Cannot create an offscreen OpenGL context.";
+        return false;
+    }
+
+    if (! ResolveGLExtensions(mContext))
+    {
+        error = "The OpenGL implementation lacks required entry points.";
+        return false;
+    }
+
+    fprintf(stderr, "Headless rendering on %s (%s)\n", (const char*)glGetString(GL_RENDERER), (const char*)glGetString(GL_VERSION));
+    return true;
+}
+
+int HeadlessCapture::getDeviceList(std::vector<std::string>& devices)
+{
+    return mFrameSource->getDeviceList(devices);
+}
+
+int HeadlessCapture::getModeList(int device, std::vector<std::string>& modes)
+{
+    return mFrameSource->getModeList(device, modes);
+}
+
+void HeadlessCapture::setFrameSource(FrameSource* source)
+{
+    mMutex.lock();
+    if (mFrameSource)
+    {
+        mFrameSource->Stop();
+        delete mFrameSource;
+    }
+    mFrameSource = source;
+    mMutex.unlock();
+}
+
+void HeadlessCapture::setUploadRing(int depth, UnpackBufferRing::Mode mode)
+{
+    mRenderThread->setUploadRing(depth, mode);
+}
+
+void HeadlessCapture::setFrameQueue(int depth, FrameQueue::Policy policy)
+{
+    mRenderThread->setFrameQueue(depth, policy);
+    mQueueDepth = depth;
+    mQueuePolicy = policy;
+}
+
+bool HeadlessCapture::setMeshSize(int width, int height)
+{
+    return mRenderThread->setMeshSize(width, height);
+}
+
+int HeadlessCapture::meshWidth() const
+{
+    return mRenderThread->meshWidth();
+}
+
+int HeadlessCapture::meshHeight() const
+{
+    return mRenderThread->meshHeight();
+}
+
+void HeadlessCapture::setMeshLayout(WarpRenderer::MeshLayout layout)
+{
+    mRenderThread->setMeshLayout(layout);
+}
+
+void HeadlessCapture::setWarpShader(WarpRenderer::WarpShader shader)
+{
+    mRenderThread->setWarpShader(shader);
+}
+
+bool HeadlessCapture::setViewer(const std::string& id)
+{
+    const CardboardViewer* viewer = mDeviceInfo.findViewer(id);
+    if (! viewer)
+        return false;
+
+    mDeviceInfo.setViewer(*viewer);
+    applyProfile();
+    return true;
+}
+
+bool HeadlessCapture::setDevice(const std::string& id)
+{
+    const Device* device = mDeviceInfo.findDevice(id);
+    if (! device)
+        return false;
+
+    mDeviceInfo.setDevice(*device);
+    applyProfile();
+    return true;
+}
+
+void HeadlessCapture::addViewer(const CardboardViewer& viewer)
+{
+    mDeviceInfo.addViewer(viewer);
+    // A selected profile that is redefined is applied again
+    if (viewer.id == mDeviceInfo.getViewer().id)
+        setViewer(viewer.id);
+}
+
+void HeadlessCapture::addDevice(const Device& device)
+{
+    mDeviceInfo.addDevice(device);
+    if (device.id == mDeviceInfo.getDevice().id)
+        setDevice(device.id);
+}
+
+// Hand the selected profiles to whichever warp is in use.  warpFrames() runs on this thread too, so
+// the remap table is never replaced in the middle of a frame; frames captured meanwhile wait in the queue.
+void HeadlessCapture::applyProfile()
+{
+    mRenderThread->setProfile(mDeviceInfo.getViewer(), mDeviceInfo.getDevice());
+    if (mCpuWarp && mCpuWarper.isInitialised())
+        mCpuWarper.init(mDeviceInfo, mFrameWidth, mFrameHeight);
+}
+
+void HeadlessCapture::setMeshCacheDirectory(const QString& directory)
+{
+    mRenderThread->setMeshCacheDirectory(directory);
+}
+
+void HeadlessCapture::setShaderCacheDirectory(const QString& directory)
+{
+    mRenderThread->setShaderCacheDirectory(directory);
+}
+
+void HeadlessCapture::setColourMatrix(WarpRenderer::ColourMatrix matrix)
+{
+    mRenderThread->setColourMatrix(matrix);
+    mColourMatrix = matrix;
+}
+
+void HeadlessCapture::setDistortionInverse(DeviceInfo::InverseMode mode)
+{
+    mDeviceInfo.setInverseMode(mode);
+    mRenderThread->setDistortionInverse(mode);
+}
+
+void HeadlessCapture::setReadback(WarpedFrame::Format format, int depth)
+{
+    mReadbackFormat = format;
+    mReadbackDepth = depth;
+}
+
+void HeadlessCapture::setPacingLog(bool enable)
+{
+    mRenderThread->framePacer().setVerbose(enable);
+}
+
+LatencyStats& HeadlessCapture::latencyStats()
+{
+    return mCpuWarp ? mCpuStats : mRenderThread->latencyStats();
+}
+
+void HeadlessCapture::setRecorder(CaptureRecorder* recorder)
+{
+    mFrameSource->Stop();
+    delete mRecorder;
+    mRecorder = recorder;
+    mCaptureDelegate->setRecorder(recorder);
+    mCpuCaptureDelegate->setRecorder(recorder);
+}
+
+void HeadlessCapture::addSink(FrameSink* sink)
+{
+    mSinks.push_back(sink);
+    mSinkOpen.push_back(false);
+}
+
+bool HeadlessCapture::InitDeckLink(int device, int mode)
+{
+    // No capture callback may reach the render thread while it is restarted
+    mFrameSource->Stop();
+    mRenderThread->stopRendering();
+    stopCpuWarp();
+
+    // Closing the sinks returns their frames to the readback ring, which is set up again below
+    for (size_t i = 0; i < mSinks.size(); i++)
+    {
+        if (mSinkOpen[i])
+            mSinks[i]->Close();
+        mSinkOpen[i] = false;
+    }
+
+    if (! mFrameSource->Open(device, mode))
+        return false;
+
+    mFrameWidth = mFrameSource->getFrameWidth();
+    mFrameHeight = mFrameSource->getFrameHeight();
+
+    // For large frames use a reduced allocator frame cache size to avoid out-of-memory
+    mCaptureAllocator->setCacheSize(mFrameWidth < 1920 ? 2 : 1);
+
+    if (mCpuWarp)
+    {
+        // The remap table depends on the frame size, so it is rebuilt for every mode
+        mCpuWarper.init(mDeviceInfo, mFrameWidth, mFrameHeight);
+        mCpuQueue.configure(mQueueDepth, mQueuePolicy);
+        mCpuQueue.resetCounters();
+        mCpuStats.reset();
+        mAcceptFrames.storeRelease(1);
+    }
+    else
+    {
+        QString error;
+        if (! mRenderThread->startRendering(mContext, mFrameWidth, mFrameHeight, mFrameSource->getFrameDuration(),
+                                            mFrameSource->getFrameTimescale(), mCaptureAllocator, error))
+        {
+            fprintf(stderr, "OpenGL initialization error: %s\n", qPrintable(error));
+            return false;
+        }
+
+        mContext->makeCurrent(mSurface);
+        if (! mReadback.init(mFrameWidth, mFrameHeight, mReadbackFormat, mReadbackDepth, mColourMatrix, error))
+        {
+            fprintf(stderr, "OpenGL initialization error: %s\n", qPrintable(error));
+            return false;
+        }
+    }
+
+    WarpedFrame::Format format = mCpuWarp ? WarpedFrame::FormatRGBA : mReadback.format();
+    for (size_t i = 0; i < mSinks.size(); i++)
+    {
+        mSinks[i]->setLatencyStats(&latencyStats());
+        mSinkOpen[i] = mSinks[i]->Open(mFrameWidth, mFrameHeight, format, mFrameSource->getFrameDuration(), mFrameSource->getFrameTimescale());
+        if (! mSinkOpen[i])
+            fprintf(stderr, "Cannot open the %s sink, it receives no frames\n", mSinks[i]->getName());
+    }
+
+    // A recording that cannot be written does not stop the capture
+    if (mRecorder && ! mRecorder->Open(mFrameWidth, mFrameHeight, mFrameSource->getFrameDuration(), mFrameSource->getFrameTimescale()))
+        fprintf(stderr, "Cannot record the captured frames\n");
+
+    IDeckLinkInputCallback* callback = mCpuWarp ? (IDeckLinkInputCallback*)mCpuCaptureDelegate : (IDeckLinkInputCallback*)mCaptureDelegate;
+    if (! mFrameSource->EnableVideoInput(mCaptureAllocator, callback))
+        return false;
+
+    return true;
+}
+
+bool HeadlessCapture::Start()
+{
+    return mFrameSource->Start();
+}
+
+bool HeadlessCapture::Stop()
+{
+    // Frames still held for in-flight uploads are retired by the render thread
+    return mFrameSource->Stop();
+}
+
+void HeadlessCapture::presentFrame()
+{
+    mRenderThread->framePresented();
+    mContext->makeCurrent(mSurface);
+
+    PresentBuffers& present = mRenderThread->presentBuffers();
+    GLsync renderFence;
+    FrameTimes times;
+    int target = present.acquireForPresent(renderFence, times);
+    if (target < 0)
+        return;
+
+    if (renderFence)
+    {
+        glWaitSync(renderFence, 0, GL_TIMEOUT_IGNORED);
+        glDeleteSync(renderFence);
+    }
+
+    // Only frames not handed out before; the target stays ours until the next acquire either way.
+    // The copy is only queued here, the fence below makes the render thread wait for it.
+    if (times.publishTime)
+        mReadback.read(present.texture(target), times);
+
+    // The render thread waits on this before drawing into the target again
+    present.releasePresented(target, glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0));
+    glFlush();
+
+    collectReadbacks();
+}
+
+void HeadlessCapture::pollReadbacks()
+{
+    mCollectPending = false;
+    mContext->makeCurrent(mSurface);
+    collectReadbacks();
+}
+
+// Hand the frames whose readback has completed to the sinks, polling again shortly while copies are
+// still in flight, so the last frames arrive even when no new frame is rendered
+void HeadlessCapture::collectReadbacks()
+{
+    WarpedFrame* frame;
+    while ((frame = mReadback.takeCompleted()) != NULL)
+    {
+        writeFrame(frame);
+        frame->Release();
+    }
+
+    if (mReadback.hasPending() && ! mCollectPending)
+    {
+        mCollectPending = true;
+        QTimer::singleShot(1, this, SLOT(pollReadbacks()));
+    }
+}
+
+void HeadlessCapture::writeFrame(WarpedFrame* frame)
+{
+    for (size_t i = 0; i < mSinks.size(); i++)
+    {
+        if (mSinkOpen[i])
+            mSinks[i]->WriteFrame(frame);
+    }
+
+    BMDTimeValue now = FramePacer::now();
+    LatencyStats& stats = latencyStats();
+    stats.record(LatencyStats::StagePresent, now - frame->times().publishTime);
+    stats.record(LatencyStats::StageTotal, now - frame->times().arrivalTime);
+    stats.count(LatencyStats::EventPresented);
+}
+
+////////////////////////////////////////////
+// CPU warp
+////////////////////////////////////////////
+
+void HeadlessCapture::queueFrame(IDeckLinkVideoInputFrame* frame, bool hasNoInputSource)
+{
+    if (! mAcceptFrames.loadAcquire())
+        return;
+
+    CapturedFrame captured;
+    captured.frame = frame;
+    captured.hasNoInputSource = hasNoInputSource;
+    captured.arrivalTime = FramePacer::now();
+    mCpuStats.count(LatencyStats::EventCaptured);
+
+    frame->AddRef();
+    if (mCpuQueue.push(captured) && mWarpPending.testAndSetOrdered(0, 1))
+        QMetaObject::invokeMethod(this, "warpFrames", Qt::QueuedConnection);
+}
+
+void HeadlessCapture::warpFrames()
+{
+    // Frames queued from here on need another call
+    mWarpPending.storeRelease(0);
+
+    CapturedFrame captured;
+    while (mCpuQueue.pop(captured))
+    {
+        FrameTimes times;
+        times.arrivalTime = captured.arrivalTime;
+        times.dequeueTime = FramePacer::now();
+        mCpuStats.record(LatencyStats::StageQueue, times.dequeueTime - times.arrivalTime);
+
+        // Rows bottom-up like frames read back from OpenGL
+        WarpedFrame* frame = new WarpedFrame(mFrameWidth, mFrameHeight, times);
+        if (captured.hasNoInputSource)
+        {
+            memset(frame->bytes(), 0, (size_t)frame->rowBytes() * frame->height());
+        }
+        else
+        {
+            void* pixels;
+            captured.frame->GetBytes(&pixels);
+            mCpuWarper.warp((const unsigned char*)pixels, captured.frame->GetRowBytes(),
+                            frame->bytes() + (size_t)(mFrameHeight - 1) * frame->rowBytes(), -(int)frame->rowBytes());
+        }
+        captured.frame->Release();
+
+        BMDTimeValue warped = FramePacer::now();
+        mCpuStats.record(LatencyStats::StageWarp, warped - times.dequeueTime);
+        frame->setPublishTime(warped);
+
+        writeFrame(frame);
+        frame->Release();
+    }
+    mCpuStats.setCount(LatencyStats::EventQueueDropped, mCpuQueue.droppedCount());
+}
+
+void HeadlessCapture::stopCpuWarp()
+{
+    mAcceptFrames.storeRelease(0);
+
+    CapturedFrame captured;
+    while (mCpuQueue.pop(captured))
+        captured.frame->Release();
+}
+
+////////////////////////////////////////////
+// CpuCaptureDelegate
+////////////////////////////////////////////
+
+HRESULT CpuCaptureDelegate::VideoInputFrameArrived(IDeckLinkVideoInputFrame* inputFrame, IDeckLinkAudioInputPacket* /*audioPacket*/)
+{
+    // Audio-only packets come with a NULL frame
+    if (! inputFrame)
+        return S_OK;
+
+    if (mRecorder)
+        mRecorder->recordFrame(inputFrame);
+    mCapture->queueFrame(inputFrame, inputFrame->GetFlags() & bmdFrameHasNoInputSource);
+    return S_OK;
+}
+
+HRESULT CpuCaptureDelegate::VideoInputFormatChanged(BMDVideoInputFormatChangedEvents /*notificationEvents*/, IDeckLinkDisplayMode* /*newDisplayMode*/, BMDDetectedVideoInputFormatFlags /*detectedSignalFlags*/)
+{
+    fprintf(stderr, "VideoInputFormatChanged()\n");
+    return S_OK;
+}
@@ -0,0 +1,180 @@
+#ifndef HEADLESS_CAPTURE_H
+#define HEADLESS_CAPTURE_H
+
+#include "CpuWarper.h"
+#include "DeckLinkAPI.h"
+#include "FrameQueue.h"
+#include "FrameSource.h"
+#include "GLExtensions.h"
+#include "LatencyStats.h"
+#include "PipelineControl.h"
+#include "ReadbackRing.h"
+#include "UnpackBufferRing.h"
+#include "WarpRenderer.h"
+
+#include <QObject>
+#include <QMutex>
+#include <QAtomicInt>
+#include <QString>
+#include <vector>
+#include <string>
+
+class CaptureDelegate;
+class CaptureRecorder;
+class CpuCaptureDelegate;
+class FrameSink;
+class PinnedMemoryAllocator;
+class WarpedFrame;
+class RenderThread;
+class QOffscreenSurface;
+class QOpenGLContext;
+
+////////////////////////////////////////////
+// HeadlessCapture
+////////////////////////////////////////////
+
+// Runs the capture pipeline without a window, for render nodes and automated tests.  Frames are
+// uploaded and warped by the same RenderThread as in OpenGLCapture; instead of being blitted to the
+// screen, every new frame is read back from the render thread's colour target through a context on
+// an offscreen surface and handed to the configured FrameSinks.  Readbacks go through a
+// ReadbackRing, so a frame reaches the sinks once its copy has completed, a frame or two later,
+// without the presenting thread waiting for the GPU.  Frame pacing is off, since there is
+// no display to pace to, so every captured frame reaches the sinks.
+//
+// With setCpuWarp() no OpenGL context is created at all: frames are queued straight from the capture
+// callback and warped by a CpuWarper on this object's thread, for hosts with software-only OpenGL.
+//
+// Everything but the sinks' WriteFrame() runs on the thread that created the object.
+class HeadlessCapture : public QObject, public PipelineControl
+{
+    Q_OBJECT
+
+public:
+    HeadlessCapture(QObject* parent = NULL);
+    ~HeadlessCapture();
+
+    // Warp on the CPU with threads worker threads (0 for one per core) instead of OpenGL; before init()
+    void setCpuWarp(bool enable, int threads = 0);
+    bool cpuWarp() const { return mCpuWarp; }
+
+    // Create the offscreen context; must succeed before anything else is called
+    bool init(QString& error);
+
+    bool InitDeckLink(int device = DEFAULT_DEVICE, int mode = DEFAULT_MODE);
+    bool Start();
+    bool Stop();
+
+    // Same as the OpenGLCapture settings
+    void setFrameSource(FrameSource* source);
+    FrameSource* frameSource() { return mFrameSource; }
+    void setUploadRing(int depth, UnpackBufferRing::Mode mode);
+    void setFrameQueue(int depth, FrameQueue::Policy policy);
+    void setPacingLog(bool enable);
+    LatencyStats& latencyStats();
+
+    // PipelineControl; the mesh is not used by the CPU warp
+    virtual bool setMeshSize(int width, int height);
+    virtual int meshWidth() const;
+    virtual int meshHeight() const;
+    void setMeshLayout(WarpRenderer::MeshLayout layout);
+    // Fragment program of the GPU warp; the CPU warp has its own filter
+    void setWarpShader(WarpRenderer::WarpShader shader);
+    // PipelineControl: the render thread swaps the new mesh in between two frames, the CPU warp
+    // rebuilds its remap table between two frames on this thread
+    virtual bool setViewer(const std::string& id);
+    virtual bool setDevice(const std::string& id);
+    virtual void addViewer(const CardboardViewer& viewer);
+    virtual void addDevice(const Device& device);
+    virtual const DeviceInfo& profiles() const { return mDeviceInfo; }
+    void setMeshCacheDirectory(const QString& directory);
+    // Where linked shader programs are kept for the next start, empty for nowhere; takes effect on the next InitDeckLink()
+    void setShaderCacheDirectory(const QString& directory);
+    // YCbCr to RGB matrix of the captured video; takes effect on the next InitDeckLink()
+    void setColourMatrix(WarpRenderer::ColourMatrix matrix);
+    // How the mesh inverts the lens distortion; takes effect on the next InitDeckLink()
+    void setDistortionInverse(DeviceInfo::InverseMode mode);
+
+    // Pixel format of the frames handed to the sinks and pack buffers in flight; before InitDeckLink().
+    // The CPU warp always delivers RGBA.
+    void setReadback(WarpedFrame::Format format, int depth);
+
+    // Same as OpenGLCapture::setRecorder(), for both warps
+    void setRecorder(CaptureRecorder* recorder);
+
+    // Takes ownership of sink; sinks are opened by InitDeckLink()
+    void addSink(FrameSink* sink);
+
+    int getDeviceList(std::vector<std::string>& devices);
+    int getModeList(int device, std::vector<std::string>& modes);
+
+    // Capture thread, CPU warp only: hand a frame to warpFrames()
+    void queueFrame(IDeckLinkVideoInputFrame* frame, bool hasNoInputSource);
+
+private slots:
+    void presentFrame();
+    void pollReadbacks();
+    void warpFrames();
+
+private:
+    void applyProfile();
+    void collectReadbacks();
+    void writeFrame(WarpedFrame* frame);
+    void stopCpuWarp();
+
+    QOffscreenSurface*                      mSurface;
+    QOpenGLContext*                         mContext;
+    CaptureDelegate*                        mCaptureDelegate;
+    CaptureRecorder*                        mRecorder;
+    RenderThread*                           mRenderThread;
+    QMutex                                  mMutex;             // protect replacing the frame source
+    FrameSource*                            mFrameSource;
+    PinnedMemoryAllocator*                  mCaptureAllocator;
+    std::vector<FrameSink*>                 mSinks;
+    std::vector<bool>                       mSinkOpen;
+    unsigned                                mFrameWidth;
+    unsigned                                mFrameHeight;
+    ReadbackRing                            mReadback;          // reads the render thread's colour targets
+    WarpedFrame::Format                     mReadbackFormat;
+    int                                     mReadbackDepth;
+    WarpRenderer::ColourMatrix              mColourMatrix;
+    bool                                    mCollectPending;    // a pollReadbacks() call is queued
+
+    // CPU warp
+    bool                                    mCpuWarp;
+    CpuCaptureDelegate*                     mCpuCaptureDelegate;
+    CpuWarper                               mCpuWarper;
+    DeviceInfo                              mDeviceInfo;        // the profiles and the selected ones
+    FrameQueue                              mCpuQueue;
+    int                                     mQueueDepth;
+    FrameQueue::Policy                      mQueuePolicy;
+    LatencyStats                            mCpuStats;
+    QAtomicInt                              mWarpPending;       // a warpFrames() call is queued
+    QAtomicInt                              mAcceptFrames;
+};
+
+////////////////////////////////////////////
+// CpuCaptureDelegate
+////////////////////////////////////////////
+
+// Capture callback of the CPU warp, the counterpart of CaptureDelegate
+class CpuCaptureDelegate : public IDeckLinkInputCallback
+{
+public:
+    CpuCaptureDelegate(HeadlessCapture* capture) : mCapture(capture), mRecorder(NULL) { }
+
+    void setRecorder(CaptureRecorder* recorder) { mRecorder = recorder; }
+
+    // IUnknown needs only a dummy implementation
+    virtual HRESULT STDMETHODCALLTYPE   QueryInterface (REFIID /*iid*/, LPVOID* /*ppv*/)    {return E_NOINTERFACE;}
+    virtual ULONG   STDMETHODCALLTYPE   AddRef ()                                           {return 1;}
+    virtual ULONG   STDMETHODCALLTYPE   Release ()                                          {return 1;}
+
+    virtual HRESULT STDMETHODCALLTYPE   VideoInputFrameArrived(IDeckLinkVideoInputFrame *videoFrame, IDeckLinkAudioInputPacket *audioPacket);
+    virtual HRESULT STDMETHODCALLTYPE   VideoInputFormatChanged(BMDVideoInputFormatChangedEvents notificationEvents, IDeckLinkDisplayMode *newDisplayMode, BMDDetectedVideoInputFormatFlags detectedSignalFlags);
+
+private:
+    HeadlessCapture*                        mCapture;
+    CaptureRecorder*                        mRecorder;
+};
+
+#endif
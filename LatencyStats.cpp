@@ -0,0 +1,301 @@
+#include "LatencyStats.h"
+#include "FramePacer.h"
+
+#include <stdio.h>
+
+// Values below 2^41 ns (about 36 minutes); larger ones land in the last bucket
+#define HISTOGRAM_MAX_SHIFT     36
+#define HISTOGRAM_BUCKETS       ((HISTOGRAM_MAX_SHIFT + 2) * 16)
+
+////////////////////////////////////////////
+// LatencyHistogram
+////////////////////////////////////////////
+
+LatencyHistogram::LatencyHistogram() :
+    mBuckets(HISTOGRAM_BUCKETS, 0),
+    mCount(0),
+    mSum(0),
+    mMax(0)
+{
+}
+
+int LatencyHistogram::bucketFor(BMDTimeValue value)
+{
+    if (value < 16)
+        return value < 0 ? 0 : (int)value;
+
+    int msb = 63 - __builtin_clzll((unsigned long long)value);
+    int shift = msb - 4;
+    if (shift > HISTOGRAM_MAX_SHIFT)
+        return HISTOGRAM_BUCKETS - 1;
+
+    return (shift + 1) * 16 + (int)((value >> shift) - 16);
+}
+
+BMDTimeValue LatencyHistogram::bucketLimit(int bucket)
+{
+    if (bucket < 16)
+        return bucket;
+
+    int shift = bucket / 16 - 1;
+    BMDTimeValue lower = (BMDTimeValue)(16 + bucket % 16) << shift;
+    return lower + ((BMDTimeValue)1 << shift) - 1;
+}
+
+void LatencyHistogram::record(BMDTimeValue value)
+{
+    mBuckets[bucketFor(value)]++;
+    mCount++;
+    mSum += value;
+    if (value > mMax)
+        mMax = value;
+}
+
+void LatencyHistogram::reset()
+{
+    mBuckets.assign(HISTOGRAM_BUCKETS, 0);
+    mCount = 0;
+    mSum = 0;
+    mMax = 0;
+}
+
+void LatencyHistogram::merge(const LatencyHistogram& other)
+{
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++)
+        mBuckets[i] += other.mBuckets[i];
+    mCount += other.mCount;
+    mSum += other.mSum;
+    if (other.mMax > mMax)
+        mMax = other.mMax;
+}
+
+BMDTimeValue LatencyHistogram::percentile(double quantile) const
+{
+    if (mCount == 0)
+        return 0;
+
+    unsigned long long rank = (unsigned long long)(quantile * mCount + 0.5);
+    if (rank < 1)
+        rank = 1;
+
+    unsigned long long seen = 0;
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++)
+    {
+        seen += mBuckets[i];
+        if (seen >= rank)
+            return bucketLimit(i) < mMax ? bucketLimit(i) : mMax;
+    }
+    return mMax;
+}
+
+////////////////////////////////////////////
+// LatencyStats
+////////////////////////////////////////////
+
+LatencyStats::LatencyStats(int windowSeconds) :
+    mWindowLength((BMDTimeValue)windowSeconds * 1000000000LL)
+{
+    reset();
+}
+
+const char* LatencyStats::stageName(Stage stage)
+{
+    switch (stage)
+    {
+    case StageDelivery:     return "delivery";
+    case StageQueue:        return "queue";
+    case StageUpload:       return "upload";
+    case StageWarp:         return "warp";
+    case StageBlit:         return "blit";
+    case StageRender:       return "render";
+    case StagePresent:      return "present";
+    case StageTotal:        return "total";
+    case StageEncode:       return "encode";
+    default:                return "?";
+    }
+}
+
+const char* LatencyStats::eventName(Event event)
+{
+    switch (event)
+    {
+    case EventCaptured:     return "captured";
+    case EventQueueDropped: return "queue_dropped";
+    case EventSuperseded:   return "superseded";
+    case EventLate:         return "late";
+    case EventPresented:    return "presented";
+    case EventEncodeDropped: return "encode_dropped";
+    default:                return "?";
+    }
+}
+
+void LatencyStats::reset()
+{
+    QMutexLocker locker(&mMutex);
+
+    for (int i = 0; i < StageCount; i++)
+    {
+        mTotal[i].reset();
+        mCurrent[i].reset();
+        mWindow[i].reset();
+    }
+    for (int i = 0; i < EventCount; i++)
+        mEvents[i].storeRelease(0);
+
+    mStartTime = FramePacer::now();
+    mWindowStart = mStartTime;
+}
+
+// Called with mMutex held
+void LatencyStats::rotate(BMDTimeValue now)
+{
+    if (now - mWindowStart < mWindowLength)
+        return;
+
+    // After an idle gap longer than a window the last completed window is empty
+    bool idle = now - mWindowStart >= 2 * mWindowLength;
+    for (int i = 0; i < StageCount; i++)
+    {
+        mWindow[i].reset();
+        if (! idle)
+            mWindow[i].merge(mCurrent[i]);
+        mCurrent[i].reset();
+    }
+    mWindowStart = now - (now - mWindowStart) % mWindowLength;
+}
+
+void LatencyStats::record(Stage stage, BMDTimeValue duration)
+{
+    QMutexLocker locker(&mMutex);
+
+    rotate(FramePacer::now());
+    mTotal[stage].record(duration);
+    mCurrent[stage].record(duration);
+}
+
+// The counters are atomic and never take the mutex: the capture callback counts every frame and
+// must not wait while a reader formats the statistics
+void LatencyStats::count(Event event, unsigned long long n)
+{
+    mEvents[event].fetchAndAddRelaxed(n);
+}
+
+void LatencyStats::setCount(Event event, unsigned long long value)
+{
+    mEvents[event].storeRelease(value);
+}
+
+LatencyHistogram LatencyStats::total(Stage stage)
+{
+    QMutexLocker locker(&mMutex);
+    return mTotal[stage];
+}
+
+LatencyHistogram LatencyStats::recent(Stage stage)
+{
+    QMutexLocker locker(&mMutex);
+
+    rotate(FramePacer::now());
+    LatencyHistogram histogram = mWindow[stage];
+    histogram.merge(mCurrent[stage]);
+    return histogram;
+}
+
+unsigned long long LatencyStats::eventCount(Event event)
+{
+    return mEvents[event].loadAcquire();
+}
+
+static void appendHistogramJson(std::string& out, const LatencyHistogram& histogram)
+{
+    char buffer[256];
+    snprintf(buffer, sizeof(buffer),
+             "{\"count\": %llu, \"mean_ms\": %.3f, \"p50_ms\": %.3f, \"p99_ms\": %.3f, \"max_ms\": %.3f}",
+             histogram.count(), histogram.mean() / 1e6, histogram.percentile(0.5) / 1e6,
+             histogram.percentile(0.99) / 1e6, histogram.max() / 1e6);
+    out += buffer;
+}
+
+std::string LatencyStats::toJson()
+{
+    QMutexLocker locker(&mMutex);
+
+    BMDTimeValue now = FramePacer::now();
+    rotate(now);
+
+    char buffer[256];
+    std::string out = "{\n";
+
+    snprintf(buffer, sizeof(buffer), "  \"uptime_s\": %.3f,\n  \"window_s\": %.0f,\n  \"events\": {",
+             (now - mStartTime) / 1e9, mWindowLength / 1e9);
+    out += buffer;
+    for (int i = 0; i < EventCount; i++)
+    {
+        snprintf(buffer, sizeof(buffer), "%s\"%s\": %llu", i ? ", " : "", eventName((Event)i), (unsigned long long)mEvents[i].loadAcquire());
+        out += buffer;
+    }
+    out += "},\n  \"stages\": {\n";
+
+    for (int i = 0; i < StageCount; i++)
+    {
+        snprintf(buffer, sizeof(buffer), "    \"%s\": {\"total\": ", stageName((Stage)i));
+        out += buffer;
+        appendHistogramJson(out, mTotal[i]);
+        out += ", \"window\": ";
+        appendHistogramJson(out, mWindow[i]);
+        out += i + 1 < StageCount ? "},\n" : "}\n";
+    }
+    out += "  }\n}\n";
+    return out;
+}
+
+std::string LatencyStats::toPrometheus()
+{
+    QMutexLocker locker(&mMutex);
+
+    rotate(FramePacer::now());
+
+    static const double quantiles[] = { 0.5, 0.99, 1.0 };
+    char buffer[256];
+    std::string out;
+
+    out += "# HELP cam2vr_frames_total Frames by what happened to them.\n";
+    out += "# TYPE cam2vr_frames_total counter\n";
+    for (int i = 0; i < EventCount; i++)
+    {
+        snprintf(buffer, sizeof(buffer), "cam2vr_frames_total{event=\"%s\"} %llu\n", eventName((Event)i), (unsigned long long)mEvents[i].loadAcquire());
+        out += buffer;
+    }
+
+    out += "# HELP cam2vr_stage_latency_seconds Latency of each pipeline stage since start.\n";
+    out += "# TYPE cam2vr_stage_latency_seconds summary\n";
+    for (int i = 0; i < StageCount; i++)
+    {
+        for (int q = 0; q < 3; q++)
+        {
+            snprintf(buffer, sizeof(buffer), "cam2vr_stage_latency_seconds{stage=\"%s\",quantile=\"%g\"} %.9f\n",
+                     stageName((Stage)i), quantiles[q], mTotal[i].percentile(quantiles[q]) / 1e9);
+            out += buffer;
+        }
+        snprintf(buffer, sizeof(buffer), "cam2vr_stage_latency_seconds_sum{stage=\"%s\"} %.9f\n"
+                                         "cam2vr_stage_latency_seconds_count{stage=\"%s\"} %llu\n",
+                 stageName((Stage)i), mTotal[i].mean() * mTotal[i].count() / 1e9,
+                 stageName((Stage)i), mTotal[i].count());
+        out += buffer;
+    }
+
+    snprintf(buffer, sizeof(buffer), "# HELP cam2vr_stage_latency_window_seconds Latency of each pipeline stage over the last %.0f s.\n",
+             mWindowLength / 1e9);
+    out += buffer;
+    out += "# TYPE cam2vr_stage_latency_window_seconds gauge\n";
+    for (int i = 0; i < StageCount; i++)
+    {
+        for (int q = 0; q < 3; q++)
+        {
+            snprintf(buffer, sizeof(buffer), "cam2vr_stage_latency_window_seconds{stage=\"%s\",quantile=\"%g\"} %.9f\n",
+                     stageName((Stage)i), quantiles[q], mWindow[i].percentile(quantiles[q]) / 1e9);
+            out += buffer;
+        }
+    }
+    return out;
+}
@@ -0,0 +1,120 @@
+#ifndef LATENCY_STATS_H
+#define LATENCY_STATS_H
+
+#include "DeckLinkAPI.h"
+
+#include <QAtomicInteger>
+#include <QMutex>
+#include <string>
+#include <vector>
+
+// Timestamps (CLOCK_MONOTONIC ns, capture clock for captureTime) carried with a frame through the pipeline
+struct FrameTimes
+{
+    FrameTimes() : captureTime(0), arrivalTime(0), dequeueTime(0), publishTime(0) {}
+
+    BMDTimeValue    captureTime;    // hardware reference timestamp
+    BMDTimeValue    arrivalTime;    // capture callback
+    BMDTimeValue    dequeueTime;    // taken off the queue by the render thread
+    BMDTimeValue    publishTime;    // rendered and handed to the presenter
+};
+
+////////////////////////////////////////////
+// LatencyHistogram
+////////////////////////////////////////////
+
+// Log-linear histogram of durations in ns: 16 buckets per power of two, so every bucket is
+// within about 6% of the values it holds, from 1 ns to over 15 minutes in ~600 counters.
+class LatencyHistogram
+{
+public:
+    LatencyHistogram();
+
+    void record(BMDTimeValue value);
+    void reset();
+    void merge(const LatencyHistogram& other);
+
+    unsigned long long count() const { return mCount; }
+    BMDTimeValue max() const { return mMax; }
+    double mean() const { return mCount ? (double)mSum / mCount : 0.0; }
+    // Upper bound of the bucket holding the given quantile (0..1), 0 when empty
+    BMDTimeValue percentile(double quantile) const;
+
+private:
+    static int bucketFor(BMDTimeValue value);
+    static BMDTimeValue bucketLimit(int bucket);
+
+    std::vector<unsigned long long>     mBuckets;
+    unsigned long long                  mCount;
+    BMDTimeValue                        mSum;
+    BMDTimeValue                        mMax;
+};
+
+////////////////////////////////////////////
+// LatencyStats
+////////////////////////////////////////////
+
+// Per-stage latency of the capture pipeline plus counts of what happened to frames.  Each stage
+// keeps a histogram since the last reset and one for the last completed window of WINDOW seconds,
+// which is what regressions should be alerted on.  All methods are thread safe; counting events
+// takes no lock, so the capture callback can count frames without waiting for a reader.
+class LatencyStats
+{
+public:
+    enum Stage {
+        StageDelivery,      // capture timestamp to callback, above the best delivery seen
+        StageQueue,         // callback to render thread
+        StageUpload,        // texture upload on the GPU
+        StageWarp,          // colour conversion and lens warp on the GPU
+        StageBlit,          // presenter's copy to the window on the GPU
+        StageRender,        // wall-clock time the render thread takes to issue upload and warp, driver
+                            // stalls included
+        StagePresent,       // handed to the presenter to buffer swap
+        StageTotal,         // callback to buffer swap
+        StageEncode,        // handed to an encoding sink to its packet muxed, headless only
+        StageCount
+    };
+
+    enum Event {
+        EventCaptured,      // frames received by the capture callback
+        EventQueueDropped,  // dropped because the render thread fell behind
+        EventSuperseded,    // skipped by the pacer, a newer frame was due at the same vsync
+        EventLate,          // rendered after its vsync
+        EventPresented,     // swapped to the screen
+        EventEncodeDropped, // dropped because an encoding sink's queue was full
+        EventCount
+    };
+
+    LatencyStats(int windowSeconds = 10);
+
+    void record(Stage stage, BMDTimeValue duration);
+    void count(Event event, unsigned long long n = 1);
+    void setCount(Event event, unsigned long long value);
+    void reset();
+
+    std::string toJson();
+    std::string toPrometheus();
+
+    // Everything since the last reset
+    LatencyHistogram total(Stage stage);
+    // For display: the last completed window together with the one being filled
+    LatencyHistogram recent(Stage stage);
+    unsigned long long eventCount(Event event);
+
+    static const char* stageName(Stage stage);
+    static const char* eventName(Event event);
+
+private:
+    void rotate(BMDTimeValue now);
+
+    QMutex                  mMutex;
+    LatencyHistogram        mTotal[StageCount];
+    LatencyHistogram        mCurrent[StageCount];   // window being filled
+    LatencyHistogram        mWindow[StageCount];    // last completed window
+    QAtomicInteger<quint64> mEvents[EventCount];     // outside mMutex
+    BMDTimeValue            mWindowLength;
+    BMDTimeValue            mWindowStart;
+    BMDTimeValue            mStartTime;
+};
+
+#endif
@@ -0,0 +1,176 @@
+#include "MeshCache.h"
+
+#include <QCryptographicHash>
+#include <QDir>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <stdio.h>
+#include <string.h>
+
+// Part of every key: bump whenever the mesh computation or the file format changes, so that meshes
+// of an older build are no longer found
+#define MESH_CACHE_VERSION  1
+
+static const char MESH_CACHE_MAGIC[8] = { 'c', 'a', 'm', '2', 'v', 'r', 'M', '\n' };
+
+namespace {
+
+// File header, followed by vertexBytes of vertex data and indexBytes of index data.  Written in the
+// host's byte order; the magic also tells a file of the other byte order apart.
+struct FileHeader {
+    char        magic[8];
+    quint32     version;
+    quint32     layout;
+    quint32     indexType;
+    quint32     vertexCount;
+    quint32     indexCount;
+    float       positionScale;
+    quint32     vertexBytes;
+    quint32     indexBytes;
+};
+
+void addFloats(QCryptographicHash& hash, const float* values, int count)
+{
+    hash.addData((const char*)values, count * sizeof(float));
+}
+
+void addInt(QCryptographicHash& hash, qint32 value)
+{
+    hash.addData((const char*)&value, sizeof(value));
+}
+
+} // namespace
+
+MeshCache::MeshCache() :
+    mMapping(NULL)
+{
+}
+
+MeshCache::~MeshCache()
+{
+    unload();
+}
+
+QString MeshCache::defaultDirectory()
+{
+    QString location = QStandardPaths::writableLocation(QStandardPaths::CacheLocation);
+    if (location.isEmpty())
+        return QString();
+    return location + "/meshes";
+}
+
+QByteArray MeshCache::key(DeviceInfo& deviceInfo, int layout, int width, int height)
+{
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+
+    addInt(hash, MESH_CACHE_VERSION);
+    addInt(hash, layout);
+    addInt(hash, width);
+    addInt(hash, height);
+    addInt(hash, deviceInfo.getInverseMode());
+
+    // The lens, not the viewer's name: renaming a viewer keeps its meshes
+    CardboardViewer viewer = deviceInfo.getViewer();
+    addFloats(hash, &viewer.fov, 1);
+    addFloats(hash, &viewer.interLensDistance, 1);
+    addFloats(hash, &viewer.baselineLensDistance, 1);
+    addFloats(hash, &viewer.screenLensDistance, 1);
+    addFloats(hash, viewer.distortionCoefficients, 2);
+    addFloats(hash, viewer.inverseCoefficients, 12);
+
+    Device device = deviceInfo.getDevice();
+    float screen[5] = { device.widthMeters, device.heightMeters, device.bevelMeters,
+                        deviceInfo.getWidth(), deviceInfo.getHeight() };
+    addFloats(hash, screen, 5);
+
+    return hash.result().toHex();
+}
+
+QString MeshCache::filePath(const QByteArray& key) const
+{
+    return mDirectory + "/" + QString::fromLatin1(key) + ".mesh";
+}
+
+bool MeshCache::load(const QByteArray& key, Mesh& mesh)
+{
+    unload();
+    if (! isEnabled())
+        return false;
+
+    mFile.setFileName(filePath(key));
+    if (! mFile.open(QIODevice::ReadOnly))
+        return false;
+
+    qint64 size = mFile.size();
+    if (size >= (qint64)sizeof(FileHeader))
+        mMapping = mFile.map(0, size);
+    if (! mMapping)
+    {
+        unload();
+        return false;
+    }
+
+    FileHeader header;
+    memcpy(&header, mMapping, sizeof(header));
+    if (memcmp(header.magic, MESH_CACHE_MAGIC, sizeof(header.magic)) != 0
+        || header.version != MESH_CACHE_VERSION
+        || (qint64)sizeof(FileHeader) + header.vertexBytes + header.indexBytes != size)
+    {
+        fprintf(stderr, "Ignoring invalid mesh cache file %s\n", qPrintable(mFile.fileName()));
+        unload();
+        return false;
+    }
+
+    mesh.layout = header.layout;
+    mesh.indexType = header.indexType;
+    mesh.vertexCount = header.vertexCount;
+    mesh.indexCount = header.indexCount;
+    mesh.positionScale = header.positionScale;
+    mesh.vertices = mMapping + sizeof(FileHeader);
+    mesh.vertexBytes = header.vertexBytes;
+    mesh.indices = mMapping + sizeof(FileHeader) + header.vertexBytes;
+    mesh.indexBytes = header.indexBytes;
+    return true;
+}
+
+void MeshCache::unload()
+{
+    if (mMapping)
+        mFile.unmap(mMapping);
+    mMapping = NULL;
+    mFile.close();
+}
+
+void MeshCache::store(const QByteArray& key, const Mesh& mesh)
+{
+    if (! isEnabled())
+        return;
+
+    if (! QDir().mkpath(mDirectory))
+    {
+        fprintf(stderr, "Cannot create the mesh cache directory %s\n", qPrintable(mDirectory));
+        return;
+    }
+
+    FileHeader header;
+    memcpy(header.magic, MESH_CACHE_MAGIC, sizeof(header.magic));
+    header.version = MESH_CACHE_VERSION;
+    header.layout = mesh.layout;
+    header.indexType = mesh.indexType;
+    header.vertexCount = mesh.vertexCount;
+    header.indexCount = mesh.indexCount;
+    header.positionScale = mesh.positionScale;
+    header.vertexBytes = mesh.vertexBytes;
+    header.indexBytes = mesh.indexBytes;
+
+    // Readers never see a partly written file: it only replaces the entry on commit()
+    QSaveFile file(filePath(key));
+    if (! file.open(QIODevice::WriteOnly)
+        || file.write((const char*)&header, sizeof(header)) != (qint64)sizeof(header)
+        || file.write((const char*)mesh.vertices, mesh.vertexBytes) != (qint64)mesh.vertexBytes
+        || file.write((const char*)mesh.indices, mesh.indexBytes) != (qint64)mesh.indexBytes
+        || ! file.commit())
+    {
+        fprintf(stderr, "Cannot write the mesh cache file %s: %s\n", qPrintable(file.fileName()), qPrintable(file.errorString()));
+    }
+}
@@ -0,0 +1,73 @@
+#ifndef MESH_CACHE_H
+#define MESH_CACHE_H
+
+#include "DeviceInfo.h"
+
+#include <QByteArray>
+#include <QFile>
+#include <QString>
+
+using namespace cam2vr;
+
+////////////////////////////////////////////
+// MeshCache
+////////////////////////////////////////////
+
+// Distortion meshes on disk, so starting up or switching viewers does not solve distortInverse() for
+// every vertex again.  A mesh is stored exactly as it is uploaded (vertex data, then index data) in a
+// file named after the hash of everything it is computed from: the viewer's lens parameters, the
+// device's screen, the inverse mode, the mesh size and layout.  Entries are never stale, a changed
+// parameter simply addresses another file.  Loading maps the file, so the buffers are filled straight
+// from the page cache.
+//
+// Not thread safe; WarpRenderer uses it on the render thread only.
+class MeshCache
+{
+public:
+    // A mesh ready for glBufferData(); the pointers are into the mapped file after load()
+    struct Mesh {
+        Mesh() : layout(0), indexType(0), vertexCount(0), indexCount(0), positionScale(1.0f),
+                 vertices(NULL), vertexBytes(0), indices(NULL), indexBytes(0) {}
+
+        quint32         layout;         // WarpRenderer::MeshLayout
+        quint32         indexType;      // GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
+        quint32         vertexCount;
+        quint32         indexCount;
+        float           positionScale;
+        const void*     vertices;
+        quint32         vertexBytes;
+        const void*     indices;
+        quint32         indexBytes;
+    };
+
+    MeshCache();
+    ~MeshCache();
+
+    // Directory of the cache files, created when the first mesh is stored; empty disables the cache
+    void setDirectory(const QString& directory) { mDirectory = directory; }
+    const QString& directory() const { return mDirectory; }
+    bool isEnabled() const { return ! mDirectory.isEmpty(); }
+
+    // The per-user cache location of the application
+    static QString defaultDirectory();
+
+    // Content address of the mesh of the given size and layout for deviceInfo's viewer and device
+    static QByteArray key(DeviceInfo& deviceInfo, int layout, int width, int height);
+
+    // Map the mesh stored under key.  False when there is none or it is unusable; otherwise mesh
+    // points into the mapping, which stays valid until unload() or the next load().
+    bool load(const QByteArray& key, Mesh& mesh);
+    void unload();
+
+    // Write mesh under key, replacing the file atomically.  Failures are reported and ignored.
+    void store(const QByteArray& key, const Mesh& mesh);
+
+private:
+    QString filePath(const QByteArray& key) const;
+
+    QString     mDirectory;
+    QFile       mFile;          // the mapped entry
+    uchar*      mMapping;
+};
+
+#endif
@@ -26,955 +26,397 @@
  */
 
 #include "OpenGLCapture.h"
+#include "CaptureRecorder.h"
 #include "GLExtensions.h"
+#include "RenderThread.h"
 #include <GL/glu.h>
 #include <QtOpenGL/QGLWidget>
+#include <QOpenGLContext>
+#include <QGuiApplication>
+#include <QScreen>
+#include <QFont>
+#include <algorithm>
+#include <stdio.h>
 #include <string>
-#include <sstream>
-
-#include <sys/time.h>
-#include <iostream>
-
-namespace patch
-{
-    template < typename T > std::string to_string( const T& n )
-    {
-        std::ostringstream stm ;
-        stm << n ;
-        return stm.str() ;
-    }
-}
-
-#define DROP_THRESHOLD 0.95
 
 OpenGLCapture::OpenGLCapture(QWidget *parent) :
 	QGLWidget(parent), mParent(parent),
     mCaptureDelegate(NULL),
-    mDLInput(NULL),
+    mRecorder(NULL),
+    mRenderThread(NULL),
+    mFrameSource(new DeckLinkFrameSource()),
     mCaptureAllocator(NULL),
 	mFrameWidth(0), mFrameHeight(0),
-	mHasNoInputSource(true),
-	mPinnedMemoryExtensionAvailable(false),
-	mTexture(0),
-    mFrameCount(0),
-    //VR
-    m_meshWidth(20), m_meshHeight(20), m_bufferScale(0.5)
+	mIdReadFrameBuf(0),
+	mShowOverlay(false),
+	mViewWidth(0), mViewHeight(0)
 {
 	ResolveGLExtensions(context());
+	setAutoBufferSwap(false);
 
 	// Register non-builtin types for connecting signals and slots using these types
 	qRegisterMetaType<IDeckLinkVideoInputFrame*>("IDeckLinkVideoInputFrame*");
 	qRegisterMetaType<IDeckLinkVideoFrame*>("IDeckLinkVideoFrame*");
 	qRegisterMetaType<BMDOutputFrameCompletionResult>("BMDOutputFrameCompletionResult");
 
-    //VR
-    m_deviceInfo = new DeviceInfo();
-    setTextureBounds();
-    computeMeshVertices(m_meshWidth, m_meshHeight);
-    computeMeshIndices(m_meshWidth, m_meshHeight);
-}
+	mRenderThread = new RenderThread();
 
-OpenGLCapture::~OpenGLCapture()
-{
-	if (mDLInput != NULL)
-	{
-		// Cleanup for Capture
-		mDLInput->SetCallback(NULL);
+	// The render thread only asks for a repaint, painting itself stays on the GUI thread
+	connect(mRenderThread, SIGNAL(frameRendered()), this, SLOT(update()), Qt::QueuedConnection);
 
-		mDLInput->Release();
-		mDLInput = NULL;
-	}
+	// Capture will use a user-supplied frame memory allocator, sized for the mode in InitDeckLink()
+	mCaptureAllocator = new PinnedMemoryAllocator("Capture", 2);
 
-	delete mCaptureDelegate;
-	delete mCaptureAllocator;
+	mCaptureDelegate = new CaptureDelegate(mRenderThread);
 }
 
-int OpenGLCapture::getDeviceList(std::vector<std::string>& devices)
+OpenGLCapture::~OpenGLCapture()
 {
-    devices.clear();
-
-    HRESULT result = E_FAIL;
-    IDeckLinkIterator* deckLinkIterator = CreateDeckLinkIteratorInstance();
+	mFrameSource->Stop();
+	mRenderThread->stopRendering();
 
-    IDeckLink* deckLink = NULL;
-    char* deckLinkName = NULL;
-
-    // Loop through all available devices
-    while (deckLinkIterator->Next(&deckLink) == S_OK)
-    {
-        result = deckLink->GetModelName((const char**)&deckLinkName);
-        if (result == S_OK)
-        {
-            devices.push_back(deckLinkName);
-            //fprintf(stderr, "        %2d: %s%s\n", deckLinkCount, deckLinkName, deckLinkCount == m_deckLinkIndex ? " (selected)" : "");
-            free(deckLinkName);
-        }
-        deckLink->Release();
-    }
+	delete mFrameSource;
+	delete mCaptureDelegate;
+	delete mRecorder;
+	delete mRenderThread;
 
-    if (deckLinkIterator != NULL)
-        deckLinkIterator->Release();
+	// Cached buffers may still be pinned; our context shares their buffer objects
+	makeCurrent();
+	mCaptureAllocator->Decommit();
+	mCaptureAllocator->releaseUnpinnedBuffers();
+	mCaptureAllocator->Release();
 
-    return 0;
+	if (mIdReadFrameBuf)
+		glDeleteFramebuffersEXT(1, &mIdReadFrameBuf);
+	mPresentTimer.cleanup();
 }
 
- IDeckLink* OpenGLCapture::getDeckLink(int idx)
- {
-     HRESULT			result;
-     IDeckLink*			deckLink;
-     IDeckLinkIterator*	deckLinkIterator = CreateDeckLinkIteratorInstance();
-     int				i = idx;
-
-     while((result = deckLinkIterator->Next(&deckLink)) == S_OK)
-     {
-         if (i == 0)
-             break;
-         --i;
-
-         deckLink->Release();
-     }
-
-     deckLinkIterator->Release();
-
-     if (result != S_OK)
-         return NULL;
-
-     return deckLink;
+int OpenGLCapture::getDeviceList(std::vector<std::string>& devices)
+{
+    return mFrameSource->getDeviceList(devices);
 }
 
- IDeckLinkDisplayMode* OpenGLCapture::getDeckLinkDisplayMode(IDeckLink* deckLink, int idx)
- {
-     HRESULT						result;
-     IDeckLinkDisplayMode*			displayMode = NULL;
-     IDeckLinkInput*				deckLinkInput = NULL;
-     IDeckLinkDisplayModeIterator*	displayModeIterator = NULL;
-     int							i = idx;
-
-     result = deckLink->QueryInterface(IID_IDeckLinkInput, (void**)&deckLinkInput);
-     if (result != S_OK)
-         goto bail;
-
-     result = deckLinkInput->GetDisplayModeIterator(&displayModeIterator);
-     if (result != S_OK)
-         goto bail;
-
-     while ((result = displayModeIterator->Next(&displayMode)) == S_OK)
-     {
-         if (i == 0)
-             break;
-         --i;
-
-         displayMode->Release();
-     }
-
-     if (result != S_OK)
-         goto bail;
-
- bail:
-     if (displayModeIterator)
-         displayModeIterator->Release();
-
-     if (deckLinkInput)
-         deckLinkInput->Release();
-
-     return displayMode;
- }
-
 int OpenGLCapture::getModeList(int device, std::vector<std::string>& modes)
 {
-    HRESULT result =                E_FAIL;
-    IDeckLinkDisplayModeIterator*	displayModeIterator = NULL;
-    IDeckLinkAttributes*			deckLinkAttributes = NULL;
-    bool							formatDetectionSupported;
-    IDeckLinkInput*					deckLinkInput = NULL;
-    IDeckLinkDisplayMode*			displayModeUsage;
-    int								displayModeCount = 0;
-    char*							displayModeName;
-
-    IDeckLink* deckLinkSelected = getDeckLink(device);
-
-    if(!deckLinkSelected)
-        return 1;
-
-    modes.clear();
-
-    result = deckLinkSelected->QueryInterface(IID_IDeckLinkAttributes, (void**)&deckLinkAttributes);
-    if (result == S_OK)
-    {
-        result = deckLinkAttributes->GetFlag(BMDDeckLinkSupportsInputFormatDetection, &formatDetectionSupported);
-        if (result == S_OK && formatDetectionSupported)
-            fprintf(stderr, "        -1:  auto detect format\n");
-    }
-
-    result = deckLinkSelected->QueryInterface(IID_IDeckLinkInput, (void**)&deckLinkInput);
-    if (result != S_OK)
-        goto bail;
-
-    result = deckLinkInput->GetDisplayModeIterator(&displayModeIterator);
-    if (result != S_OK)
-        goto bail;
+    return mFrameSource->getModeList(device, modes);
+}
 
-    while (displayModeIterator->Next(&displayModeUsage) == S_OK)
+void OpenGLCapture::setFrameSource(FrameSource* source)
+{
+    mMutex.lock();
+    if (mFrameSource)
     {
-        result = displayModeUsage->GetName((const char **)&displayModeName);
-        if (result == S_OK)
-        {
-            BMDTimeValue frameRateDuration;
-            BMDTimeValue frameRateScale;
-
-            displayModeUsage->GetFrameRate(&frameRateDuration, &frameRateScale);
-            string tmp = displayModeName;
-            tmp.append(" ");
-            tmp.append(patch::to_string(displayModeUsage->GetWidth()));
-            tmp.append("x");
-            tmp.append(patch::to_string(displayModeUsage->GetHeight()));
-            double fps = (double)frameRateScale / (double)frameRateDuration;
-            tmp.append(" ");
-            tmp.append(patch::to_string(fps));
-            tmp.append("fps");
-            modes.push_back(tmp);
-
-            free(displayModeName);
-        }
-
-        displayModeUsage->Release();
-        ++displayModeCount;
+        mFrameSource->Stop();
+        delete mFrameSource;
     }
-
-    return 0;
-
-    bail:
-        if (displayModeIterator != NULL)
-            displayModeIterator->Release();
-
-        if (deckLinkInput != NULL)
-            deckLinkInput->Release();
-
-        if (deckLinkAttributes != NULL)
-            deckLinkAttributes->Release();
-
-        if (deckLinkSelected != NULL)
-            deckLinkSelected->Release();
-
-        return 1;
+    mFrameSource = source;
+    mMutex.unlock();
 }
 
-bool OpenGLCapture::InitDeckLink(int device, int mode)
+void OpenGLCapture::setUploadRing(int depth, UnpackBufferRing::Mode mode)
 {
-	bool							bSuccess = false;
-	IDeckLinkIterator*				pDLIterator = NULL;
-	IDeckLink*						pDL = NULL;
-    IDeckLinkDisplayModeIterator*	pDLDisplayModeIterator = NULL;
-    IDeckLinkDisplayMode*			pDLDisplayMode = NULL;
-    BMDDisplayMode					displayMode = bmdModeHD1080i6000; //bmdModeHD1080i5994; //bmdModeHD1080p30; //bmdModeHD1080i6000;
-	float							fps;
-
-	pDLIterator = CreateDeckLinkIteratorInstance();
-	if (pDLIterator == NULL)
-	{
-		QMessageBox::critical(NULL, "This application requires the DeckLink drivers installed.", "Please install the Blackmagic DeckLink drivers to use the features of this application.");
-		return false;
-	}
-
-    pDL = getDeckLink(device);
-
-    if(mDLInput) {
-        mDLInput->StopStreams();
-        mDLInput->DisableVideoInput();
-        mDLInput->Release();
-        mDLInput = NULL;
-    }
-
-    pDL->QueryInterface(IID_IDeckLinkInput, (void**)&mDLInput);
-    if (! mDLInput)
-	{
-        QMessageBox::critical(NULL, "Expected Input DeckLink devices", "This application requires DeckLink device.");
-		goto error;
-	}
+    mRenderThread->setUploadRing(depth, mode);
+}
 
-    if (mDLInput->GetDisplayModeIterator(&pDLDisplayModeIterator) != S_OK)
-    {
-        QMessageBox::critical(NULL, "Cannot get Display Mode Iterator.", "DeckLink error.");
-        goto error;
-    }
+void OpenGLCapture::setFrameQueue(int depth, FrameQueue::Policy policy)
+{
+    mRenderThread->setFrameQueue(depth, policy);
+}
 
-    pDLDisplayMode = getDeckLinkDisplayMode(pDL, mode);
-    if (pDLDisplayMode == NULL)
-    {
-        QMessageBox::critical(NULL, "Cannot get specified BMDDisplayMode.", "DeckLink error.");
-        goto error;
-    }
+bool OpenGLCapture::setMeshSize(int width, int height)
+{
+    return mRenderThread->setMeshSize(width, height);
+}
 
-    displayMode = pDLDisplayMode->GetDisplayMode();
+int OpenGLCapture::meshWidth() const
+{
+    return mRenderThread->meshWidth();
+}
 
-	mFrameWidth = pDLDisplayMode->GetWidth();
-	mFrameHeight = pDLDisplayMode->GetHeight();
+int OpenGLCapture::meshHeight() const
+{
+    return mRenderThread->meshHeight();
+}
 
-	// Compute a rotate angle rate so box will spin at a rate independent of video mode frame rate
-	pDLDisplayMode->GetFrameRate(&mFrameDuration, &mFrameTimescale);
-	fps = (float)mFrameTimescale / (float)mFrameDuration;
-    //mRotateAngleRate = 35.0f / fps;			// rotate box through 35 degrees every second
+void OpenGLCapture::setMeshLayout(WarpRenderer::MeshLayout layout)
+{
+    mRenderThread->setMeshLayout(layout);
+}
 
-	// resize window to match video frame, but scale large formats down by half for viewing
-	if (mFrameWidth < 1920)
-		mParent->resize(mFrameWidth, mFrameHeight);
-	else
-		mParent->resize(mFrameWidth / 2, mFrameHeight / 2);
+void OpenGLCapture::setWarpShader(WarpRenderer::WarpShader shader)
+{
+    mRenderThread->setWarpShader(shader);
+}
 
-	// Check required extensions and setup OpenGL state
-    if (! InitOpenGLState())
-		goto error;
+WarpRenderer::WarpShader OpenGLCapture::drawShader() const
+{
+    return mRenderThread->drawShader();
+}
 
-	// Capture will use a user-supplied frame memory allocator
-	// For large frames use a reduced allocator frame cache size to avoid out-of-memory
-	mCaptureAllocator = new PinnedMemoryAllocator(this, "Capture", mFrameWidth < 1920 ? 2 : 1);
+bool OpenGLCapture::setViewer(const std::string& id)
+{
+    const CardboardViewer* viewer = mDeviceInfo.findViewer(id);
+    if (! viewer)
+        return false;
 
-	if (mDLInput->SetVideoInputFrameMemoryAllocator(mCaptureAllocator) != S_OK)
-		goto error;
+    mDeviceInfo.setViewer(*viewer);
+    mRenderThread->setProfile(mDeviceInfo.getViewer(), mDeviceInfo.getDevice());
+    return true;
+}
 
-	if (mDLInput->EnableVideoInput(displayMode, bmdFormat8BitYUV, bmdVideoInputFlagDefault) != S_OK)
-		goto error;
+bool OpenGLCapture::setDevice(const std::string& id)
+{
+    const Device* device = mDeviceInfo.findDevice(id);
+    if (! device)
+        return false;
 
-	mCaptureDelegate = new CaptureDelegate();
-	if (mDLInput->SetCallback(mCaptureDelegate) != S_OK)
-		goto error;
+    mDeviceInfo.setDevice(*device);
+    mRenderThread->setProfile(mDeviceInfo.getViewer(), mDeviceInfo.getDevice());
+    return true;
+}
 
-	// Use signals and slots to ensure OpenGL rendering is performed on the main thread
-	connect(mCaptureDelegate, SIGNAL(captureFrameArrived(IDeckLinkVideoInputFrame*, bool)), this, SLOT(VideoFrameArrived(IDeckLinkVideoInputFrame*, bool)), Qt::QueuedConnection);
+void OpenGLCapture::addViewer(const CardboardViewer& viewer)
+{
+    mDeviceInfo.addViewer(viewer);
+    // A selected profile that is redefined is applied again
+    if (viewer.id == mDeviceInfo.getViewer().id)
+        setViewer(viewer.id);
+}
 
-	bSuccess = true;
+void OpenGLCapture::addDevice(const Device& device)
+{
+    mDeviceInfo.addDevice(device);
+    if (device.id == mDeviceInfo.getDevice().id)
+        setDevice(device.id);
+}
 
-error:
-	if (!bSuccess)
-	{
-		if (mDLInput != NULL)
-		{
-			mDLInput->Release();
-			mDLInput = NULL;
-		}
-    }
+void OpenGLCapture::setMeshCacheDirectory(const QString& directory)
+{
+    mRenderThread->setMeshCacheDirectory(directory);
+}
 
-	if (pDL != NULL)
-	{
-		pDL->Release();
-		pDL = NULL;
-	}
+void OpenGLCapture::setShaderCacheDirectory(const QString& directory)
+{
+    mRenderThread->setShaderCacheDirectory(directory);
+}
 
-	if (pDLIterator != NULL)
-	{
-		pDLIterator->Release();
-		pDLIterator = NULL;
-	}
+void OpenGLCapture::setColourMatrix(WarpRenderer::ColourMatrix matrix)
+{
+    mRenderThread->setColourMatrix(matrix);
+}
 
-	return bSuccess;
+void OpenGLCapture::setDistortionInverse(DeviceInfo::InverseMode mode)
+{
+    mDeviceInfo.setInverseMode(mode);
+    mRenderThread->setDistortionInverse(mode);
 }
 
-//
-// QGLWidget virtual methods
-//
-void OpenGLCapture::initializeGL ()
+void OpenGLCapture::setRecorder(CaptureRecorder* recorder)
 {
-	// Initialization is deferred to InitOpenGLState() when the width and height of the DeckLink video frame are known
+    mFrameSource->Stop();
+    delete mRecorder;
+    mRecorder = recorder;
+    mCaptureDelegate->setRecorder(recorder);
 }
 
-void OpenGLCapture::paintGL ()
+void OpenGLCapture::setPacingLog(bool enable)
 {
-	// The DeckLink API provides IDeckLinkGLScreenPreviewHelper as a convenient way to view the playout video frames
-	// in a window.  However, it performs a copy from host memory to the GPU which is wasteful in this case since
-	// we already have the rendered frame to be played out sitting in the GPU in the mIdFrameBuf frame buffer.
+    mRenderThread->framePacer().setVerbose(enable);
+}
 
-	// Simply copy the off-screen frame buffer to on-screen frame buffer, scaling to the viewing window size.
-	glBindFramebufferEXT(GL_READ_FRAMEBUFFER, mIdFrameBuf);
-	glBindFramebufferEXT(GL_DRAW_FRAMEBUFFER, 0);
-	glViewport(0, 0, mViewWidth, mViewHeight);
-	glBlitFramebufferEXT(0, 0, mFrameWidth, mFrameHeight, 0, 0, mViewWidth, mViewHeight, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+void OpenGLCapture::setPacing(bool enable)
+{
+    mRenderThread->framePacer().setEnabled(enable);
 }
 
-void OpenGLCapture::resizeGL (int width, int height)
+LatencyStats& OpenGLCapture::latencyStats()
 {
-	// We don't set the project or model matrices here since the window data is copied directly from
-	// an off-screen FBO in paintGL().  Just save the width and height for use in paintGL().
-	mViewWidth = width;
-	mViewHeight = height;
+    return mRenderThread->latencyStats();
 }
 
-bool OpenGLCapture::InitOpenGLState()
+bool OpenGLCapture::InitDeckLink(int device, int mode)
 {
-	makeCurrent();
+	// No capture callback may reach the render thread while it is restarted
+	mFrameSource->Stop();
+	mRenderThread->stopRendering();
 
-	if (! CheckOpenGLExtensions())
+	if (! mFrameSource->Open(device, mode))
 		return false;
 
-	// Prepare the shader used to perform colour space conversion on the video texture
-	char compilerErrorMessage[1024];
-	if (! compileFragmentShader(sizeof(compilerErrorMessage), compilerErrorMessage))
-	{
-		QMessageBox::critical(NULL, compilerErrorMessage, "OpenGL Shader failed to compile");
-		return false;
-	}
+	mFrameWidth = mFrameSource->getFrameWidth();
+	mFrameHeight = mFrameSource->getFrameHeight();
+	mFrameDuration = mFrameSource->getFrameDuration();
+	mFrameTimescale = mFrameSource->getFrameTimescale();
 
-	// Setup the scene
-	glShadeModel( GL_SMOOTH );					// Enable smooth shading
-	glClearColor( 0.0f, 0.0f, 0.0f, 0.5f );		// Black background
-	glClearDepth( 1.0f );						// Depth buffer setup
-	glEnable( GL_DEPTH_TEST );					// Enable depth testing
-	glDepthFunc( GL_LEQUAL );					// Type of depth test to do
-	glHint( GL_PERSPECTIVE_CORRECTION_HINT, GL_NICEST );
+	// resize window to match video frame, but scale large formats down by half for viewing
+	QWidget* window = mParent ? mParent : this;
+	if (mFrameWidth < 1920)
+		window->resize(mFrameWidth, mFrameHeight);
+	else
+		window->resize(mFrameWidth / 2, mFrameHeight / 2);
 
-	if (! mPinnedMemoryExtensionAvailable)
+	if (! isValid())
 	{
-		glGenBuffers(1, &mUnpinnedTextureBuffer);
+		QMessageBox::critical(NULL,"OpenGL initialization error.", "OpenGL context is not valid for specified QGLFormat.");
+		return false;
 	}
 
-	// Setup the texture which will hold the captured video frame pixels
-	glEnable(GL_TEXTURE_2D);
-	glGenTextures(1, &mTexture);
-	glBindTexture(GL_TEXTURE_2D, mTexture);
-
-	// Parameters to control how texels are sampled from the texture
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP);
-
-	// Create texture with empty data, we will update it using glTexSubImage2D each frame.
-	// The captured video is YCbCr 4:2:2 packed into a UYVY macropixel.  OpenGL has no YCbCr format
-	// so treat it as RGBA 4:4:4:4 by halving the width and using GL_RGBA internal format.
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, mFrameWidth/2, mFrameHeight, 0, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, NULL);
+	// Until buffer swaps have been timed, pace against the refresh rate the screen reports
+	if (QGuiApplication::primaryScreen())
+		mRenderThread->framePacer().setNominalRefresh(QGuiApplication::primaryScreen()->refreshRate());
 
-	glBindTexture(GL_TEXTURE_2D, 0);
-	glDisable(GL_TEXTURE_2D);
-
-	// Create Frame Buffer Object (FBO) to perform off-screen rendering of scene.
-	// This allows the render to be done on a framebuffer with width and height exactly matching the video format.
-	glGenFramebuffersEXT(1, &mIdFrameBuf);
-	glGenRenderbuffersEXT(1, &mIdColorBuf);
-	glGenRenderbuffersEXT(1, &mIdDepthBuf);
-
-	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, mIdFrameBuf);
-
-	glBindRenderbufferEXT(GL_RENDERBUFFER_EXT, mIdColorBuf);
-	glRenderbufferStorageEXT(GL_RENDERBUFFER_EXT, GL_RGBA8, mFrameWidth, mFrameHeight);
-	glBindRenderbufferEXT(GL_RENDERBUFFER_EXT, mIdDepthBuf);
-	glRenderbufferStorageEXT(GL_RENDERBUFFER_EXT, GL_DEPTH_COMPONENT, mFrameWidth, mFrameHeight);
-
-	glFramebufferRenderbufferEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT, GL_RENDERBUFFER_EXT, mIdColorBuf);
-	glFramebufferRenderbufferEXT(GL_FRAMEBUFFER_EXT, GL_DEPTH_ATTACHMENT_EXT, GL_RENDERBUFFER_EXT, mIdDepthBuf);
+	// For large frames use a reduced allocator frame cache size to avoid out-of-memory
+	mCaptureAllocator->setCacheSize(mFrameWidth < 1920 ? 2 : 1);
 
-	GLenum glStatus = glCheckFramebufferStatusEXT(GL_FRAMEBUFFER_EXT);
-	if (glStatus != GL_FRAMEBUFFER_COMPLETE_EXT)
+	// Check required extensions and setup OpenGL state in the render thread's context
+	QString error;
+	if (! mRenderThread->startRendering(context()->contextHandle(), mFrameWidth, mFrameHeight, mFrameDuration, mFrameTimescale, mCaptureAllocator, error))
 	{
-		QMessageBox::critical(NULL, "Cannot initialize framebuffer.", "OpenGL initialization error.");
+		QMessageBox::critical(NULL, "OpenGL initialization error.", error);
 		return false;
 	}
 
-    // VR
-    if(m_vertices.size() < 1)
-    {
-        QMessageBox::critical(NULL, "No vertices", "OpenGL initialization error.");
-        return false;
-    }
-    // create vbo
-    glGenBuffers(1,&m_vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, m_vbo);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(float)*m_vertices.size(), &m_vertices[0], GL_STATIC_DRAW);
-
-    unsigned int val;
-    val = glGetAttribLocation(mProgram, "position");
-    glEnableVertexAttribArray(val);
-    glVertexAttribPointer( val,  2, GL_FLOAT, GL_FALSE, 5*sizeof(float), (void*)0);
-
-    val = glGetAttribLocation(mProgram, "texCoord");
-    glEnableVertexAttribArray(val);
-    glVertexAttribPointer( val,  3, GL_FLOAT, GL_FALSE, 5*sizeof(float), (void*)(2*sizeof(float)));
-
-    // create ibo
-    glGenBuffers(1,&m_ibo);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_ibo);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned int)*m_indices.size(), &m_indices[0], GL_STATIC_DRAW);
+	// A recording that cannot be written does not stop the capture
+	if (mRecorder && ! mRecorder->Open(mFrameWidth, mFrameHeight, mFrameDuration, mFrameTimescale))
+		fprintf(stderr, "Cannot record the captured frames\n");
 
+	if (! mFrameSource->EnableVideoInput(mCaptureAllocator, mCaptureDelegate))
+		return false;
 
 	return true;
 }
 
-//VR
-void OpenGLCapture::setTextureBounds()
+//
+// QGLWidget virtual methods
+//
+void OpenGLCapture::initializeGL ()
 {
-    float leftBounds[] = {0, 0, 0.5, 1};
-    float rightBounds[] = {0.5, 0, 0.5, 1};
-
-    // Left eye
-    m_viewportOffsetScale[0] = leftBounds[0]; // X
-    m_viewportOffsetScale[1] = leftBounds[1]; // Y
-    m_viewportOffsetScale[2] = leftBounds[2]; // Width
-    m_viewportOffsetScale[3] = leftBounds[3]; // Height
-
-    // Right eye
-    m_viewportOffsetScale[4] = rightBounds[0]; // X
-    m_viewportOffsetScale[5] = rightBounds[1]; // Y
-    m_viewportOffsetScale[6] = rightBounds[2]; // Width
-    m_viewportOffsetScale[7] = rightBounds[3]; // Height
-}
-
-float lerp(float a, float b, float t) {
-    return a + ((b - a) * t);
+	// Initialization is deferred to the render thread when the width and height of the DeckLink video frame are known
+	mPresentTimer.init();
 }
 
-void OpenGLCapture::computeMeshVertices(int width, int height)
+void OpenGLCapture::paintGL ()
 {
-    m_vertices.resize(2 * width * height * 5);
-
-    float lensFrustum[4];
-    m_deviceInfo->getLeftEyeVisibleTanAngles(lensFrustum);
-
-    float noLensFrustum[4];
-    m_deviceInfo->getLeftEyeNoLensTanAngles(noLensFrustum);
-
-    float viewport[4];
-    m_deviceInfo->getLeftEyeVisibleScreenRect(noLensFrustum, viewport);
-    //viewport[4]: x, y, width, height
-
-    float vidx = 0;
-    float iidx = 0;
-    for (int e = 0; e < 2; e++) {
-        for (int j = 0; j < height; j++) {
-            for (int i = 0; i < width; i++, vidx++) {
-                float u = 1.0 * i / (width - 1);
-                float v = 1.0 * j / (height - 1);
-
-                // Grid points regularly spaced in StreoScreen, and barrel distorted in
-                // the mesh.
-                float s = u;
-                float t = v;
-                float x = lerp(lensFrustum[0], lensFrustum[2], u);
-                float y = lerp(lensFrustum[3], lensFrustum[1], v);
-                float d = sqrt(x * x + y * y);
-                float r = m_deviceInfo->distortInverse(d);
-                float p = x * r / d;
-                float q = y * r / d;
-                u = (p - noLensFrustum[0]) / (noLensFrustum[2] - noLensFrustum[0]);
-                v = (q - noLensFrustum[3]) / (noLensFrustum[1] - noLensFrustum[3]);
-
-                // Convert u,v to mesh screen coordinates.
-                float aspect = m_deviceInfo->getDevice().widthMeters / m_deviceInfo->getDevice().heightMeters;
-
-                // FIXME: The original Unity plugin multiplied U by the aspect ratio
-                // and didn't multiply either value by 2, but that seems to get it
-                // really close to correct looking for me. I hate this kind of "Don't
-                // know why it works" code though, and wold love a more logical
-                // explanation of what needs to happen here.
-                u = (viewport[0] + u * viewport[2] - 0.5) * 2.0; // * aspect;
-                v = (viewport[1] + v * viewport[3] - 0.5) * 2.0;
-
-                m_vertices[(vidx * 5) + 0] = u; // position.x
-                m_vertices[(vidx * 5) + 1] = v; // position.y
-                m_vertices[(vidx * 5) + 2] = s; // texCoord.x
-                m_vertices[(vidx * 5) + 3] = t; // texCoord.y
-                m_vertices[(vidx * 5) + 4] = e; // texCoord.z (viewport index)
-
-                //cout << u << " " << v << endl;
-            }
-        }
-        float w = lensFrustum[2] - lensFrustum[0];
-        lensFrustum[0] = -(w + lensFrustum[0]);
-        lensFrustum[2] = w - lensFrustum[2];
-        w = noLensFrustum[2] - noLensFrustum[0];
-        noLensFrustum[0] = -(w + noLensFrustum[0]);
-        noLensFrustum[2] = w - noLensFrustum[2];
-        viewport[0] = 1 - (viewport[0] + viewport[2]);
-    }
-}
+	mRenderThread->framePresented();
 
-void OpenGLCapture::computeMeshIndices(int width, int height)
-{
-    m_indices.resize(2 * (width - 1) * (height - 1) * 6);
-
-    float halfwidth = width / 2;
-    float halfheight = height / 2;
-    float vidx = 0;
-    float iidx = 0;
-    for (int e = 0; e < 2; e++) {
-        for (int j = 0; j < height; j++) {
-            for (int i = 0; i < width; i++, vidx++) {
-                if (i == 0 || j == 0)
-                  continue;
-                // Build a quad.  Lower right and upper left quadrants have quads with
-                // the triangle diagonal flipped to get the vignette to interpolate
-                // correctly.
-                if ((i <= halfwidth) == (j <= halfheight)) {
-                    // Quad diagonal lower left to upper right.
-                    m_indices[iidx++] = vidx;
-                    m_indices[iidx++] = vidx - width - 1;
-                    m_indices[iidx++] = vidx - width;
-                    m_indices[iidx++] = vidx - width - 1;
-                    m_indices[iidx++] = vidx;
-                    m_indices[iidx++] = vidx - 1;
-                } else {
-                    // Quad diagonal upper left to lower right.
-                    m_indices[iidx++] = vidx - 1;
-                    m_indices[iidx++] = vidx - width;
-                    m_indices[iidx++] = vidx;
-                    m_indices[iidx++] = vidx - width;
-                    m_indices[iidx++] = vidx - 1;
-                    m_indices[iidx++] = vidx - width - 1;
-                }
-            }
-        }
-    }
-}
+	FrameTimes times;
+	presentFrame(times);
+	if (mShowOverlay)
+		drawOverlay();
 
+	// Buffers are swapped here rather than by QGLWidget so the swap, which returns at a vsync, can be
+	// timed for the frame pacer
+	swapBuffers();
+	BMDTimeValue swapTime = FramePacer::now();
+	mRenderThread->framePacer().onVsync(swapTime);
 
-unsigned int OpenGLCapture::getTime() {
-    struct timeval tp;
-    gettimeofday(&tp, 0);
-    return (tp.tv_sec * 1000 + tp.tv_usec / 1000);
-}
+	LatencyStats& stats = mRenderThread->latencyStats();
+	if (times.publishTime)
+	{
+		stats.record(LatencyStats::StagePresent, swapTime - times.publishTime);
+		stats.record(LatencyStats::StageTotal, swapTime - times.arrivalTime);
+		stats.count(LatencyStats::EventPresented);
+	}
 
+	// Blits of earlier repaints whose GPU time is known by now
+	mPresentSamples.clear();
+	mPresentTimer.poll(mPresentSamples);
+	for (size_t i = 0; i < mPresentSamples.size(); i++)
+		stats.record((LatencyStats::Stage)mPresentSamples[i].section, mPresentSamples[i].duration);
+}
 
-//
-// Update the captured video frame texture
-//
-void OpenGLCapture::VideoFrameArrived(IDeckLinkVideoInputFrame* inputFrame, bool hasNoInputSource)
+void OpenGLCapture::presentFrame(FrameTimes& times)
 {
-    mMutex.lock();
-
-    if (mFrameCount == 0) {
-       BMDTimeValue hframedur;
-       HRESULT h = inputFrame->GetHardwareReferenceTimestamp(mFrameTimescale, &m_startOfTime, &hframedur);
-       m_lastFrameTime = getTime();
-    }
-
-    // check if we need to skip this frame
-    bool skip = false;
-    BMDTimeScale htimeScale = mFrameTimescale;
-    BMDTimeValue hframeTime;
-    BMDTimeValue hframeDuration;
-    HRESULT h = inputFrame->GetHardwareReferenceTimestamp(htimeScale, &hframeTime, &hframeDuration);
-    if (h == S_OK) {
-        double frametime = (double)(hframeTime-m_startOfTime) / (double)hframeDuration; 
-        double instantfps = 1000.0/(getTime()-m_lastFrameTime);
-        if (frametime > mFrameCount) {
-            skip = true;
-            mFrameCount++;  
-        }
-        if (instantfps <= m_displayFPS*DROP_THRESHOLD) {
-            skip = true;
-            mFrameCount++;
-        }
-       m_lastFrameTime = getTime();
-    }
-    
-    if (skip) {
-       std::cout << ".";
-       mMutex.unlock();
-       return;
-    }
-   
-    if (m_displayFPS >= 50.0 && mFrameCount%2 == 0) {
-        mFrameCount++;
-        mMutex.unlock();
-        return;
-    }
-
-	mHasNoInputSource = hasNoInputSource;
-
-	long textureSize = inputFrame->GetRowBytes() * inputFrame->GetHeight();
-	void* videoPixels;
-	inputFrame->GetBytes(&videoPixels);
-
-	makeCurrent();
-
-	glEnable(GL_TEXTURE_2D);
+	// The DeckLink API provides IDeckLinkGLScreenPreviewHelper as a convenient way to view the playout video frames
+	// in a window.  However, it performs a copy from host memory to the GPU which is wasteful in this case since
+	// we already have the rendered frame sitting in the GPU in one of the render thread's colour targets.
+	glBindFramebufferEXT(GL_DRAW_FRAMEBUFFER, 0);
+	glViewport(0, 0, mViewWidth, mViewHeight);
 
-	if (! mPinnedMemoryExtensionAvailable)
+	PresentBuffers& present = mRenderThread->presentBuffers();
+	GLsync renderFence;
+	int target = present.acquireForPresent(renderFence, times);
+	if (target < 0)
 	{
-		// Use a normal texture buffer
-		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, mUnpinnedTextureBuffer);
-		glBufferData(GL_PIXEL_UNPACK_BUFFER, textureSize, videoPixels, GL_DYNAMIC_DRAW);
+		glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+		glClear(GL_COLOR_BUFFER_BIT);
+		return;
 	}
-	else
-	{
-		// Use a pinned buffer for the GL_PIXEL_UNPACK_BUFFER target
-		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, mCaptureAllocator->bufferObjectForPinnedAddress(textureSize, videoPixels));
-	}
-	glBindTexture(GL_TEXTURE_2D, mTexture);
-
-	// NULL for last arg indicates use current GL_PIXEL_UNPACK_BUFFER target as texture data
-	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, mFrameWidth/2, mFrameHeight, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, NULL);
 
-	if (mPinnedMemoryExtensionAvailable)
+	// Wait on the GPU, not here, for the render thread's draw into the target
+	if (renderFence)
 	{
-		// Ensure pinned texture has been transferred to GPU before we draw with it
-		GLsync fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
-		glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 40 * 1000 * 1000);	// timeout in nanosec
-		glDeleteSync(fence);
+		glWaitSync(renderFence, 0, GL_TIMEOUT_IGNORED);
+		glDeleteSync(renderFence);
 	}
 
-	glBindTexture(GL_TEXTURE_2D, 0);
-	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
-	glDisable(GL_TEXTURE_2D);
+	// Frame buffer objects are not shared between contexts, so attach the target to one of our own
+	if (! mIdReadFrameBuf)
+		glGenFramebuffersEXT(1, &mIdReadFrameBuf);
+	glBindFramebufferEXT(GL_READ_FRAMEBUFFER, mIdReadFrameBuf);
+	glFramebufferTexture2DEXT(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0_EXT, GL_TEXTURE_2D, present.texture(target), 0);
 
-    drawFrame();
+	// Simply copy the off-screen frame buffer to on-screen frame buffer, scaling to the viewing window size.
+	mPresentTimer.begin(LatencyStats::StageBlit);
+	glBlitFramebufferEXT(0, 0, mFrameWidth, mFrameHeight, 0, 0, mViewWidth, mViewHeight, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+	mPresentTimer.end();
 
-    mFrameCount++;
+	glFramebufferTexture2DEXT(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0_EXT, GL_TEXTURE_2D, 0, 0);
+	glBindFramebufferEXT(GL_READ_FRAMEBUFFER, 0);
 
-    mMutex.unlock();
-	inputFrame->Release();
+	// The buffer swap in paintGL() flushes this fence
+	present.releasePresented(target, glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0));
 }
 
-// Draw the captured video frame texture onto a box, rendering to the off-screen frame buffer.
-// Read the rendered scene back from the frame buffer and schedule it for playout.
-void OpenGLCapture::drawFrame()
+void OpenGLCapture::drawOverlay()
 {
-    //mMutex.lock();
-
-	// make GL context current
-	makeCurrent();
-
-	// Draw OpenGL scene to the off-screen frame buffer
-	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, mIdFrameBuf);
-
-    GLfloat aspectRatio = (GLfloat)mFrameWidth / (GLfloat)mFrameHeight;
-    glViewport (0, 0, mFrameWidth, mFrameHeight);
+	static const LatencyStats::Stage stages[] = {
+		LatencyStats::StageUpload, LatencyStats::StageWarp, LatencyStats::StageBlit,
+		LatencyStats::StageRender, LatencyStats::StageTotal
+	};
+	static const char* labels[] = { "upload GPU", "warp GPU", "blit GPU", "render", "total" };
 
-    glClear( GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT );
-    glScalef( aspectRatio, 1.0f, 1.0f );
-    glFinish();
+	LatencyStats& stats = mRenderThread->latencyStats();
+	QFont font("Monospace", 10);
+	font.setStyleHint(QFont::TypeWriter);
+	qglColor(Qt::yellow);
 
-	if (mHasNoInputSource)
+	char line[160];
+	int y = 20;
+	for (int i = 0; i < (int)(sizeof(stages) / sizeof(stages[0])); i++, y += 16)
 	{
-		// Draw a big X when no input is available on capture
-		glBegin( GL_QUADS );
-		glColor3f( 1.0f, 0.0f, 1.0f );
-		glVertex3f(  0.8f,  0.9f,  1.0f );
-		glVertex3f(  0.9f,  0.8f,  1.0f );
-		glColor3f( 1.0f, 1.0f, 0.0f );
-		glVertex3f( -0.8f, -0.9f,  1.0f );
-		glVertex3f( -0.9f, -0.8f,  1.0f );
-		glColor3f( 1.0f, 0.0f, 1.0f );
-		glVertex3f( -0.8f,  0.9f,  1.0f );
-		glVertex3f( -0.9f,  0.8f,  1.0f );
-		glColor3f( 1.0f, 1.0f, 0.0f );
-		glVertex3f(  0.8f, -0.9f,  1.0f );
-		glVertex3f(  0.9f, -0.8f,  1.0f );
-		glEnd();
+		LatencyHistogram histogram = stats.recent(stages[i]);
+		if (histogram.count() == 0)
+			snprintf(line, sizeof(line), "%-10s  -", labels[i]);
+		else
+			snprintf(line, sizeof(line), "%-10s  p50 %6.2f  p99 %6.2f  max %6.2f ms", labels[i],
+					 histogram.percentile(0.5) / 1e6, histogram.percentile(0.99) / 1e6, histogram.max() / 1e6);
+		renderText(10, y, line, font);
 	}
-	else
-	{
-		// Pass texture unit 0 to the fragment shader as a uniform variable
-		glEnable(GL_TEXTURE_2D);
-		glBindTexture(GL_TEXTURE_2D, mTexture);
-		glUseProgram(mProgram);
-		GLint locUYVYtex = glGetUniformLocation(mProgram, "UYVYtex");
-		glUniform1i(locUYVYtex, 0);		// Bind texture unit 0
-
-        GLint locOffset = glGetUniformLocation(mProgram, "viewportOffsetScale");
-        glUniform4fv(locOffset, 2, m_viewportOffsetScale);
-
-        glBindBuffer(GL_ARRAY_BUFFER, m_vbo);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_ibo);
-        glDrawElements( GL_TRIANGLES, m_indices.size(), GL_UNSIGNED_INT, (void*)0 );
-
-        glBindBuffer(GL_ARRAY_BUFFER, 0);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-		glUseProgram(0);
-		glDisable(GL_TEXTURE_2D);
-		glBindTexture(GL_TEXTURE_2D, 0);
-	}
-
-    //mMutex.unlock();
-	updateGL();				// Trigger the QGLWidget to repaint the on-screen window in paintGL()
-}
-
-bool OpenGLCapture::Start()
-{
-	mDLInput->StartStreams();
 
-	return true;
+	snprintf(line, sizeof(line), "presented %llu  late %llu  superseded %llu  dropped %llu",
+			 stats.eventCount(LatencyStats::EventPresented), stats.eventCount(LatencyStats::EventLate),
+			 stats.eventCount(LatencyStats::EventSuperseded), stats.eventCount(LatencyStats::EventQueueDropped));
+	renderText(10, y, line, font);
 }
 
-bool OpenGLCapture::Stop()
+void OpenGLCapture::resizeGL (int width, int height)
 {
-	mDLInput->StopStreams();
-	mDLInput->DisableVideoInput();
-
-	return true;
+	// We don't set the project or model matrices here since the window data is copied directly from
+	// an off-screen FBO in paintGL().  Just save the width and height for use in paintGL().
+	mViewWidth = width;
+	mViewHeight = height;
 }
 
-// Setup fragment shader to take YCbCr 4:2:2 video texture in UYVY macropixel format
-// and perform colour space conversion to RGBA in the GPU.
-bool OpenGLCapture::compileFragmentShader(int errorMessageSize, char* errorMessage)
+bool OpenGLCapture::Start()
 {
-	GLsizei		errorBufferSize;
-	GLint		compileResult, linkResult;
-
-    const char* vertexSource =
-        "#version 130 \n"
-
-        "attribute vec2 position; \n"
-        "attribute vec3 texCoord; \n"
-
-        "varying vec2 vTexCoord; \n"
-
-        "uniform vec4 viewportOffsetScale[2]; \n"
-
-        "void main() { \n"
-        "    vec4 viewport = viewportOffsetScale[int(texCoord.z)]; \n"
-        "    vTexCoord = (texCoord.xy * viewport.zw) + viewport.xy; \n"
-        "    vTexCoord.y = 1 - vTexCoord.y; \n"
-        "    gl_Position = vec4( position, 1.0, 1.0 ); \n"
-        "} \n";
-
-	const char*	fragmentSource =
-		"#version 130 \n"
-		"uniform sampler2D UYVYtex; \n"		// UYVY macropixel texture passed as RGBA format
-        "varying vec2 vTexCoord; \n"
-
-		"vec4 rec709YCbCr2rgba(float Y, float Cb, float Cr, float a) \n"
-		"{ \n"
-		"	float r, g, b; \n"
-		// Y: Undo 1/256 texture value scaling and scale [16..235] to [0..1] range
-		// C: Undo 1/256 texture value scaling and scale [16..240] to [-0.5 .. + 0.5] range
-		"	Y = (Y * 256.0 - 16.0) / 219.0; \n"
-		"	Cb = (Cb * 256.0 - 16.0) / 224.0 - 0.5; \n"
-		"	Cr = (Cr * 256.0 - 16.0) / 224.0 - 0.5; \n"
-		// Convert to RGB using Rec.709 conversion matrix (see eq 26.7 in Poynton 2003)
-		"	r = Y + 1.5748 * Cr; \n"
-		"	g = Y - 0.1873 * Cb - 0.4681 * Cr; \n"
-		"	b = Y + 1.8556 * Cb; \n"
-		"	return vec4(r, g, b, a); \n"
-		"}\n"
-
-		// Perform bilinear interpolation between the provided components.
-		// The samples are expected as shown:
-		// ---------
-		// | X | Y |
-		// |---+---|
-		// | W | Z |
-		// ---------
-		"vec4 bilinear(vec4 W, vec4 X, vec4 Y, vec4 Z, vec2 weight) \n"
-		"{\n"
-		"	vec4 m0 = mix(W, Z, weight.x);\n"
-		"	vec4 m1 = mix(X, Y, weight.x);\n"
-		"	return mix(m0, m1, weight.y); \n"
-		"}\n"
-
-		// Gather neighboring YUV macropixels from the given texture coordinate
-		"void textureGatherYUV(sampler2D UYVYsampler, vec2 tc, out vec4 W, out vec4 X, out vec4 Y, out vec4 Z) \n"
-		"{\n"
-		"	ivec2 tx = ivec2(tc * textureSize(UYVYsampler, 0));\n"
-		"	ivec2 tmin = ivec2(0,0);\n"
-		"	ivec2 tmax = textureSize(UYVYsampler, 0) - ivec2(1,1);\n"
-		"	W = texelFetch(UYVYsampler, tx, 0); \n"
-		"	X = texelFetch(UYVYsampler, clamp(tx + ivec2(0,1), tmin, tmax), 0); \n"
-		"	Y = texelFetch(UYVYsampler, clamp(tx + ivec2(1,1), tmin, tmax), 0); \n"
-		"	Z = texelFetch(UYVYsampler, clamp(tx + ivec2(1,0), tmin, tmax), 0); \n"
-		"}\n"
-
-		"void main(void) \n"
-		"{\n"
-		/* The shader uses texelFetch to obtain the YUV macropixels to avoid unwanted interpolation
-		 * introduced by the GPU interpreting the YUV data as RGBA pixels.
-		 * The YUV macropixels are converted into individual RGB pixels and bilinear interpolation is applied. */
-        "	//vec2 tc = gl_TexCoord[0].st; \n"
-		"	float alpha = 0.7; \n"
-
-		"	vec4 macro, macro_u, macro_r, macro_ur;\n"
-		"	vec4 pixel, pixel_r, pixel_u, pixel_ur; \n"
-        "	textureGatherYUV(UYVYtex, vTexCoord, macro, macro_u, macro_ur, macro_r);\n"
-
-		//   Select the components for the bilinear interpolation based on the texture coordinate
-		//   location within the YUV macropixel:
-		//   -----------------          ----------------------
-		//   | UY/VY | UY/VY |          | macro_u | macro_ur |
-		//   |-------|-------|    =>    |---------|----------|
-		//   | UY/VY | UY/VY |          | macro   | macro_r  |
-		//   |-------|-------|          ----------------------
-		//   | RG/BA | RG/BA |
-		//   -----------------
-        "	vec2 off = fract(vTexCoord * textureSize(UYVYtex, 0)); \n"
-		"	if (off.x > 0.5) { \n"			// right half of macropixel
-		"		pixel = rec709YCbCr2rgba(macro.a, macro.b, macro.r, alpha); \n"
-		"		pixel_r = rec709YCbCr2rgba(macro_r.g, macro_r.b, macro_r.r, alpha); \n"
-		"		pixel_u = rec709YCbCr2rgba(macro_u.a, macro_u.b, macro_u.r, alpha); \n"
-		"		pixel_ur = rec709YCbCr2rgba(macro_ur.g, macro_ur.b, macro_ur.r, alpha); \n"
-		"	} else { \n"					// left half & center of macropixel
-		"		pixel = rec709YCbCr2rgba(macro.g, macro.b, macro.r, alpha); \n"
-		"		pixel_r = rec709YCbCr2rgba(macro.a, macro.b, macro.r, alpha); \n"
-		"		pixel_u = rec709YCbCr2rgba(macro_u.g, macro_u.b, macro_u.r, alpha); \n"
-		"		pixel_ur = rec709YCbCr2rgba(macro_u.a, macro_u.b, macro_u.r, alpha); \n"
-		"	}\n"
-
-		"	gl_FragColor = bilinear(pixel, pixel_u, pixel_ur, pixel_r, off); \n"
-		"}\n";
-
-    mVertexShader = glCreateShader(GL_VERTEX_SHADER);
-    glShaderSource(mVertexShader, 1, (const GLchar**)&vertexSource, NULL);
-    glCompileShader(mVertexShader);
-    glGetShaderiv(mVertexShader, GL_COMPILE_STATUS, &compileResult);
-    if (compileResult == GL_FALSE)
-    {
-        glGetShaderInfoLog(mVertexShader, errorMessageSize, &errorBufferSize, errorMessage);
-        qDebug() << errorMessage;
-        return false;
-    }
-
-	mFragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-	glShaderSource(mFragmentShader, 1, (const GLchar**)&fragmentSource, NULL);
-	glCompileShader(mFragmentShader);
-	glGetShaderiv(mFragmentShader, GL_COMPILE_STATUS, &compileResult);
-	if (compileResult == GL_FALSE)
-	{
-		glGetShaderInfoLog(mFragmentShader, errorMessageSize, &errorBufferSize, errorMessage);
-        qDebug() << errorMessage;
-		return false;
-	}
-
-	mProgram = glCreateProgram();
-
-    glAttachShader(mProgram, mVertexShader);
-	glAttachShader(mProgram, mFragmentShader);
-	glLinkProgram(mProgram);
-
-	glGetProgramiv(mProgram, GL_LINK_STATUS, &linkResult);
-	if (linkResult == GL_FALSE)
-	{
-		glGetProgramInfoLog(mProgram, errorMessageSize, &errorBufferSize, errorMessage);
-        qDebug() << errorMessage;
-		return false;
-	}
-
-	return true;
+	return mFrameSource->Start();
 }
 
-bool OpenGLCapture::CheckOpenGLExtensions()
+bool OpenGLCapture::Stop()
 {
-	const GLubyte* strExt;
-	GLboolean hasFBO, hasPinned;
-
-	if (! isValid())
-	{
-		QMessageBox::critical(NULL,"OpenGL initialization error.", "OpenGL context is not valid for specified QGLFormat.");
-		return false;
-	}
-
-	makeCurrent();
-	strExt = glGetString (GL_EXTENSIONS);
-	hasFBO = gluCheckExtension ((const GLubyte*)"GL_EXT_framebuffer_object", strExt);
-	hasPinned = gluCheckExtension ((const GLubyte*)"GL_AMD_pinned_memory", strExt);
-
-	mPinnedMemoryExtensionAvailable = hasPinned;
-
-	if (!hasFBO)
-	{
-		QMessageBox::critical(NULL,"OpenGL initialization error.", "OpenGL extension \"GL_EXT_framebuffer_object\" is not supported.");
-		return false;
-	}
-
-	if (!mPinnedMemoryExtensionAvailable)
-		fprintf(stderr, "GL_AMD_pinned_memory extension not available, using regular texture buffer fallback instead\n");
-
-	return true;
+	// Frames still held for in-flight uploads are retired by the render thread
+	return mFrameSource->Stop();
 }
 
 ////////////////////////////////////////////
@@ -992,8 +434,7 @@ bool OpenGLCapture::CheckOpenGLExtensions()
 // The frame cache delays the releasing of buffers until the cache fills up, thereby avoiding an
 // allocate plus pin operation for every frame, followed by an unpin and deallocate on every frame.
 
-PinnedMemoryAllocator::PinnedMemoryAllocator(QGLWidget* context, const char *name, unsigned cacheSize) :
-	mContext(context),
+PinnedMemoryAllocator::PinnedMemoryAllocator(const char *name, unsigned cacheSize) :
 	mRefCount(1),
 	mName(name),
 	mFrameCacheSize(cacheSize)	// large cache size will keep more GPU memory pinned and may result in out of memory errors
@@ -1006,7 +447,14 @@ PinnedMemoryAllocator::~PinnedMemoryAllocator()
 
 GLuint PinnedMemoryAllocator::bufferObjectForPinnedAddress(int bufferSize, const void* address)
 {
+	QMutexLocker locker(&mCacheMutex);
+
 	// Store all input memory buffers in a map to lookup corresponding pinned buffer handle
+	// A mapped address released and handed out again before it was un-pinned keeps its buffer
+	std::vector<const void*>::iterator pending = std::find(mPendingUnpinMapped.begin(), mPendingUnpinMapped.end(), address);
+	if (pending != mPendingUnpinMapped.end())
+		mPendingUnpinMapped.erase(pending);
+
 	if (mBufferHandleForPinnedAddress.count(address) == 0)
 	{
 		// This method assumes the OpenGL context is current
@@ -1035,18 +483,52 @@ GLuint PinnedMemoryAllocator::bufferObjectForPinnedAddress(int bufferSize, const
 	return mBufferHandleForPinnedAddress[address];
 }
 
-void PinnedMemoryAllocator::unPinAddress(const void* address)
+void PinnedMemoryAllocator::setCacheSize(unsigned cacheSize)
 {
-	// un-pin address only if it has been pinned
-	if (mBufferHandleForPinnedAddress.count(address) > 0)
+	QMutexLocker locker(&mCacheMutex);
+
+	mFrameCacheSize = cacheSize;
+	while (mFrameCache.size() > mFrameCacheSize)
 	{
-		mContext->makeCurrent();
+		discardBuffer(mFrameCache.back());
+		mFrameCache.pop_back();
+	}
+}
+
+// Called with mCacheMutex held.  Buffers are released on whichever thread drops the last frame
+// reference, where no GL context is current, so pinned ones are only queued for un-pinning.
+void PinnedMemoryAllocator::discardBuffer(void* buffer)
+{
+	mBufferSize.erase(buffer);
+
+	if (mBufferHandleForPinnedAddress.count(buffer) > 0)
+		mPendingUnpin.push_back(buffer);
+	else
+		free(buffer);
+}
 
+void PinnedMemoryAllocator::releaseUnpinnedBuffers()
+{
+	QMutexLocker locker(&mCacheMutex);
+
+	for (size_t i = 0; i < mPendingUnpin.size(); i++)
+	{
 		// The buffer is un-pinned by the GPU when the buffer is deleted
-		GLuint bufferHandle = mBufferHandleForPinnedAddress[address];
+		GLuint bufferHandle = mBufferHandleForPinnedAddress[mPendingUnpin[i]];
+		glDeleteBuffers(1, &bufferHandle);
+		mBufferHandleForPinnedAddress.erase(mPendingUnpin[i]);
+		free(mPendingUnpin[i]);
+	}
+	mPendingUnpin.clear();
+
+	for (size_t i = 0; i < mPendingUnpinMapped.size(); i++)
+	{
+		// Only un-pinned, the memory belongs to whoever mapped it
+		GLuint bufferHandle = mBufferHandleForPinnedAddress[mPendingUnpinMapped[i]];
 		glDeleteBuffers(1, &bufferHandle);
-		mBufferHandleForPinnedAddress.erase(address);
+		mBufferHandleForPinnedAddress.erase(mPendingUnpinMapped[i]);
 	}
+	mPendingUnpinMapped.clear();
 }
 
 // IUnknown methods
@@ -1073,23 +555,43 @@ ULONG STDMETHODCALLTYPE		PinnedMemoryAllocator::Release(void)
 // IDeckLinkMemoryAllocator methods
 HRESULT STDMETHODCALLTYPE	PinnedMemoryAllocator::AllocateBuffer (uint32_t bufferSize, void* *allocatedBuffer)
 {
-	if (mFrameCache.empty())
-	{
-		// alignment to 4K required when pinning memory
-		if (posix_memalign(allocatedBuffer, 4096, bufferSize) != 0)
-			return E_OUTOFMEMORY;
-	}
-	else
+	QMutexLocker locker(&mCacheMutex);
+
+	// Re-use most recently ReleaseBuffer'd address, unless it was allocated for another video mode
+	while (! mFrameCache.empty())
 	{
-		// Re-use most recently ReleaseBuffer'd address
-		*allocatedBuffer = mFrameCache.back();
+		void* buffer = mFrameCache.back();
 		mFrameCache.pop_back();
+
+		if (mBufferSize[buffer] == bufferSize)
+		{
+			*allocatedBuffer = buffer;
+			return S_OK;
+		}
+		discardBuffer(buffer);
 	}
+
+	// alignment to 4K required when pinning memory
+	if (posix_memalign(allocatedBuffer, 4096, bufferSize) != 0)
+		return E_OUTOFMEMORY;
+
+	mBufferSize[*allocatedBuffer] = bufferSize;
 	return S_OK;
 }
 
 HRESULT STDMETHODCALLTYPE	PinnedMemoryAllocator::ReleaseBuffer (void* buffer)
 {
+	QMutexLocker locker(&mCacheMutex);
+
+	// Memory this allocator did not allocate, such as a frame in the file mapping of a replayed
+	// recording, is not cached or freed, only un-pinned if it was pinned for its upload
+	if (mBufferSize.count(buffer) == 0)
+	{
+		if (mBufferHandleForPinnedAddress.count(buffer) > 0)
+			mPendingUnpinMapped.push_back(buffer);
+		return S_OK;
+	}
+
 	if (mFrameCache.size() < mFrameCacheSize)
 	{
 		mFrameCache.push_back(buffer);
@@ -1097,8 +599,7 @@ HRESULT STDMETHODCALLTYPE	PinnedMemoryAllocator::ReleaseBuffer (void* buffer)
 	else
 	{
 		// No room left in cache, so un-pin (if it was pinned) and free this buffer
-		unPinAddress(buffer);
-		free(buffer);
+		discardBuffer(buffer);
 	}
 	return S_OK;
 }
@@ -1110,11 +611,12 @@ HRESULT STDMETHODCALLTYPE	PinnedMemoryAllocator::Commit ()
 
 HRESULT STDMETHODCALLTYPE	PinnedMemoryAllocator::Decommit ()
 {
+	QMutexLocker locker(&mCacheMutex);
+
 	while (! mFrameCache.empty())
 	{
 		// Cleanup any frames allocated and pinned in AllocateBuffer() but not freed in ReleaseBuffer()
-		unPinAddress( mFrameCache.back() );
-		free( mFrameCache.back() );
+		discardBuffer( mFrameCache.back() );
 		mFrameCache.pop_back();
 	}
 	return S_OK;
@@ -1133,10 +635,10 @@ HRESULT	CaptureDelegate::VideoInputFrameArrived(IDeckLinkVideoInputFrame* inputF
 
 	bool hasNoInputSource = inputFrame->GetFlags() & bmdFrameHasNoInputSource;
 
-	// emit just adds a message to Qt's event queue since we're in a different thread, so add a reference
-	// to the input frame to prevent it getting released before the connected slot can process the frame.
-	inputFrame->AddRef();
-	emit captureFrameArrived(inputFrame, hasNoInputSource);
+	// Hand the frame to the recorder and the render thread without waiting for either; they add their own references.
+	if (mRecorder)
+		mRecorder->recordFrame(inputFrame);
+	mRenderThread->queueFrame(inputFrame, hasNoInputSource);
 	return S_OK;
 }
 
@@ -28,25 +28,28 @@
 #ifndef __OPENGL_COMPOSITE_H__
 #define __OPENGL_COMPOSITE_H__
 
-#include "DeviceInfo.h"
 #include "DeckLinkAPI.h"
+#include "FrameQueue.h"
+#include "FrameSource.h"
+#include "GpuTimer.h"
+#include "PipelineControl.h"
+#include "UnpackBufferRing.h"
+#include "WarpRenderer.h"
 #include <QGLWidget>
 #include <QMutex>
 #include <QAtomicInt>
 #include <map>
 #include <vector>
-#include <deque>
 #include <string>
 
 class CaptureDelegate;
+class CaptureRecorder;
+class LatencyStats;
+struct FrameTimes;
 class PinnedMemoryAllocator;
+class RenderThread;
 
-using namespace cam2vr;
-
-#define DEFAULT_DEVICE 0
-#define DEFAULT_MODE 15
-
-class OpenGLCapture : public QGLWidget
+class OpenGLCapture : public QGLWidget, public PipelineControl
 {
 	Q_OBJECT
 
@@ -58,76 +61,91 @@ public:
 	bool Start();
 	bool Stop();
 
+    // Takes ownership of source; by default frames come from a DeckLink card
+    void setFrameSource(FrameSource* source);
+    FrameSource* frameSource() { return mFrameSource; }
+
+    // Unpack buffer ring used when GL_AMD_pinned_memory is not available; takes effect on the next InitDeckLink()
+    void setUploadRing(int depth, UnpackBufferRing::Mode mode);
+
+    // Queue between the capture callback and the render thread; takes effect on the next InitDeckLink()
+    void setFrameQueue(int depth, FrameQueue::Policy policy);
+
+    // PipelineControl: changes while capturing replace only the distortion mesh
+    virtual bool setMeshSize(int width, int height);
+    virtual int meshWidth() const;
+    virtual int meshHeight() const;
+    // Buffer layout of the distortion mesh, also replaced while capturing
+    void setMeshLayout(WarpRenderer::MeshLayout layout);
+    // Fragment program of the warp, also switched while capturing
+    void setWarpShader(WarpRenderer::WarpShader shader);
+    // The program frames are warped with, which falls back to the gather shader
+    WarpRenderer::WarpShader drawShader() const;
+    // PipelineControl: the selected profiles are swapped in by the render thread between two frames
+    virtual bool setViewer(const std::string& id);
+    virtual bool setDevice(const std::string& id);
+    virtual void addViewer(const CardboardViewer& viewer);
+    virtual void addDevice(const Device& device);
+    virtual const DeviceInfo& profiles() const { return mDeviceInfo; }
+    // Where computed meshes are kept for the next start, empty for nowhere; takes effect on the next InitDeckLink()
+    void setMeshCacheDirectory(const QString& directory);
+    // Where linked shader programs are kept for the next start, empty for nowhere; takes effect on the next InitDeckLink()
+    void setShaderCacheDirectory(const QString& directory);
+    // YCbCr to RGB matrix of the captured video; takes effect on the next InitDeckLink()
+    void setColourMatrix(WarpRenderer::ColourMatrix matrix);
+    // How the mesh inverts the lens distortion; takes effect on the next InitDeckLink()
+    void setDistortionInverse(DeviceInfo::InverseMode mode);
+
+    // Print every frame pacing decision to stderr
+    void setPacingLog(bool enable);
+    // Skip frames the display would not show (the default); when disabled every frame is rendered
+    void setPacing(bool enable);
+
+    // Record the raw captured frames; takes ownership of recorder, which InitDeckLink() opens for the mode
+    void setRecorder(CaptureRecorder* recorder);
+
+    // Per-stage latency of the pipeline, reset whenever capture is (re)initialised
+    LatencyStats& latencyStats();
+
+    // Draw recent GPU and pipeline timings over the video
+    void setStatsOverlay(bool enable) { mShowOverlay = enable; update(); }
+    bool statsOverlay() const { return mShowOverlay; }
+
     int getDeviceList(std::vector<std::string>& devices);
     int getModeList(int device, std::vector<std::string>& modes);
 
-    unsigned int getTime();
-
 private:
-	bool CheckOpenGLExtensions();
-
-    IDeckLink* getDeckLink(int idx);
-    IDeckLinkDisplayMode* getDeckLinkDisplayMode(IDeckLink* deckLink, int idx);
-
 	// QGLWidget virtual methods
 	virtual void initializeGL();
 	virtual void paintGL();
 	virtual void resizeGL(int width, int height);
 
-    // VR
-    void setTextureBounds();
-    void computeMeshVertices(int width, int height);
-    void computeMeshIndices(int width, int height);
-    void drawFrame();
-
-private slots:
-	void VideoFrameArrived(IDeckLinkVideoInputFrame* inputFrame, bool hasNoInputSource);
+	void presentFrame(FrameTimes& times);
+	void drawOverlay();
 
 private:
 	QWidget*								mParent;
 	CaptureDelegate*						mCaptureDelegate;
-    QMutex									mMutex;				// protect access to both OpenGL and DeckLink calls
+	CaptureRecorder*						mRecorder;
+	RenderThread*							mRenderThread;		// uploads and warps frames in a context shared with ours
+    QMutex									mMutex;				// protect replacing the frame source
 
 	// DeckLink
-	IDeckLinkInput*							mDLInput;
+	FrameSource*							mFrameSource;
     PinnedMemoryAllocator*					mCaptureAllocator;
     BMDTimeValue							mFrameDuration;
 	BMDTimeScale							mFrameTimescale;
     unsigned								mFrameWidth;
 	unsigned								mFrameHeight;
-	bool									mHasNoInputSource;
 
 	// OpenGL data
-	bool									mPinnedMemoryExtensionAvailable;
-	GLuint									mTexture;
-	GLuint									mUnpinnedTextureBuffer;
-	GLuint									mIdFrameBuf;
-	GLuint									mIdColorBuf;
-	GLuint									mIdDepthBuf;
-	GLuint									mProgram;
-    GLuint                                  mVertexShader;
-	GLuint									mFragmentShader;
+	GLuint									mIdReadFrameBuf;	// reads the render thread's colour targets when presenting
+	GpuTimer								mPresentTimer;		// GPU time of the blit
+	std::vector<GpuTimer::Sample>			mPresentSamples;
+	bool									mShowOverlay;
+	DeviceInfo								mDeviceInfo;		// the profiles, and those selected for the render thread
     int										mViewWidth;
 	int										mViewHeight;
-
-	bool InitOpenGLState();
-	bool compileFragmentShader(int errorMessageSize, char* errorMessage);
-
-    // VR
-    int                                     m_meshWidth, m_meshHeight;
-    float                                   m_bufferScale;
-    float                                   m_viewportOffsetScale[8];
-    DeviceInfo*                             m_deviceInfo;
-    unsigned int                            m_vbo;
-    unsigned int                            m_ibo;
-    std::vector<float>                      m_vertices;
-    std::vector<unsigned int>               m_indices;
-
-    //
-    BMDTimeValue m_startOfTime;
-    unsigned int m_lastFrameTime;
-    float m_displayFPS;
-    unsigned int mFrameCount;
 };
 
 ////////////////////////////////////////////
@@ -136,11 +154,15 @@ private:
 class PinnedMemoryAllocator : public IDeckLinkMemoryAllocator
 {
 public:
-	PinnedMemoryAllocator(QGLWidget* context, const char* name, unsigned cacheSize);
+	PinnedMemoryAllocator(const char* name, unsigned cacheSize);
 	virtual ~PinnedMemoryAllocator();
 
 	GLuint bufferObjectForPinnedAddress(int bufferSize, const void* address);
-	void unPinAddress(const void* address);
+	void setCacheSize(unsigned cacheSize);
+
+	// Un-pin and free the buffers released since the last call.  Must be called with a GL context
+	// of the share group the buffers were pinned in current.
+	void releaseUnpinnedBuffers();
 
 	// IUnknown methods
 	virtual HRESULT STDMETHODCALLTYPE	QueryInterface(REFIID iid, LPVOID *ppv);
@@ -154,10 +176,15 @@ public:
 	virtual HRESULT STDMETHODCALLTYPE	Decommit ();
 
 private:
-	QGLWidget*							mContext;
+	void discardBuffer(void* buffer);
+
 	QAtomicInt							mRefCount;
+	QMutex								mCacheMutex;		// frames are allocated, pinned and released on different threads
 	std::map<const void*, GLuint>		mBufferHandleForPinnedAddress;
+	std::map<const void*, uint32_t>		mBufferSize;
 	std::vector<void*>					mFrameCache;
+	std::vector<void*>					mPendingUnpin;		// pinned buffers to free once a GL context is current
+	std::vector<const void*>			mPendingUnpinMapped;	// pinned memory of others, only to un-pin
 	const char*							mName;
 	unsigned							mFrameCacheSize;
 };
@@ -166,12 +193,13 @@ private:
 // Capture Delegate Class
 ////////////////////////////////////////////
 
-class CaptureDelegate : public QObject, public IDeckLinkInputCallback
+class CaptureDelegate : public IDeckLinkInputCallback
 {
-	Q_OBJECT
-
 public:
-	CaptureDelegate () { }
+	CaptureDelegate (RenderThread* renderThread) : mRenderThread(renderThread), mRecorder(NULL) { }
+
+	// Also hand every frame to recorder, NULL for none; only call while capture is stopped
+	void setRecorder(CaptureRecorder* recorder) { mRecorder = recorder; }
 
 	// IUnknown needs only a dummy implementation
 	virtual HRESULT	STDMETHODCALLTYPE	QueryInterface (REFIID /*iid*/, LPVOID* /*ppv*/)	{return E_NOINTERFACE;}
@@ -181,8 +209,9 @@ public:
 	virtual HRESULT STDMETHODCALLTYPE	VideoInputFrameArrived(IDeckLinkVideoInputFrame *videoFrame, IDeckLinkAudioInputPacket *audioPacket);
 	virtual HRESULT	STDMETHODCALLTYPE	VideoInputFormatChanged(BMDVideoInputFormatChangedEvents notificationEvents, IDeckLinkDisplayMode *newDisplayMode, BMDDetectedVideoInputFormatFlags detectedSignalFlags);
 
-signals:
-	void captureFrameArrived(IDeckLinkVideoInputFrame *videoFrame, bool hasNoInputSource);
+private:
+	RenderThread*							mRenderThread;
+	CaptureRecorder*						mRecorder;
 };
 
 
@@ -0,0 +1,38 @@
+#ifndef PIPELINE_CONTROL_H
+#define PIPELINE_CONTROL_H
+
+#include "DeviceInfo.h"
+
+#include <string>
+
+using namespace cam2vr;
+
+////////////////////////////////////////////
+// PipelineControl
+////////////////////////////////////////////
+
+// Settings of a running pipeline that can be changed without restarting capture, for the menus and
+// the StatsServer's control endpoints.  Implemented by OpenGLCapture and HeadlessCapture; every
+// method is called on the GUI thread.
+class PipelineControl
+{
+public:
+    virtual ~PipelineControl() {}
+
+    // Vertices per eye of the distortion mesh; false when the size is out of range
+    virtual bool setMeshSize(int width, int height) = 0;
+    virtual int meshWidth() const = 0;
+    virtual int meshHeight() const = 0;
+
+    // Viewer and phone the mesh is computed for, by the id of one of profiles()' viewers or devices;
+    // false for an unknown id
+    virtual bool setViewer(const std::string& id) = 0;
+    virtual bool setDevice(const std::string& id) = 0;
+    // Make a user-defined profile selectable, replacing the one with the same id
+    virtual void addViewer(const CardboardViewer& viewer) = 0;
+    virtual void addDevice(const Device& device) = 0;
+    // The profiles to choose from and the selected viewer and device
+    virtual const DeviceInfo& profiles() const = 0;
+};
+
+#endif
@@ -0,0 +1,688 @@
+#include "PlayoutSink.h"
+#include "FramePacer.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+
+namespace {
+
+IDeckLink* deckLinkAt(int index)
+{
+    IDeckLinkIterator* deckLinkIterator = CreateDeckLinkIteratorInstance();
+    if (deckLinkIterator == NULL)
+        return NULL;
+
+    IDeckLink* deckLink = NULL;
+    while (deckLinkIterator->Next(&deckLink) == S_OK)
+    {
+        if (index-- == 0)
+            break;
+        deckLink->Release();
+        deckLink = NULL;
+    }
+    deckLinkIterator->Release();
+    return deckLink;
+}
+
+void sleepUntilNs(BMDTimeValue deadline)
+{
+    struct timespec ts;
+    ts.tv_sec = deadline / 1000000000LL;
+    ts.tv_nsec = deadline % 1000000000LL;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) != 0)
+        ;
+}
+
+const char* completionName(BMDOutputFrameCompletionResult result)
+{
+    switch (result)
+    {
+    case bmdOutputFrameCompleted:       return "completed";
+    case bmdOutputFrameDisplayedLate:   return "late";
+    case bmdOutputFrameDropped:         return "dropped";
+    case bmdOutputFrameFlushed:         return "flushed";
+    }
+    return "unknown";
+}
+
+} // namespace
+
+////////////////////////////////////////////
+// DeckLinkPlayoutDevice
+////////////////////////////////////////////
+
+DeckLinkPlayoutDevice::DeckLinkPlayoutDevice(int device) :
+    mDevice(device),
+    mDLOutput(NULL),
+    mWidth(0), mHeight(0),
+    mPixelFormat(bmdFormat8BitBGRA),
+    mFrameDuration(0), mTimeScale(0),
+    mPlaying(false)
+{
+}
+
+DeckLinkPlayoutDevice::~DeckLinkPlayoutDevice()
+{
+    Close();
+}
+
+bool DeckLinkPlayoutDevice::findDisplayMode(BMDDisplayMode& displayMode)
+{
+    IDeckLinkDisplayModeIterator* displayModeIterator = NULL;
+    if (mDLOutput->GetDisplayModeIterator(&displayModeIterator) != S_OK)
+        return false;
+
+    bool found = false;
+    IDeckLinkDisplayMode* mode = NULL;
+    while (! found && displayModeIterator->Next(&mode) == S_OK)
+    {
+        BMDTimeValue duration;
+        BMDTimeScale scale;
+        mode->GetFrameRate(&duration, &scale);
+        if (mode->GetWidth() == (long)mWidth && mode->GetHeight() == (long)mHeight
+            && duration * mTimeScale == mFrameDuration * scale)
+        {
+            displayMode = mode->GetDisplayMode();
+            found = true;
+        }
+        mode->Release();
+    }
+    displayModeIterator->Release();
+    return found;
+}
+
+bool DeckLinkPlayoutDevice::Open(unsigned width, unsigned height, BMDPixelFormat pixelFormat, BMDTimeValue frameDuration,
+                                 BMDTimeScale timeScale, IDeckLinkVideoOutputCallback* callback)
+{
+    Close();
+
+    mWidth = width;
+    mHeight = height;
+    mPixelFormat = pixelFormat;
+    mFrameDuration = frameDuration;
+    mTimeScale = timeScale;
+
+    IDeckLink* deckLink = deckLinkAt(mDevice);
+    if (! deckLink)
+    {
+        fprintf(stderr, "DeckLink playout: there is no device %d\n", mDevice);
+        return false;
+    }
+    HRESULT result = deckLink->QueryInterface(IID_IDeckLinkOutput, (void**)&mDLOutput);
+    deckLink->Release();
+    if (result != S_OK)
+    {
+        fprintf(stderr, "DeckLink playout: device %d has no video output\n", mDevice);
+        mDLOutput = NULL;
+        return false;
+    }
+
+    // The output runs in the mode of the capture: same size, same rate
+    BMDDisplayMode displayMode;
+    BMDDisplayModeSupport support = bmdDisplayModeNotSupported;
+    if (! findDisplayMode(displayMode))
+    {
+        fprintf(stderr, "DeckLink playout: device %d has no %ux%u mode at %.2f frames/s\n",
+                mDevice, width, height, (double)timeScale / frameDuration);
+    }
+    else if (mDLOutput->DoesSupportVideoMode(displayMode, pixelFormat, bmdVideoOutputFlagDefault, &support, NULL) != S_OK
+             || support == bmdDisplayModeNotSupported)
+    {
+        fprintf(stderr, "DeckLink playout: device %d cannot play out %s frames in this mode\n", mDevice,
+                pixelFormat == bmdFormat8BitYUV ? "UYVY" : "BGRA");
+    }
+    else if (mDLOutput->EnableVideoOutput(displayMode, bmdVideoOutputFlagDefault) != S_OK)
+    {
+        fprintf(stderr, "DeckLink playout: cannot enable the video output of device %d, it may be in use\n", mDevice);
+    }
+    else
+    {
+        mDLOutput->SetScheduledFrameCompletionCallback(callback);
+        return true;
+    }
+
+    mDLOutput->Release();
+    mDLOutput = NULL;
+    return false;
+}
+
+IDeckLinkMutableVideoFrame* DeckLinkPlayoutDevice::CreateFrame()
+{
+    IDeckLinkMutableVideoFrame* frame = NULL;
+    int rowBytes = mPixelFormat == bmdFormat8BitYUV ? mWidth * 2 : mWidth * 4;
+    if (mDLOutput->CreateVideoFrame(mWidth, mHeight, rowBytes, mPixelFormat, bmdFrameFlagDefault, &frame) != S_OK)
+        return NULL;
+    return frame;
+}
+
+bool DeckLinkPlayoutDevice::ScheduleFrame(IDeckLinkVideoFrame* frame, BMDTimeValue displayTime)
+{
+    return mDLOutput->ScheduleVideoFrame(frame, displayTime, mFrameDuration, mTimeScale) == S_OK;
+}
+
+bool DeckLinkPlayoutDevice::StartPlayback(BMDTimeValue startTime)
+{
+    mPlaying = mDLOutput->StartScheduledPlayback(startTime, mTimeScale, 1.0) == S_OK;
+    return mPlaying;
+}
+
+BMDTimeValue DeckLinkPlayoutDevice::streamTime()
+{
+    BMDTimeValue time;
+    double speed;
+    if (! mPlaying || mDLOutput->GetScheduledStreamTime(mTimeScale, &time, &speed) != S_OK)
+        return -1;
+    return time;
+}
+
+void DeckLinkPlayoutDevice::Close()
+{
+    if (! mDLOutput)
+        return;
+
+    if (mPlaying)
+        mDLOutput->StopScheduledPlayback(0, NULL, 0);
+    mPlaying = false;
+    mDLOutput->SetScheduledFrameCompletionCallback(NULL);
+    mDLOutput->DisableVideoOutput();
+    mDLOutput->Release();
+    mDLOutput = NULL;
+}
+
+////////////////////////////////////////////
+// SimulatedPlayoutThread
+////////////////////////////////////////////
+
+// The output clock of SimulatedPlayoutDevice
+class SimulatedPlayoutThread : public QThread
+{
+public:
+    SimulatedPlayoutThread(SimulatedPlayoutDevice* device) : mDevice(device), mStop(0) {}
+
+    void requestStop() { mStop.storeRelease(1); }
+
+protected:
+    virtual void run();
+
+private:
+    SimulatedPlayoutDevice* mDevice;
+    QAtomicInt              mStop;
+};
+
+void SimulatedPlayoutThread::run()
+{
+    const double periodNs = mDevice->mFrameDuration * 1e9 / mDevice->mTimeScale;
+    for (unsigned long long frameIndex = 0; mStop.loadAcquire() == 0; frameIndex++)
+    {
+        sleepUntilNs(mDevice->mStartNs + (BMDTimeValue)(frameIndex * periodNs));
+        mDevice->showFrame(mDevice->mStartTime + (BMDTimeValue)frameIndex * mDevice->mFrameDuration);
+    }
+}
+
+////////////////////////////////////////////
+// SimulatedPlayoutDevice
+////////////////////////////////////////////
+
+SimulatedPlayoutDevice::SimulatedPlayoutDevice(const std::string& logPath) :
+    mLogPath(logPath),
+    mLog(NULL),
+    mCallback(NULL),
+    mThread(NULL),
+    mWidth(0), mHeight(0),
+    mPixelFormat(bmdFormat8BitBGRA),
+    mFrameDuration(0), mTimeScale(0),
+    mOpenNs(0),
+    mStartTime(0),
+    mStartNs(0)
+{
+}
+
+SimulatedPlayoutDevice::~SimulatedPlayoutDevice()
+{
+    Close();
+}
+
+bool SimulatedPlayoutDevice::Open(unsigned width, unsigned height, BMDPixelFormat pixelFormat, BMDTimeValue frameDuration,
+                                  BMDTimeScale timeScale, IDeckLinkVideoOutputCallback* callback)
+{
+    Close();
+
+    if (! mLogPath.empty())
+    {
+        mLog = mLogPath == "-" ? stdout : fopen(mLogPath.c_str(), "w");
+        if (! mLog)
+        {
+            fprintf(stderr, "Simulated playout: cannot open %s: %s\n", mLogPath.c_str(), strerror(errno));
+            return false;
+        }
+        fprintf(mLog, "frame,display_time,scheduled_ms,shown_ms,result\n");
+    }
+
+    mWidth = width;
+    mHeight = height;
+    mPixelFormat = pixelFormat;
+    mFrameDuration = frameDuration;
+    mTimeScale = timeScale;
+    mCallback = callback;
+    mOpenNs = FramePacer::now();
+    return true;
+}
+
+IDeckLinkMutableVideoFrame* SimulatedPlayoutDevice::CreateFrame()
+{
+    return new PlayoutVideoFrame(mWidth, mHeight, mPixelFormat);
+}
+
+bool SimulatedPlayoutDevice::ScheduleFrame(IDeckLinkVideoFrame* frame, BMDTimeValue displayTime)
+{
+    if (! mCallback)
+        return false;
+
+    ScheduledFrame scheduled;
+    scheduled.frame = frame;
+    scheduled.displayTime = displayTime;
+    scheduled.scheduledNs = FramePacer::now();
+
+    frame->AddRef();
+    QMutexLocker locker(&mMutex);
+    mScheduled.push_back(scheduled);
+    return true;
+}
+
+bool SimulatedPlayoutDevice::StartPlayback(BMDTimeValue startTime)
+{
+    if (! mCallback || mThread)
+        return false;
+
+    mMutex.lock();
+    mStartTime = startTime;
+    mStartNs = FramePacer::now();
+    mMutex.unlock();
+
+    mThread = new SimulatedPlayoutThread(this);
+    mThread->start(QThread::TimeCriticalPriority);
+    return true;
+}
+
+BMDTimeValue SimulatedPlayoutDevice::streamTime()
+{
+    QMutexLocker locker(&mMutex);
+    if (! mStartNs)
+        return -1;
+    return mStartTime + (BMDTimeValue)((FramePacer::now() - mStartNs) * (double)mTimeScale / 1e9);
+}
+
+bool SimulatedPlayoutDevice::earlierDisplayTime(const ScheduledFrame& a, const ScheduledFrame& b)
+{
+    return a.displayTime < b.displayTime;
+}
+
+// Output thread: the frame boundary of displayTime has been reached
+void SimulatedPlayoutDevice::showFrame(BMDTimeValue displayTime)
+{
+    std::vector<ScheduledFrame> due;
+    mMutex.lock();
+    for (size_t i = 0; i < mScheduled.size(); )
+    {
+        if (mScheduled[i].displayTime <= displayTime)
+        {
+            due.push_back(mScheduled[i]);
+            mScheduled.erase(mScheduled.begin() + i);
+        }
+        else
+        {
+            i++;
+        }
+    }
+    mMutex.unlock();
+    if (due.empty())
+        return;
+
+    // Frames scheduled after their time had passed: the newest is shown late, the others never
+    std::sort(due.begin(), due.end(), earlierDisplayTime);
+    BMDTimeValue now = FramePacer::now();
+    for (size_t i = 0; i + 1 < due.size(); i++)
+        complete(due[i], 0, bmdOutputFrameDropped);
+    complete(due.back(), now, due.back().displayTime == displayTime ? bmdOutputFrameCompleted : bmdOutputFrameDisplayedLate);
+}
+
+void SimulatedPlayoutDevice::complete(const ScheduledFrame& scheduled, BMDTimeValue shownNs, BMDOutputFrameCompletionResult result)
+{
+    if (mLog)
+    {
+        char shown[32] = "";
+        if (shownNs)
+            snprintf(shown, sizeof(shown), "%.3f", (shownNs - mOpenNs) / 1e6);
+        fprintf(mLog, "%lld,%lld,%.3f,%s,%s\n", (long long)(scheduled.displayTime / mFrameDuration), (long long)scheduled.displayTime,
+                (scheduled.scheduledNs - mOpenNs) / 1e6, shown, completionName(result));
+    }
+
+    mCallback->ScheduledFrameCompleted(scheduled.frame, result);
+    scheduled.frame->Release();
+}
+
+void SimulatedPlayoutDevice::Close()
+{
+    if (! mCallback)
+        return;
+
+    if (mThread)
+    {
+        mThread->requestStop();
+        mThread->wait();
+        delete mThread;
+        mThread = NULL;
+    }
+
+    mMutex.lock();
+    std::vector<ScheduledFrame> flushed;
+    flushed.swap(mScheduled);
+    mStartNs = 0;
+    mMutex.unlock();
+
+    std::sort(flushed.begin(), flushed.end(), earlierDisplayTime);
+    for (size_t i = 0; i < flushed.size(); i++)
+        complete(flushed[i], 0, bmdOutputFrameFlushed);
+    mCallback->ScheduledPlaybackHasStopped();
+    mCallback = NULL;
+
+    if (mLog == stdout)
+        fflush(mLog);
+    else if (mLog)
+        fclose(mLog);
+    mLog = NULL;
+}
+
+////////////////////////////////////////////
+// PlayoutVideoFrame
+////////////////////////////////////////////
+
+PlayoutVideoFrame::PlayoutVideoFrame(long width, long height, BMDPixelFormat pixelFormat) :
+    mRefCount(1),
+    mWidth(width),
+    mHeight(height),
+    mPixelFormat(pixelFormat),
+    mFlags(bmdFrameFlagDefault),
+    mBytes((size_t)GetRowBytes() * height)
+{
+}
+
+HRESULT STDMETHODCALLTYPE PlayoutVideoFrame::QueryInterface(REFIID /*iid*/, LPVOID* /*ppv*/)
+{
+    return E_NOINTERFACE;
+}
+
+ULONG STDMETHODCALLTYPE PlayoutVideoFrame::AddRef(void)
+{
+    int oldValue = mRefCount.fetchAndAddAcquire(1);
+    return (ULONG)(oldValue + 1);
+}
+
+ULONG STDMETHODCALLTYPE PlayoutVideoFrame::Release(void)
+{
+    int oldValue = mRefCount.fetchAndAddAcquire(-1);
+    if (oldValue == 1)      // i.e. current value will be 0
+        delete this;
+
+    return (ULONG)(oldValue - 1);
+}
+
+HRESULT PlayoutVideoFrame::GetTimecode(BMDTimecodeFormat /*format*/, IDeckLinkTimecode** timecode)
+{
+    *timecode = NULL;
+    return S_FALSE;
+}
+
+HRESULT PlayoutVideoFrame::GetAncillaryData(IDeckLinkVideoFrameAncillary** ancillary)
+{
+    *ancillary = NULL;
+    return S_FALSE;
+}
+
+HRESULT PlayoutVideoFrame::SetTimecode(BMDTimecodeFormat /*format*/, IDeckLinkTimecode* /*timecode*/)
+{
+    return E_NOTIMPL;
+}
+
+HRESULT PlayoutVideoFrame::SetTimecodeFromComponents(BMDTimecodeFormat /*format*/, uint8_t /*hours*/, uint8_t /*minutes*/,
+                                                     uint8_t /*seconds*/, uint8_t /*frames*/, BMDTimecodeFlags /*flags*/)
+{
+    return E_NOTIMPL;
+}
+
+HRESULT PlayoutVideoFrame::SetAncillaryData(IDeckLinkVideoFrameAncillary* /*ancillary*/)
+{
+    return E_NOTIMPL;
+}
+
+HRESULT PlayoutVideoFrame::SetTimecodeUserBits(BMDTimecodeFormat /*format*/, BMDTimecodeUserBits /*userBits*/)
+{
+    return E_NOTIMPL;
+}
+
+////////////////////////////////////////////
+// PlayoutSink
+////////////////////////////////////////////
+
+PlayoutSink::PlayoutSink(PlayoutDevice* device, int preroll) :
+    mDevice(device),
+    mDelegate(NULL),
+    mPreroll(std::max(preroll, 1)),
+    mFrameDuration(0),
+    mNextDisplayTime(0),
+    mPlaying(false),
+    mScheduled(0),
+    mResyncs(0),
+    mOpen(false),
+    mCompleted(0),
+    mLate(0),
+    mDropped(0),
+    mFlushed(0),
+    mSkipped(0)
+{
+    mDelegate = new PlayoutDelegate(this);
+}
+
+PlayoutSink::~PlayoutSink()
+{
+    Close();
+    delete mDevice;
+    delete mDelegate;
+}
+
+bool PlayoutSink::Open(unsigned width, unsigned height, WarpedFrame::Format format, BMDTimeValue frameDuration, BMDTimeScale timeScale)
+{
+    Close();
+
+    // Frames already in YUV stay in YUV, which every card can play out
+    BMDPixelFormat pixelFormat = format == WarpedFrame::FormatRGBA ? bmdFormat8BitBGRA : bmdFormat8BitYUV;
+    if (! mDevice->Open(width, height, pixelFormat, frameDuration, timeScale, mDelegate))
+        return false;
+
+    // The preroll, the frame being shown and the one being filled
+    std::vector<IDeckLinkMutableVideoFrame*> frames;
+    for (int i = 0; i < mPreroll + 2; i++)
+    {
+        IDeckLinkMutableVideoFrame* frame = mDevice->CreateFrame();
+        if (! frame)
+        {
+            fprintf(stderr, "%s: cannot allocate output frames\n", getName());
+            for (size_t j = 0; j < frames.size(); j++)
+                frames[j]->Release();
+            mDevice->Close();
+            return false;
+        }
+        frames.push_back(frame);
+    }
+
+    mFrameDuration = frameDuration;
+    mNextDisplayTime = 0;
+    mPlaying = false;
+    mScheduled = 0;
+    mResyncs = 0;
+
+    QMutexLocker locker(&mMutex);
+    mFrames = frames;
+    mFree = frames;
+    mCompleted = 0;
+    mLate = 0;
+    mDropped = 0;
+    mFlushed = 0;
+    mSkipped = 0;
+    mOpen = true;
+
+    fprintf(stderr, "%s: playing out %ux%u %s at %.2f frames/s after %d frames preroll\n", getName(), width, height,
+            pixelFormat == bmdFormat8BitYUV ? "UYVY" : "BGRA", (double)timeScale / frameDuration, mPreroll);
+    return true;
+}
+
+// RGBA rows bottom-up to BGRA rows top-down, UYVY copied, NV12 to UYVY with every chroma row used
+// for two rows.  The warp's alpha is not a key, so the output is opaque.
+void PlayoutSink::convertFrame(WarpedFrame* frame, IDeckLinkMutableVideoFrame* output)
+{
+    void* bytes;
+    output->GetBytes(&bytes);
+    long outputRowBytes = output->GetRowBytes();
+    unsigned width = std::min(frame->width(), (unsigned)output->GetWidth());
+    unsigned height = std::min(frame->height(), (unsigned)output->GetHeight());
+
+    for (unsigned y = 0; y < height; y++)
+    {
+        unsigned char* out = (unsigned char*)bytes + (size_t)y * outputRowBytes;
+        switch (frame->format())
+        {
+        case WarpedFrame::FormatRGBA:
+        {
+            const unsigned char* in = frame->bytes() + (size_t)(frame->height() - 1 - y) * frame->rowBytes();
+            for (unsigned x = 0; x < width; x++, in += 4, out += 4)
+            {
+                out[0] = in[2];
+                out[1] = in[1];
+                out[2] = in[0];
+                out[3] = 0xff;
+            }
+            break;
+        }
+        case WarpedFrame::FormatUYVY:
+            memcpy(out, frame->bytes() + (size_t)y * frame->rowBytes(), width * 2);
+            break;
+        default:
+        {
+            const unsigned char* luma = frame->bytes() + (size_t)y * frame->rowBytes();
+            const unsigned char* chroma = frame->bytes() + (size_t)frame->height() * frame->rowBytes() + (size_t)(y / 2) * frame->rowBytes();
+            for (unsigned x = 0; x + 1 < width; x += 2, out += 4)
+            {
+                out[0] = chroma[x];
+                out[1] = luma[x];
+                out[2] = chroma[x + 1];
+                out[3] = luma[x + 1];
+            }
+            break;
+        }
+        }
+    }
+}
+
+void PlayoutSink::WriteFrame(WarpedFrame* frame)
+{
+    IDeckLinkMutableVideoFrame* output = NULL;
+    {
+        QMutexLocker locker(&mMutex);
+        if (! mOpen)
+            return;
+        if (mFree.empty())
+        {
+            // The output is behind; showing this frame would add to the latency
+            mSkipped++;
+            return;
+        }
+        output = mFree.back();
+        mFree.pop_back();
+    }
+
+    convertFrame(frame, output);
+
+    // A frame due within the next frame duration would arrive too late, so after a stall, or with
+    // an output clock faster than the capture, the preroll is restored from the current time on
+    if (mPlaying)
+    {
+        BMDTimeValue now = mDevice->streamTime();
+        if (now >= 0 && mNextDisplayTime < now + mFrameDuration)
+        {
+            mNextDisplayTime = (now / mFrameDuration + mPreroll) * mFrameDuration;
+            mResyncs++;
+        }
+    }
+
+    if (! mDevice->ScheduleFrame(output, mNextDisplayTime))
+    {
+        QMutexLocker locker(&mMutex);
+        mFree.push_back(output);
+        mSkipped++;
+        return;
+    }
+    mScheduled++;
+    mNextDisplayTime += mFrameDuration;
+
+    if (! mPlaying && mScheduled >= (unsigned long long)mPreroll)
+        mPlaying = mDevice->StartPlayback(0);
+}
+
+void PlayoutSink::frameCompleted(IDeckLinkVideoFrame* frame, BMDOutputFrameCompletionResult result)
+{
+    QMutexLocker locker(&mMutex);
+    if (! mOpen)
+        return;
+
+    switch (result)
+    {
+    case bmdOutputFrameCompleted:       mCompleted++; break;
+    case bmdOutputFrameDisplayedLate:   mCompleted++; mLate++; break;
+    case bmdOutputFrameDropped:         mDropped++; break;
+    case bmdOutputFrameFlushed:         mFlushed++; break;
+    }
+
+    for (size_t i = 0; i < mFrames.size(); i++)
+    {
+        if (static_cast<IDeckLinkVideoFrame*>(mFrames[i]) == frame)
+        {
+            mFree.push_back(mFrames[i]);
+            break;
+        }
+    }
+}
+
+void PlayoutSink::Close()
+{
+    mMutex.lock();
+    bool open = mOpen;
+    mMutex.unlock();
+    if (! open)
+        return;
+
+    // Scheduled frames come back flushed
+    mDevice->Close();
+
+    QMutexLocker locker(&mMutex);
+    mOpen = false;
+    for (size_t i = 0; i < mFrames.size(); i++)
+        mFrames[i]->Release();
+    mFrames.clear();
+    mFree.clear();
+
+    fprintf(stderr, "%s: %llu frames scheduled, %llu shown (%llu late), %llu dropped and %llu flushed by the output, "
+            "%llu not scheduled, %llu resynchronisations\n",
+            getName(), mScheduled, mCompleted, mLate, mDropped, mFlushed, mSkipped, mResyncs);
+}
+
+////////////////////////////////////////////
+// PlayoutDelegate
+////////////////////////////////////////////
+
+HRESULT PlayoutDelegate::ScheduledFrameCompleted(IDeckLinkVideoFrame* completedFrame, BMDOutputFrameCompletionResult result)
+{
+    mSink->frameCompleted(completedFrame, result);
+    return S_OK;
+}
@@ -0,0 +1,257 @@
+#ifndef PLAYOUT_SINK_H
+#define PLAYOUT_SINK_H
+
+#include "DeckLinkAPI.h"
+#include "FrameSink.h"
+
+#include <QAtomicInt>
+#include <QMutex>
+#include <QThread>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+class PlayoutDelegate;
+class SimulatedPlayoutThread;
+
+////////////////////////////////////////////
+// PlayoutDevice
+////////////////////////////////////////////
+
+// The part of IDeckLinkOutput that scheduled playback needs, so PlayoutSink runs the same against a
+// DeckLink card and against SimulatedPlayoutDevice.  Times are in the time scale given to Open().
+class PlayoutDevice
+{
+public:
+    virtual ~PlayoutDevice() {}
+
+    virtual const char* getName() = 0;
+
+    // Enable output of frames of the given size, rate and pixel format, bmdFormat8BitBGRA or
+    // bmdFormat8BitYUV.  Completed frames are reported to callback, on a thread of the device.
+    virtual bool Open(unsigned width, unsigned height, BMDPixelFormat pixelFormat, BMDTimeValue frameDuration,
+                      BMDTimeScale timeScale, IDeckLinkVideoOutputCallback* callback) = 0;
+    // A frame in that format, rows top-down, to fill and schedule
+    virtual IDeckLinkMutableVideoFrame* CreateFrame() = 0;
+    // Show frame for one frame duration from displayTime; the device keeps a reference until completion
+    virtual bool ScheduleFrame(IDeckLinkVideoFrame* frame, BMDTimeValue displayTime) = 0;
+    // Start showing the frames scheduled from startTime on
+    virtual bool StartPlayback(BMDTimeValue startTime) = 0;
+    // Stream time being shown, negative before StartPlayback()
+    virtual BMDTimeValue streamTime() = 0;
+    // Stop playback, completing the frames still scheduled as flushed, and disable the output
+    virtual void Close() = 0;
+};
+
+////////////////////////////////////////////
+// DeckLinkPlayoutDevice
+////////////////////////////////////////////
+
+// Playout on the output of a DeckLink card, in the display mode matching the frame size and rate
+class DeckLinkPlayoutDevice : public PlayoutDevice
+{
+public:
+    DeckLinkPlayoutDevice(int device);
+    virtual ~DeckLinkPlayoutDevice();
+
+    virtual const char* getName() { return "decklink"; }
+
+    virtual bool Open(unsigned width, unsigned height, BMDPixelFormat pixelFormat, BMDTimeValue frameDuration,
+                      BMDTimeScale timeScale, IDeckLinkVideoOutputCallback* callback);
+    virtual IDeckLinkMutableVideoFrame* CreateFrame();
+    virtual bool ScheduleFrame(IDeckLinkVideoFrame* frame, BMDTimeValue displayTime);
+    virtual bool StartPlayback(BMDTimeValue startTime);
+    virtual BMDTimeValue streamTime();
+    virtual void Close();
+
+private:
+    bool findDisplayMode(BMDDisplayMode& displayMode);
+
+    int                 mDevice;
+    IDeckLinkOutput*    mDLOutput;
+    unsigned            mWidth;
+    unsigned            mHeight;
+    BMDPixelFormat      mPixelFormat;
+    BMDTimeValue        mFrameDuration;
+    BMDTimeScale        mTimeScale;
+    bool                mPlaying;
+};
+
+////////////////////////////////////////////
+// SimulatedPlayoutDevice
+////////////////////////////////////////////
+
+// Stand-in for a DeckLink output: a thread plays the scheduled frames out on the monotonic clock at
+// the frame rate and completes them like a card would.  Of the frames due at a frame boundary the
+// newest is shown, on time or, when it was scheduled after its display time had passed, late; older
+// ones are dropped.  With a log file every frame is recorded as a CSV line: its display time, when
+// it was scheduled and shown (ms since Open()) and the completion result.
+class SimulatedPlayoutDevice : public PlayoutDevice
+{
+public:
+    // logPath empty for no log, "-" for stdout
+    SimulatedPlayoutDevice(const std::string& logPath);
+    virtual ~SimulatedPlayoutDevice();
+
+    virtual const char* getName() { return "playout-sim"; }
+
+    virtual bool Open(unsigned width, unsigned height, BMDPixelFormat pixelFormat, BMDTimeValue frameDuration,
+                      BMDTimeScale timeScale, IDeckLinkVideoOutputCallback* callback);
+    virtual IDeckLinkMutableVideoFrame* CreateFrame();
+    virtual bool ScheduleFrame(IDeckLinkVideoFrame* frame, BMDTimeValue displayTime);
+    virtual bool StartPlayback(BMDTimeValue startTime);
+    virtual BMDTimeValue streamTime();
+    virtual void Close();
+
+private:
+    friend class SimulatedPlayoutThread;
+
+    struct ScheduledFrame {
+        IDeckLinkVideoFrame*    frame;
+        BMDTimeValue            displayTime;
+        BMDTimeValue            scheduledNs;    // monotonic
+    };
+
+    static bool earlierDisplayTime(const ScheduledFrame& a, const ScheduledFrame& b);
+    void showFrame(BMDTimeValue displayTime);
+    void complete(const ScheduledFrame& scheduled, BMDTimeValue shownNs, BMDOutputFrameCompletionResult result);
+
+    std::string                     mLogPath;
+    FILE*                           mLog;
+    IDeckLinkVideoOutputCallback*   mCallback;
+    SimulatedPlayoutThread*         mThread;
+    unsigned                        mWidth;
+    unsigned                        mHeight;
+    BMDPixelFormat                  mPixelFormat;
+    BMDTimeValue                    mFrameDuration;
+    BMDTimeScale                    mTimeScale;
+    BMDTimeValue                    mOpenNs;
+
+    QMutex                          mMutex;         // protects the members below
+    std::vector<ScheduledFrame>     mScheduled;
+    BMDTimeValue                    mStartTime;     // stream time of the playback start
+    BMDTimeValue                    mStartNs;       // monotonic time of the playback start, 0 before
+};
+
+////////////////////////////////////////////
+// PlayoutVideoFrame
+////////////////////////////////////////////
+
+// BGRA or UYVY frame in host memory, the frames of SimulatedPlayoutDevice
+class PlayoutVideoFrame : public IDeckLinkMutableVideoFrame
+{
+public:
+    PlayoutVideoFrame(long width, long height, BMDPixelFormat pixelFormat);
+
+    // IUnknown methods
+    virtual HRESULT STDMETHODCALLTYPE   QueryInterface(REFIID iid, LPVOID *ppv);
+    virtual ULONG STDMETHODCALLTYPE     AddRef(void);
+    virtual ULONG STDMETHODCALLTYPE     Release(void);
+
+    // IDeckLinkVideoFrame methods
+    virtual long GetWidth(void)                 { return mWidth; }
+    virtual long GetHeight(void)                { return mHeight; }
+    virtual long GetRowBytes(void)              { return mPixelFormat == bmdFormat8BitYUV ? mWidth * 2 : mWidth * 4; }
+    virtual BMDPixelFormat GetPixelFormat(void) { return mPixelFormat; }
+    virtual BMDFrameFlags GetFlags(void)        { return mFlags; }
+    virtual HRESULT GetBytes(void **buffer)     { *buffer = &mBytes[0]; return S_OK; }
+    virtual HRESULT GetTimecode(BMDTimecodeFormat format, IDeckLinkTimecode **timecode);
+    virtual HRESULT GetAncillaryData(IDeckLinkVideoFrameAncillary **ancillary);
+
+    // IDeckLinkMutableVideoFrame methods; only the flags are kept
+    virtual HRESULT SetFlags(BMDFrameFlags newFlags) { mFlags = newFlags; return S_OK; }
+    virtual HRESULT SetTimecode(BMDTimecodeFormat format, IDeckLinkTimecode *timecode);
+    virtual HRESULT SetTimecodeFromComponents(BMDTimecodeFormat format, uint8_t hours, uint8_t minutes, uint8_t seconds, uint8_t frames, BMDTimecodeFlags flags);
+    virtual HRESULT SetAncillaryData(IDeckLinkVideoFrameAncillary *ancillary);
+    virtual HRESULT SetTimecodeUserBits(BMDTimecodeFormat format, BMDTimecodeUserBits userBits);
+
+protected:
+    virtual ~PlayoutVideoFrame() {}
+
+private:
+    QAtomicInt                  mRefCount;
+    long                        mWidth;
+    long                        mHeight;
+    BMDPixelFormat              mPixelFormat;
+    BMDFrameFlags               mFlags;
+    std::vector<unsigned char>  mBytes;
+};
+
+////////////////////////////////////////////
+// PlayoutSink
+////////////////////////////////////////////
+
+// Schedules warped frames for playout on a PlayoutDevice, so the picture leaves on a video output
+// rather than through the desktop's compositor.  Frames are copied, RGBA ones converted to BGRA and
+// NV12 ones to UYVY, into a small pool of device frames and scheduled back to back, one frame
+// duration apart; playback starts once preroll frames are scheduled, which is also the latency the
+// output adds.  Completed frames return to the pool.
+//
+// Capture and output run on different clocks.  When the output runs slow the pool runs empty and
+// incoming frames are not scheduled, which keeps the latency at the preroll; when it runs fast, or
+// after a stall, frames would be late and scheduling continues preroll frames after the current
+// stream time instead.
+class PlayoutSink : public FrameSink
+{
+public:
+    // Takes ownership of device
+    PlayoutSink(PlayoutDevice* device, int preroll = DefaultPreroll);
+    virtual ~PlayoutSink();
+
+    enum { DefaultPreroll = 3 };
+
+    virtual const char* getName() { return mDevice->getName(); }
+
+    virtual bool Open(unsigned width, unsigned height, WarpedFrame::Format format, BMDTimeValue frameDuration, BMDTimeScale timeScale);
+    virtual void WriteFrame(WarpedFrame* frame);
+    virtual void Close();
+
+    // Device thread: frame has been shown, dropped or flushed
+    void frameCompleted(IDeckLinkVideoFrame* frame, BMDOutputFrameCompletionResult result);
+
+private:
+    void convertFrame(WarpedFrame* frame, IDeckLinkMutableVideoFrame* output);
+
+    PlayoutDevice*                              mDevice;
+    PlayoutDelegate*                            mDelegate;
+    int                                         mPreroll;
+    BMDTimeValue                                mFrameDuration;
+    BMDTimeValue                                mNextDisplayTime;
+    bool                                        mPlaying;
+    unsigned long long                          mScheduled;
+    unsigned long long                          mResyncs;
+
+    QMutex                                      mMutex;     // protects the members below
+    bool                                        mOpen;
+    std::vector<IDeckLinkMutableVideoFrame*>    mFrames;    // the pool
+    std::vector<IDeckLinkMutableVideoFrame*>    mFree;
+    unsigned long long                          mCompleted; // shown, including late ones
+    unsigned long long                          mLate;
+    unsigned long long                          mDropped;   // by the device
+    unsigned long long                          mFlushed;
+    unsigned long long                          mSkipped;   // not scheduled: the pool was empty or the device refused
+};
+
+////////////////////////////////////////////
+// PlayoutDelegate
+////////////////////////////////////////////
+
+// Completion callback of PlayoutSink, the counterpart of CaptureDelegate
+class PlayoutDelegate : public IDeckLinkVideoOutputCallback
+{
+public:
+    PlayoutDelegate(PlayoutSink* sink) : mSink(sink) { }
+
+    // IUnknown needs only a dummy implementation
+    virtual HRESULT STDMETHODCALLTYPE   QueryInterface (REFIID /*iid*/, LPVOID* /*ppv*/)    {return E_NOINTERFACE;}
+    virtual ULONG   STDMETHODCALLTYPE   AddRef ()                                           {return 1;}
+    virtual ULONG   STDMETHODCALLTYPE   Release ()                                          {return 1;}
+
+    virtual HRESULT STDMETHODCALLTYPE   ScheduledFrameCompleted(IDeckLinkVideoFrame* completedFrame, BMDOutputFrameCompletionResult result);
+    virtual HRESULT STDMETHODCALLTYPE   ScheduledPlaybackHasStopped() { return S_OK; }
+
+private:
+    PlayoutSink*                            mSink;
+};
+
+#endif
@@ -0,0 +1,384 @@
+#include "ReadbackRing.h"
+
+#include <stdio.h>
+
+namespace {
+
+const GLuint POSITION_ATTRIB = 0;
+
+const char* conversionVersion = "#version 130 \n";
+
+const char* conversionVertexSource =
+    "attribute vec2 position; \n"
+    "void main() { \n"
+    "    gl_Position = vec4(position, 0.0, 1.0); \n"
+    "} \n";
+
+// RGB to limited range YCbCr, with rows counted from the top of the warped frame
+const char* conversionSource =
+    "uniform sampler2D warped; \n"
+    "uniform int height; \n"
+
+    "#if COLOUR_MATRIX == 601 \n"
+    "const float Kr = 0.299; \n"
+    "const float Kb = 0.114; \n"
+    "#else \n"
+    "const float Kr = 0.2126; \n"
+    "const float Kb = 0.0722; \n"
+    "#endif \n"
+
+    "vec3 rgb2YCbCr(vec3 rgb) \n"
+    "{ \n"
+    "    float Y = dot(rgb, vec3(Kr, 1.0 - Kr - Kb, Kb)); \n"
+    "    return vec3(Y, (rgb.b - Y) / (2.0 * (1.0 - Kb)), (rgb.r - Y) / (2.0 * (1.0 - Kr))); \n"
+    "} \n"
+
+    // Y to [16..235], C to [16..240] around 128, normalised for an 8 bit target
+    "float lumaByte(float Y) { return (16.0 + 219.0 * Y) / 255.0; } \n"
+    "float chromaByte(float C) { return (128.0 + 224.0 * C) / 255.0; } \n"
+
+    "vec3 pixel(int x, int y) \n"
+    "{ \n"
+    "    return texelFetch(warped, ivec2(x, height - 1 - y), 0).rgb; \n"
+    "} \n"
+
+    "#if FORMAT_UYVY \n"
+    // Target of width / 2 RGBA texels, each a macropixel: Cb Y0 Cr Y1
+    "void main() \n"
+    "{ \n"
+    "    ivec2 p = ivec2(gl_FragCoord.xy); \n"
+    "    vec3 a = rgb2YCbCr(pixel(2 * p.x, p.y)); \n"
+    "    vec3 b = rgb2YCbCr(pixel(2 * p.x + 1, p.y)); \n"
+    "    vec2 C = (a.yz + b.yz) * 0.5; \n"
+    "    gl_FragColor = vec4(chromaByte(C.x), lumaByte(a.x), chromaByte(C.y), lumaByte(b.x)); \n"
+    "} \n"
+    "#else \n"
+    // Single channel target of height * 3 / 2 rows: the luma plane, then Cb Cr pairs of 2x2 pixels
+    "void main() \n"
+    "{ \n"
+    "    ivec2 p = ivec2(gl_FragCoord.xy); \n"
+    "    if (p.y < height) \n"
+    "    { \n"
+    "        gl_FragColor = vec4(lumaByte(rgb2YCbCr(pixel(p.x, p.y)).x)); \n"
+    "        return; \n"
+    "    } \n"
+    "    int x = p.x - p.x % 2; \n"
+    "    int y = (p.y - height) * 2; \n"
+    // The conversion is affine, so converting the mean is the mean of the converted pixels
+    "    vec3 C = rgb2YCbCr((pixel(x, y) + pixel(x + 1, y) + pixel(x, y + 1) + pixel(x + 1, y + 1)) * 0.25); \n"
+    "    gl_FragColor = vec4(chromaByte(p.x % 2 == 0 ? C.y : C.z)); \n"
+    "} \n"
+    "#endif \n";
+
+} // namespace
+
+ReadbackRing::ReadbackRing() :
+    mNext(0),
+    mOldest(0),
+    mPending(0),
+    mWidth(0), mHeight(0),
+    mFormat(WarpedFrame::FormatRGBA),
+    mBufferSize(0),
+    mPersistent(false),
+    mDroppedCount(0),
+    mIdReadFrameBuf(0),
+    mIdConvertFrameBuf(0),
+    mConvertTexture(0),
+    mQuadBuffer(0),
+    mProgram(0),
+    mConvertWidth(0), mConvertHeight(0)
+{
+    mShaderManager.bindAttribLocation(POSITION_ATTRIB, "position");
+}
+
+ReadbackRing::~ReadbackRing()
+{
+    // Buffers are owned by the GL context, cleanup() must be called while it is current
+}
+
+bool ReadbackRing::init(unsigned width, unsigned height, WarpedFrame::Format format, int depth,
+                        WarpRenderer::ColourMatrix matrix, QString& error)
+{
+    cleanup();
+
+    if (format != WarpedFrame::FormatRGBA && (width % 2 || height % 2))
+    {
+        error = QString("Cannot read %1x%2 frames back as %3, the sizes must be even.").arg((int)width).arg((int)height).arg(WarpedFrame::formatName(format));
+        return false;
+    }
+
+    mWidth = width;
+    mHeight = height;
+    mFormat = format;
+    mBufferSize = WarpedFrame::byteCount(width, height, format);
+    mPersistent = glBufferStorage != NULL;
+
+    glGenFramebuffersEXT(1, &mIdReadFrameBuf);
+    if (mFormat != WarpedFrame::FormatRGBA && ! initConversion(matrix, error))
+    {
+        cleanup();
+        return false;
+    }
+
+    mSlots.resize(depth < 1 ? 1 : depth);
+    for (size_t i = 0; i < mSlots.size(); i++)
+    {
+        Slot& slot = mSlots[i];
+        slot.fence = NULL;
+        slot.mapped = NULL;
+        slot.state.storeRelease(SlotFree);
+
+        glGenBuffers(1, &slot.buffer);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+
+        if (mPersistent)
+        {
+            // Client storage: the CPU reads every byte, which is slow from write-combined memory
+            const GLbitfield flags = GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            glBufferStorage(GL_PIXEL_PACK_BUFFER, mBufferSize, NULL, flags | GL_CLIENT_STORAGE_BIT);
+            slot.mapped = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, mBufferSize, flags);
+            if (slot.mapped == NULL)
+            {
+                error = QString("Cannot map a persistent pack buffer of %1 bytes.").arg((int)mBufferSize);
+                glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+                cleanup();
+                return false;
+            }
+        }
+        else
+        {
+            glBufferData(GL_PIXEL_PACK_BUFFER, mBufferSize, NULL, GL_STREAM_READ);
+        }
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    mNext = 0;
+    mOldest = 0;
+    mPending = 0;
+    mDroppedCount = 0;
+
+    fprintf(stderr, "Reading frames back as %s through %d %s pack buffers\n", WarpedFrame::formatName(mFormat),
+            (int)mSlots.size(), mPersistent ? "persistently mapped" : "mapped on completion");
+    return true;
+}
+
+bool ReadbackRing::initConversion(WarpRenderer::ColourMatrix matrix, QString& error)
+{
+    char defines[128];
+    snprintf(defines, sizeof(defines), "#define COLOUR_MATRIX %d \n#define FORMAT_UYVY %d \n",
+             matrix == WarpRenderer::ColourRec601 ? 601 : 709, mFormat == WarpedFrame::FormatUYVY ? 1 : 0);
+
+    std::vector<const char*> vertexSources;
+    vertexSources.push_back(conversionVersion);
+    vertexSources.push_back(conversionVertexSource);
+    std::vector<const char*> fragmentSources;
+    fragmentSources.push_back(conversionVersion);
+    fragmentSources.push_back(defines);
+    fragmentSources.push_back(conversionSource);
+
+    QString shaderError;
+    mProgram = mShaderManager.program(vertexSources, fragmentSources, shaderError);
+    if (! mProgram)
+    {
+        error = "The readback conversion shader failed to compile: " + shaderError;
+        return false;
+    }
+
+    if (mFormat == WarpedFrame::FormatUYVY)
+    {
+        mConvertWidth = mWidth / 2;
+        mConvertHeight = mHeight;
+    }
+    else
+    {
+        mConvertWidth = mWidth;
+        mConvertHeight = mHeight + mHeight / 2;
+    }
+
+    glGenTextures(1, &mConvertTexture);
+    glBindTexture(GL_TEXTURE_2D, mConvertTexture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexImage2D(GL_TEXTURE_2D, 0, mFormat == WarpedFrame::FormatUYVY ? GL_RGBA8 : GL_R8, mConvertWidth, mConvertHeight, 0,
+                 mFormat == WarpedFrame::FormatUYVY ? GL_RGBA : GL_RED, GL_UNSIGNED_BYTE, NULL);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glGenFramebuffersEXT(1, &mIdConvertFrameBuf);
+    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, mIdConvertFrameBuf);
+    glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT, GL_TEXTURE_2D, mConvertTexture, 0);
+    GLenum status = glCheckFramebufferStatusEXT(GL_FRAMEBUFFER_EXT);
+    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
+    if (status != GL_FRAMEBUFFER_COMPLETE_EXT)
+    {
+        error = QString("Cannot render to the %1 readback texture.").arg(WarpedFrame::formatName(mFormat));
+        return false;
+    }
+
+    // Two triangles covering the target
+    static const float quad[] = { -1, -1,  1, -1,  -1, 1,  1, 1 };
+    glGenBuffers(1, &mQuadBuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, mQuadBuffer);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(quad), quad, GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    // Nothing else draws in this context
+    glEnableVertexAttribArray(POSITION_ATTRIB);
+    return true;
+}
+
+void ReadbackRing::cleanup()
+{
+    for (size_t i = 0; i < mSlots.size(); i++)
+    {
+        Slot& slot = mSlots[i];
+        if (slot.state.loadAcquire() == SlotHeld)
+            fprintf(stderr, "Readback ring: a sink still holds a frame of slot %d\n", (int)i);
+        if (slot.fence)
+            glDeleteSync(slot.fence);
+        if (slot.mapped)
+        {
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        }
+        glDeleteBuffers(1, &slot.buffer);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    mSlots.clear();
+    mPending = 0;
+
+    if (mDroppedCount)
+        fprintf(stderr, "Readback ring: %llu frames dropped, no pack buffer was free\n", mDroppedCount);
+    mDroppedCount = 0;
+
+    if (mIdReadFrameBuf)
+        glDeleteFramebuffersEXT(1, &mIdReadFrameBuf);
+    if (mIdConvertFrameBuf)
+        glDeleteFramebuffersEXT(1, &mIdConvertFrameBuf);
+    if (mConvertTexture)
+        glDeleteTextures(1, &mConvertTexture);
+    if (mQuadBuffer)
+        glDeleteBuffers(1, &mQuadBuffer);
+    mIdReadFrameBuf = 0;
+    mIdConvertFrameBuf = 0;
+    mConvertTexture = 0;
+    mQuadBuffer = 0;
+    // The program stays with the shader manager for the next init()
+    mProgram = 0;
+}
+
+void ReadbackRing::frameReleased(int slot)
+{
+    mSlots[slot].state.storeRelease(SlotReleased);
+}
+
+// Return the slots of released frames to the ring; mapped on completion buffers are unmapped first
+void ReadbackRing::reclaim()
+{
+    for (size_t i = 0; i < mSlots.size(); i++)
+    {
+        Slot& slot = mSlots[i];
+        if (slot.state.loadAcquire() != SlotReleased)
+            continue;
+
+        if (! mPersistent && slot.mapped)
+        {
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+            slot.mapped = NULL;
+        }
+        slot.state.storeRelease(SlotFree);
+    }
+}
+
+bool ReadbackRing::read(GLuint texture, const FrameTimes& times)
+{
+    reclaim();
+
+    Slot& slot = mSlots[mNext];
+    if (slot.state.loadAcquire() != SlotFree)
+    {
+        ++mDroppedCount;
+        return false;
+    }
+
+    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, mIdReadFrameBuf);
+    glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT, GL_TEXTURE_2D, texture, 0);
+
+    GLenum format = GL_RGBA;
+    unsigned width = mWidth;
+    unsigned height = mHeight;
+    if (mFormat != WarpedFrame::FormatRGBA)
+    {
+        glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, mIdConvertFrameBuf);
+        glViewport(0, 0, mConvertWidth, mConvertHeight);
+
+        glUseProgram(mProgram);
+        glUniform1i(glGetUniformLocation(mProgram, "warped"), 0);
+        glUniform1i(glGetUniformLocation(mProgram, "height"), mHeight);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, texture);
+
+        glBindBuffer(GL_ARRAY_BUFFER, mQuadBuffer);
+        glVertexAttribPointer(POSITION_ATTRIB, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), (void*)0);
+        glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glUseProgram(0);
+
+        format = mFormat == WarpedFrame::FormatUYVY ? GL_RGBA : GL_RED;
+        width = mConvertWidth;
+        height = mConvertHeight;
+    }
+
+    // Into the buffer: returns once the copy is queued
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, width, height, format, GL_UNSIGNED_BYTE, (void*)0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, mIdReadFrameBuf);
+    glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT, GL_TEXTURE_2D, 0, 0);
+    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
+
+    slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    slot.times = times;
+    slot.state.storeRelease(SlotReading);
+    mNext = (mNext + 1) % mSlots.size();
+    ++mPending;
+    return true;
+}
+
+WarpedFrame* ReadbackRing::takeCompleted()
+{
+    if (mPending == 0)
+        return NULL;
+
+    Slot& slot = mSlots[mOldest];
+    if (glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0) == GL_TIMEOUT_EXPIRED)
+        return NULL;
+    glDeleteSync(slot.fence);
+    slot.fence = NULL;
+
+    if (! mPersistent)
+    {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+        slot.mapped = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, mBufferSize, GL_MAP_READ_BIT);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    }
+
+    int index = mOldest;
+    mOldest = (mOldest + 1) % mSlots.size();
+    --mPending;
+
+    if (! slot.mapped)
+    {
+        fprintf(stderr, "Readback ring: cannot map a pack buffer, dropping the frame\n");
+        slot.state.storeRelease(SlotFree);
+        ++mDroppedCount;
+        return NULL;
+    }
+
+    slot.state.storeRelease(SlotHeld);
+    return new WarpedFrame(mWidth, mHeight, mFormat, (unsigned char*)slot.mapped, slot.times, this, index);
+}
@@ -0,0 +1,102 @@
+#ifndef READBACK_RING_H
+#define READBACK_RING_H
+
+#include "FrameSink.h"
+#include "GLExtensions.h"
+#include "ShaderManager.h"
+#include "WarpRenderer.h"
+
+#include <QAtomicInt>
+#include <QString>
+#include <vector>
+
+////////////////////////////////////////////
+// ReadbackRing
+////////////////////////////////////////////
+
+// Asynchronous readback of warped frames into a ring of GL_PIXEL_PACK_BUFFERs, the counterpart of
+// UnpackBufferRing.  read() only queues the copy of a colour target into the next slot's buffer and
+// fences it; takeCompleted() hands out frames whose fence has signalled, in order, as WarpedFrames
+// pointing straight into the mapped buffer, so sinks get the pixels without another copy.  A slot
+// is reused once the last reference to its frame is released, from any thread.
+//
+// For UYVY and NV12 the target is first converted by a fragment shader, with the colour matrix of
+// the warp and limited range, flipped to rows top-down, which transfers half (UYVY) or three
+// eighths (NV12) of the RGBA bytes.
+//
+// With GL_ARB_buffer_storage the buffers are mapped once, persistently and in client memory, which
+// reads fastest; otherwise a buffer is mapped while its frame is held.
+//
+// All methods but frameReleased() must be called with the owning GL context, or one sharing with
+// it, current.  Frames must be released before cleanup().
+class ReadbackRing : public WarpedFrame::Owner
+{
+public:
+    ReadbackRing();
+    ~ReadbackRing();
+
+    // Read width x height RGBA targets as format; the sizes must be even for UYVY and NV12
+    bool init(unsigned width, unsigned height, WarpedFrame::Format format, int depth,
+              WarpRenderer::ColourMatrix matrix, QString& error);
+    void cleanup();
+
+    // Queue the readback of texture.  False when every slot is being read or held by a sink, in
+    // which case the frame is dropped.
+    bool read(GLuint texture, const FrameTimes& times);
+    // The oldest frame read completely, or NULL; the caller must Release() it
+    WarpedFrame* takeCompleted();
+    // Reads queued but not taken yet
+    bool hasPending() const { return mPending > 0; }
+
+    WarpedFrame::Format format() const { return mFormat; }
+    int depth() const { return (int)mSlots.size(); }
+    bool persistent() const { return mPersistent; }
+
+    // Frames dropped because no slot was free
+    unsigned long long droppedCount() const { return mDroppedCount; }
+
+    // WarpedFrame::Owner, any thread
+    virtual void frameReleased(int slot);
+
+private:
+    enum SlotState {
+        SlotFree = 0,
+        SlotReading,        // fenced, not taken yet
+        SlotHeld,           // handed out as a WarpedFrame
+        SlotReleased        // the frame is gone, the buffer still to be unmapped
+    };
+
+    struct Slot {
+        GLuint      buffer;
+        GLsync      fence;
+        void*       mapped;
+        FrameTimes  times;
+        QAtomicInt  state;
+    };
+
+    bool initConversion(WarpRenderer::ColourMatrix matrix, QString& error);
+    void reclaim();
+
+    std::vector<Slot>   mSlots;
+    int                 mNext;              // slot read() fills next
+    int                 mOldest;            // slot takeCompleted() looks at
+    int                 mPending;
+    unsigned            mWidth;
+    unsigned            mHeight;
+    WarpedFrame::Format mFormat;
+    unsigned            mBufferSize;
+    bool                mPersistent;
+    unsigned long long  mDroppedCount;
+
+    // Source target attachment, and the conversion pass for UYVY and NV12
+    GLuint              mIdReadFrameBuf;
+    GLuint              mIdConvertFrameBuf;
+    GLuint              mConvertTexture;
+    GLuint              mQuadBuffer;
+    GLuint              mProgram;
+    unsigned            mConvertWidth;
+    unsigned            mConvertHeight;
+    ShaderManager       mShaderManager;
+};
+
+#endif
@@ -0,0 +1,455 @@
+#include "RecordedFrameSource.h"
+#include "FramePacer.h"
+
+#include <QCoreApplication>
+#include <QMetaObject>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <sstream>
+
+namespace {
+
+// Frames ahead of the one being delivered that the kernel is asked to read in
+const unsigned kReadaheadFrames = 8;
+
+void sleepUntilNs(BMDTimeValue deadline)
+{
+    struct timespec ts;
+    ts.tv_sec = deadline / 1000000000LL;
+    ts.tv_nsec = deadline % 1000000000LL;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) != 0)
+        ;
+}
+
+} // namespace
+
+////////////////////////////////////////////
+// RecordedFrameThread
+////////////////////////////////////////////
+class RecordedFrameThread : public QThread
+{
+public:
+    RecordedFrameThread(RecordedFrameSource* source) :
+        mSource(source), mStop(0), mFramesDelivered(0), mFramesDropped(0), mLoopsDone(0), mElapsedSeconds(0) {}
+
+    void requestStop() { mStop.storeRelease(1); }
+
+    unsigned long long framesDelivered() const { return mFramesDelivered; }
+    unsigned long long framesDropped() const { return mFramesDropped; }
+    double elapsedSeconds() const { return mElapsedSeconds; }
+
+protected:
+    virtual void run();
+
+private:
+    void readahead(size_t entry);
+
+    RecordedFrameSource*    mSource;
+    QAtomicInt              mStop;
+    unsigned long long      mFramesDelivered;
+    unsigned long long      mFramesDropped;
+    int                     mLoopsDone;
+    double                  mElapsedSeconds;
+};
+
+void RecordedFrameThread::run()
+{
+    RecordedFrameSource* s = mSource;
+    const size_t        count = s->mEntries.size();
+    const BMDTimeValue  startNs = FramePacer::now();
+    const BMDTimeValue  loopNs = s->loopNs();
+    const BMDTimeValue  streamSpan = count * s->mInfo.frameDuration;
+    BMDTimeValue        periodNs = 0;
+    bool                paced = s->mRate != 0;
+
+    if (s->mRate > 0)
+        periodNs = (BMDTimeValue)(1000000000.0 / s->mRate);
+
+    readahead(0);
+
+    size_t i = 0;
+    while (mStop.loadAcquire() == 0)
+    {
+        if (i == count)
+        {
+            i = 0;
+            if (++mLoopsDone == s->mLoops)
+                break;
+        }
+
+        if (periodNs > 0)
+            sleepUntilNs(startNs + (BMDTimeValue)(mLoopsDone * count + i) * periodNs);
+        else if (paced)
+            sleepUntilNs(startNs + mLoopsDone * loopNs + s->offsetNs(i));
+        else if (s->mFramesInFlight.loadAcquire() >= s->mMaxFramesInFlight)
+        {
+            // Free-running: wait for the pipeline to hand back a frame rather than counting drops
+            QThread::usleep(100);
+            continue;
+        }
+
+        // Like a card out of capture buffers, a paced replay drops frames the pipeline still holds too many of
+        if (s->mFramesInFlight.loadAcquire() >= s->mMaxFramesInFlight)
+        {
+            ++mFramesDropped;
+            ++i;
+            continue;
+        }
+
+        const RecordedFrameSource::Entry& entry = s->mEntries[i];
+        readahead(i + kReadaheadFrames);
+
+        s->mFramesInFlight.fetchAndAddOrdered(1);
+        RecordedVideoFrame* frame = new RecordedVideoFrame(s->mAllocator, s->mMapping + entry.slot * s->mInfo.slotBytes,
+                                                           &s->mFramesInFlight, s->mFrameWidth, s->mFrameHeight,
+                                                           entry.streamTime + mLoopsDone * streamSpan, FramePacer::now(),
+                                                           s->mFrameDuration, s->mFrameTimescale, entry.noInput);
+
+        // Like the DeckLink driver, the callback gets a borrowed reference; it must AddRef() to keep the frame
+        s->mCallback->VideoInputFrameArrived(frame, NULL);
+        frame->Release();
+
+        ++mFramesDelivered;
+        ++i;
+    }
+
+    mElapsedSeconds = (FramePacer::now() - startNs) / 1e9;
+
+    if (mStop.loadAcquire() == 0)
+    {
+        fprintf(stderr, "Replay: end of %s after %d loop%s\n", s->mPath.c_str(), mLoopsDone, mLoopsDone == 1 ? "" : "s");
+        if (s->mQuitAtEnd && QCoreApplication::instance())
+            QMetaObject::invokeMethod(QCoreApplication::instance(), "quit", Qt::QueuedConnection);
+    }
+}
+
+// Have the pages of a frame a little ahead read in, so the uploader does not fault on them
+void RecordedFrameThread::readahead(size_t entry)
+{
+    const RecordedFrameSource* s = mSource;
+    if (s->mPreload)
+        return;
+
+    entry %= s->mEntries.size();
+    madvise(s->mMapping + s->mEntries[entry].slot * s->mInfo.slotBytes, s->mInfo.slotBytes, MADV_WILLNEED);
+}
+
+////////////////////////////////////////////
+// RecordedFrameSource
+////////////////////////////////////////////
+RecordedFrameSource::RecordedFrameSource(const std::string& path) :
+    mPath(path),
+    mIndexRead(false),
+    mFd(-1),
+    mMapping(NULL),
+    mMappingBytes(0),
+    mAllocator(NULL),
+    mCallback(NULL),
+    mThread(NULL),
+    mRate(-1),
+    mLoops(1),
+    mQuitAtEnd(false),
+    mPreload(false),
+    mMaxFramesInFlight(8),
+    mFramesInFlight(0)
+{
+}
+
+RecordedFrameSource::~RecordedFrameSource()
+{
+    Stop();
+    unmap();
+}
+
+// "original" keeps the recorded cadence, "max" or 0 runs as fast as possible, or a rate in fps
+bool RecordedFrameSource::rateFromName(const std::string& name, double& fps)
+{
+    if (name == "original")
+    {
+        fps = -1;
+        return true;
+    }
+    if (name == "max")
+    {
+        fps = 0;
+        return true;
+    }
+
+    std::istringstream in(name);
+    double rate = 0;
+    if ((in >> rate) && in.eof() && rate >= 0)
+    {
+        fps = rate;
+        return true;
+    }
+    return false;
+}
+
+int RecordedFrameSource::getDeviceList(std::vector<std::string>& devices)
+{
+    devices.clear();
+    devices.push_back("Recording " + mPath);
+    return 0;
+}
+
+int RecordedFrameSource::getModeList(int device, std::vector<std::string>& modes)
+{
+    if (device != 0 || ! readIndex())
+        return 1;
+
+    std::ostringstream stm;
+    stm << mInfo.width << "x" << mInfo.height << " " << (double)mInfo.timeScale / (double)mInfo.frameDuration
+        << "fps, " << mEntries.size() << " frames";
+    modes.clear();
+    modes.push_back(stm.str());
+    return 0;
+}
+
+bool RecordedFrameSource::Open(int device, int mode)
+{
+    if (device != 0 || mode != 0)
+    {
+        fprintf(stderr, "Replay: invalid device %d / mode %d, a recording has one of each\n", device, mode);
+        return false;
+    }
+
+    Stop();
+    if (! readIndex() || ! map())
+        return false;
+
+    mFrameWidth = mInfo.width;
+    mFrameHeight = mInfo.height;
+    mFrameDuration = mInfo.frameDuration;
+    mFrameTimescale = mInfo.timeScale;
+
+    return true;
+}
+
+bool RecordedFrameSource::EnableVideoInput(IDeckLinkMemoryAllocator* allocator, IDeckLinkInputCallback* callback)
+{
+    if (allocator == NULL || callback == NULL || mMapping == NULL)
+        return false;
+
+    mAllocator = allocator;
+    mCallback = callback;
+    return true;
+}
+
+bool RecordedFrameSource::Start()
+{
+    if (mAllocator == NULL || mCallback == NULL)
+        return false;
+
+    if (mThread != NULL)
+        return true;
+
+    if (mRate < 0)
+        fprintf(stderr, "Replay: %s, %u frames %ux%u at the recorded cadence\n", mPath.c_str(), (unsigned)mEntries.size(), mFrameWidth, mFrameHeight);
+    else if (mRate > 0)
+        fprintf(stderr, "Replay: %s, %u frames %ux%u at %.2f fps\n", mPath.c_str(), (unsigned)mEntries.size(), mFrameWidth, mFrameHeight, mRate);
+    else
+        fprintf(stderr, "Replay: %s, %u frames %ux%u unpaced\n", mPath.c_str(), (unsigned)mEntries.size(), mFrameWidth, mFrameHeight);
+
+    mThread = new RecordedFrameThread(this);
+    mThread->start(QThread::TimeCriticalPriority);
+
+    return true;
+}
+
+bool RecordedFrameSource::Stop()
+{
+    if (mThread == NULL)
+        return true;
+
+    mThread->requestStop();
+    mThread->wait();
+
+    double seconds = mThread->elapsedSeconds();
+    fprintf(stderr, "Replay: %llu frames delivered, %llu dropped in %.2f s (%.2f fps)\n",
+            mThread->framesDelivered(), mThread->framesDropped(), seconds,
+            seconds > 0 ? mThread->framesDelivered() / seconds : 0.0);
+
+    delete mThread;
+    mThread = NULL;
+
+    return true;
+}
+
+// Read the header and frame lines written by CaptureRecorder
+bool RecordedFrameSource::readIndex()
+{
+    if (mIndexRead)
+        return true;
+
+    std::string indexPath = RecordingInfo::indexPath(mPath);
+    FILE* file = fopen(indexPath.c_str(), "r");
+    if (! file)
+    {
+        fprintf(stderr, "Replay: cannot open %s: %s\n", indexPath.c_str(), strerror(errno));
+        return false;
+    }
+
+    RecordingInfo info;
+    std::vector<Entry> entries;
+    char line[256];
+    bool header = true;
+    bool valid = fgets(line, sizeof(line), file) && strcmp(line, "cam2vr-raw-capture 1\n") == 0;
+
+    while (valid && fgets(line, sizeof(line), file))
+    {
+        if (header)
+        {
+            char key[64];
+            long long value;
+            if (strcmp(line, "frames\n") == 0)
+                header = false;
+            else if (sscanf(line, "%63s %lld", key, &value) != 2 || value < 0)
+                valid = false;
+            else if (strcmp(key, "width") == 0)
+                info.width = (unsigned)value;
+            else if (strcmp(key, "height") == 0)
+                info.height = (unsigned)value;
+            else if (strcmp(key, "row_bytes") == 0)
+                info.rowBytes = (unsigned)value;
+            else if (strcmp(key, "frame_bytes") == 0)
+                info.frameBytes = (unsigned)value;
+            else if (strcmp(key, "slot_bytes") == 0)
+                info.slotBytes = (unsigned)value;
+            else if (strcmp(key, "frame_duration") == 0)
+                info.frameDuration = value;
+            else if (strcmp(key, "time_scale") == 0)
+                info.timeScale = value;
+            // Keys of later versions are skipped
+            continue;
+        }
+
+        Entry entry;
+        long long hardwareNs, streamTime, arrivalNs;
+        int noInput;
+        if (sscanf(line, "%llu,%lld,%lld,%lld,%d", &entry.slot, &hardwareNs, &streamTime, &arrivalNs, &noInput) != 5)
+        {
+            // The last line of a recording cut short may be incomplete
+            break;
+        }
+        entry.hardwareNs = hardwareNs;
+        entry.streamTime = streamTime;
+        entry.arrivalNs = arrivalNs;
+        entry.noInput = noInput != 0;
+        entries.push_back(entry);
+    }
+    fclose(file);
+
+    // The pipeline only takes UYVY at two bytes a pixel, in page aligned slots
+    if (! valid || header || info.width == 0 || info.height == 0 || info.rowBytes != info.width * 2
+        || info.frameBytes != info.rowBytes * info.height || info.slotBytes < info.frameBytes
+        || info.slotBytes % RecordingInfo::Alignment != 0 || info.frameDuration <= 0 || info.timeScale <= 0)
+    {
+        fprintf(stderr, "Replay: %s is not a raw capture index\n", indexPath.c_str());
+        return false;
+    }
+    if (entries.empty())
+    {
+        fprintf(stderr, "Replay: %s holds no frames\n", indexPath.c_str());
+        return false;
+    }
+
+    mInfo = info;
+    mEntries.swap(entries);
+    mIndexRead = true;
+    return true;
+}
+
+bool RecordedFrameSource::map()
+{
+    if (mMapping)
+        return true;
+
+    mFd = open(mPath.c_str(), O_RDONLY);
+    struct stat st;
+    if (mFd < 0 || fstat(mFd, &st) != 0)
+    {
+        fprintf(stderr, "Replay: cannot open %s: %s\n", mPath.c_str(), strerror(errno));
+        unmap();
+        return false;
+    }
+
+    // After a crash the index may list fewer frames than were written, or more, as it is flushed in batches
+    unsigned long long slotCount = (unsigned long long)st.st_size / mInfo.slotBytes;
+    size_t usable = 0;
+    while (usable < mEntries.size() && mEntries[usable].slot < slotCount)
+        usable++;
+    if (usable == 0)
+    {
+        fprintf(stderr, "Replay: %s holds none of the frames of its index\n", mPath.c_str());
+        unmap();
+        return false;
+    }
+    if (usable < mEntries.size())
+    {
+        fprintf(stderr, "Replay: %s ends after %u of %u indexed frames\n", mPath.c_str(), (unsigned)usable, (unsigned)mEntries.size());
+        mEntries.resize(usable);
+    }
+
+    // Read-only and shared: the frames are the page cache's pages, never copied into the process
+    mMappingBytes = (size_t)(slotCount * mInfo.slotBytes);
+    void* mapping = mmap(NULL, mMappingBytes, PROT_READ, MAP_SHARED | (mPreload ? MAP_POPULATE : 0), mFd, 0);
+    if (mapping == MAP_FAILED)
+    {
+        fprintf(stderr, "Replay: cannot map %s: %s\n", mPath.c_str(), strerror(errno));
+        mMappingBytes = 0;
+        unmap();
+        return false;
+    }
+    mMapping = (unsigned char*)mapping;
+
+    if (mPreload)
+        fprintf(stderr, "Replay: %s preloaded, %.0f MB\n", mPath.c_str(), mMappingBytes / 1e6);
+    else
+        madvise(mMapping, mMappingBytes, MADV_SEQUENTIAL);
+
+    return true;
+}
+
+void RecordedFrameSource::unmap()
+{
+    if (mMapping)
+    {
+        // Frames still held by the pipeline point into the mapping; leaking it beats a crash
+        if (mFramesInFlight.loadAcquire() == 0)
+            munmap(mMapping, mMappingBytes);
+        else
+            fprintf(stderr, "Replay: %d frames still in use, %s stays mapped\n", mFramesInFlight.loadAcquire(), mPath.c_str());
+        mMapping = NULL;
+        mMappingBytes = 0;
+    }
+    if (mFd >= 0)
+    {
+        close(mFd);
+        mFd = -1;
+    }
+}
+
+BMDTimeValue RecordedFrameSource::offsetNs(size_t i) const
+{
+    // Recordings of a source without hardware timestamps fall back to the arrival times
+    const Entry& first = mEntries[0];
+    const Entry& entry = mEntries[i];
+    if (first.hardwareNs != 0 && entry.hardwareNs >= first.hardwareNs)
+        return entry.hardwareNs - first.hardwareNs;
+    if (entry.arrivalNs >= first.arrivalNs)
+        return entry.arrivalNs - first.arrivalNs;
+    return (BMDTimeValue)i * mInfo.frameDuration * 1000000000LL / mInfo.timeScale;
+}
+
+// Length of one pass, the last frame shown for a frame duration before the first comes again
+BMDTimeValue RecordedFrameSource::loopNs() const
+{
+    return offsetNs(mEntries.size() - 1) + mInfo.frameDuration * 1000000000LL / mInfo.timeScale;
+}
@@ -0,0 +1,122 @@
+#ifndef RECORDED_FRAME_SOURCE_H
+#define RECORDED_FRAME_SOURCE_H
+
+#include "FrameSource.h"
+#include "CaptureRecorder.h"
+#include "SyntheticFrameSource.h"
+
+#include <QThread>
+#include <QAtomicInt>
+#include <string>
+#include <vector>
+
+class RecordedFrameThread;
+
+////////////////////////////////////////////
+// RecordedFrameSource
+////////////////////////////////////////////
+
+// Plays back a raw capture recording made with CaptureRecorder (--record), so the warp pipeline can
+// be run on the same frames again and again, for regression and performance runs on machines
+// without a DeckLink card.  The data file is memory-mapped and every frame handed to the callback
+// points straight into the mapping: nothing is copied on the way to the uploader, which either pins
+// the frame's pages or copies them into its unpack buffer ring, as it does with captured frames.
+//
+// Frames are delivered at the cadence of the recorded hardware timestamps, gaps of frames dropped
+// while recording included, at a fixed rate, or as fast as the pipeline takes them.  Stream times
+// are the recorded ones, continued across loops; hardware reference timestamps are the time of
+// delivery, so the latency statistics measure this run rather than the recorded one.
+class RecordedFrameSource : public FrameSource
+{
+public:
+    RecordedFrameSource(const std::string& path);
+    virtual ~RecordedFrameSource();
+
+    virtual const char* getName() { return "replay"; }
+
+    virtual int getDeviceList(std::vector<std::string>& devices);
+    virtual int getModeList(int device, std::vector<std::string>& modes);
+    virtual int getDefaultMode() { return 0; }
+
+    virtual bool Open(int device, int mode);
+    virtual bool EnableVideoInput(IDeckLinkMemoryAllocator* allocator, IDeckLinkInputCallback* callback);
+
+    virtual bool Start();
+    virtual bool Stop();
+
+    // A negative rate (the default) keeps the recorded cadence, 0 delivers frames as fast as the
+    // pipeline takes them and anything else is a fixed rate in frames per second.
+    void setRate(double fps) { mRate = fps; }
+    // Times the recording is played, 0 for over and over
+    void setLoops(int loops) { mLoops = loops; }
+    // Quit the application once the last loop has been delivered, ending a headless run
+    void setQuitAtEnd(bool quit) { mQuitAtEnd = quit; }
+    // Read the whole recording into memory on Open(), so no frame waits for the disk
+    void setPreload(bool preload) { mPreload = preload; }
+    void setMaxFramesInFlight(int frames) { mMaxFramesInFlight = frames; }
+
+    static bool rateFromName(const std::string& name, double& fps);
+
+private:
+    friend class RecordedFrameThread;
+
+    struct Entry {
+        unsigned long long  slot;
+        BMDTimeValue        hardwareNs;
+        BMDTimeValue        streamTime;
+        BMDTimeValue        arrivalNs;
+        bool                noInput;
+    };
+
+    bool readIndex();
+    bool map();
+    void unmap();
+
+    // Delivery time of entry i relative to the first one, in ns
+    BMDTimeValue offsetNs(size_t i) const;
+    BMDTimeValue loopNs() const;
+
+private:
+    std::string                 mPath;
+    RecordingInfo               mInfo;
+    std::vector<Entry>          mEntries;
+    bool                        mIndexRead;
+
+    int                         mFd;
+    unsigned char*              mMapping;
+    size_t                      mMappingBytes;
+
+    IDeckLinkMemoryAllocator*   mAllocator;
+    IDeckLinkInputCallback*     mCallback;
+    RecordedFrameThread*        mThread;
+
+    double                      mRate;
+    int                         mLoops;
+    bool                        mQuitAtEnd;
+    bool                        mPreload;
+    int                         mMaxFramesInFlight;
+    QAtomicInt                  mFramesInFlight;
+};
+
+////////////////////////////////////////////
+// RecordedVideoFrame
+////////////////////////////////////////////
+
+// A frame in the mapping of a recording.  On the last Release() the address is handed back to the
+// allocator, which did not allocate it and only un-pins it if the uploader pinned it.
+class RecordedVideoFrame : public SyntheticVideoFrame
+{
+public:
+    RecordedVideoFrame(IDeckLinkMemoryAllocator* allocator, void* buffer, QAtomicInt* framesInFlight,
+                       long width, long height, BMDTimeValue streamTime, BMDTimeValue hardwareTimeNs,
+                       BMDTimeValue frameDuration, BMDTimeScale timeScale, bool noInput) :
+        SyntheticVideoFrame(allocator, buffer, framesInFlight, width, height, streamTime, hardwareTimeNs, frameDuration, timeScale),
+        mNoInput(noInput) {}
+
+    virtual BMDFrameFlags GetFlags(void) { return mNoInput ? bmdFrameHasNoInputSource : bmdFrameFlagDefault; }
+
+private:
+    bool    mNoInput;
+};
+
+#endif
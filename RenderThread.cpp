@@ -0,0 +1,418 @@
+#include "RenderThread.h"
+#include "OpenGLCapture.h"
+
+#include <QCoreApplication>
+#include <QOpenGLContext>
+#include <QOffscreenSurface>
+#include <stdio.h>
+
+// Colour targets shared with the presenter: latest, presenting and one being rendered
+#define PRESENT_TARGETS 3
+
+////////////////////////////////////////////
+// PresentBuffers
+////////////////////////////////////////////
+
+PresentBuffers::PresentBuffers() :
+    mLatest(-1),
+    mPresenting(-1)
+{
+}
+
+void PresentBuffers::deleteFences()
+{
+    for (size_t i = 0; i < mTextures.size(); i++)
+    {
+        if (mRenderFence[i])
+            glDeleteSync(mRenderFence[i]);
+        if (mPresentFence[i])
+            glDeleteSync(mPresentFence[i]);
+    }
+}
+
+void PresentBuffers::setTargets(const std::vector<GLuint>& textures)
+{
+    QMutexLocker locker(&mMutex);
+
+    deleteFences();
+    mTextures = textures;
+    mRenderFence.assign(textures.size(), (GLsync)NULL);
+    mPresentFence.assign(textures.size(), (GLsync)NULL);
+    mTimes.assign(textures.size(), FrameTimes());
+    mLatest = -1;
+    mPresenting = -1;
+}
+
+void PresentBuffers::clear()
+{
+    setTargets(std::vector<GLuint>());
+}
+
+int PresentBuffers::acquireForRender(GLsync& fence)
+{
+    QMutexLocker locker(&mMutex);
+
+    int target = 0;
+    while (target == mLatest || target == mPresenting)
+        target++;
+
+    fence = mPresentFence[target];
+    mPresentFence[target] = NULL;
+    return target;
+}
+
+void PresentBuffers::publish(int target, GLsync fence, const FrameTimes& times)
+{
+    QMutexLocker locker(&mMutex);
+
+    // A previous frame that was never shown is simply replaced
+    if (mLatest >= 0 && mRenderFence[mLatest])
+    {
+        glDeleteSync(mRenderFence[mLatest]);
+        mRenderFence[mLatest] = NULL;
+    }
+
+    mRenderFence[target] = fence;
+    mTimes[target] = times;
+    mLatest = target;
+}
+
+int PresentBuffers::acquireForPresent(GLsync& fence, FrameTimes& times)
+{
+    QMutexLocker locker(&mMutex);
+
+    fence = NULL;
+    times = FrameTimes();
+    if (mLatest >= 0)
+    {
+        // The previously shown target becomes free for the renderer
+        mPresenting = mLatest;
+        mLatest = -1;
+
+        fence = mRenderFence[mPresenting];
+        mRenderFence[mPresenting] = NULL;
+        times = mTimes[mPresenting];
+    }
+    return mPresenting;
+}
+
+void PresentBuffers::releasePresented(int target, GLsync fence)
+{
+    QMutexLocker locker(&mMutex);
+
+    // Targets may have been replaced while presenting
+    if (target >= (int)mTextures.size())
+    {
+        glDeleteSync(fence);
+        return;
+    }
+
+    if (mPresentFence[target])
+        glDeleteSync(mPresentFence[target]);
+    mPresentFence[target] = fence;
+}
+
+////////////////////////////////////////////
+// RenderThread
+////////////////////////////////////////////
+
+RenderThread::RenderThread(QObject* parent) :
+    QThread(parent),
+    mContext(NULL),
+    mSurface(NULL),
+    mCaptureAllocator(NULL),
+    mQueueDepth(2),
+    mQueuePolicy(FrameQueue::PolicyDropOldest),
+    mQuit(0),
+    mRepaintPending(0),
+    mAcceptFrames(0),
+    mMeshSize(mRenderer.meshWidth() << 16 | mRenderer.meshHeight()),
+    mMeshLayout(mRenderer.meshLayout()),
+    mWarpShader(mRenderer.warpShader()),
+    mDrawShader(mRenderer.drawShader()),
+    mViewer(mRenderer.viewer()),
+    mDevice(mRenderer.device()),
+    mProfileChanged(0),
+    mInitResult(false),
+    mFrameWidth(0), mFrameHeight(0),
+    mFrameDuration(0), mFrameTimescale(0)
+{
+}
+
+RenderThread::~RenderThread()
+{
+    stopRendering();
+}
+
+bool RenderThread::startRendering(QOpenGLContext* shareContext, unsigned frameWidth, unsigned frameHeight,
+                                  BMDTimeValue frameDuration, BMDTimeScale frameTimescale,
+                                  PinnedMemoryAllocator* allocator, QString& error)
+{
+    stopRendering();
+
+    mFrameWidth = frameWidth;
+    mFrameHeight = frameHeight;
+    mFrameDuration = frameDuration;
+    mFrameTimescale = frameTimescale;
+    mCaptureAllocator = allocator;
+    mPacer.reset(frameTimescale > 0 ? frameDuration * 1000000000LL / frameTimescale : 0);
+
+    // The surface has to be created on the GUI thread, the context is then handed to the render thread
+    mSurface = new QOffscreenSurface();
+    mSurface->setFormat(shareContext->format());
+    mSurface->create();
+
+    mContext = new QOpenGLContext();
+    mContext->setFormat(shareContext->format());
+    mContext->setShareContext(shareContext);
+    if (! mContext->create())
+    {
+        error = "Cannot create the rendering OpenGL context.";
+        stopRendering();
+        return false;
+    }
+    mContext->moveToThread(this);
+
+    mQueue.configure(mQueueDepth, mQueuePolicy);
+    mQueue.resetCounters();
+    mStats.reset();
+    mDoorbell.tryAcquire(mDoorbell.available());
+    mQuit.storeRelease(0);
+    start(QThread::HighPriority);
+
+    // GL objects are created by the render thread itself
+    mInitDone.acquire();
+    if (! mInitResult)
+    {
+        error = mInitError;
+        stopRendering();
+        return false;
+    }
+
+    mAcceptFrames.storeRelease(1);
+    return true;
+}
+
+void RenderThread::stopRendering()
+{
+    if (! mContext)
+        return;
+
+    // The caller stops capture first, so no callback is still pushing once the thread has exited
+    mAcceptFrames.storeRelease(0);
+    mQuit.storeRelease(1);
+    mDoorbell.release();
+    wait();
+
+    releaseQueuedFrames();
+
+    fprintf(stderr, "Frame queue (%d, %s): %u enqueued, %u dropped, %u consumed\n",
+            mQueue.capacity(), FrameQueue::policyName(mQueue.policy()),
+            mQueue.enqueuedCount(), mQueue.droppedCount(), mQueue.consumedCount());
+    mPacer.printSummary();
+
+    delete mContext;
+    mContext = NULL;
+    mSurface->destroy();
+    delete mSurface;
+    mSurface = NULL;
+}
+
+bool RenderThread::setMeshSize(int width, int height)
+{
+    if (! WarpRenderer::isValidMeshSize(width, height))
+        return false;
+
+    mMeshSize.storeRelease(width << 16 | height);
+    // Wake the render thread so the mesh is replaced even while no frames arrive
+    mDoorbell.release();
+    return true;
+}
+
+void RenderThread::setMeshLayout(WarpRenderer::MeshLayout layout)
+{
+    mMeshLayout.storeRelease(layout);
+    mDoorbell.release();
+}
+
+void RenderThread::setWarpShader(WarpRenderer::WarpShader shader)
+{
+    mWarpShader.storeRelease(shader);
+    mDoorbell.release();
+}
+
+void RenderThread::setProfile(const CardboardViewer& viewer, const Device& device)
+{
+    QMutexLocker locker(&mProfileMutex);
+    mViewer = viewer;
+    mDevice = device;
+    mProfileChanged.storeRelease(1);
+    mDoorbell.release();
+}
+
+// Render thread: bring the renderer's mesh up to the last requested profile, size and layout, and
+// select the requested shader.  Called between frames; captured frames keep arriving in the queue
+// while a new mesh is computed.
+void RenderThread::applyMesh()
+{
+    if (mProfileChanged.fetchAndStoreAcquire(0))
+    {
+        mProfileMutex.lock();
+        CardboardViewer viewer = mViewer;
+        Device device = mDevice;
+        mProfileMutex.unlock();
+        mRenderer.setProfile(viewer, device);
+    }
+
+    int size = mMeshSize.loadAcquire();
+    mRenderer.setMeshSize(size >> 16, size & 0xffff);
+    mRenderer.setMeshLayout((WarpRenderer::MeshLayout)mMeshLayout.loadAcquire());
+    mRenderer.setWarpShader((WarpRenderer::WarpShader)mWarpShader.loadAcquire());
+    mDrawShader.storeRelease(mRenderer.drawShader());
+}
+
+void RenderThread::queueFrame(IDeckLinkVideoInputFrame* frame, bool hasNoInputSource)
+{
+    if (! mAcceptFrames.loadAcquire())
+        return;
+
+    CapturedFrame captured;
+    captured.frame = frame;
+    captured.hasNoInputSource = hasNoInputSource;
+    captured.arrivalTime = FramePacer::now();
+    mStats.count(LatencyStats::EventCaptured);
+
+    // The queue holds its own reference until the render thread is done with the frame
+    frame->AddRef();
+    if (mQueue.push(captured))
+        mDoorbell.release();
+}
+
+void RenderThread::releaseQueuedFrames()
+{
+    CapturedFrame captured;
+    while (mQueue.pop(captured))
+        captured.frame->Release();
+}
+
+void RenderThread::run()
+{
+    mContext->makeCurrent(mSurface);
+
+    applyMesh();
+    mInitResult = mRenderer.init(mFrameWidth, mFrameHeight, PRESENT_TARGETS, mCaptureAllocator, mInitError);
+    mDrawShader.storeRelease(mRenderer.drawShader());
+    if (mInitResult)
+    {
+        mPresent.setTargets(mRenderer.targetTextures());
+        if (! mGpuTimer.init())
+            fprintf(stderr, "Timer queries not supported, GPU stage latencies are not measured\n");
+    }
+    mInitDone.release();
+
+    while (mInitResult && ! mQuit.loadAcquire())
+    {
+        // Wake up for every frame, and regularly to retire uploads while capture is idle
+        mDoorbell.tryAcquire(1, 10);
+        applyMesh();
+
+        // Take everything queued so the pacer can see which frames would be replaced before display
+        CapturedFrame captured;
+        mBatch.clear();
+        while (mQueue.pop(captured))
+            mBatch.push_back(captured);
+
+        BMDTimeValue dequeueTime = FramePacer::now();
+        BMDTimeValue next = mBatch.empty() ? -1 : captureTime(mBatch[0]);
+        for (size_t i = 0; i < mBatch.size(); i++)
+        {
+            FrameTimes times;
+            times.captureTime = next;
+            times.arrivalTime = mBatch[i].arrivalTime;
+            times.dequeueTime = dequeueTime;
+            next = i + 1 < mBatch.size() ? captureTime(mBatch[i + 1]) : -1;
+
+            FramePacer::Decision decision = mPacer.decide(times.captureTime, times.arrivalTime, next);
+            mStats.record(LatencyStats::StageDelivery, mPacer.deliveryJitter());
+            mStats.record(LatencyStats::StageQueue, times.dequeueTime - times.arrivalTime);
+
+            if (decision == FramePacer::DecisionSuperseded)
+            {
+                mStats.count(LatencyStats::EventSuperseded);
+                mBatch[i].frame->Release();
+                continue;
+            }
+            if (decision == FramePacer::DecisionLate)
+                mStats.count(LatencyStats::EventLate);
+
+            BMDTimeValue start = FramePacer::now();
+            renderFrame(mBatch[i], times);
+            BMDTimeValue duration = FramePacer::now() - start;
+            mPacer.rendered(duration);
+            mStats.record(LatencyStats::StageRender, duration);
+        }
+
+        mStats.setCount(LatencyStats::EventQueueDropped, mQueue.droppedCount());
+        collectGpuTimes();
+        mRenderer.retireUploads();
+        mCaptureAllocator->releaseUnpinnedBuffers();
+    }
+
+    releaseQueuedFrames();
+    mPresent.clear();
+    mGpuTimer.cleanup();
+    mRenderer.cleanup();
+    mCaptureAllocator->releaseUnpinnedBuffers();
+
+    // Give the context back so it can be deleted from the GUI thread
+    mContext->doneCurrent();
+    mContext->moveToThread(QCoreApplication::instance()->thread());
+}
+
+// Hardware reference time of the frame in ns, or its arrival time when the source has none
+BMDTimeValue RenderThread::captureTime(const CapturedFrame& captured)
+{
+    BMDTimeValue frameTime, frameDuration;
+
+    if (captured.frame->GetHardwareReferenceTimestamp(1000000000LL, &frameTime, &frameDuration) != S_OK)
+        return captured.arrivalTime;
+    return frameTime;
+}
+
+void RenderThread::renderFrame(const CapturedFrame& captured, FrameTimes& times)
+{
+    // Draw into a target the presenter is not using, after the GPU has finished its last read of it
+    GLsync presentFence;
+    int target = mPresent.acquireForRender(presentFence);
+    if (presentFence)
+    {
+        glWaitSync(presentFence, 0, GL_TIMEOUT_IGNORED);
+        glDeleteSync(presentFence);
+    }
+
+    mGpuTimer.begin(LatencyStats::StageUpload);
+    mRenderer.uploadFrame(captured.frame);
+    mGpuTimer.end();
+    mGpuTimer.begin(LatencyStats::StageWarp);
+    mRenderer.drawFrame(target, captured.hasNoInputSource);
+    mGpuTimer.end();
+
+    // The presenting context may only wait on a fence that has been flushed to the GPU
+    GLsync renderFence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    glFlush();
+    times.publishTime = FramePacer::now();
+    mPresent.publish(target, renderFence, times);
+
+    // One repaint picks up the latest frame, however many were published meanwhile
+    if (mRepaintPending.testAndSetOrdered(0, 1))
+        emit frameRendered();
+}
+
+// Record the GPU times of earlier frames that have become available, without waiting for any
+void RenderThread::collectGpuTimes()
+{
+    mGpuSamples.clear();
+    mGpuTimer.poll(mGpuSamples);
+    for (size_t i = 0; i < mGpuSamples.size(); i++)
+        mStats.record((LatencyStats::Stage)mGpuSamples[i].section, mGpuSamples[i].duration);
+}
@@ -0,0 +1,198 @@
+#ifndef RENDER_THREAD_H
+#define RENDER_THREAD_H
+
+#include "DeckLinkAPI.h"
+#include "FrameQueue.h"
+#include "FramePacer.h"
+#include "GLExtensions.h"
+#include "GpuTimer.h"
+#include "LatencyStats.h"
+#include "WarpRenderer.h"
+
+#include <QThread>
+#include <QMutex>
+#include <QSemaphore>
+#include <QAtomicInt>
+#include <QString>
+#include <vector>
+
+class QOpenGLContext;
+class QOffscreenSurface;
+class PinnedMemoryAllocator;
+
+////////////////////////////////////////////
+// PresentBuffers
+////////////////////////////////////////////
+
+// Triple-buffered hand-over of warped frames from the render thread to the GUI thread.  At any time
+// one target holds the latest rendered frame, one is being shown by the presenter and the remaining
+// one is free for the renderer, so neither side ever waits for the other on the CPU.  The GPU side is
+// ordered with fences: the renderer publishes a fence after drawing and the presenter one after
+// reading, and each side waits (glWaitSync, on the GPU) for the other's fence before using a target.
+class PresentBuffers
+{
+public:
+    PresentBuffers();
+
+    // Render thread: install the colour targets, or none to stop presenting
+    void setTargets(const std::vector<GLuint>& textures);
+    void clear();
+
+    // Render thread: a target that is neither the latest nor being presented.  fence receives the
+    // presenter's fence for it (or NULL), which the caller must wait on and delete.
+    int acquireForRender(GLsync& fence);
+    // Render thread: make target the latest frame.  fence must already be flushed.
+    void publish(int target, GLsync fence, const FrameTimes& times);
+
+    // GUI thread: the target to show, switching to the latest frame when there is one.  fence receives
+    // the renderer's fence (or NULL), which the caller must wait on and delete, and times the
+    // timestamps of a newly shown frame (publishTime 0 when the frame was already shown).  -1 when
+    // nothing has been rendered yet.
+    int acquireForPresent(GLsync& fence, FrameTimes& times);
+    // GUI thread: the presenter has issued its reads from target, fenced by fence
+    void releasePresented(int target, GLsync fence);
+
+    GLuint texture(int target) const { return mTextures[target]; }
+
+private:
+    void deleteFences();
+
+    QMutex                  mMutex;
+    std::vector<GLuint>     mTextures;
+    std::vector<GLsync>     mRenderFence;       // per target, set by publish()
+    std::vector<GLsync>     mPresentFence;      // per target, set by releasePresented()
+    std::vector<FrameTimes> mTimes;             // per target, of the frame rendered into it
+    int                     mLatest;            // newest published target not yet shown, or -1
+    int                     mPresenting;        // target shown by the presenter, or -1
+};
+
+////////////////////////////////////////////
+// RenderThread
+////////////////////////////////////////////
+
+// Uploads and warps captured frames on a dedicated thread with its own GL context, shared with the
+// GUI widget's context.  The capture callback hands frames over through a lock-free FrameQueue and
+// returns immediately; finished frames are published to PresentBuffers and the GUI thread is only
+// asked to repaint, so a slow or blocked event loop no longer stalls capture.
+class RenderThread : public QThread
+{
+    Q_OBJECT
+
+public:
+    RenderThread(QObject* parent = NULL);
+    ~RenderThread();
+
+    // Unpack buffer ring used when GL_AMD_pinned_memory is not available; takes effect on the next startRendering()
+    void setUploadRing(int depth, UnpackBufferRing::Mode mode) { mRenderer.setUploadRing(depth, mode); }
+
+    // Vertices per eye of the distortion mesh.  Safe to call from any thread at any time: the render
+    // thread swaps the new mesh in before its next frame, leaving capture and every other GL object
+    // alone.  False when the size is out of range.
+    bool setMeshSize(int width, int height);
+    int meshWidth() const { return mMeshSize.loadAcquire() >> 16; }
+    int meshHeight() const { return mMeshSize.loadAcquire() & 0xffff; }
+
+    // Directory of the distortion mesh cache, empty for none; while not rendering
+    void setMeshCacheDirectory(const QString& directory) { mRenderer.setMeshCacheDirectory(directory); }
+
+    // Directory of the shader program binaries, empty for none, and the YCbCr matrix of the shaders;
+    // while not rendering
+    void setShaderCacheDirectory(const QString& directory) { mRenderer.setShaderCacheDirectory(directory); }
+    void setColourMatrix(WarpRenderer::ColourMatrix matrix) { mRenderer.setColourMatrix(matrix); }
+    // How the mesh inverts the lens distortion; while not rendering
+    void setDistortionInverse(DeviceInfo::InverseMode mode) { mRenderer.setDistortionInverse(mode); }
+
+    // Vertex and index layout of the mesh, swapped in the same way
+    void setMeshLayout(WarpRenderer::MeshLayout layout);
+    WarpRenderer::MeshLayout meshLayout() const { return (WarpRenderer::MeshLayout)mMeshLayout.loadAcquire(); }
+
+    // Fragment program of the warp, switched in the same way
+    void setWarpShader(WarpRenderer::WarpShader shader);
+    WarpRenderer::WarpShader warpShader() const { return (WarpRenderer::WarpShader)mWarpShader.loadAcquire(); }
+    // The shader the renderer actually warps with once the requested one has been applied
+    WarpRenderer::WarpShader drawShader() const { return (WarpRenderer::WarpShader)mDrawShader.loadAcquire(); }
+
+    // Viewer and phone the mesh is computed for, swapped in the same way
+    void setProfile(const CardboardViewer& viewer, const Device& device);
+
+    // Depth and overflow policy of the queue between capture and rendering; takes effect on the next startRendering()
+    void setFrameQueue(int depth, FrameQueue::Policy policy) { mQueueDepth = depth; mQueuePolicy = policy; }
+    const FrameQueue& frameQueue() const { return mQueue; }
+
+    // Decides which frames are rendered; the presenter reports its buffer swaps to it
+    FramePacer& framePacer() { return mPacer; }
+
+    // Latency of each pipeline stage, reset by startRendering(); the presenter records its own stages
+    LatencyStats& latencyStats() { return mStats; }
+
+    // Create a context sharing objects with shareContext and start rendering frames of the given
+    // format.  Must be called on the GUI thread; returns once GL initialisation has finished.
+    bool startRendering(QOpenGLContext* shareContext, unsigned frameWidth, unsigned frameHeight,
+                        BMDTimeValue frameDuration, BMDTimeScale frameTimescale,
+                        PinnedMemoryAllocator* allocator, QString& error);
+    // Release queued frames and all GL objects and wait for the thread to exit
+    void stopRendering();
+
+    // Capture thread: hand a frame to the render thread.  When the render thread is too far behind
+    // the queue policy decides which frame is dropped, or whether to wait for it.
+    void queueFrame(IDeckLinkVideoInputFrame* frame, bool hasNoInputSource);
+
+    PresentBuffers& presentBuffers() { return mPresent; }
+
+    // GUI thread: a repaint for the frames published so far has started
+    void framePresented() { mRepaintPending.storeRelease(0); }
+
+signals:
+    // Emitted once per repaint the GUI needs, not once per frame
+    void frameRendered();
+
+protected:
+    virtual void run();
+
+private:
+    void renderFrame(const CapturedFrame& captured, FrameTimes& times);
+    void collectGpuTimes();
+    void releaseQueuedFrames();
+    void applyMesh();
+    BMDTimeValue captureTime(const CapturedFrame& captured);
+
+private:
+    QOpenGLContext*                         mContext;
+    QOffscreenSurface*                      mSurface;
+    PinnedMemoryAllocator*                  mCaptureAllocator;
+    WarpRenderer                            mRenderer;
+    PresentBuffers                          mPresent;
+
+    FrameQueue                              mQueue;
+    int                                     mQueueDepth;
+    FrameQueue::Policy                      mQueuePolicy;
+    QSemaphore                              mDoorbell;          // released for every queued frame
+    std::vector<CapturedFrame>              mBatch;             // frames popped together, paced as a group
+    FramePacer                              mPacer;
+    LatencyStats                            mStats;
+    GpuTimer                                mGpuTimer;          // upload and warp time on the GPU
+    std::vector<GpuTimer::Sample>           mGpuSamples;
+    QAtomicInt                              mQuit;
+    QAtomicInt                              mRepaintPending;
+    QAtomicInt                              mAcceptFrames;
+    QAtomicInt                              mMeshSize;          // requested mesh, width << 16 | height
+    QAtomicInt                              mMeshLayout;
+    QAtomicInt                              mWarpShader;
+    QAtomicInt                              mDrawShader;        // set by the render thread
+    QMutex                                  mProfileMutex;      // protects mViewer and mDevice
+    CardboardViewer                         mViewer;            // requested profile
+    Device                                  mDevice;
+    QAtomicInt                              mProfileChanged;    // set with a new profile, cleared by applyMesh()
+
+    // Hand-over of the GL initialisation result to startRendering()
+    QSemaphore                              mInitDone;
+    bool                                    mInitResult;
+    QString                                 mInitError;
+
+    unsigned                                mFrameWidth;
+    unsigned                                mFrameHeight;
+    BMDTimeValue                            mFrameDuration;
+    BMDTimeScale                            mFrameTimescale;
+};
+
+#endif
@@ -0,0 +1,256 @@
+#include "ShaderManager.h"
+
+#include <QCryptographicHash>
+#include <QDir>
+#include <QFile>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <stdio.h>
+#include <string.h>
+
+// Part of every file: bump whenever the file format changes
+#define SHADER_CACHE_VERSION  1
+
+static const char SHADER_CACHE_MAGIC[8] = { 'c', 'a', 'm', '2', 'v', 'r', 'P', '\n' };
+
+namespace {
+
+// File header, followed by length bytes of program binary
+struct FileHeader {
+    char        magic[8];
+    quint32     version;
+    quint32     binaryFormat;
+    quint32     length;
+};
+
+void addSources(QCryptographicHash& hash, const char* stage, const std::vector<const char*>& sources)
+{
+    // Stage names and the terminating zeros keep differently split sources apart
+    hash.addData(stage, strlen(stage) + 1);
+    for (size_t i = 0; i < sources.size(); i++)
+        hash.addData(sources[i], strlen(sources[i]) + 1);
+}
+
+void addString(QCryptographicHash& hash, const GLubyte* value)
+{
+    const char* text = value ? (const char*)value : "";
+    hash.addData(text, strlen(text) + 1);
+}
+
+} // namespace
+
+ShaderManager::ShaderManager() :
+    mBinaryFormats(-1)
+{
+}
+
+QString ShaderManager::defaultDirectory()
+{
+    QString location = QStandardPaths::writableLocation(QStandardPaths::CacheLocation);
+    if (location.isEmpty())
+        return QString();
+    return location + "/shaders";
+}
+
+void ShaderManager::bindAttribLocation(GLuint index, const char* name)
+{
+    mAttribLocations.push_back(std::make_pair(index, std::string(name)));
+}
+
+QByteArray ShaderManager::key(const std::vector<const char*>& vertexSources, const std::vector<const char*>& fragmentSources) const
+{
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+
+    addSources(hash, "vertex", vertexSources);
+    addSources(hash, "fragment", fragmentSources);
+    for (size_t i = 0; i < mAttribLocations.size(); i++)
+    {
+        quint32 index = mAttribLocations[i].first;
+        hash.addData((const char*)&index, sizeof(index));
+        hash.addData(mAttribLocations[i].second.c_str(), mAttribLocations[i].second.size() + 1);
+    }
+
+    // A binary is only valid for the driver that produced it
+    addString(hash, glGetString(GL_VENDOR));
+    addString(hash, glGetString(GL_RENDERER));
+    addString(hash, glGetString(GL_VERSION));
+
+    return hash.result().toHex();
+}
+
+QString ShaderManager::filePath(const QByteArray& key) const
+{
+    return mDirectory + "/" + QString::fromLatin1(key) + ".bin";
+}
+
+bool ShaderManager::binariesSupported()
+{
+    if (mBinaryFormats < 0)
+    {
+        GLint formats = 0;
+        if (glGetProgramBinary && glProgramBinary)
+            glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+        mBinaryFormats = formats;
+        if (! formats)
+            fprintf(stderr, "Program binaries not supported, shaders are compiled at every start\n");
+    }
+    return mBinaryFormats > 0;
+}
+
+GLuint ShaderManager::program(const std::vector<const char*>& vertexSources, const std::vector<const char*>& fragmentSources, QString& error)
+{
+    QByteArray programKey = key(vertexSources, fragmentSources);
+    std::map<QByteArray, GLuint>::const_iterator found = mPrograms.find(programKey);
+    if (found != mPrograms.end())
+        return found->second;
+
+    bool useCache = ! mDirectory.isEmpty() && binariesSupported();
+    GLuint program = useCache ? loadBinary(programKey) : 0;
+    if (! program)
+    {
+        program = build(vertexSources, fragmentSources, error);
+        if (! program)
+            return 0;
+        if (useCache)
+            storeBinary(programKey, program);
+    }
+
+    mPrograms[programKey] = program;
+    return program;
+}
+
+void ShaderManager::clear()
+{
+    for (std::map<QByteArray, GLuint>::const_iterator i = mPrograms.begin(); i != mPrograms.end(); ++i)
+        glDeleteProgram(i->second);
+    mPrograms.clear();
+}
+
+GLuint ShaderManager::compile(GLenum type, const std::vector<const char*>& sources, QString& error)
+{
+    GLuint shader = glCreateShader(type);
+    glShaderSource(shader, sources.size(), (const GLchar**)&sources[0], NULL);
+    glCompileShader(shader);
+
+    GLint compileResult;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &compileResult);
+    if (compileResult == GL_FALSE)
+    {
+        char errorMessage[1024];
+        glGetShaderInfoLog(shader, sizeof(errorMessage), NULL, errorMessage);
+        error = errorMessage;
+        glDeleteShader(shader);
+        return 0;
+    }
+    return shader;
+}
+
+// Compile and link the sources.  The shaders are only needed for linking, so they are deleted again.
+GLuint ShaderManager::build(const std::vector<const char*>& vertexSources, const std::vector<const char*>& fragmentSources, QString& error)
+{
+    GLuint vertexShader = compile(GL_VERTEX_SHADER, vertexSources, error);
+    if (! vertexShader)
+        return 0;
+    GLuint fragmentShader = compile(GL_FRAGMENT_SHADER, fragmentSources, error);
+    if (! fragmentShader)
+    {
+        glDeleteShader(vertexShader);
+        return 0;
+    }
+
+    GLuint program = glCreateProgram();
+    glAttachShader(program, vertexShader);
+    glAttachShader(program, fragmentShader);
+    for (size_t i = 0; i < mAttribLocations.size(); i++)
+        glBindAttribLocation(program, mAttribLocations[i].first, mAttribLocations[i].second.c_str());
+    if (glProgramParameteri && ! mDirectory.isEmpty() && binariesSupported())
+        glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    glLinkProgram(program);
+
+    glDetachShader(program, vertexShader);
+    glDetachShader(program, fragmentShader);
+    glDeleteShader(vertexShader);
+    glDeleteShader(fragmentShader);
+
+    GLint linkResult;
+    glGetProgramiv(program, GL_LINK_STATUS, &linkResult);
+    if (linkResult == GL_FALSE)
+    {
+        char errorMessage[1024];
+        glGetProgramInfoLog(program, sizeof(errorMessage), NULL, errorMessage);
+        error = errorMessage;
+        glDeleteProgram(program);
+        return 0;
+    }
+    return program;
+}
+
+GLuint ShaderManager::loadBinary(const QByteArray& key)
+{
+    QFile file(filePath(key));
+    if (! file.open(QIODevice::ReadOnly))
+        return 0;
+    QByteArray data = file.readAll();
+
+    FileHeader header;
+    if (data.size() < (int)sizeof(header))
+        return 0;
+    memcpy(&header, data.constData(), sizeof(header));
+    if (memcmp(header.magic, SHADER_CACHE_MAGIC, sizeof(header.magic)) != 0
+        || header.version != SHADER_CACHE_VERSION
+        || sizeof(header) + header.length != (quint32)data.size())
+    {
+        fprintf(stderr, "Ignoring invalid shader cache file %s\n", qPrintable(file.fileName()));
+        return 0;
+    }
+
+    GLuint program = glCreateProgram();
+    glProgramBinary(program, header.binaryFormat, data.constData() + sizeof(header), header.length);
+
+    // Drivers may reject binaries of their own, e.g. after a change of hardware; it is rebuilt then
+    GLint linkResult;
+    glGetProgramiv(program, GL_LINK_STATUS, &linkResult);
+    if (linkResult == GL_FALSE)
+    {
+        fprintf(stderr, "Shader cache file %s was rejected by the driver, compiling the shader\n", qPrintable(file.fileName()));
+        glDeleteProgram(program);
+        return 0;
+    }
+    return program;
+}
+
+void ShaderManager::storeBinary(const QByteArray& key, GLuint program)
+{
+    GLint length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0)
+        return;
+
+    std::vector<char> binary(length);
+    GLenum binaryFormat = 0;
+    glGetProgramBinary(program, length, &length, &binaryFormat, &binary[0]);
+    if (length <= 0)
+        return;
+
+    if (! QDir().mkpath(mDirectory))
+    {
+        fprintf(stderr, "Cannot create the shader cache directory %s\n", qPrintable(mDirectory));
+        return;
+    }
+
+    FileHeader header;
+    memcpy(header.magic, SHADER_CACHE_MAGIC, sizeof(header.magic));
+    header.version = SHADER_CACHE_VERSION;
+    header.binaryFormat = binaryFormat;
+    header.length = length;
+
+    // Readers never see a partly written file: it only replaces the entry on commit()
+    QSaveFile file(filePath(key));
+    if (! file.open(QIODevice::WriteOnly)
+        || file.write((const char*)&header, sizeof(header)) != (qint64)sizeof(header)
+        || file.write(&binary[0], length) != (qint64)length
+        || ! file.commit())
+    {
+        fprintf(stderr, "Cannot write the shader cache file %s: %s\n", qPrintable(file.fileName()), qPrintable(file.errorString()));
+    }
+}
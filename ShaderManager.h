@@ -0,0 +1,68 @@
+#ifndef SHADER_MANAGER_H
+#define SHADER_MANAGER_H
+
+#include "GLExtensions.h"
+
+#include <QByteArray>
+#include <QString>
+#include <map>
+#include <string>
+#include <vector>
+
+////////////////////////////////////////////
+// ShaderManager
+////////////////////////////////////////////
+
+// Linked GLSL programs by their sources, so WarpRenderer compiles each variant once per process and,
+// with a program binary cache, once per driver.  A variant is a list of sources per stage, typically a
+// #version line, the #defines selecting the variant and the shader text.  The first request for a
+// variant loads the binary an earlier run stored, or compiles and links the sources and stores the
+// binary; later requests return the same program.  Programs are kept until clear(): they belong to the
+// share group rather than the context that created them, so re-initialising the renderer with a new
+// context for another mode finds them.
+//
+// Binaries (glGetProgramBinary(), OpenGL 4.1 or GL_ARB_get_program_binary) are kept one per file,
+// named after the hash of the sources, the attribute locations and the GL vendor, renderer and
+// version, so a changed shader or driver simply addresses another file.  A binary the driver rejects
+// anyway is rebuilt from the sources and replaced.
+//
+// Not thread safe; WarpRenderer uses it on the render thread, with a context of the share group current.
+class ShaderManager
+{
+public:
+    ShaderManager();
+
+    // Directory of program binaries, created when the first one is stored; empty disables the cache
+    void setCacheDirectory(const QString& directory) { mDirectory = directory; }
+    const QString& cacheDirectory() const { return mDirectory; }
+
+    // The per-user cache location of the application
+    static QString defaultDirectory();
+
+    // Attribute location bound before linking every program
+    void bindAttribLocation(GLuint index, const char* name);
+
+    // The program linked from the given vertex and fragment shader sources, 0 when it does not
+    // compile or link, with the driver's log in error
+    GLuint program(const std::vector<const char*>& vertexSources, const std::vector<const char*>& fragmentSources, QString& error);
+
+    // Delete every program; the context must belong to their share group
+    void clear();
+
+private:
+    QByteArray key(const std::vector<const char*>& vertexSources, const std::vector<const char*>& fragmentSources) const;
+    QString filePath(const QByteArray& key) const;
+    bool binariesSupported();
+
+    GLuint build(const std::vector<const char*>& vertexSources, const std::vector<const char*>& fragmentSources, QString& error);
+    GLuint compile(GLenum type, const std::vector<const char*>& sources, QString& error);
+    GLuint loadBinary(const QByteArray& key);
+    void storeBinary(const QByteArray& key, GLuint program);
+
+    QString                                     mDirectory;
+    std::vector<std::pair<GLuint, std::string> > mAttribLocations;
+    std::map<QByteArray, GLuint>                mPrograms;          // by key
+    int                                         mBinaryFormats;     // -1 until queried
+};
+
+#endif
@@ -0,0 +1,212 @@
+#include "StatsServer.h"
+#include "LatencyStats.h"
+#include "PipelineControl.h"
+#include "ViewerProfile.h"
+
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QHostAddress>
+#include <QUrl>
+#include <QUrlQuery>
+#include <stdio.h>
+
+// Requests are a single line; anything longer than this is not for us
+#define MAX_REQUEST_LINE    4096
+
+StatsServer::StatsServer(LatencyStats* stats, QObject* parent) :
+    QObject(parent),
+    mServer(new QTcpServer(this)),
+    mStats(stats),
+    mControl(NULL)
+{
+    connect(mServer, SIGNAL(newConnection()), this, SLOT(acceptConnection()));
+}
+
+bool StatsServer::listen(quint16 port)
+{
+    if (! mServer->listen(QHostAddress::LocalHost, port))
+    {
+        fprintf(stderr, "Cannot serve statistics on port %u: %s\n", port, qPrintable(mServer->errorString()));
+        return false;
+    }
+
+    fprintf(stderr, "Serving statistics on http://127.0.0.1:%u/stats and /metrics\n", port);
+    return true;
+}
+
+void StatsServer::acceptConnection()
+{
+    while (mServer->hasPendingConnections())
+    {
+        QTcpSocket* socket = mServer->nextPendingConnection();
+        connect(socket, SIGNAL(readyRead()), this, SLOT(readRequest()));
+        connect(socket, SIGNAL(disconnected()), socket, SLOT(deleteLater()));
+    }
+}
+
+void StatsServer::readRequest()
+{
+    QTcpSocket* socket = qobject_cast<QTcpSocket*>(sender());
+    if (! socket)
+        return;
+
+    if (! socket->canReadLine())
+    {
+        if (socket->bytesAvailable() > MAX_REQUEST_LINE)
+            socket->abort();
+        return;
+    }
+
+    // Only the request line matters: "GET /path?query HTTP/1.x"; a request body is never read
+    QList<QByteArray> request = socket->readLine(MAX_REQUEST_LINE).trimmed().split(' ');
+    disconnect(socket, SIGNAL(readyRead()), this, SLOT(readRequest()));
+
+    QByteArray status = "200 OK";
+    QByteArray contentType;
+    std::string body;
+
+    QUrl url;
+    if (request.size() >= 2)
+        url = QUrl(QString::fromLatin1(request[1]));
+
+    if (request.size() < 2 || ! url.isValid())
+    {
+        status = "400 Bad Request";
+    }
+    else if (url.path() == "/mesh" && mControl)
+    {
+        status = handleMesh(request[0], QUrlQuery(url), body);
+        if (! body.empty())
+            contentType = "application/json";
+    }
+    else if (url.path() == "/profile" && mControl)
+    {
+        status = handleProfile(request[0], QUrlQuery(url), body);
+        if (! body.empty())
+            contentType = "application/json";
+    }
+    else if (request[0] != "GET")
+    {
+        status = "405 Method Not Allowed";
+    }
+    else if (url.path() == "/stats")
+    {
+        contentType = "application/json";
+        body = mStats->toJson();
+    }
+    else if (url.path() == "/metrics")
+    {
+        contentType = "text/plain; version=0.0.4";
+        body = mStats->toPrometheus();
+    }
+    else
+    {
+        status = "404 Not Found";
+    }
+
+    if (contentType.isEmpty())
+    {
+        contentType = "text/plain";
+        body = status.toStdString() + "\n";
+    }
+
+    QByteArray response = "HTTP/1.0 " + status + "\r\n"
+                          "Content-Type: " + contentType + "\r\n"
+                          "Content-Length: " + QByteArray::number((int)body.size()) + "\r\n"
+                          "Connection: close\r\n\r\n";
+    response.append(body.data(), (int)body.size());
+
+    socket->write(response);
+    socket->disconnectFromHost();
+}
+
+// GET reports the mesh size, POST changes it first.  Returns the status; body is left empty on errors.
+QByteArray StatsServer::handleMesh(const QByteArray& method, const QUrlQuery& query, std::string& body)
+{
+    if (method == "POST")
+    {
+        bool okWidth = false, okHeight = true;
+        int width = query.queryItemValue("width").toInt(&okWidth);
+        int height = width;
+        if (query.hasQueryItem("height"))
+            height = query.queryItemValue("height").toInt(&okHeight);
+
+        if (! okWidth || ! okHeight || ! mControl->setMeshSize(width, height))
+            return "400 Bad Request";
+        fprintf(stderr, "Distortion mesh set to %dx%d from the control endpoint\n", width, height);
+    }
+    else if (method != "GET")
+    {
+        return "405 Method Not Allowed";
+    }
+
+    char json[64];
+    snprintf(json, sizeof(json), "{\"width\": %d, \"height\": %d}\n", mControl->meshWidth(), mControl->meshHeight());
+    body = json;
+    return "200 OK";
+}
+
+// A JSON string; profile ids are user-defined
+static std::string jsonString(const std::string& text)
+{
+    std::string quoted = "\"";
+    for (size_t i = 0; i < text.size(); i++)
+    {
+        if (text[i] == '"' || text[i] == '\\')
+            quoted += '\\';
+        if ((unsigned char)text[i] >= ' ')
+            quoted += text[i];
+    }
+    return quoted + "\"";
+}
+
+// GET reports the selected viewer and phone, POST selects them first.  Returns the status; body is
+// left empty on errors.
+QByteArray StatsServer::handleProfile(const QByteArray& method, const QUrlQuery& query, std::string& body)
+{
+    if (method == "POST" && query.hasQueryItem("import"))
+    {
+        CardboardViewer viewer;
+        QString error;
+        if (! ViewerProfile::fromUrl(query.queryItemValue("import"), viewer, error))
+        {
+            fprintf(stderr, "Cannot import a viewer from the control endpoint: %s\n", qPrintable(error));
+            return "400 Bad Request";
+        }
+        mControl->addViewer(viewer);
+        mControl->setViewer(viewer.id);
+        fprintf(stderr, "Viewer %s imported from the control endpoint\n", viewer.id.c_str());
+    }
+    else if (method == "POST")
+    {
+        std::string viewer = query.queryItemValue("viewer").toStdString();
+        std::string device = query.queryItemValue("device").toStdString();
+        const DeviceInfo& profiles = mControl->profiles();
+        if ((viewer.empty() && device.empty())
+            || (! viewer.empty() && ! profiles.findViewer(viewer))
+            || (! device.empty() && ! profiles.findDevice(device)))
+            return "400 Bad Request";
+
+        if (! viewer.empty())
+            mControl->setViewer(viewer);
+        if (! device.empty())
+            mControl->setDevice(device);
+        fprintf(stderr, "Profile set to viewer %s, phone %s from the control endpoint\n",
+                profiles.getViewer().id.c_str(), profiles.getDevice().id.c_str());
+    }
+    else if (method != "GET")
+    {
+        return "405 Method Not Allowed";
+    }
+
+    const DeviceInfo& profiles = mControl->profiles();
+    body = "{\"viewer\": " + jsonString(profiles.getViewer().id) + ", \"device\": " + jsonString(profiles.getDevice().id);
+    body += ", \"viewers\": [";
+    for (size_t i = 0; i < profiles.getViewers().size(); i++)
+        body += (i ? ", " : "") + jsonString(profiles.getViewers()[i].id);
+    body += "], \"devices\": [";
+    for (size_t i = 0; i < profiles.getDevices().size(); i++)
+        body += (i ? ", " : "") + jsonString(profiles.getDevices()[i].id);
+    body += "]}\n";
+    return "200 OK";
+}
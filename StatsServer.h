@@ -0,0 +1,52 @@
+#ifndef STATS_SERVER_H
+#define STATS_SERVER_H
+
+#include <QObject>
+#include <string>
+
+class QTcpServer;
+class LatencyStats;
+class PipelineControl;
+class QUrlQuery;
+
+////////////////////////////////////////////
+// StatsServer
+////////////////////////////////////////////
+
+// Minimal HTTP endpoint on 127.0.0.1 for monitoring and alerting:
+//  GET /stats      latency histograms and frame counters as JSON
+//  GET /metrics    the same in the Prometheus text format
+// and, with a PipelineControl, for tuning the running pipeline:
+//  GET /mesh                           the distortion mesh size per eye as JSON
+//  POST /mesh?width=W&height=H         change it; height defaults to width
+//  GET /profile                        the selected viewer and phone and the ids to choose from
+//  POST /profile?viewer=ID&device=ID   select either or both
+//  POST /profile?import=URL            add the viewer of a Cardboard QR code URL (or its p value) and select it
+// Runs on the GUI thread's event loop; every request is answered and the connection closed.
+class StatsServer : public QObject
+{
+    Q_OBJECT
+
+public:
+    StatsServer(LatencyStats* stats, QObject* parent = NULL);
+
+    // Start listening on the loopback interface; false when the port cannot be bound
+    bool listen(quint16 port);
+
+    // Serve the control endpoints for control, or none when NULL
+    void setControl(PipelineControl* control) { mControl = control; }
+
+private slots:
+    void acceptConnection();
+    void readRequest();
+
+private:
+    QByteArray handleMesh(const QByteArray& method, const QUrlQuery& query, std::string& body);
+    QByteArray handleProfile(const QByteArray& method, const QUrlQuery& query, std::string& body);
+
+    QTcpServer*         mServer;
+    LatencyStats*       mStats;
+    PipelineControl*    mControl;       // NULL without control endpoints
+};
+
+#endif
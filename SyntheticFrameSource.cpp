@@ -0,0 +1,445 @@
+#include "SyntheticFrameSource.h"
+
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include <sstream>
+
+namespace {
+
+struct SyntheticMode {
+    const char*     name;
+    BMDDisplayMode  displayMode;
+    unsigned        width;
+    unsigned        height;
+    BMDTimeValue    frameDuration;
+    BMDTimeScale    timeScale;
+};
+
+const SyntheticMode kSyntheticModes[] = {
+    { "NTSC",           bmdModeNTSC,        720,  486,  1001, 30000 },
+    { "PAL",            bmdModePAL,         720,  576,  1000, 25000 },
+    { "HD 720p60",      bmdModeHD720p60,    1280, 720,  1000, 60000 },
+    { "HD 1080p25",     bmdModeHD1080p25,   1920, 1080, 1000, 25000 },
+    { "HD 1080p29.97",  bmdModeHD1080p2997, 1920, 1080, 1001, 30000 },
+    { "HD 1080p30",     bmdModeHD1080p30,   1920, 1080, 1000, 30000 },
+    { "HD 1080p50",     bmdModeHD1080p50,   1920, 1080, 1000, 50000 },
+    { "HD 1080p59.94",  bmdModeHD1080p5994, 1920, 1080, 1001, 60000 },
+    { "HD 1080p60",     bmdModeHD1080p6000, 1920, 1080, 1000, 60000 },
+    { "4K 2160p30",     bmdMode4K2160p30,   3840, 2160, 1000, 30000 },
+    { "4K 2160p50",     bmdMode4K2160p50,   3840, 2160, 1000, 50000 },
+    { "4K 2160p60",     bmdMode4K2160p60,   3840, 2160, 1000, 60000 },
+};
+
+const int kSyntheticModeCount = sizeof(kSyntheticModes) / sizeof(kSyntheticModes[0]);
+const int kSyntheticDefaultMode = 8;        // HD 1080p60
+
+BMDTimeValue monotonicNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (BMDTimeValue)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+void sleepUntilNs(BMDTimeValue deadline)
+{
+    struct timespec ts;
+    ts.tv_sec = deadline / 1000000000LL;
+    ts.tv_nsec = deadline % 1000000000LL;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) != 0)
+        ;
+}
+
+inline void putMacroPixel(unsigned char* p, unsigned char y0, unsigned char y1, unsigned char cb, unsigned char cr)
+{
+    p[0] = cb;
+    p[1] = y0;
+    p[2] = cr;
+    p[3] = y1;
+}
+
+} // namespace
+
+////////////////////////////////////////////
+// SyntheticFrameThread
+////////////////////////////////////////////
+class SyntheticFrameThread : public QThread
+{
+public:
+    SyntheticFrameThread(SyntheticFrameSource* source) :
+        mSource(source), mStop(0), mFramesDelivered(0), mFramesDropped(0), mElapsedSeconds(0) {}
+
+    void requestStop() { mStop.storeRelease(1); }
+
+    unsigned long long framesDelivered() const { return mFramesDelivered; }
+    unsigned long long framesDropped() const { return mFramesDropped; }
+    double elapsedSeconds() const { return mElapsedSeconds; }
+
+protected:
+    virtual void run();
+
+private:
+    SyntheticFrameSource*   mSource;
+    QAtomicInt              mStop;
+    unsigned long long      mFramesDelivered;
+    unsigned long long      mFramesDropped;
+    double                  mElapsedSeconds;
+};
+
+void SyntheticFrameThread::run()
+{
+    const unsigned long    frameBytes = mSource->mFrameWidth * 2 * mSource->mFrameHeight;
+    const BMDTimeValue     startNs = monotonicNs();
+    BMDTimeValue           periodNs = 0;
+    unsigned long long     frameIndex = 0;
+
+    if (mSource->effectiveRate() > 0)
+        periodNs = (BMDTimeValue)(1000000000.0 / mSource->effectiveRate());
+
+    while (mStop.loadAcquire() == 0)
+    {
+        if (periodNs > 0)
+            sleepUntilNs(startNs + (BMDTimeValue)frameIndex * periodNs);
+        else if (mSource->mFramesInFlight.loadAcquire() >= mSource->mMaxFramesInFlight)
+        {
+            // Free-running: wait for the pipeline to hand back a buffer rather than counting drops
+            QThread::usleep(100);
+            continue;
+        }
+
+        // A real card drops the frame when the host has not returned enough buffers
+        void* buffer = NULL;
+        if (mSource->mFramesInFlight.loadAcquire() >= mSource->mMaxFramesInFlight
+            || mSource->mAllocator->AllocateBuffer(frameBytes, &buffer) != S_OK)
+        {
+            ++mFramesDropped;
+            ++frameIndex;
+            continue;
+        }
+
+        mSource->fillFrame((unsigned char*)buffer, frameIndex);
+
+        mSource->mFramesInFlight.fetchAndAddOrdered(1);
+        SyntheticVideoFrame* frame = new SyntheticVideoFrame(mSource->mAllocator, buffer, &mSource->mFramesInFlight,
+                                                             mSource->mFrameWidth, mSource->mFrameHeight,
+                                                             (BMDTimeValue)frameIndex * mSource->mFrameDuration,
+                                                             monotonicNs(),
+                                                             mSource->mFrameDuration, mSource->mFrameTimescale);
+
+        // Like the DeckLink driver, the callback gets a borrowed reference; it must AddRef() to keep the frame
+        mSource->mCallback->VideoInputFrameArrived(frame, NULL);
+        frame->Release();
+
+        ++mFramesDelivered;
+        ++frameIndex;
+    }
+
+    mElapsedSeconds = (monotonicNs() - startNs) / 1e9;
+}
+
+////////////////////////////////////////////
+// SyntheticFrameSource
+////////////////////////////////////////////
+SyntheticFrameSource::SyntheticFrameSource() :
+    mAllocator(NULL),
+    mCallback(NULL),
+    mThread(NULL),
+    mMode(kSyntheticDefaultMode),
+    mRate(-1),
+    mPattern(PatternBars),
+    mMaxFramesInFlight(8),
+    mFramesInFlight(0)
+{
+}
+
+SyntheticFrameSource::~SyntheticFrameSource()
+{
+    Stop();
+}
+
+bool SyntheticFrameSource::patternFromName(const std::string& name, Pattern& pattern)
+{
+    if (name == "bars")
+        pattern = PatternBars;
+    else if (name == "ramp")
+        pattern = PatternRamp;
+    else if (name == "box")
+        pattern = PatternBox;
+    else
+        return false;
+    return true;
+}
+
+// Accepts either a mode index or a short name such as "1080p60" or "2160p30"
+int SyntheticFrameSource::modeFromName(const std::string& name)
+{
+    for (int i = 0; i < kSyntheticModeCount; i++)
+    {
+        std::string modeName = kSyntheticModes[i].name;
+        if (modeName == name || modeName.substr(modeName.find(' ') + 1) == name)
+            return i;
+    }
+
+    std::istringstream in(name);
+    int idx = -1;
+    if ((in >> idx) && in.eof() && idx >= 0 && idx < kSyntheticModeCount)
+        return idx;
+
+    return -1;
+}
+
+int SyntheticFrameSource::getDeviceList(std::vector<std::string>& devices)
+{
+    devices.clear();
+    devices.push_back("Synthetic frame source");
+    return 0;
+}
+
+int SyntheticFrameSource::getModeList(int device, std::vector<std::string>& modes)
+{
+    if (device != 0)
+        return 1;
+
+    modes.clear();
+    for (int i = 0; i < kSyntheticModeCount; i++)
+    {
+        const SyntheticMode& m = kSyntheticModes[i];
+        std::ostringstream stm;
+        stm << m.name << " " << m.width << "x" << m.height << " " << (double)m.timeScale / (double)m.frameDuration << "fps";
+        modes.push_back(stm.str());
+    }
+    return 0;
+}
+
+double SyntheticFrameSource::effectiveRate() const
+{
+    if (mRate < 0)
+        return (double)mFrameTimescale / (double)mFrameDuration;
+    return mRate;
+}
+
+int SyntheticFrameSource::getDefaultMode()
+{
+    return kSyntheticDefaultMode;
+}
+
+bool SyntheticFrameSource::Open(int device, int mode)
+{
+    if (device != 0 || mode < 0 || mode >= kSyntheticModeCount)
+    {
+        fprintf(stderr, "Synthetic frame source: invalid device %d / mode %d\n", device, mode);
+        return false;
+    }
+
+    Stop();
+
+    const SyntheticMode& m = kSyntheticModes[mode];
+    mMode = mode;
+    mFrameWidth = m.width;
+    mFrameHeight = m.height;
+    mFrameDuration = m.frameDuration;
+    mFrameTimescale = m.timeScale;
+
+    return true;
+}
+
+bool SyntheticFrameSource::EnableVideoInput(IDeckLinkMemoryAllocator* allocator, IDeckLinkInputCallback* callback)
+{
+    if (allocator == NULL || callback == NULL || mFrameWidth == 0)
+        return false;
+
+    mAllocator = allocator;
+    mCallback = callback;
+    return true;
+}
+
+bool SyntheticFrameSource::Start()
+{
+    if (mAllocator == NULL || mCallback == NULL)
+        return false;
+
+    if (mThread != NULL)
+        return true;
+
+    double rate = effectiveRate();
+    if (rate > 0)
+        fprintf(stderr, "Synthetic frame source: %s %ux%u at %.2f fps\n", kSyntheticModes[mMode].name, mFrameWidth, mFrameHeight, rate);
+    else
+        fprintf(stderr, "Synthetic frame source: %s %ux%u unpaced\n", kSyntheticModes[mMode].name, mFrameWidth, mFrameHeight);
+
+    renderPattern();
+
+    mAllocator->Commit();
+    mThread = new SyntheticFrameThread(this);
+    mThread->start(QThread::TimeCriticalPriority);
+
+    return true;
+}
+
+bool SyntheticFrameSource::Stop()
+{
+    if (mThread == NULL)
+        return true;
+
+    mThread->requestStop();
+    mThread->wait();
+
+    double seconds = mThread->elapsedSeconds();
+    fprintf(stderr, "Synthetic frame source: %llu frames delivered, %llu dropped in %.2f s (%.2f fps)\n",
+            mThread->framesDelivered(), mThread->framesDropped(), seconds,
+            seconds > 0 ? mThread->framesDelivered() / seconds : 0.0);
+
+    delete mThread;
+    mThread = NULL;
+
+    return true;
+}
+
+void SyntheticFrameSource::renderPattern()
+{
+    const unsigned rowBytes = mFrameWidth * 2;
+    mPatternFrame.resize(rowBytes * mFrameHeight);
+
+    for (unsigned y = 0; y < mFrameHeight; y++)
+    {
+        unsigned char* row = &mPatternFrame[y * rowBytes];
+        for (unsigned x = 0; x < mFrameWidth; x += 2)
+        {
+            switch (mPattern)
+            {
+            case PatternBars:
+            {
+                // 75% Rec.709 colour bars: white, yellow, cyan, green, magenta, red, blue
+                static const unsigned char bars[7][3] = {
+                    { 180, 128, 128 }, { 168,  44, 136 }, { 145, 147,  44 }, { 133,  63,  52 },
+                    {  63, 193, 204 }, {  51, 109, 212 }, {  28, 212, 120 }
+                };
+                const unsigned char* c = bars[x * 7 / mFrameWidth];
+                putMacroPixel(row + x * 2, c[0], c[0], c[1], c[2]);
+                break;
+            }
+            case PatternRamp:
+                putMacroPixel(row + x * 2, 16 + 219 * x / mFrameWidth, 16 + 219 * (x + 1) / mFrameWidth, 128, 128);
+                break;
+            case PatternBox:
+                putMacroPixel(row + x * 2, 126, 126, 128, 128);
+                break;
+            }
+        }
+    }
+}
+
+void SyntheticFrameSource::fillFrame(unsigned char* buffer, unsigned long long frameIndex)
+{
+    const unsigned rowBytes = mFrameWidth * 2;
+
+    switch (mPattern)
+    {
+    case PatternBars:
+        memcpy(buffer, &mPatternFrame[0], mPatternFrame.size());
+        break;
+
+    case PatternRamp:
+    {
+        // Scroll by 8 pixels (4 macropixels) per frame
+        unsigned shift = (unsigned)((frameIndex * 16) % rowBytes);
+        for (unsigned y = 0; y < mFrameHeight; y++)
+        {
+            const unsigned char* src = &mPatternFrame[y * rowBytes];
+            unsigned char* dst = buffer + y * rowBytes;
+            memcpy(dst, src + shift, rowBytes - shift);
+            memcpy(dst + rowBytes - shift, src, shift);
+        }
+        break;
+    }
+
+    case PatternBox:
+    {
+        memcpy(buffer, &mPatternFrame[0], mPatternFrame.size());
+
+        unsigned boxSize = (mFrameHeight / 4) & ~1u;
+        unsigned range = mFrameWidth - boxSize;
+        unsigned boxX = (unsigned)((frameIndex * 8) % range) & ~1u;
+        unsigned boxY = (mFrameHeight - boxSize) / 2;
+        for (unsigned y = boxY; y < boxY + boxSize; y++)
+        {
+            unsigned char* row = buffer + y * rowBytes;
+            for (unsigned x = boxX; x < boxX + boxSize; x += 2)
+                putMacroPixel(row + x * 2, 235, 235, 128, 128);
+        }
+        break;
+    }
+    }
+}
+
+////////////////////////////////////////////
+// SyntheticVideoFrame
+////////////////////////////////////////////
+SyntheticVideoFrame::SyntheticVideoFrame(IDeckLinkMemoryAllocator* allocator, void* buffer, QAtomicInt* framesInFlight,
+                                         long width, long height, BMDTimeValue streamTime, BMDTimeValue hardwareTimeNs,
+                                         BMDTimeValue frameDuration, BMDTimeScale timeScale) :
+    mRefCount(1),
+    mAllocator(allocator),
+    mBuffer(buffer),
+    mFramesInFlight(framesInFlight),
+    mWidth(width),
+    mHeight(height),
+    mStreamTime(streamTime),
+    mHardwareTimeNs(hardwareTimeNs),
+    mFrameDuration(frameDuration),
+    mTimeScale(timeScale)
+{
+}
+
+SyntheticVideoFrame::~SyntheticVideoFrame()
+{
+    mAllocator->ReleaseBuffer(mBuffer);
+    mFramesInFlight->fetchAndAddOrdered(-1);
+}
+
+HRESULT STDMETHODCALLTYPE SyntheticVideoFrame::QueryInterface(REFIID /*iid*/, LPVOID* /*ppv*/)
+{
+    return E_NOINTERFACE;
+}
+
+ULONG STDMETHODCALLTYPE SyntheticVideoFrame::AddRef(void)
+{
+    int oldValue = mRefCount.fetchAndAddAcquire(1);
+    return (ULONG)(oldValue + 1);
+}
+
+ULONG STDMETHODCALLTYPE SyntheticVideoFrame::Release(void)
+{
+    int oldValue = mRefCount.fetchAndAddAcquire(-1);
+    if (oldValue == 1)      // i.e. current value will be 0
+        delete this;
+
+    return (ULONG)(oldValue - 1);
+}
+
+HRESULT SyntheticVideoFrame::GetTimecode(BMDTimecodeFormat /*format*/, IDeckLinkTimecode** timecode)
+{
+    *timecode = NULL;
+    return S_FALSE;
+}
+
+HRESULT SyntheticVideoFrame::GetAncillaryData(IDeckLinkVideoFrameAncillary** ancillary)
+{
+    *ancillary = NULL;
+    return S_FALSE;
+}
+
+HRESULT SyntheticVideoFrame::GetStreamTime(BMDTimeValue* frameTime, BMDTimeValue* frameDuration, BMDTimeScale timeScale)
+{
+    *frameTime = mStreamTime * timeScale / mTimeScale;
+    *frameDuration = mFrameDuration * timeScale / mTimeScale;
+    return S_OK;
+}
+
+HRESULT SyntheticVideoFrame::GetHardwareReferenceTimestamp(BMDTimeScale timeScale, BMDTimeValue* frameTime, BMDTimeValue* frameDuration)
+{
+    // Split into seconds and remainder so the multiplication cannot overflow
+    *frameTime = (mHardwareTimeNs / 1000000000LL) * timeScale + (mHardwareTimeNs % 1000000000LL) * timeScale / 1000000000LL;
+    *frameDuration = mFrameDuration * timeScale / mTimeScale;
+    return S_OK;
+}
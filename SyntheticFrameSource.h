@@ -0,0 +1,125 @@
+#ifndef SYNTHETIC_FRAME_SOURCE_H
+#define SYNTHETIC_FRAME_SOURCE_H
+
+#include "FrameSource.h"
+
+#include <QThread>
+#include <QAtomicInt>
+#include <vector>
+
+class SyntheticFrameThread;
+
+////////////////////////////////////////////
+// SyntheticFrameSource
+////////////////////////////////////////////
+
+// Stand-in for a DeckLink card: generates UYVY test patterns at a given mode and rate and
+// delivers them through IDeckLinkInputCallback::VideoInputFrameArrived(), so the whole
+// capture -> upload -> warp -> present path can be profiled on machines without a card.
+class SyntheticFrameSource : public FrameSource
+{
+public:
+    enum Pattern {
+        PatternBars = 0,        // static 75% colour bars
+        PatternRamp,            // luma ramp scrolling horizontally
+        PatternBox              // white box moving over a grey background
+    };
+
+    SyntheticFrameSource();
+    virtual ~SyntheticFrameSource();
+
+    virtual const char* getName() { return "synthetic"; }
+
+    virtual int getDeviceList(std::vector<std::string>& devices);
+    virtual int getModeList(int device, std::vector<std::string>& modes);
+    virtual int getDefaultMode();
+
+    virtual bool Open(int device, int mode);
+    virtual bool EnableVideoInput(IDeckLinkMemoryAllocator* allocator, IDeckLinkInputCallback* callback);
+
+    virtual bool Start();
+    virtual bool Stop();
+
+    // Frames per second to generate; 0 delivers frames as fast as the pipeline takes them
+    // and a negative rate (the default) uses the nominal rate of the selected mode.
+    void setRate(double fps) { mRate = fps; }
+    void setPattern(Pattern pattern) { mPattern = pattern; }
+
+    // Number of frames the "card" can have outstanding before it starts dropping input,
+    // like a DeckLink device running out of capture buffers.
+    void setMaxFramesInFlight(int frames) { mMaxFramesInFlight = frames; }
+
+    static bool patternFromName(const std::string& name, Pattern& pattern);
+    static int modeFromName(const std::string& name);
+
+private:
+    friend class SyntheticFrameThread;
+
+    double effectiveRate() const;
+    void renderPattern();
+    void fillFrame(unsigned char* buffer, unsigned long long frameIndex);
+
+private:
+    IDeckLinkMemoryAllocator*   mAllocator;
+    IDeckLinkInputCallback*     mCallback;
+    SyntheticFrameThread*       mThread;
+
+    int                         mMode;
+    double                      mRate;
+    Pattern                     mPattern;
+    int                         mMaxFramesInFlight;
+    QAtomicInt                  mFramesInFlight;
+
+    // Pre-rendered pattern, copied (and for moving patterns shifted) into each frame
+    std::vector<unsigned char>  mPatternFrame;
+};
+
+////////////////////////////////////////////
+// SyntheticVideoFrame
+////////////////////////////////////////////
+
+// IDeckLinkVideoInputFrame wrapping a buffer obtained from the capture allocator.
+// The buffer is handed back to the allocator when the last reference is released.
+class SyntheticVideoFrame : public IDeckLinkVideoInputFrame
+{
+public:
+    SyntheticVideoFrame(IDeckLinkMemoryAllocator* allocator, void* buffer, QAtomicInt* framesInFlight,
+                        long width, long height, BMDTimeValue streamTime, BMDTimeValue hardwareTimeNs,
+                        BMDTimeValue frameDuration, BMDTimeScale timeScale);
+
+    // IUnknown methods
+    virtual HRESULT STDMETHODCALLTYPE   QueryInterface(REFIID iid, LPVOID *ppv);
+    virtual ULONG STDMETHODCALLTYPE     AddRef(void);
+    virtual ULONG STDMETHODCALLTYPE     Release(void);
+
+    // IDeckLinkVideoFrame methods
+    virtual long GetWidth(void)                 { return mWidth; }
+    virtual long GetHeight(void)                { return mHeight; }
+    virtual long GetRowBytes(void)              { return mWidth * 2; }
+    virtual BMDPixelFormat GetPixelFormat(void) { return bmdFormat8BitYUV; }
+    virtual BMDFrameFlags GetFlags(void)        { return bmdFrameFlagDefault; }
+    virtual HRESULT GetBytes(void **buffer)     { *buffer = mBuffer; return S_OK; }
+    virtual HRESULT GetTimecode(BMDTimecodeFormat format, IDeckLinkTimecode **timecode);
+    virtual HRESULT GetAncillaryData(IDeckLinkVideoFrameAncillary **ancillary);
+
+    // IDeckLinkVideoInputFrame methods
+    virtual HRESULT GetStreamTime(BMDTimeValue *frameTime, BMDTimeValue *frameDuration, BMDTimeScale timeScale);
+    virtual HRESULT GetHardwareReferenceTimestamp(BMDTimeScale timeScale, BMDTimeValue *frameTime, BMDTimeValue *frameDuration);
+
+protected:
+    virtual ~SyntheticVideoFrame();
+
+private:
+    QAtomicInt                  mRefCount;
+    IDeckLinkMemoryAllocator*   mAllocator;
+    void*                       mBuffer;
+    QAtomicInt*                 mFramesInFlight;
+    long                        mWidth;
+    long                        mHeight;
+    BMDTimeValue                mStreamTime;        // in units of mTimeScale
+    BMDTimeValue                mHardwareTimeNs;    // monotonic clock when the frame was "captured"
+    BMDTimeValue                mFrameDuration;     // in units of mTimeScale
+    BMDTimeScale                mTimeScale;
+};
+
+#endif
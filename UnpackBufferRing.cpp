@@ -0,0 +1,166 @@
+#include "UnpackBufferRing.h"
+
+#include <string.h>
+#include <stdio.h>
+
+UnpackBufferRing::UnpackBufferRing() :
+    mCurrent(0),
+    mBufferSize(0),
+    mMode(ModeAuto),
+    mStallCount(0)
+{
+}
+
+UnpackBufferRing::~UnpackBufferRing()
+{
+    // Buffers are owned by the GL context, cleanup() must be called while it is current
+}
+
+const char* UnpackBufferRing::modeName(Mode mode)
+{
+    switch (mode)
+    {
+    case ModePersistent:    return "persistent";
+    case ModeOrphan:        return "orphan";
+    default:                return "auto";
+    }
+}
+
+bool UnpackBufferRing::modeFromName(const char* name, Mode& mode)
+{
+    if (strcmp(name, "auto") == 0)
+        mode = ModeAuto;
+    else if (strcmp(name, "persistent") == 0)
+        mode = ModePersistent;
+    else if (strcmp(name, "orphan") == 0)
+        mode = ModeOrphan;
+    else
+        return false;
+    return true;
+}
+
+bool UnpackBufferRing::init(unsigned bufferSize, int depth, Mode mode)
+{
+    cleanup();
+
+    if (mode == ModeAuto)
+        mode = glBufferStorage ? ModePersistent : ModeOrphan;
+
+    if (mode == ModePersistent && ! glBufferStorage)
+    {
+        fprintf(stderr, "GL_ARB_buffer_storage not available, using orphaned unpack buffers instead\n");
+        mode = ModeOrphan;
+    }
+
+    mMode = mode;
+    mBufferSize = bufferSize;
+    mSlots.resize(depth < 1 ? 1 : depth);
+
+    for (size_t i = 0; i < mSlots.size(); i++)
+    {
+        Slot& slot = mSlots[i];
+        slot.fence = NULL;
+        slot.mapped = NULL;
+
+        glGenBuffers(1, &slot.buffer);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.buffer);
+
+        if (mMode == ModePersistent)
+        {
+            const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            glBufferStorage(GL_PIXEL_UNPACK_BUFFER, mBufferSize, NULL, flags);
+            slot.mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, mBufferSize, flags);
+            if (slot.mapped == NULL)
+            {
+                fprintf(stderr, "Unpack buffer ring: cannot map persistent buffer of %u bytes\n", mBufferSize);
+                glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+                cleanup();
+                return false;
+            }
+        }
+        else
+        {
+            glBufferData(GL_PIXEL_UNPACK_BUFFER, mBufferSize, NULL, GL_STREAM_DRAW);
+        }
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    mCurrent = 0;
+    mStallCount = 0;
+    return true;
+}
+
+void UnpackBufferRing::cleanup()
+{
+    for (size_t i = 0; i < mSlots.size(); i++)
+    {
+        Slot& slot = mSlots[i];
+        if (slot.fence)
+            glDeleteSync(slot.fence);
+        if (slot.mapped)
+        {
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.buffer);
+            glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        }
+        glDeleteBuffers(1, &slot.buffer);
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    mSlots.clear();
+}
+
+void UnpackBufferRing::waitForSlot(Slot& slot)
+{
+    if (slot.fence == NULL)
+        return;
+
+    // With a deep enough ring the fence has long signalled and this returns immediately
+    GLenum result = glClientWaitSync(slot.fence, 0, 0);
+    if (result == GL_TIMEOUT_EXPIRED)
+    {
+        ++mStallCount;
+        glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 40 * 1000 * 1000);    // timeout in nanosec
+    }
+
+    glDeleteSync(slot.fence);
+    slot.fence = NULL;
+}
+
+GLuint UnpackBufferRing::beginUpload(const void* pixels, unsigned size)
+{
+    Slot& slot = mSlots[mCurrent];
+
+    if (size > mBufferSize)
+        size = mBufferSize;
+
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.buffer);
+
+    if (mMode == ModePersistent)
+    {
+        // The GPU may still be reading this slot from a previous lap around the ring
+        waitForSlot(slot);
+        memcpy(slot.mapped, pixels, size);
+    }
+    else
+    {
+        // Orphan the old storage so the map never synchronises with pending reads
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, mBufferSize, NULL, GL_STREAM_DRAW);
+        void* dst = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+        if (dst)
+        {
+            memcpy(dst, pixels, size);
+            glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        }
+    }
+
+    return slot.buffer;
+}
+
+void UnpackBufferRing::endUpload()
+{
+    Slot& slot = mSlots[mCurrent];
+
+    if (mMode == ModePersistent)
+        slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+    mCurrent = (mCurrent + 1) % mSlots.size();
+}
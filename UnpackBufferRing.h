@@ -0,0 +1,63 @@
+#ifndef UNPACK_BUFFER_RING_H
+#define UNPACK_BUFFER_RING_H
+
+#include "GLExtensions.h"
+
+#include <vector>
+
+////////////////////////////////////////////
+// UnpackBufferRing
+////////////////////////////////////////////
+
+// Ring of GL_PIXEL_UNPACK_BUFFERs used to upload captured frames when GL_AMD_pinned_memory is not
+// available.  Each slot is fenced after the glTexSubImage2D that reads it, so the copy of frame N+1
+// into the next slot never waits for the GPU to finish with frame N, and no buffer is reallocated
+// per frame.
+//
+// All methods must be called with the owning GL context current.
+class UnpackBufferRing
+{
+public:
+    enum Mode {
+        ModeAuto = 0,       // persistent mapping when GL_ARB_buffer_storage is available, orphaning otherwise
+        ModePersistent,     // buffers mapped once with GL_MAP_PERSISTENT_BIT, slots reused after their fence
+        ModeOrphan          // storage orphaned and re-mapped for every frame, the driver renames it
+    };
+
+    UnpackBufferRing();
+    ~UnpackBufferRing();
+
+    bool init(unsigned bufferSize, int depth, Mode mode = ModeAuto);
+    void cleanup();
+
+    // Copy pixels into the next slot and leave its buffer bound to GL_PIXEL_UNPACK_BUFFER
+    GLuint beginUpload(const void* pixels, unsigned size);
+    // Fence the slot once the commands reading from it have been issued
+    void endUpload();
+
+    Mode mode() const { return mMode; }
+    int depth() const { return (int)mSlots.size(); }
+
+    // Number of uploads that had to wait for the GPU to release a slot
+    unsigned long long stallCount() const { return mStallCount; }
+
+    static const char* modeName(Mode mode);
+    static bool modeFromName(const char* name, Mode& mode);
+
+private:
+    struct Slot {
+        GLuint  buffer;
+        GLsync  fence;
+        void*   mapped;     // persistent mapping, NULL in orphan mode
+    };
+
+    void waitForSlot(Slot& slot);
+
+    std::vector<Slot>   mSlots;
+    int                 mCurrent;
+    unsigned            mBufferSize;
+    Mode                mMode;
+    unsigned long long  mStallCount;
+};
+
+#endif
@@ -0,0 +1,62 @@
+#include "UploadScheduler.h"
+
+UploadScheduler::UploadScheduler(int maxPending) :
+    mMaxPending(maxPending < 1 ? 1 : maxPending),
+    mRetired(0),
+    mForcedWaits(0)
+{
+}
+
+UploadScheduler::~UploadScheduler()
+{
+    // flush() needs the GL context, the owner must call it before destruction
+}
+
+void UploadScheduler::submit(IDeckLinkVideoInputFrame* frame)
+{
+    PendingUpload upload;
+    upload.frame = frame;
+    upload.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    mPending.push_back(upload);
+}
+
+void UploadScheduler::release(PendingUpload& upload)
+{
+    glDeleteSync(upload.fence);
+    upload.frame->Release();
+    ++mRetired;
+}
+
+void UploadScheduler::retire()
+{
+    // Uploads complete in submission order, so stop at the first one still in flight
+    while (! mPending.empty())
+    {
+        PendingUpload& upload = mPending.front();
+        GLenum result = glClientWaitSync(upload.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+
+        if (result == GL_TIMEOUT_EXPIRED)
+        {
+            if ((int)mPending.size() <= mMaxPending)
+                break;
+
+            // Too many frames held: the capture device would start dropping input, so wait for the oldest
+            ++mForcedWaits;
+            glClientWaitSync(upload.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 40 * 1000 * 1000);   // timeout in nanosec
+        }
+
+        release(upload);
+        mPending.pop_front();
+    }
+}
+
+void UploadScheduler::flush()
+{
+    while (! mPending.empty())
+    {
+        PendingUpload& upload = mPending.front();
+        glClientWaitSync(upload.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 40 * 1000 * 1000);       // timeout in nanosec
+        release(upload);
+        mPending.pop_front();
+    }
+}
@@ -0,0 +1,56 @@
+#ifndef UPLOAD_SCHEDULER_H
+#define UPLOAD_SCHEDULER_H
+
+#include "GLExtensions.h"
+#include "DeckLinkAPI.h"
+
+#include <deque>
+
+////////////////////////////////////////////
+// UploadScheduler
+////////////////////////////////////////////
+
+// Keeps captured frames alive while the GPU is still reading them.  With GL_AMD_pinned_memory the
+// texture upload DMAs straight out of the DeckLink frame buffer, so the frame may only be handed back
+// to the capture allocator once the fence recorded after its glTexSubImage2D has signalled.  Instead of
+// blocking on that fence every frame, each upload is queued with its fence and retired on a later
+// iteration, letting capture, DMA and drawing of consecutive frames overlap.
+//
+// All methods must be called with the owning GL context current.
+class UploadScheduler
+{
+public:
+    UploadScheduler(int maxPending = 3);
+    ~UploadScheduler();
+
+    // Takes over the caller's reference on frame and fences the upload commands issued so far
+    void submit(IDeckLinkVideoInputFrame* frame);
+
+    // Release frames whose uploads have completed.  Blocks on the oldest upload only when more than
+    // maxPending are outstanding, so the capture device never runs out of buffers.
+    void retire();
+
+    // Wait for and release everything, e.g. before the capture allocator or GL state is torn down
+    void flush();
+
+    void setMaxPending(int maxPending) { mMaxPending = maxPending < 1 ? 1 : maxPending; }
+    int pending() const { return (int)mPending.size(); }
+
+    unsigned long long retiredCount() const { return mRetired; }
+    unsigned long long forcedWaitCount() const { return mForcedWaits; }
+
+private:
+    struct PendingUpload {
+        IDeckLinkVideoInputFrame*   frame;
+        GLsync                      fence;
+    };
+
+    void release(PendingUpload& upload);
+
+    std::deque<PendingUpload>   mPending;
+    int                         mMaxPending;
+    unsigned long long          mRetired;
+    unsigned long long          mForcedWaits;
+};
+
+#endif
@@ -0,0 +1,394 @@
+#include "UyvyConverter.h"
+
+#include <math.h>
+#include <stddef.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define UYVY_CONVERTER_X86
+#include <immintrin.h>
+#endif
+
+namespace {
+
+// The shader's Rec.709 matrix (Poynton 2003, eq 26.7)
+const double kCrToR = 1.5748;
+const double kCbToG = 0.1873;
+const double kCrToG = 0.4681;
+const double kCbToB = 1.8556;
+
+// The shader maps the normalised texture value t = v / 255 with (t * 256 - 16) / 219 for luma and
+// (t * 256 - 16) / 224 - 0.5 for chroma.  Scaled to 8 bit output that is
+//   Y' = v * 256 / 219 - 4080 / 219,    C' = (c - 127.5) * 256 / 224
+// Luma is multiplied as v << 7 by a Q14 factor and chroma as (c - 128) << 8 by Q13 factors, so every
+// product keeps 5 fractional bits after the high half of a 16 bit multiply and the sums stay in
+// range of a signed 16 bit lane.
+const int kFractionBits = 5;
+
+int fixedPoint(double value, int bits)
+{
+    return (int)floor(value * (1 << bits) + 0.5);
+}
+
+const double kLumaScale = 256.0 / 219.0;
+const double kLumaOffset = -4080.0 / 219.0;
+const double kChromaScale = 256.0 / 224.0;
+
+const int kY = fixedPoint(kLumaScale, 14);
+const int kRV = fixedPoint(kCrToR * kChromaScale, 13);
+const int kGU = fixedPoint(kCbToG * kChromaScale, 13);
+const int kGV = fixedPoint(kCrToG * kChromaScale, 13);
+const int kBU = fixedPoint(kCbToB * kChromaScale, 13);
+
+// Luma offset, the half step from centring chroma on 128 instead of 127.5, and rounding
+const int kRounding = 1 << (kFractionBits - 1);
+const int kBiasR = fixedPoint(kLumaOffset + 0.5 * kCrToR * kChromaScale, kFractionBits) + kRounding;
+const int kBiasG = fixedPoint(kLumaOffset - 0.5 * (kCbToG + kCrToG) * kChromaScale, kFractionBits) + kRounding;
+const int kBiasB = fixedPoint(kLumaOffset + 0.5 * kCbToB * kChromaScale, kFractionBits) + kRounding;
+
+////////////////////////////////////////////
+// Scalar kernels; also finish the rows of the vector kernels
+////////////////////////////////////////////
+
+// High half of a signed 16 x 16 bit product, as _mm_mulhi_epi16
+inline int mulhi(int a, int b)
+{
+    return (a * b) >> 16;
+}
+
+inline unsigned char toPixel(int value)
+{
+    value >>= kFractionBits;
+    return (unsigned char)(value < 0 ? 0 : (value > 255 ? 255 : value));
+}
+
+void rowToRGB32Scalar(const unsigned char* src, unsigned char* dst, unsigned pairs,
+                      unsigned char alpha, bool bgr)
+{
+    int ri = bgr ? 2 : 0;
+    int bi = bgr ? 0 : 2;
+
+    for (unsigned i = 0; i < pairs; i++, src += 4, dst += 8)
+    {
+        int u = (src[0] - 128) << 8;
+        int v = (src[2] - 128) << 8;
+        int r = mulhi(v, kRV) + kBiasR;
+        int g = kBiasG - mulhi(u, kGU) - mulhi(v, kGV);
+        int b = mulhi(u, kBU) + kBiasB;
+
+        int y0 = mulhi(src[1] << 7, kY);
+        int y1 = mulhi(src[3] << 7, kY);
+
+        dst[ri] = toPixel(y0 + r);
+        dst[1] = toPixel(y0 + g);
+        dst[bi] = toPixel(y0 + b);
+        dst[3] = alpha;
+        dst[4 + ri] = toPixel(y1 + r);
+        dst[5] = toPixel(y1 + g);
+        dst[4 + bi] = toPixel(y1 + b);
+        dst[7] = alpha;
+    }
+}
+
+// src1 is the next row, or src0 again for the last row of an odd height
+void rowToNV12Scalar(const unsigned char* src0, const unsigned char* src1, unsigned pairs,
+                     unsigned char* dstY0, unsigned char* dstY1, unsigned char* dstUV)
+{
+    for (unsigned i = 0; i < pairs; i++, src0 += 4, src1 += 4)
+    {
+        dstUV[2 * i] = (unsigned char)((src0[0] + src1[0] + 1) >> 1);
+        dstUV[2 * i + 1] = (unsigned char)((src0[2] + src1[2] + 1) >> 1);
+        dstY0[2 * i] = src0[1];
+        dstY0[2 * i + 1] = src0[3];
+        if (dstY1)
+        {
+            dstY1[2 * i] = src1[1];
+            dstY1[2 * i + 1] = src1[3];
+        }
+    }
+}
+
+#ifdef UYVY_CONVERTER_X86
+
+////////////////////////////////////////////
+// SSE2 kernels, 8 pixels per iteration
+////////////////////////////////////////////
+
+__attribute__((target("sse2")))
+unsigned rowToRGB32SSE2(const unsigned char* src, unsigned char* dst, unsigned pairs,
+                        unsigned char alpha, bool bgr)
+{
+    const __m128i lowByte = _mm_set1_epi16(0x00ff);
+    const __m128i lowWord = _mm_set1_epi32(0x0000ffff);
+    const __m128i centre = _mm_set1_epi16(128);
+    const __m128i ky = _mm_set1_epi16((short)kY);
+    const __m128i krv = _mm_set1_epi16((short)kRV);
+    const __m128i kgu = _mm_set1_epi16((short)kGU);
+    const __m128i kgv = _mm_set1_epi16((short)kGV);
+    const __m128i kbu = _mm_set1_epi16((short)kBU);
+    const __m128i biasR = _mm_set1_epi16((short)kBiasR);
+    const __m128i biasG = _mm_set1_epi16((short)kBiasG);
+    const __m128i biasB = _mm_set1_epi16((short)kBiasB);
+    const __m128i a8 = _mm_set1_epi8((char)alpha);
+
+    unsigned done = 0;
+    for (; done + 4 <= pairs; done += 4, src += 16, dst += 32)
+    {
+        __m128i in = _mm_loadu_si128((const __m128i*)src);
+
+        // 16 bit lanes: Y0..Y7, and U0 V0 U1 V1 .. U3 V3
+        __m128i y = _mm_srli_epi16(in, 8);
+        __m128i c = _mm_sub_epi16(_mm_and_si128(in, lowByte), centre);
+
+        // Chroma of each macropixel repeated for both of its pixels
+        __m128i u = _mm_and_si128(c, lowWord);
+        u = _mm_or_si128(u, _mm_slli_epi32(u, 16));
+        __m128i v = _mm_srli_epi32(c, 16);
+        v = _mm_or_si128(v, _mm_slli_epi32(v, 16));
+        u = _mm_slli_epi16(u, 8);
+        v = _mm_slli_epi16(v, 8);
+
+        y = _mm_mulhi_epi16(_mm_slli_epi16(y, 7), ky);
+        __m128i r = _mm_add_epi16(_mm_add_epi16(y, _mm_mulhi_epi16(v, krv)), biasR);
+        __m128i g = _mm_sub_epi16(_mm_sub_epi16(_mm_add_epi16(y, biasG), _mm_mulhi_epi16(u, kgu)), _mm_mulhi_epi16(v, kgv));
+        __m128i b = _mm_add_epi16(_mm_add_epi16(y, _mm_mulhi_epi16(u, kbu)), biasB);
+
+        __m128i r8 = _mm_packus_epi16(_mm_srai_epi16(r, kFractionBits), r);
+        __m128i g8 = _mm_packus_epi16(_mm_srai_epi16(g, kFractionBits), g);
+        __m128i b8 = _mm_packus_epi16(_mm_srai_epi16(b, kFractionBits), b);
+        if (bgr)
+        {
+            __m128i t = r8;
+            r8 = b8;
+            b8 = t;
+        }
+
+        __m128i rg = _mm_unpacklo_epi8(r8, g8);
+        __m128i ba = _mm_unpacklo_epi8(b8, a8);
+        _mm_storeu_si128((__m128i*)dst, _mm_unpacklo_epi16(rg, ba));
+        _mm_storeu_si128((__m128i*)(dst + 16), _mm_unpackhi_epi16(rg, ba));
+    }
+    return done;
+}
+
+__attribute__((target("sse2")))
+unsigned rowToNV12SSE2(const unsigned char* src0, const unsigned char* src1, unsigned pairs,
+                       unsigned char* dstY0, unsigned char* dstY1, unsigned char* dstUV)
+{
+    const __m128i lowByte = _mm_set1_epi16(0x00ff);
+
+    unsigned done = 0;
+    for (; done + 8 <= pairs; done += 8, src0 += 32, src1 += 32)
+    {
+        __m128i a0 = _mm_loadu_si128((const __m128i*)src0);
+        __m128i a1 = _mm_loadu_si128((const __m128i*)(src0 + 16));
+        __m128i b0 = _mm_loadu_si128((const __m128i*)src1);
+        __m128i b1 = _mm_loadu_si128((const __m128i*)(src1 + 16));
+
+        __m128i c0 = _mm_and_si128(_mm_avg_epu8(a0, b0), lowByte);
+        __m128i c1 = _mm_and_si128(_mm_avg_epu8(a1, b1), lowByte);
+        _mm_storeu_si128((__m128i*)(dstUV + 2 * done), _mm_packus_epi16(c0, c1));
+
+        _mm_storeu_si128((__m128i*)(dstY0 + 2 * done), _mm_packus_epi16(_mm_srli_epi16(a0, 8), _mm_srli_epi16(a1, 8)));
+        if (dstY1)
+            _mm_storeu_si128((__m128i*)(dstY1 + 2 * done), _mm_packus_epi16(_mm_srli_epi16(b0, 8), _mm_srli_epi16(b1, 8)));
+    }
+    return done;
+}
+
+////////////////////////////////////////////
+// AVX2 kernels, 16 pixels per iteration
+////////////////////////////////////////////
+
+// Same steps as the SSE2 kernels in each 128 bit lane, with the lanes put back in order when storing
+
+__attribute__((target("avx2")))
+unsigned rowToRGB32AVX2(const unsigned char* src, unsigned char* dst, unsigned pairs,
+                        unsigned char alpha, bool bgr)
+{
+    const __m256i lowByte = _mm256_set1_epi16(0x00ff);
+    const __m256i lowWord = _mm256_set1_epi32(0x0000ffff);
+    const __m256i centre = _mm256_set1_epi16(128);
+    const __m256i ky = _mm256_set1_epi16((short)kY);
+    const __m256i krv = _mm256_set1_epi16((short)kRV);
+    const __m256i kgu = _mm256_set1_epi16((short)kGU);
+    const __m256i kgv = _mm256_set1_epi16((short)kGV);
+    const __m256i kbu = _mm256_set1_epi16((short)kBU);
+    const __m256i biasR = _mm256_set1_epi16((short)kBiasR);
+    const __m256i biasG = _mm256_set1_epi16((short)kBiasG);
+    const __m256i biasB = _mm256_set1_epi16((short)kBiasB);
+    const __m256i a8 = _mm256_set1_epi8((char)alpha);
+
+    unsigned done = 0;
+    for (; done + 8 <= pairs; done += 8, src += 32, dst += 64)
+    {
+        __m256i in = _mm256_loadu_si256((const __m256i*)src);
+
+        __m256i y = _mm256_srli_epi16(in, 8);
+        __m256i c = _mm256_sub_epi16(_mm256_and_si256(in, lowByte), centre);
+
+        __m256i u = _mm256_and_si256(c, lowWord);
+        u = _mm256_or_si256(u, _mm256_slli_epi32(u, 16));
+        __m256i v = _mm256_srli_epi32(c, 16);
+        v = _mm256_or_si256(v, _mm256_slli_epi32(v, 16));
+        u = _mm256_slli_epi16(u, 8);
+        v = _mm256_slli_epi16(v, 8);
+
+        y = _mm256_mulhi_epi16(_mm256_slli_epi16(y, 7), ky);
+        __m256i r = _mm256_add_epi16(_mm256_add_epi16(y, _mm256_mulhi_epi16(v, krv)), biasR);
+        __m256i g = _mm256_sub_epi16(_mm256_sub_epi16(_mm256_add_epi16(y, biasG), _mm256_mulhi_epi16(u, kgu)), _mm256_mulhi_epi16(v, kgv));
+        __m256i b = _mm256_add_epi16(_mm256_add_epi16(y, _mm256_mulhi_epi16(u, kbu)), biasB);
+
+        __m256i r8 = _mm256_packus_epi16(_mm256_srai_epi16(r, kFractionBits), r);
+        __m256i g8 = _mm256_packus_epi16(_mm256_srai_epi16(g, kFractionBits), g);
+        __m256i b8 = _mm256_packus_epi16(_mm256_srai_epi16(b, kFractionBits), b);
+        if (bgr)
+        {
+            __m256i t = r8;
+            r8 = b8;
+            b8 = t;
+        }
+
+        __m256i rg = _mm256_unpacklo_epi8(r8, g8);
+        __m256i ba = _mm256_unpacklo_epi8(b8, a8);
+        __m256i lo = _mm256_unpacklo_epi16(rg, ba);     // pixels 0-3, 8-11
+        __m256i hi = _mm256_unpackhi_epi16(rg, ba);     // pixels 4-7, 12-15
+        _mm256_storeu_si256((__m256i*)dst, _mm256_permute2x128_si256(lo, hi, 0x20));
+        _mm256_storeu_si256((__m256i*)(dst + 32), _mm256_permute2x128_si256(lo, hi, 0x31));
+    }
+    return done;
+}
+
+__attribute__((target("avx2")))
+unsigned rowToNV12AVX2(const unsigned char* src0, const unsigned char* src1, unsigned pairs,
+                       unsigned char* dstY0, unsigned char* dstY1, unsigned char* dstUV)
+{
+    const __m256i lowByte = _mm256_set1_epi16(0x00ff);
+
+    unsigned done = 0;
+    for (; done + 16 <= pairs; done += 16, src0 += 64, src1 += 64)
+    {
+        __m256i a0 = _mm256_loadu_si256((const __m256i*)src0);
+        __m256i a1 = _mm256_loadu_si256((const __m256i*)(src0 + 32));
+        __m256i b0 = _mm256_loadu_si256((const __m256i*)src1);
+        __m256i b1 = _mm256_loadu_si256((const __m256i*)(src1 + 32));
+
+        // packus interleaves the lanes of its operands; 0xd8 restores the source order
+        __m256i c0 = _mm256_and_si256(_mm256_avg_epu8(a0, b0), lowByte);
+        __m256i c1 = _mm256_and_si256(_mm256_avg_epu8(a1, b1), lowByte);
+        _mm256_storeu_si256((__m256i*)(dstUV + 2 * done), _mm256_permute4x64_epi64(_mm256_packus_epi16(c0, c1), 0xd8));
+
+        __m256i y0 = _mm256_packus_epi16(_mm256_srli_epi16(a0, 8), _mm256_srli_epi16(a1, 8));
+        _mm256_storeu_si256((__m256i*)(dstY0 + 2 * done), _mm256_permute4x64_epi64(y0, 0xd8));
+        if (dstY1)
+        {
+            __m256i y1 = _mm256_packus_epi16(_mm256_srli_epi16(b0, 8), _mm256_srli_epi16(b1, 8));
+            _mm256_storeu_si256((__m256i*)(dstY1 + 2 * done), _mm256_permute4x64_epi64(y1, 0xd8));
+        }
+    }
+    return done;
+}
+
+#endif // UYVY_CONVERTER_X86
+
+} // namespace
+
+UyvyConverter::UyvyConverter() :
+    mIsa(bestIsa())
+{
+}
+
+UyvyConverter::UyvyConverter(Isa isa) :
+    mIsa(isaSupported(isa) ? isa : bestIsa())
+{
+}
+
+UyvyConverter::Isa UyvyConverter::bestIsa()
+{
+    if (isaSupported(IsaAVX2))
+        return IsaAVX2;
+    if (isaSupported(IsaSSE2))
+        return IsaSSE2;
+    return IsaScalar;
+}
+
+bool UyvyConverter::isaSupported(Isa isa)
+{
+    switch (isa)
+    {
+    case IsaScalar:
+        return true;
+#ifdef UYVY_CONVERTER_X86
+    case IsaSSE2:
+        return __builtin_cpu_supports("sse2");
+    case IsaAVX2:
+        return __builtin_cpu_supports("avx2");
+#endif
+    default:
+        return false;
+    }
+}
+
+const char* UyvyConverter::isaName(Isa isa)
+{
+    switch (isa)
+    {
+    case IsaSSE2:   return "sse2";
+    case IsaAVX2:   return "avx2";
+    default:        return "scalar";
+    }
+}
+
+void UyvyConverter::toRGBA(const unsigned char* src, unsigned srcRowBytes, unsigned width, unsigned height,
+                           unsigned char* dst, unsigned dstRowBytes, unsigned char alpha) const
+{
+    toRGB32(src, srcRowBytes, width, height, dst, dstRowBytes, alpha, false);
+}
+
+void UyvyConverter::toBGRA(const unsigned char* src, unsigned srcRowBytes, unsigned width, unsigned height,
+                           unsigned char* dst, unsigned dstRowBytes, unsigned char alpha) const
+{
+    toRGB32(src, srcRowBytes, width, height, dst, dstRowBytes, alpha, true);
+}
+
+void UyvyConverter::toRGB32(const unsigned char* src, unsigned srcRowBytes, unsigned width, unsigned height,
+                            unsigned char* dst, unsigned dstRowBytes, unsigned char alpha, bool bgr) const
+{
+    unsigned pairs = width / 2;
+
+    for (unsigned row = 0; row < height; row++, src += srcRowBytes, dst += dstRowBytes)
+    {
+        unsigned done = 0;
+#ifdef UYVY_CONVERTER_X86
+        if (mIsa == IsaAVX2)
+            done = rowToRGB32AVX2(src, dst, pairs, alpha, bgr);
+        else if (mIsa == IsaSSE2)
+            done = rowToRGB32SSE2(src, dst, pairs, alpha, bgr);
+#endif
+        rowToRGB32Scalar(src + 4 * done, dst + 8 * done, pairs - done, alpha, bgr);
+    }
+}
+
+void UyvyConverter::toNV12(const unsigned char* src, unsigned srcRowBytes, unsigned width, unsigned height,
+                           unsigned char* dstY, unsigned dstYRowBytes, unsigned char* dstUV, unsigned dstUVRowBytes) const
+{
+    unsigned pairs = width / 2;
+
+    for (unsigned row = 0; row < height; row += 2)
+    {
+        const unsigned char* src0 = src + row * srcRowBytes;
+        const unsigned char* src1 = row + 1 < height ? src0 + srcRowBytes : src0;
+        unsigned char* dstY0 = dstY + row * dstYRowBytes;
+        unsigned char* dstY1 = row + 1 < height ? dstY0 + dstYRowBytes : NULL;
+        unsigned char* uv = dstUV + (row / 2) * dstUVRowBytes;
+
+        unsigned done = 0;
+#ifdef UYVY_CONVERTER_X86
+        if (mIsa == IsaAVX2)
+            done = rowToNV12AVX2(src0, src1, pairs, dstY0, dstY1, uv);
+        else if (mIsa == IsaSSE2)
+            done = rowToNV12SSE2(src0, src1, pairs, dstY0, dstY1, uv);
+#endif
+        rowToNV12Scalar(src0 + 4 * done, src1 + 4 * done, pairs - done,
+                        dstY0 + 2 * done, dstY1 ? dstY1 + 2 * done : NULL, uv + 2 * done);
+    }
+}
@@ -0,0 +1,53 @@
+#ifndef UYVY_CONVERTER_H
+#define UYVY_CONVERTER_H
+
+////////////////////////////////////////////
+// UyvyConverter
+////////////////////////////////////////////
+
+// CPU counterpart of the colour conversion in the warp fragment shader, for machines without a
+// usable GPU, for reference images and for feeding encoders.  Converts 8 bit UYVY (bmdFormat8BitYUV)
+// to RGBA, BGRA or NV12.
+//
+// RGB output uses the shader's YCbCr2rgba() Rec.709 coefficients and range handling, including its
+// scaling of the normalised texture values by 256 instead of 255, so RGB values match what the GPU
+// draws (before the shader's bilinear filtering) to within rounding.  Every pixel takes the chroma
+// of its own macropixel.  The arithmetic is 16 bit fixed point, done identically by the scalar, SSE2
+// and AVX2 kernels, so the output does not depend on the instruction set used.  NV12 output stays in
+// video range: luma is copied and chroma averaged over each pair of rows.
+//
+// Widths must be even.  Stateless apart from the instruction set; safe to share between threads.
+class UyvyConverter
+{
+public:
+    enum Isa {
+        IsaScalar = 0,
+        IsaSSE2,
+        IsaAVX2
+    };
+
+    // Defaults to the best instruction set the CPU supports
+    UyvyConverter();
+    UyvyConverter(Isa isa);
+
+    Isa isa() const { return mIsa; }
+
+    void toRGBA(const unsigned char* src, unsigned srcRowBytes, unsigned width, unsigned height,
+                unsigned char* dst, unsigned dstRowBytes, unsigned char alpha = 255) const;
+    void toBGRA(const unsigned char* src, unsigned srcRowBytes, unsigned width, unsigned height,
+                unsigned char* dst, unsigned dstRowBytes, unsigned char alpha = 255) const;
+    void toNV12(const unsigned char* src, unsigned srcRowBytes, unsigned width, unsigned height,
+                unsigned char* dstY, unsigned dstYRowBytes, unsigned char* dstUV, unsigned dstUVRowBytes) const;
+
+    static Isa bestIsa();
+    static bool isaSupported(Isa isa);
+    static const char* isaName(Isa isa);
+
+private:
+    void toRGB32(const unsigned char* src, unsigned srcRowBytes, unsigned width, unsigned height,
+                 unsigned char* dst, unsigned dstRowBytes, unsigned char alpha, bool bgr) const;
+
+    Isa     mIsa;
+};
+
+#endif
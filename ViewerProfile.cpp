@@ -0,0 +1,328 @@
+#include "ViewerProfile.h"
+
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QUrl>
+#include <QUrlQuery>
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+
+// Header of DeviceParams written to a stream by the Cardboard SDK: this big-endian sentinel, then the
+// message length
+#define DEVICE_PARAMS_SENTINEL  0x35587a2b
+
+namespace {
+
+// DeviceParams fields (cardboard_device.proto)
+enum {
+    FieldVendor = 1,
+    FieldModel = 2,
+    FieldScreenToLensDistance = 3,
+    FieldInterLensDistance = 4,
+    FieldLeftEyeFieldOfViewAngles = 5,      // left, right, bottom, top, in degrees
+    FieldTrayToLensDistance = 6,
+    FieldDistortionCoefficients = 7,
+    FieldVerticalAlignment = 11             // 0 bottom, 1 centre, 2 top
+};
+
+enum {
+    WireVarint = 0,
+    WireFixed64 = 1,
+    WireLengthDelimited = 2,
+    WireFixed32 = 5
+};
+
+// Reader of the protocol buffer wire format, enough for DeviceParams
+class WireReader
+{
+public:
+    WireReader(const QByteArray& data) :
+        mData((const unsigned char*)data.constData()), mSize(data.size()), mPos(0), mError(false) {}
+
+    bool atEnd() const { return mPos >= mSize || mError; }
+    bool error() const { return mError; }
+
+    quint64 varint()
+    {
+        quint64 value = 0;
+        for (int shift = 0; shift < 64; shift += 7)
+        {
+            if (mPos >= mSize)
+                break;
+            unsigned char byte = mData[mPos++];
+            value |= (quint64)(byte & 0x7f) << shift;
+            if (! (byte & 0x80))
+                return value;
+        }
+        mError = true;
+        return 0;
+    }
+
+    float fixed32()
+    {
+        if (mSize - mPos < 4)
+        {
+            mError = true;
+            return 0;
+        }
+        // Little-endian on the wire
+        quint32 bits = mData[mPos] | mData[mPos + 1] << 8 | mData[mPos + 2] << 16 | (quint32)mData[mPos + 3] << 24;
+        mPos += 4;
+        float value;
+        memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+
+    QByteArray bytes()
+    {
+        quint64 length = varint();
+        if (mError || length > (quint64)(mSize - mPos))
+        {
+            mError = true;
+            return QByteArray();
+        }
+        QByteArray value((const char*)mData + mPos, (int)length);
+        mPos += (int)length;
+        return value;
+    }
+
+    void skip(int wireType)
+    {
+        switch (wireType)
+        {
+        case WireVarint:            varint(); break;
+        case WireFixed64:           fixed32(); fixed32(); break;
+        case WireLengthDelimited:   bytes(); break;
+        case WireFixed32:           fixed32(); break;
+        default:                    mError = true; break;
+        }
+    }
+
+    // A repeated float, packed or one element per field
+    void floats(int wireType, std::vector<float>& values)
+    {
+        if (wireType == WireFixed32)
+        {
+            values.push_back(fixed32());
+        }
+        else if (wireType == WireLengthDelimited)
+        {
+            // The reader only points into the data
+            QByteArray data = bytes();
+            WireReader packed(data);
+            while (! packed.atEnd())
+                values.push_back(packed.fixed32());
+            mError = mError || packed.error();
+        }
+        else
+        {
+            mError = true;
+        }
+    }
+
+private:
+    const unsigned char*    mData;
+    int                     mSize;
+    int                     mPos;
+    bool                    mError;
+};
+
+// What the Cardboard SDK assumes for fields a viewer does not set: the original Cardboard
+void setDefaults(CardboardViewer& viewer)
+{
+    viewer.id = "custom";
+    viewer.label = "Custom viewer";
+    viewer.fov = 40;
+    viewer.interLensDistance = 0.060;
+    viewer.baselineLensDistance = 0.035;
+    viewer.screenLensDistance = 0.042;
+    viewer.distortionCoefficients[0] = 0.441;
+    viewer.distortionCoefficients[1] = 0.156;
+    std::fill(viewer.inverseCoefficients, viewer.inverseCoefficients + 12, 0.0f);
+}
+
+void fitInverse(CardboardViewer& viewer)
+{
+    float error = DeviceInfo::fitInverseCoefficients(viewer);
+    fprintf(stderr, "Fitted the inverse distortion of viewer %s, largest error %.2g\n", viewer.id.c_str(), error);
+}
+
+bool isValid(const CardboardViewer& viewer, QString& error)
+{
+    if (viewer.id.empty())
+        error = "The viewer has no id.";
+    else if (! (viewer.fov > 0 && viewer.fov < 90))
+        error = QString("Field of view %1 is not between 0 and 90 degrees.").arg(viewer.fov);
+    else if (! (viewer.interLensDistance > 0) || ! (viewer.screenLensDistance > 0) || ! (viewer.baselineLensDistance >= 0))
+        error = "Lens distances must be positive.";
+    else if (! DeviceInfo::isInvertible(viewer))
+        error = QString("Distortion coefficients %1, %2 fold back within the field of view, so the warp cannot be inverted.")
+                .arg(viewer.distortionCoefficients[0]).arg(viewer.distortionCoefficients[1]);
+    else
+        return true;
+    return false;
+}
+
+} // namespace
+
+bool ViewerProfile::load(const QString& spec, CardboardViewer& viewer, QString& error)
+{
+    QFile file(spec);
+    if (! file.exists())
+        return fromUrl(spec, viewer, error);
+
+    if (! file.open(QIODevice::ReadOnly))
+    {
+        error = QString("Cannot read %1: %2").arg(spec).arg(file.errorString());
+        return false;
+    }
+    QByteArray data = file.readAll();
+    QByteArray text = data.trimmed();
+
+    if (text.startsWith("{"))
+        return fromJson(data, viewer, error);
+    if (text.startsWith("http://") || text.startsWith("https://"))
+        return fromUrl(QString::fromLatin1(text), viewer, error);
+
+    if (data.size() >= 8)
+    {
+        const unsigned char* header = (const unsigned char*)data.constData();
+        quint32 sentinel = (quint32)header[0] << 24 | header[1] << 16 | header[2] << 8 | header[3];
+        quint32 length = (quint32)header[4] << 24 | header[5] << 16 | header[6] << 8 | header[7];
+        if (sentinel == DEVICE_PARAMS_SENTINEL && length <= (quint32)data.size() - 8)
+            return fromDeviceParams(data.mid(8, (int)length), viewer, error);
+    }
+    return fromDeviceParams(data, viewer, error);
+}
+
+bool ViewerProfile::fromUrl(const QString& url, CardboardViewer& viewer, QString& error)
+{
+    QString p = url;
+    if (url.startsWith("http://") || url.startsWith("https://"))
+    {
+        QUrlQuery query = QUrlQuery(QUrl(url));
+        if (! query.hasQueryItem("p"))
+        {
+            // QR codes usually hold a short link that redirects to the URL with the parameters
+            error = QString("%1 has no viewer parameters; for a short link, pass the URL it redirects to.").arg(url);
+            return false;
+        }
+        p = query.queryItemValue("p");
+    }
+
+    QByteArray params = QByteArray::fromBase64(p.toLatin1(), QByteArray::Base64UrlEncoding);
+    if (params.isEmpty())
+    {
+        error = QString("'%1' is neither a file nor Cardboard viewer parameters.").arg(url);
+        return false;
+    }
+    return fromDeviceParams(params, viewer, error);
+}
+
+bool ViewerProfile::fromDeviceParams(const QByteArray& params, CardboardViewer& viewer, QString& error)
+{
+    CardboardViewer result;
+    setDefaults(result);
+
+    std::string vendor, model;
+    std::vector<float> fov, distortion;
+    WireReader reader(params);
+    while (! reader.atEnd())
+    {
+        quint64 tag = reader.varint();
+        int wireType = (int)(tag & 7);
+        switch (tag >> 3)
+        {
+        case FieldVendor:                   vendor = reader.bytes().toStdString(); break;
+        case FieldModel:                    model = reader.bytes().toStdString(); break;
+        case FieldScreenToLensDistance:     result.screenLensDistance = reader.fixed32(); break;
+        case FieldInterLensDistance:        result.interLensDistance = reader.fixed32(); break;
+        case FieldLeftEyeFieldOfViewAngles: reader.floats(wireType, fov); break;
+        case FieldTrayToLensDistance:       result.baselineLensDistance = reader.fixed32(); break;
+        case FieldDistortionCoefficients:   reader.floats(wireType, distortion); break;
+        case FieldVerticalAlignment:
+            if (reader.varint() != 0)
+                fprintf(stderr, "Viewer lenses are not aligned to the tray; the tray to lens distance is used anyway\n");
+            break;
+        default:                            reader.skip(wireType); break;
+        }
+    }
+    if (reader.error())
+    {
+        error = "The Cardboard viewer parameters are corrupt.";
+        return false;
+    }
+
+    if (! model.empty())
+        result.id = model;
+    if (! vendor.empty() || ! model.empty())
+        result.label = vendor.empty() || model.empty() ? vendor + model : vendor + " " + model;
+    // The warp has one field of view for all four sides
+    if (! fov.empty())
+        result.fov = *std::max_element(fov.begin(), fov.end());
+    if (! distortion.empty())
+    {
+        if (distortion.size() > 2)
+            fprintf(stderr, "Viewer %s has %d distortion coefficients, only the first two are used\n", result.id.c_str(), (int)distortion.size());
+        result.distortionCoefficients[0] = distortion[0];
+        result.distortionCoefficients[1] = distortion.size() > 1 ? distortion[1] : 0;
+    }
+
+    if (! isValid(result, error))
+        return false;
+    fitInverse(result);
+    viewer = result;
+    return true;
+}
+
+bool ViewerProfile::fromJson(const QByteArray& json, CardboardViewer& viewer, QString& error)
+{
+    QJsonParseError parseError;
+    QJsonDocument document = QJsonDocument::fromJson(json, &parseError);
+    if (! document.isObject())
+    {
+        error = QString("Invalid viewer JSON: %1").arg(parseError.errorString());
+        return false;
+    }
+
+    CardboardViewer result;
+    setDefaults(result);
+
+    QJsonObject object = document.object();
+    result.id = object.value("id").toString(QString::fromStdString(result.id)).toStdString();
+    result.label = object.value("label").toString(QString::fromStdString(result.id)).toStdString();
+    result.fov = object.value("fov").toDouble(result.fov);
+    result.interLensDistance = object.value("interLensDistance").toDouble(result.interLensDistance);
+    result.baselineLensDistance = object.value("baselineLensDistance").toDouble(result.baselineLensDistance);
+    result.screenLensDistance = object.value("screenLensDistance").toDouble(result.screenLensDistance);
+
+    QJsonArray distortion = object.value("distortionCoefficients").toArray();
+    if (distortion.size() > 2)
+    {
+        error = "A viewer has at most two distortionCoefficients.";
+        return false;
+    }
+    for (int i = 0; i < distortion.size(); i++)
+        result.distortionCoefficients[i] = distortion[i].toDouble();
+    if (distortion.size() == 1)
+        result.distortionCoefficients[1] = 0;
+
+    QJsonArray inverse = object.value("inverseCoefficients").toArray();
+    if (! inverse.isEmpty() && inverse.size() != 12)
+    {
+        error = "inverseCoefficients must have 12 terms, or be left out to be fitted.";
+        return false;
+    }
+    for (int i = 0; i < inverse.size(); i++)
+        result.inverseCoefficients[i] = inverse[i].toDouble();
+
+    if (! isValid(result, error))
+        return false;
+    if (inverse.isEmpty())
+        fitInverse(result);
+    viewer = result;
+    return true;
+}
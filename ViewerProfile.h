@@ -0,0 +1,37 @@
+#ifndef VIEWER_PROFILE_H
+#define VIEWER_PROFILE_H
+
+#include "DeviceInfo.h"
+
+#include <QByteArray>
+#include <QString>
+
+using namespace cam2vr;
+
+////////////////////////////////////////////
+// ViewerProfile
+////////////////////////////////////////////
+
+// Reads viewer definitions into CardboardViewer, so a new headset needs no code change:
+//  - the viewer parameters of a Cardboard QR code, i.e. the URL it leads to,
+//    http://google.com/cardboard/cfg?p=<base64url>, or just its p value.  p is a serialised
+//    DeviceParams message of the Cardboard SDK, decoded here without the protocol buffer library.
+//  - a file holding such a URL, a DeviceParams message (as stored on phones, with or without the
+//    SDK's stream header), or JSON with CardboardViewer's field names:
+//      {"id": "MyViewer", "label": "My viewer", "fov": 50, "interLensDistance": 0.064,
+//       "baselineLensDistance": 0.035, "screenLensDistance": 0.039, "distortionCoefficients": [0.34, 0.55]}
+// Missing fields take the Cardboard SDK's defaults, those of CardboardV1.  inverseCoefficients are
+// fitted with DeviceInfo::fitInverseCoefficients() unless the JSON lists all twelve.
+class ViewerProfile
+{
+public:
+    // spec is a file name, a URL or a p value
+    static bool load(const QString& spec, CardboardViewer& viewer, QString& error);
+
+    // A Cardboard URL or its p value
+    static bool fromUrl(const QString& url, CardboardViewer& viewer, QString& error);
+    static bool fromDeviceParams(const QByteArray& params, CardboardViewer& viewer, QString& error);
+    static bool fromJson(const QByteArray& json, CardboardViewer& viewer, QString& error);
+};
+
+#endif
@@ -0,0 +1,1200 @@
+#include "WarpRenderer.h"
+#include "OpenGLCapture.h"
+#include "FramePacer.h"
+#include <GL/glu.h>
+#include <QDebug>
+#include <math.h>
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+
+namespace {
+
+// Vertex of the strip layout: position as normalised shorts of position / positionScale, texture
+// coordinates and eye as normalised unsigned shorts, padded to 4 byte alignment
+struct PackedVertex {
+    GLshort     x, y;
+    GLushort    s, t, eye, pad;
+};
+
+// Strip indices are 16-bit as long as the restart index is not also a vertex
+inline bool useShortIndices(unsigned vertexCount)
+{
+    return vertexCount <= 0xffff;
+}
+
+const unsigned int RESTART_INDEX = 0xffffffff;
+
+// Vertex attribute locations, bound before linking so all warp programs share them
+const GLuint POSITION_ATTRIB = 0;
+const GLuint TEXCOORD_ATTRIB = 1;
+
+} // namespace
+
+WarpRenderer::WarpRenderer() :
+    mCaptureAllocator(NULL),
+    mFrameWidth(0), mFrameHeight(0),
+    mPinnedMemoryExtensionAvailable(false),
+    mTexture(0),
+    mLumaTexture(0),
+    mChromaTexture(0),
+    mPlaneFrameBuf(0),
+    mLumaProgram(0),
+    mChromaProgram(0),
+    mUploadRingDepth(3),
+    mUploadRingMode(UnpackBufferRing::ModeAuto),
+    mIdFrameBuf(0),
+    mIdDepthBuf(0),
+    mProgram(0),
+    mWarpShader(ShaderGather),
+    mDrawShader(ShaderGather),
+    mColourMatrix(ColourRec709),
+    //VR
+    m_meshWidth(20), m_meshHeight(20),
+    m_meshLayout(MeshStrips), m_drawLayout(MeshTriangles),
+    m_bufferScale(0.5),
+    m_vbo(0), m_ibo(0),
+    m_vboBytes(0), m_iboBytes(0),
+    m_indexType(GL_UNSIGNED_INT),
+    m_indexCount(0),
+    m_positionScale(1.0f),
+    m_positionAttrib(-1), m_texCoordAttrib(-1)
+{
+    // The mesh's attribute pointers then hold for every program
+    mShaderManager.bindAttribLocation(POSITION_ATTRIB, "position");
+    mShaderManager.bindAttribLocation(TEXCOORD_ATTRIB, "texCoord");
+    mShaderManager.setCacheDirectory(ShaderManager::defaultDirectory());
+
+    //VR
+    m_deviceInfo = new DeviceInfo();
+    setTextureBounds();
+    m_meshCache.setDirectory(MeshCache::defaultDirectory());
+}
+
+WarpRenderer::~WarpRenderer()
+{
+    delete m_deviceInfo;
+}
+
+bool WarpRenderer::isValidMeshSize(int width, int height)
+{
+    return width >= MinMeshSize && width <= MaxMeshSize && height >= MinMeshSize && height <= MaxMeshSize;
+}
+
+void WarpRenderer::setMeshSize(int width, int height)
+{
+    if (! isValidMeshSize(width, height))
+    {
+        fprintf(stderr, "Ignoring distortion mesh size %dx%d, each side must be %d to %d\n", width, height, MinMeshSize, MaxMeshSize);
+        return;
+    }
+    if (width == m_meshWidth && height == m_meshHeight)
+        return;
+
+    m_meshWidth = width;
+    m_meshHeight = height;
+
+    // Only the mesh changes: the video texture, colour targets and FBO are kept
+    if (m_vbo)
+        uploadMesh();
+}
+
+void WarpRenderer::setMeshLayout(MeshLayout layout)
+{
+    if (layout == m_meshLayout)
+        return;
+
+    m_meshLayout = layout;
+    if (m_vbo)
+        uploadMesh();
+}
+
+void WarpRenderer::setProfile(const CardboardViewer& viewer, const Device& device)
+{
+    m_deviceInfo->setViewer(viewer);
+    m_deviceInfo->setDevice(device);
+    fprintf(stderr, "Warping for viewer %s on phone %s\n", viewer.id.c_str(), device.id.c_str());
+
+    // The mesh cache is keyed by the lens and screen, so returning to a profile loads its mesh
+    if (m_vbo)
+        uploadMesh();
+}
+
+void WarpRenderer::setDistortionInverse(DeviceInfo::InverseMode mode)
+{
+    if (mode == m_deviceInfo->getInverseMode())
+        return;
+
+    m_deviceInfo->setInverseMode(mode);
+    fprintf(stderr, "Inverting the lens distortion with the %s method, largest error %.2g\n",
+            DeviceInfo::inverseModeName(mode), m_deviceInfo->getInverseErrorBound());
+    if (m_vbo)
+        uploadMesh();
+}
+
+void WarpRenderer::setWarpShader(WarpShader shader)
+{
+    if (shader == mWarpShader)
+        return;
+
+    mWarpShader = shader;
+    if (mProgram)
+        selectProgram();
+}
+
+void WarpRenderer::setColourMatrix(ColourMatrix matrix)
+{
+    if (matrix == mColourMatrix)
+        return;
+
+    mColourMatrix = matrix;
+    if (mProgram)
+        selectProgram();
+}
+
+// Use the requested program, or the gather one, which init() has built, when the requested one cannot
+// be built.  The two-plane shader also needs the programs that split its planes.
+void WarpRenderer::selectProgram()
+{
+    QString error;
+    mDrawShader = mWarpShader;
+    mProgram = program(mDrawShader, error);
+    if (mProgram && mDrawShader == ShaderTwoPlane)
+    {
+        mLumaProgram = planeProgram(false, error);
+        mChromaProgram = mLumaProgram ? planeProgram(true, error) : 0;
+        if (! mChromaProgram)
+            mProgram = 0;
+    }
+    if (! mProgram)
+    {
+        fprintf(stderr, "The %s warp shader is not available, using the gather shader: %s\n", warpShaderName(mDrawShader), qPrintable(error));
+        mDrawShader = ShaderGather;
+        mProgram = program(mDrawShader, error);
+    }
+    fprintf(stderr, "Warping with the %s shader, %s colours\n", warpShaderName(mDrawShader), colourMatrixName(mColourMatrix));
+}
+
+const char* WarpRenderer::colourMatrixName(ColourMatrix matrix)
+{
+    switch (matrix)
+    {
+    case ColourRec709:  return "709";
+    case ColourRec601:  return "601";
+    }
+    return "unknown";
+}
+
+bool WarpRenderer::colourMatrixFromName(const char* name, ColourMatrix& matrix)
+{
+    if (strcmp(name, "709") == 0)
+        matrix = ColourRec709;
+    else if (strcmp(name, "601") == 0)
+        matrix = ColourRec601;
+    else
+        return false;
+    return true;
+}
+
+const char* WarpRenderer::warpShaderName(WarpShader shader)
+{
+    switch (shader)
+    {
+    case ShaderGather:      return "gather";
+    case ShaderTwoPlane:    return "two-plane";
+    case ShaderCount:       break;
+    }
+    return "unknown";
+}
+
+bool WarpRenderer::warpShaderFromName(const char* name, WarpShader& shader)
+{
+    if (strcmp(name, "gather") == 0)
+        shader = ShaderGather;
+    else if (strcmp(name, "two-plane") == 0)
+        shader = ShaderTwoPlane;
+    else
+        return false;
+    return true;
+}
+
+const char* WarpRenderer::meshLayoutName(MeshLayout layout)
+{
+    switch (layout)
+    {
+    case MeshTriangles: return "triangles";
+    case MeshStrips:    return "strips";
+    }
+    return "unknown";
+}
+
+bool WarpRenderer::meshLayoutFromName(const char* name, MeshLayout& layout)
+{
+    if (strcmp(name, "triangles") == 0)
+        layout = MeshTriangles;
+    else if (strcmp(name, "strips") == 0)
+        layout = MeshStrips;
+    else
+        return false;
+    return true;
+}
+
+void WarpRenderer::meshBufferSizes(MeshLayout layout, int width, int height, int& vertexBytes, int& indexBytes)
+{
+    unsigned vertexCount = 2 * width * height;
+    std::vector<unsigned int> indices;
+
+    if (layout == MeshStrips)
+    {
+        computeMeshStripIndices(width, height, indices);
+        vertexBytes = vertexCount * sizeof(PackedVertex);
+        indexBytes = indices.size() * (useShortIndices(vertexCount) ? sizeof(GLushort) : sizeof(GLuint));
+    }
+    else
+    {
+        computeMeshIndices(width, height, indices);
+        vertexBytes = vertexCount * 5 * sizeof(float);
+        indexBytes = indices.size() * sizeof(GLuint);
+    }
+}
+
+bool WarpRenderer::init(unsigned frameWidth, unsigned frameHeight, int targetCount, PinnedMemoryAllocator* allocator, QString& error)
+{
+    cleanup();
+
+    mFrameWidth = frameWidth;
+    mFrameHeight = frameHeight;
+    mCaptureAllocator = allocator;
+
+    if (! CheckOpenGLExtensions(error))
+        return false;
+
+    // Prepare the shader used to perform colour space conversion on the video texture.  Programs
+    // built for an earlier mode are reused, and the binaries of earlier runs are loaded.
+    BMDTimeValue start = FramePacer::now();
+    QString shaderError;
+    if (! program(ShaderGather, shaderError))
+    {
+        error = QString("OpenGL Shader failed to compile: ") + shaderError;
+        return false;
+    }
+    // The other variants too, and the two-plane shader's plane programs, so that switching shaders
+    // while capturing only swaps programs.  One that does not build here is reported, and replaced by
+    // the gather shader, when it is selected below.
+    for (int i = ShaderGather + 1; i < ShaderCount; i++)
+        program((WarpShader)i, shaderError);
+    planeProgram(false, shaderError);
+    planeProgram(true, shaderError);
+    fprintf(stderr, "Shaders ready in %.1f ms\n", (FramePacer::now() - start) / 1e6);
+
+    // Setup the scene
+    glShadeModel( GL_SMOOTH );                  // Enable smooth shading
+    glClearColor( 0.0f, 0.0f, 0.0f, 0.5f );     // Black background
+    glClearDepth( 1.0f );                       // Depth buffer setup
+    glEnable( GL_DEPTH_TEST );                  // Enable depth testing
+    glDepthFunc( GL_LEQUAL );                   // Type of depth test to do
+    glHint( GL_PERSPECTIVE_CORRECTION_HINT, GL_NICEST );
+
+    if (! mPinnedMemoryExtensionAvailable)
+    {
+        // Ring of unpack buffers so uploading a frame overlaps the GPU consuming the previous ones
+        if (! mUnpackRing.init(mFrameWidth * 2 * mFrameHeight, mUploadRingDepth, mUploadRingMode))
+        {
+            error = "Cannot create pixel unpack buffers.";
+            return false;
+        }
+        fprintf(stderr, "Uploading through %d %s unpack buffers\n", mUnpackRing.depth(), UnpackBufferRing::modeName(mUnpackRing.mode()));
+    }
+
+    // Setup the texture which will hold the captured video frame pixels
+    glEnable(GL_TEXTURE_2D);
+    glGenTextures(1, &mTexture);
+    glBindTexture(GL_TEXTURE_2D, mTexture);
+
+    // Parameters to control how texels are sampled from the texture
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP);
+
+    // Create texture with empty data, we will update it using glTexSubImage2D each frame.
+    // The captured video is YCbCr 4:2:2 packed into a UYVY macropixel.  OpenGL has no YCbCr format
+    // so treat it as RGBA 4:4:4:4 by halving the width and using GL_RGBA internal format.
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, mFrameWidth/2, mFrameHeight, 0, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, NULL);
+
+    // Planes of the two-plane shader: a full width R8 texture of Y and a half width RG8 texture of
+    // (Cb, Cr), so hardware filtering interpolates each component directly.  splitPlanes() renders
+    // them from the video texture, and only while that shader is in use.
+    GLuint planes[2];
+    glGenTextures(2, planes);
+    mLumaTexture = planes[0];
+    mChromaTexture = planes[1];
+    for (int i = 0; i < 2; i++)
+    {
+        glBindTexture(GL_TEXTURE_2D, planes[i]);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    }
+    glBindTexture(GL_TEXTURE_2D, mLumaTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, mFrameWidth, mFrameHeight, 0, GL_RED, GL_UNSIGNED_BYTE, NULL);
+    glBindTexture(GL_TEXTURE_2D, mChromaTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RG8, mFrameWidth/2, mFrameHeight, 0, GL_RG, GL_UNSIGNED_BYTE, NULL);
+
+    // Colour targets of the off-screen frame buffer.  These are textures rather than a renderbuffer
+    // so that the presenting context, which shares objects with this one, can read them.
+    mColorTextures.resize(targetCount < 1 ? 1 : targetCount);
+    glGenTextures(mColorTextures.size(), &mColorTextures[0]);
+    for (size_t i = 0; i < mColorTextures.size(); i++)
+    {
+        glBindTexture(GL_TEXTURE_2D, mColorTextures[i]);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, mFrameWidth, mFrameHeight, 0, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, NULL);
+    }
+
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glDisable(GL_TEXTURE_2D);
+
+    // Create Frame Buffer Object (FBO) to perform off-screen rendering of scene.
+    // This allows the render to be done on a framebuffer with width and height exactly matching the video format.
+    glGenFramebuffersEXT(1, &mIdFrameBuf);
+    glGenRenderbuffersEXT(1, &mIdDepthBuf);
+
+    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, mIdFrameBuf);
+
+    glBindRenderbufferEXT(GL_RENDERBUFFER_EXT, mIdDepthBuf);
+    glRenderbufferStorageEXT(GL_RENDERBUFFER_EXT, GL_DEPTH_COMPONENT, mFrameWidth, mFrameHeight);
+
+    glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT, GL_TEXTURE_2D, mColorTextures[0], 0);
+    glFramebufferRenderbufferEXT(GL_FRAMEBUFFER_EXT, GL_DEPTH_ATTACHMENT_EXT, GL_RENDERBUFFER_EXT, mIdDepthBuf);
+
+    GLenum glStatus = glCheckFramebufferStatusEXT(GL_FRAMEBUFFER_EXT);
+    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
+    if (glStatus != GL_FRAMEBUFFER_COMPLETE_EXT)
+    {
+        error = "Cannot initialize framebuffer.";
+        return false;
+    }
+
+    // Frame buffer the planes are split into, one attached at a time; no depth buffer
+    glGenFramebuffersEXT(1, &mPlaneFrameBuf);
+    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, mPlaneFrameBuf);
+    glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT, GL_TEXTURE_2D, mLumaTexture, 0);
+    glStatus = glCheckFramebufferStatusEXT(GL_FRAMEBUFFER_EXT);
+    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
+    if (glStatus != GL_FRAMEBUFFER_COMPLETE_EXT)
+    {
+        error = "Cannot initialize the plane framebuffer.";
+        return false;
+    }
+
+    selectProgram();
+
+    // VR
+    m_positionAttrib = glGetAttribLocation(mProgram, "position");
+    glEnableVertexAttribArray(m_positionAttrib);
+    m_texCoordAttrib = glGetAttribLocation(mProgram, "texCoord");
+    glEnableVertexAttribArray(m_texCoordAttrib);
+
+    // create vbo and ibo
+    uploadMesh();
+
+    return true;
+}
+
+// Copy the mesh in its layout into m_vbo and m_ibo, creating them on first use, and point the vertex
+// attributes at it.  The mesh comes from the mesh cache when it has been computed before.  Each
+// upload orphans the buffers' storage instead of overwriting it in place, so a draw of the previous
+// mesh still queued on the GPU never stalls the update; the storage only grows, when a mesh does not
+// fit the current one.
+void WarpRenderer::uploadMesh()
+{
+    m_drawLayout = m_meshLayout;
+    if (m_drawLayout == MeshStrips && ! glPrimitiveRestartIndex)
+    {
+        fprintf(stderr, "Primitive restart not supported, drawing the distortion mesh as triangles\n");
+        m_drawLayout = MeshTriangles;
+    }
+
+    BMDTimeValue start = FramePacer::now();
+
+    MeshCache::Mesh mesh;
+    QByteArray key = MeshCache::key(*m_deviceInfo, m_drawLayout, m_meshWidth, m_meshHeight);
+    bool cached = m_meshCache.load(key, mesh) && isValidMesh(mesh);
+
+    // Storage of a computed mesh
+    std::vector<unsigned char> vertexData;
+    std::vector<unsigned char> indexData;
+    if (! cached)
+    {
+        m_meshCache.unload();
+        buildMesh(vertexData, indexData, mesh);
+        m_meshCache.store(key, mesh);
+    }
+
+    m_indexType = mesh.indexType;
+    m_indexCount = mesh.indexCount;
+    m_positionScale = mesh.positionScale;
+
+    if (! m_vbo)
+        glGenBuffers(1, &m_vbo);
+    if (! m_ibo)
+        glGenBuffers(1, &m_ibo);
+    if ((GLsizeiptr)mesh.vertexBytes > m_vboBytes)
+        m_vboBytes = mesh.vertexBytes;
+    if ((GLsizeiptr)mesh.indexBytes > m_iboBytes)
+        m_iboBytes = mesh.indexBytes;
+
+    // The mesh changes only when it is tuned, so it stays a static draw buffer
+    glBindBuffer(GL_ARRAY_BUFFER, m_vbo);
+    glBufferData(GL_ARRAY_BUFFER, m_vboBytes, NULL, GL_STATIC_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, mesh.vertexBytes, mesh.vertices);
+
+    // The attribute pointers refer to m_vbo by name, so they only change with the layout
+    if (m_drawLayout == MeshTriangles)
+    {
+        glVertexAttribPointer(m_positionAttrib, 2, GL_FLOAT, GL_FALSE, 5*sizeof(float), (void*)0);
+        glVertexAttribPointer(m_texCoordAttrib, 3, GL_FLOAT, GL_FALSE, 5*sizeof(float), (void*)(2*sizeof(float)));
+    }
+    else
+    {
+        glVertexAttribPointer(m_positionAttrib, 2, GL_SHORT, GL_TRUE, sizeof(PackedVertex), (void*)0);
+        glVertexAttribPointer(m_texCoordAttrib, 3, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(PackedVertex), (void*)(2*sizeof(GLshort)));
+    }
+
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_ibo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, m_iboBytes, NULL, GL_STATIC_DRAW);
+    glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, mesh.indexBytes, mesh.indices);
+
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    m_meshCache.unload();
+
+    fprintf(stderr, "Distortion mesh %dx%d per eye as %s: %u vertices in %u bytes, %u %d-bit indices in %u bytes, %s in %.1f ms\n",
+            m_meshWidth, m_meshHeight, meshLayoutName(m_drawLayout), mesh.vertexCount, mesh.vertexBytes,
+            mesh.indexCount, m_indexType == GL_UNSIGNED_SHORT ? 16 : 32, mesh.indexBytes,
+            cached ? "loaded from the mesh cache" : "computed", (FramePacer::now() - start) / 1e6);
+}
+
+// Compute the mesh of the current size in m_drawLayout into vertexData and indexData, and describe it in mesh
+void WarpRenderer::buildMesh(std::vector<unsigned char>& vertexData, std::vector<unsigned char>& indexData, MeshCache::Mesh& mesh)
+{
+    computeMeshVertices(m_meshWidth, m_meshHeight);
+
+    std::vector<unsigned int> indices;
+    unsigned vertexCount = m_vertices.size() / 5;
+
+    mesh.layout = m_drawLayout;
+    mesh.vertexCount = vertexCount;
+    mesh.positionScale = 1.0f;
+
+    if (m_drawLayout == MeshTriangles)
+    {
+        computeMeshIndices(m_meshWidth, m_meshHeight, indices);
+        mesh.indexType = GL_UNSIGNED_INT;
+
+        const unsigned char* vertices = (const unsigned char*)&m_vertices[0];
+        vertexData.assign(vertices, vertices + sizeof(float) * m_vertices.size());
+    }
+    else
+    {
+        computeMeshStripIndices(m_meshWidth, m_meshHeight, indices);
+        mesh.indexType = useShortIndices(vertexCount) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+
+        // Positions may reach slightly past the edges of the screen, so they are scaled into range
+        for (size_t i = 0; i < m_vertices.size(); i += 5)
+        {
+            mesh.positionScale = std::max(mesh.positionScale, fabsf(m_vertices[i]));
+            mesh.positionScale = std::max(mesh.positionScale, fabsf(m_vertices[i + 1]));
+        }
+
+        vertexData.resize(sizeof(PackedVertex) * vertexCount);
+        PackedVertex* packed = (PackedVertex*)&vertexData[0];
+        for (unsigned i = 0; i < vertexCount; i++, packed++)
+        {
+            const float* vertex = &m_vertices[i * 5];
+            packed->x = (GLshort)lrintf(vertex[0] / mesh.positionScale * 32767.0f);
+            packed->y = (GLshort)lrintf(vertex[1] / mesh.positionScale * 32767.0f);
+            packed->s = (GLushort)lrintf(vertex[2] * 65535.0f);
+            packed->t = (GLushort)lrintf(vertex[3] * 65535.0f);
+            packed->eye = vertex[4] > 0 ? 65535 : 0;
+            packed->pad = 0;
+        }
+    }
+
+    mesh.indexCount = indices.size();
+    if (mesh.indexType == GL_UNSIGNED_SHORT)
+    {
+        // The restart index becomes 0xffff along with the others
+        indexData.resize(sizeof(GLushort) * indices.size());
+        GLushort* shortIndices = (GLushort*)&indexData[0];
+        for (size_t i = 0; i < indices.size(); i++)
+            shortIndices[i] = (GLushort)indices[i];
+    }
+    else
+    {
+        const unsigned char* data = (const unsigned char*)&indices[0];
+        indexData.assign(data, data + sizeof(GLuint) * indices.size());
+    }
+
+    mesh.vertices = &vertexData[0];
+    mesh.vertexBytes = vertexData.size();
+    mesh.indices = &indexData[0];
+    mesh.indexBytes = indexData.size();
+}
+
+// Whether a mesh from the cache fits the current size and layout; the key makes a mismatch unlikely
+// but a truncated or foreign file must not reach the GPU, nor an index past the last vertex
+bool WarpRenderer::isValidMesh(const MeshCache::Mesh& mesh)
+{
+    unsigned vertexSize = m_drawLayout == MeshStrips ? sizeof(PackedVertex) : 5 * sizeof(float);
+    unsigned indexSize = mesh.indexType == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+
+    if (! (mesh.layout == (quint32)m_drawLayout
+           && (mesh.indexType == GL_UNSIGNED_SHORT || mesh.indexType == GL_UNSIGNED_INT)
+           && mesh.vertexCount == (quint32)(2 * m_meshWidth * m_meshHeight)
+           && mesh.vertexBytes == mesh.vertexCount * vertexSize
+           && mesh.indexBytes == mesh.indexCount * indexSize
+           && mesh.positionScale >= 1.0f))
+        return false;
+
+    // Strips may also contain the restart index, which is never a vertex
+    bool strips = m_drawLayout == MeshStrips;
+    if (mesh.indexType == GL_UNSIGNED_SHORT)
+    {
+        const GLushort* indices = (const GLushort*)mesh.indices;
+        for (quint32 i = 0; i < mesh.indexCount; i++)
+        {
+            if (indices[i] >= mesh.vertexCount && ! (strips && indices[i] == 0xffff))
+                return false;
+        }
+    }
+    else
+    {
+        const GLuint* indices = (const GLuint*)mesh.indices;
+        for (quint32 i = 0; i < mesh.indexCount; i++)
+        {
+            if (indices[i] >= mesh.vertexCount && ! (strips && indices[i] == RESTART_INDEX))
+                return false;
+        }
+    }
+    return true;
+}
+
+void WarpRenderer::cleanup()
+{
+    // Frames still referenced by in-flight uploads go back to the capture allocator first
+    mUploadScheduler.flush();
+    mUnpackRing.cleanup();
+
+    if (mTexture)
+        glDeleteTextures(1, &mTexture);
+    if (mLumaTexture)
+        glDeleteTextures(1, &mLumaTexture);
+    if (mChromaTexture)
+        glDeleteTextures(1, &mChromaTexture);
+    if (mPlaneFrameBuf)
+        glDeleteFramebuffersEXT(1, &mPlaneFrameBuf);
+    if (! mColorTextures.empty())
+        glDeleteTextures(mColorTextures.size(), &mColorTextures[0]);
+    if (mIdDepthBuf)
+        glDeleteRenderbuffersEXT(1, &mIdDepthBuf);
+    if (mIdFrameBuf)
+        glDeleteFramebuffersEXT(1, &mIdFrameBuf);
+    if (m_vbo)
+        glDeleteBuffers(1, &m_vbo);
+    if (m_ibo)
+        glDeleteBuffers(1, &m_ibo);
+
+    mTexture = 0;
+    mLumaTexture = 0;
+    mChromaTexture = 0;
+    mPlaneFrameBuf = 0;
+    mColorTextures.clear();
+    mIdDepthBuf = 0;
+    mIdFrameBuf = 0;
+    m_vbo = 0;
+    m_ibo = 0;
+    m_vboBytes = 0;
+    m_iboBytes = 0;
+}
+
+//
+// Update the captured video frame texture
+//
+void WarpRenderer::uploadFrame(IDeckLinkVideoInputFrame* inputFrame)
+{
+    long textureSize = inputFrame->GetRowBytes() * inputFrame->GetHeight();
+    void* videoPixels;
+    inputFrame->GetBytes(&videoPixels);
+
+    glEnable(GL_TEXTURE_2D);
+
+    if (! mPinnedMemoryExtensionAvailable)
+    {
+        // Copy into the next free slot of the unpack buffer ring
+        mUnpackRing.beginUpload(videoPixels, textureSize);
+    }
+    else
+    {
+        // Use a pinned buffer for the GL_PIXEL_UNPACK_BUFFER target
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, mCaptureAllocator->bufferObjectForPinnedAddress(textureSize, videoPixels));
+    }
+    glBindTexture(GL_TEXTURE_2D, mTexture);
+
+    // NULL for last arg indicates use current GL_PIXEL_UNPACK_BUFFER target as texture data
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, mFrameWidth/2, mFrameHeight, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, NULL);
+
+    if (! mPinnedMemoryExtensionAvailable)
+    {
+        // The slot can be rewritten once the texture copy from it has completed
+        mUnpackRing.endUpload();
+    }
+    else
+    {
+        // The DMA reads straight from the frame buffer, so keep the frame until the upload's fence
+        // signals.  Drawing needs no wait: it is ordered after the upload on the GPU.
+        mUploadScheduler.submit(inputFrame);
+    }
+
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    glDisable(GL_TEXTURE_2D);
+
+    if (mDrawShader == ShaderTwoPlane)
+        splitPlanes();
+
+    // Pinned frames are released by the upload scheduler
+    if (! mPinnedMemoryExtensionAvailable)
+        inputFrame->Release();
+}
+
+// Split the video texture into the two-plane shader's planes on the GPU, drawing one triangle over
+// each.  The frame crosses the bus once, as for the gather shader; the split reads it twice and writes
+// 2 bytes per pixel in video memory.  Timed with the upload, whose result it completes.
+void WarpRenderer::splitPlanes()
+{
+    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, mPlaneFrameBuf);
+    glBindTexture(GL_TEXTURE_2D, mTexture);
+
+    GLuint planes[2] = { mLumaTexture, mChromaTexture };
+    GLuint programs[2] = { mLumaProgram, mChromaProgram };
+    for (int i = 0; i < 2; i++)
+    {
+        glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT, GL_TEXTURE_2D, planes[i], 0);
+        glViewport(0, 0, i == 0 ? mFrameWidth : mFrameWidth/2, mFrameHeight);
+        glUseProgram(programs[i]);
+        glUniform1i(glGetUniformLocation(programs[i], "UYVYtex"), 0);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+    }
+
+    glUseProgram(0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
+}
+
+void WarpRenderer::retireUploads()
+{
+    // Hand back frames whose pinned uploads have completed since the last iteration
+    mUploadScheduler.retire();
+}
+
+//VR
+void WarpRenderer::setTextureBounds()
+{
+    float leftBounds[] = {0, 0, 0.5, 1};
+    float rightBounds[] = {0.5, 0, 0.5, 1};
+
+    // Left eye
+    m_viewportOffsetScale[0] = leftBounds[0]; // X
+    m_viewportOffsetScale[1] = leftBounds[1]; // Y
+    m_viewportOffsetScale[2] = leftBounds[2]; // Width
+    m_viewportOffsetScale[3] = leftBounds[3]; // Height
+
+    // Right eye
+    m_viewportOffsetScale[4] = rightBounds[0]; // X
+    m_viewportOffsetScale[5] = rightBounds[1]; // Y
+    m_viewportOffsetScale[6] = rightBounds[2]; // Width
+    m_viewportOffsetScale[7] = rightBounds[3]; // Height
+}
+
+float lerp(float a, float b, float t) {
+    return a + ((b - a) * t);
+}
+
+void WarpRenderer::computeMeshVertices(int width, int height)
+{
+    m_vertices.resize(2 * width * height * 5);
+
+    float lensFrustum[4];
+    m_deviceInfo->getLeftEyeVisibleTanAngles(lensFrustum);
+
+    float noLensFrustum[4];
+    m_deviceInfo->getLeftEyeNoLensTanAngles(noLensFrustum);
+
+    float viewport[4];
+    m_deviceInfo->getLeftEyeVisibleScreenRect(noLensFrustum, viewport);
+    //viewport[4]: x, y, width, height
+
+    // Radii of the grid points of one eye, inverted in one batch
+    std::vector<float> radii(width * height);
+    std::vector<float> undistorted(width * height);
+
+    float vidx = 0;
+    float iidx = 0;
+    for (int e = 0; e < 2; e++) {
+        for (int j = 0, k = 0; j < height; j++) {
+            for (int i = 0; i < width; i++, k++) {
+                float x = lerp(lensFrustum[0], lensFrustum[2], 1.0 * i / (width - 1));
+                float y = lerp(lensFrustum[3], lensFrustum[1], 1.0 * j / (height - 1));
+                radii[k] = sqrt(x * x + y * y);
+            }
+        }
+        m_deviceInfo->distortInverse(&radii[0], &undistorted[0], radii.size());
+
+        for (int j = 0, k = 0; j < height; j++) {
+            for (int i = 0; i < width; i++, k++, vidx++) {
+                float u = 1.0 * i / (width - 1);
+                float v = 1.0 * j / (height - 1);
+
+                // Grid points regularly spaced in StreoScreen, and barrel distorted in
+                // the mesh.
+                float s = u;
+                float t = v;
+                float x = lerp(lensFrustum[0], lensFrustum[2], u);
+                float y = lerp(lensFrustum[3], lensFrustum[1], v);
+                float d = radii[k];
+                float r = undistorted[k];
+                float p = x * r / d;
+                float q = y * r / d;
+                u = (p - noLensFrustum[0]) / (noLensFrustum[2] - noLensFrustum[0]);
+                v = (q - noLensFrustum[3]) / (noLensFrustum[1] - noLensFrustum[3]);
+
+                // Convert u,v to mesh screen coordinates.
+                float aspect = m_deviceInfo->getDevice().widthMeters / m_deviceInfo->getDevice().heightMeters;
+
+                // FIXME: The original Unity plugin multiplied U by the aspect ratio
+                // and didn't multiply either value by 2, but that seems to get it
+                // really close to correct looking for me. I hate this kind of "Don't
+                // know why it works" code though, and wold love a more logical
+                // explanation of what needs to happen here.
+                u = (viewport[0] + u * viewport[2] - 0.5) * 2.0; // * aspect;
+                v = (viewport[1] + v * viewport[3] - 0.5) * 2.0;
+
+                m_vertices[(vidx * 5) + 0] = u; // position.x
+                m_vertices[(vidx * 5) + 1] = v; // position.y
+                m_vertices[(vidx * 5) + 2] = s; // texCoord.x
+                m_vertices[(vidx * 5) + 3] = t; // texCoord.y
+                m_vertices[(vidx * 5) + 4] = e; // texCoord.z (viewport index)
+
+                //cout << u << " " << v << endl;
+            }
+        }
+        float w = lensFrustum[2] - lensFrustum[0];
+        lensFrustum[0] = -(w + lensFrustum[0]);
+        lensFrustum[2] = w - lensFrustum[2];
+        w = noLensFrustum[2] - noLensFrustum[0];
+        noLensFrustum[0] = -(w + noLensFrustum[0]);
+        noLensFrustum[2] = w - noLensFrustum[2];
+        viewport[0] = 1 - (viewport[0] + viewport[2]);
+    }
+}
+
+void WarpRenderer::computeMeshIndices(int width, int height, std::vector<unsigned int>& indices)
+{
+    indices.resize(2 * (width - 1) * (height - 1) * 6);
+
+    float halfwidth = width / 2;
+    float halfheight = height / 2;
+    float vidx = 0;
+    float iidx = 0;
+    for (int e = 0; e < 2; e++) {
+        for (int j = 0; j < height; j++) {
+            for (int i = 0; i < width; i++, vidx++) {
+                if (i == 0 || j == 0)
+                  continue;
+                // Build a quad.  Lower right and upper left quadrants have quads with
+                // the triangle diagonal flipped to get the vignette to interpolate
+                // correctly.
+                if ((i <= halfwidth) == (j <= halfheight)) {
+                    // Quad diagonal lower left to upper right.
+                    indices[iidx++] = vidx;
+                    indices[iidx++] = vidx - width - 1;
+                    indices[iidx++] = vidx - width;
+                    indices[iidx++] = vidx - width - 1;
+                    indices[iidx++] = vidx;
+                    indices[iidx++] = vidx - 1;
+                } else {
+                    // Quad diagonal upper left to lower right.
+                    indices[iidx++] = vidx - 1;
+                    indices[iidx++] = vidx - width;
+                    indices[iidx++] = vidx;
+                    indices[iidx++] = vidx - width;
+                    indices[iidx++] = vidx - 1;
+                    indices[iidx++] = vidx - width - 1;
+                }
+            }
+        }
+    }
+}
+
+// The triangles of computeMeshIndices() as strips: one per row of quads and diagonal direction, each
+// zig-zagging between the two rows of vertices.  Whether the first vertex of a column pair is on the
+// lower or upper row decides the diagonal of every quad in the strip.  Strips are separated by
+// RESTART_INDEX.
+void WarpRenderer::computeMeshStripIndices(int width, int height, std::vector<unsigned int>& indices)
+{
+    indices.clear();
+    indices.reserve(2 * (height - 1) * (2 * width + 6));
+
+    int halfwidth = width / 2;
+    int halfheight = height / 2;
+    for (int e = 0; e < 2; e++) {
+        unsigned int base = e * width * height;
+        for (int j = 1; j < height; j++) {
+            int stripDiagonal = -1;
+            for (int i = 1; i < width; i++) {
+                // Quad diagonal lower left to upper right, as in computeMeshIndices()
+                int diagonal = (i <= halfwidth) == (j <= halfheight);
+                unsigned int lower = base + (j - 1) * width;
+                unsigned int upper = base + j * width;
+
+                if (diagonal != stripDiagonal) {
+                    if (! indices.empty())
+                        indices.push_back(RESTART_INDEX);
+                    stripDiagonal = diagonal;
+                    indices.push_back(diagonal ? upper + i - 1 : lower + i - 1);
+                    indices.push_back(diagonal ? lower + i - 1 : upper + i - 1);
+                }
+                indices.push_back(diagonal ? upper + i : lower + i);
+                indices.push_back(diagonal ? lower + i : upper + i);
+            }
+        }
+    }
+}
+
+// Draw the captured video frame texture through the distortion mesh, rendering into colour target
+// index of the off-screen frame buffer.  Nothing here waits for the GPU: the presenter synchronises
+// with a fence placed after the draw.
+void WarpRenderer::drawFrame(int target, bool hasNoInputSource)
+{
+    // Draw OpenGL scene to the off-screen frame buffer
+    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, mIdFrameBuf);
+    glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT, GL_TEXTURE_2D, mColorTextures[target], 0);
+
+    GLfloat aspectRatio = (GLfloat)mFrameWidth / (GLfloat)mFrameHeight;
+    glViewport (0, 0, mFrameWidth, mFrameHeight);
+
+    glClear( GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT );
+    glScalef( aspectRatio, 1.0f, 1.0f );
+
+    if (hasNoInputSource)
+    {
+        // Draw a big X when no input is available on capture
+        glBegin( GL_QUADS );
+        glColor3f( 1.0f, 0.0f, 1.0f );
+        glVertex3f(  0.8f,  0.9f,  1.0f );
+        glVertex3f(  0.9f,  0.8f,  1.0f );
+        glColor3f( 1.0f, 1.0f, 0.0f );
+        glVertex3f( -0.8f, -0.9f,  1.0f );
+        glVertex3f( -0.9f, -0.8f,  1.0f );
+        glColor3f( 1.0f, 0.0f, 1.0f );
+        glVertex3f( -0.8f,  0.9f,  1.0f );
+        glVertex3f( -0.9f,  0.8f,  1.0f );
+        glColor3f( 1.0f, 1.0f, 0.0f );
+        glVertex3f(  0.8f, -0.9f,  1.0f );
+        glVertex3f(  0.9f, -0.8f,  1.0f );
+        glEnd();
+    }
+    else
+    {
+        // Pass texture unit 0 to the fragment shader as a uniform variable
+        glEnable(GL_TEXTURE_2D);
+        glBindTexture(GL_TEXTURE_2D, mTexture);
+        glUseProgram(mProgram);
+        GLint locUYVYtex = glGetUniformLocation(mProgram, "UYVYtex");
+        glUniform1i(locUYVYtex, 0);        // Bind texture unit 0
+
+        if (mDrawShader == ShaderTwoPlane)
+        {
+            // Luma and chroma planes on texture units 1 and 2
+            glActiveTexture(GL_TEXTURE1);
+            glBindTexture(GL_TEXTURE_2D, mLumaTexture);
+            glActiveTexture(GL_TEXTURE2);
+            glBindTexture(GL_TEXTURE_2D, mChromaTexture);
+            glActiveTexture(GL_TEXTURE0);
+            GLint locLumaTex = glGetUniformLocation(mProgram, "lumaTex");
+            glUniform1i(locLumaTex, 1);
+            GLint locChromaTex = glGetUniformLocation(mProgram, "chromaTex");
+            glUniform1i(locChromaTex, 2);
+        }
+
+        GLint locOffset = glGetUniformLocation(mProgram, "viewportOffsetScale");
+        glUniform4fv(locOffset, 2, m_viewportOffsetScale);
+
+        GLint locScale = glGetUniformLocation(mProgram, "positionScale");
+        glUniform1f(locScale, m_positionScale);
+
+        glBindBuffer(GL_ARRAY_BUFFER, m_vbo);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_ibo);
+        if (m_drawLayout == MeshStrips)
+        {
+            glEnable(GL_PRIMITIVE_RESTART);
+            glPrimitiveRestartIndex(m_indexType == GL_UNSIGNED_SHORT ? 0xffff : RESTART_INDEX);
+            glDrawElements( GL_TRIANGLE_STRIP, m_indexCount, m_indexType, (void*)0 );
+            glDisable(GL_PRIMITIVE_RESTART);
+        }
+        else
+        {
+            glDrawElements( GL_TRIANGLES, m_indexCount, GL_UNSIGNED_INT, (void*)0 );
+        }
+
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+        glUseProgram(0);
+        if (mDrawShader == ShaderTwoPlane)
+        {
+            glActiveTexture(GL_TEXTURE1);
+            glBindTexture(GL_TEXTURE_2D, 0);
+            glActiveTexture(GL_TEXTURE2);
+            glBindTexture(GL_TEXTURE_2D, 0);
+            glActiveTexture(GL_TEXTURE0);
+        }
+        glDisable(GL_TEXTURE_2D);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+
+    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
+}
+
+// Program of the shader in the current colour matrix, from the shader manager.  The fragment shaders
+// take the YCbCr 4:2:2 video texture in UYVY macropixel format and perform colour space conversion to
+// RGBA in the GPU; the variant is selected by #defines between the #version line and the sources.
+GLuint WarpRenderer::program(WarpShader shader, QString& error)
+{
+    const char* version = "#version 130 \n";
+
+    const char* vertexSource =
+        "attribute vec2 position; \n"
+        "attribute vec3 texCoord; \n"
+
+        "varying vec2 vTexCoord; \n"
+
+        "uniform vec4 viewportOffsetScale[2]; \n"
+        "uniform float positionScale; \n"
+
+        "void main() { \n"
+        "    vec4 viewport = viewportOffsetScale[int(texCoord.z)]; \n"
+        "    vTexCoord = (texCoord.xy * viewport.zw) + viewport.xy; \n"
+        "    vTexCoord.y = 1 - vTexCoord.y; \n"
+        "    gl_Position = vec4( position * positionScale, 1.0, 1.0 ); \n"
+        "} \n";
+
+    // Common to both fragment shaders
+    const char*    conversionSource =
+        "uniform sampler2D UYVYtex; \n"        // UYVY macropixel texture passed as RGBA format
+        "varying vec2 vTexCoord; \n"
+
+        "vec4 YCbCr2rgba(float Y, float Cb, float Cr, float a) \n"
+        "{ \n"
+        "    float r, g, b; \n"
+        // Y: Undo 1/256 texture value scaling and scale [16..235] to [0..1] range
+        // C: Undo 1/256 texture value scaling and scale [16..240] to [-0.5 .. + 0.5] range
+        "    Y = (Y * 256.0 - 16.0) / 219.0; \n"
+        "    Cb = (Cb * 256.0 - 16.0) / 224.0 - 0.5; \n"
+        "    Cr = (Cr * 256.0 - 16.0) / 224.0 - 0.5; \n"
+        "#if COLOUR_MATRIX == 601 \n"
+        // Convert to RGB using Rec.601 conversion matrix, for standard definition video
+        "    r = Y + 1.402 * Cr; \n"
+        "    g = Y - 0.3441 * Cb - 0.7141 * Cr; \n"
+        "    b = Y + 1.772 * Cb; \n"
+        "#else \n"
+        // Convert to RGB using Rec.709 conversion matrix (see eq 26.7 in Poynton 2003)
+        "    r = Y + 1.5748 * Cr; \n"
+        "    g = Y - 0.1873 * Cb - 0.4681 * Cr; \n"
+        "    b = Y + 1.8556 * Cb; \n"
+        "#endif \n"
+        "    return vec4(r, g, b, a); \n"
+        "}\n";
+
+    const char*    gatherSource =
+        // Perform bilinear interpolation between the provided components.
+        // The samples are expected as shown:
+        // ---------
+        // | X | Y |
+        // |---+---|
+        // | W | Z |
+        // ---------
+        "vec4 bilinear(vec4 W, vec4 X, vec4 Y, vec4 Z, vec2 weight) \n"
+        "{\n"
+        "    vec4 m0 = mix(W, Z, weight.x);\n"
+        "    vec4 m1 = mix(X, Y, weight.x);\n"
+        "    return mix(m0, m1, weight.y); \n"
+        "}\n"
+
+        // Gather neighboring YUV macropixels from the given texture coordinate
+        "void textureGatherYUV(sampler2D UYVYsampler, vec2 tc, out vec4 W, out vec4 X, out vec4 Y, out vec4 Z) \n"
+        "{\n"
+        "    ivec2 tx = ivec2(tc * textureSize(UYVYsampler, 0));\n"
+        "    ivec2 tmin = ivec2(0,0);\n"
+        "    ivec2 tmax = textureSize(UYVYsampler, 0) - ivec2(1,1);\n"
+        "    W = texelFetch(UYVYsampler, tx, 0); \n"
+        "    X = texelFetch(UYVYsampler, clamp(tx + ivec2(0,1), tmin, tmax), 0); \n"
+        "    Y = texelFetch(UYVYsampler, clamp(tx + ivec2(1,1), tmin, tmax), 0); \n"
+        "    Z = texelFetch(UYVYsampler, clamp(tx + ivec2(1,0), tmin, tmax), 0); \n"
+        "}\n"
+
+        "void main(void) \n"
+        "{\n"
+        /* The shader uses texelFetch to obtain the YUV macropixels to avoid unwanted interpolation
+         * introduced by the GPU interpreting the YUV data as RGBA pixels.
+         * The YUV macropixels are converted into individual RGB pixels and bilinear interpolation is applied. */
+        "    //vec2 tc = gl_TexCoord[0].st; \n"
+        "    float alpha = 0.7; \n"
+
+        "    vec4 macro, macro_u, macro_r, macro_ur;\n"
+        "    vec4 pixel, pixel_r, pixel_u, pixel_ur; \n"
+        "    textureGatherYUV(UYVYtex, vTexCoord, macro, macro_u, macro_ur, macro_r);\n"
+
+        //   Select the components for the bilinear interpolation based on the texture coordinate
+        //   location within the YUV macropixel:
+        //   -----------------          ----------------------
+        //   | UY/VY | UY/VY |          | macro_u | macro_ur |
+        //   |-------|-------|    =>    |---------|----------|
+        //   | UY/VY | UY/VY |          | macro   | macro_r  |
+        //   |-------|-------|          ----------------------
+        //   | RG/BA | RG/BA |
+        //   -----------------
+        "    vec2 off = fract(vTexCoord * textureSize(UYVYtex, 0)); \n"
+        "    if (off.x > 0.5) { \n"            // right half of macropixel
+        "        pixel = YCbCr2rgba(macro.a, macro.b, macro.r, alpha); \n"
+        "        pixel_r = YCbCr2rgba(macro_r.g, macro_r.b, macro_r.r, alpha); \n"
+        "        pixel_u = YCbCr2rgba(macro_u.a, macro_u.b, macro_u.r, alpha); \n"
+        "        pixel_ur = YCbCr2rgba(macro_ur.g, macro_ur.b, macro_ur.r, alpha); \n"
+        "    } else { \n"                    // left half & center of macropixel
+        "        pixel = YCbCr2rgba(macro.g, macro.b, macro.r, alpha); \n"
+        "        pixel_r = YCbCr2rgba(macro.a, macro.b, macro.r, alpha); \n"
+        "        pixel_u = YCbCr2rgba(macro_u.g, macro_u.b, macro_u.r, alpha); \n"
+        "        pixel_ur = YCbCr2rgba(macro_u.a, macro_u.b, macro_u.r, alpha); \n"
+        "    }\n"
+
+        "    gl_FragColor = bilinear(pixel, pixel_u, pixel_ur, pixel_r, off); \n"
+        "}\n";
+
+    // The gather shader's result with one filtered sample per plane.  Its bilinear mix of converted
+    // pixels equals converting mixed components, as the conversion is affine, and the mix it selects
+    // per half macropixel is a plain linear filter:
+    //   - luma between pixels 2m + right and the next one, weight w = fract(macro.x)
+    //   - chroma of macropixel m on the left half, mixed with macropixel m + 1 by w on the right half
+    //   - both between rows floor(y) and the next one, weight fract(y)
+    // where right = w > 0.5.  Offsetting the coordinates by half a texel makes the hardware filter pick
+    // exactly those texels and weights.  Results differ from the gather shader only by the filter's
+    // weight precision (8 bits on most GPUs) and in the last column, where it repeats Y1 instead of
+    // reading Y0 of the same macropixel.
+    const char*    twoPlaneSource =
+        "uniform sampler2D lumaTex; \n"       // one Y per pixel
+        "uniform sampler2D chromaTex; \n"     // (Cb, Cr) per macropixel
+
+        "void main(void) \n"
+        "{\n"
+        "    vec2 chromaSize = vec2(textureSize(chromaTex, 0)); \n"
+        "    vec2 lumaSize = vec2(textureSize(lumaTex, 0)); \n"
+
+        "    float macro = vTexCoord.x * chromaSize.x; \n"
+        "    float m = floor(macro); \n"
+        "    float w = macro - m; \n"
+        "    float right = w > 0.5 ? 1.0 : 0.0; \n"
+        "    float v = vTexCoord.y + 0.5 / lumaSize.y; \n"
+
+        "    float Y = texture(lumaTex, vec2((2.0 * m + right + w + 0.5) / lumaSize.x, v)).r; \n"
+        "    vec2 C = texture(chromaTex, vec2((m + 0.5 + right * w) / chromaSize.x, v)).rg; \n"
+
+        "    gl_FragColor = YCbCr2rgba(Y, C.r, C.g, 0.7); \n"
+        "}\n";
+
+    char defines[64];
+    snprintf(defines, sizeof(defines), "#define COLOUR_MATRIX %d \n", mColourMatrix == ColourRec601 ? 601 : 709);
+
+    std::vector<const char*> vertexSources;
+    vertexSources.push_back(version);
+    vertexSources.push_back(defines);
+    vertexSources.push_back(vertexSource);
+
+    std::vector<const char*> fragmentSources;
+    fragmentSources.push_back(version);
+    fragmentSources.push_back(defines);
+    fragmentSources.push_back(conversionSource);
+    fragmentSources.push_back(shader == ShaderTwoPlane ? twoPlaneSource : gatherSource);
+
+    return mShaderManager.program(vertexSources, fragmentSources, error);
+}
+
+// Program splitting the video texture into one plane of the two-plane shader, drawn over a triangle
+// covering the plane; every fragment fetches the macropixel of its pixel.  The UYVY texel holds
+// Cb in b, Y0 in g, Cr in r and Y1 in a.
+GLuint WarpRenderer::planeProgram(bool chroma, QString& error)
+{
+    const char* version = "#version 130 \n";
+
+    const char* vertexSource =
+        "void main() { \n"
+        "    vec2 corner = vec2(float(gl_VertexID & 1), float(gl_VertexID >> 1)); \n"
+        "    gl_Position = vec4(corner * 4.0 - 1.0, 0.0, 1.0); \n"
+        "} \n";
+
+    const char* lumaSource =
+        "uniform sampler2D UYVYtex; \n"
+
+        "void main(void) \n"
+        "{\n"
+        "    ivec2 pixel = ivec2(gl_FragCoord.xy); \n"
+        "    vec4 macro = texelFetch(UYVYtex, ivec2(pixel.x / 2, pixel.y), 0); \n"
+        "    gl_FragColor = vec4((pixel.x & 1) == 0 ? macro.g : macro.a, 0.0, 0.0, 1.0); \n"
+        "}\n";
+
+    const char* chromaSource =
+        "uniform sampler2D UYVYtex; \n"
+
+        "void main(void) \n"
+        "{\n"
+        "    vec4 macro = texelFetch(UYVYtex, ivec2(gl_FragCoord.xy), 0); \n"
+        "    gl_FragColor = vec4(macro.b, macro.r, 0.0, 1.0); \n"
+        "}\n";
+
+    std::vector<const char*> vertexSources;
+    vertexSources.push_back(version);
+    vertexSources.push_back(vertexSource);
+
+    std::vector<const char*> fragmentSources;
+    fragmentSources.push_back(version);
+    fragmentSources.push_back(chroma ? chromaSource : lumaSource);
+
+    return mShaderManager.program(vertexSources, fragmentSources, error);
+}
+
+bool WarpRenderer::CheckOpenGLExtensions(QString& error)
+{
+    const GLubyte* strExt;
+    GLboolean hasFBO, hasPinned;
+
+    strExt = glGetString (GL_EXTENSIONS);
+    hasFBO = gluCheckExtension ((const GLubyte*)"GL_EXT_framebuffer_object", strExt);
+    hasPinned = gluCheckExtension ((const GLubyte*)"GL_AMD_pinned_memory", strExt);
+
+    mPinnedMemoryExtensionAvailable = hasPinned;
+
+    if (!hasFBO)
+    {
+        error = "OpenGL extension \"GL_EXT_framebuffer_object\" is not supported.";
+        return false;
+    }
+
+    if (!mPinnedMemoryExtensionAvailable)
+        fprintf(stderr, "GL_AMD_pinned_memory extension not available, using regular texture buffer fallback instead\n");
+
+    return true;
+}
@@ -0,0 +1,190 @@
+#ifndef WARP_RENDERER_H
+#define WARP_RENDERER_H
+
+#include "DeviceInfo.h"
+#include "DeckLinkAPI.h"
+#include "GLExtensions.h"
+#include "MeshCache.h"
+#include "ShaderManager.h"
+#include "UnpackBufferRing.h"
+#include "UploadScheduler.h"
+
+#include <QString>
+#include <vector>
+
+class PinnedMemoryAllocator;
+
+using namespace cam2vr;
+
+////////////////////////////////////////////
+// WarpRenderer
+////////////////////////////////////////////
+
+// Owns the GL objects of the capture pipeline: the UYVY video texture and its upload path, the
+// colour-conversion/lens-warp program with its distortion mesh, and an off-screen FBO whose colour
+// attachment is one of a small set of textures the presenter can read from another (shared) context.
+//
+// All methods except the constructor must be called with the rendering GL context current.
+class WarpRenderer
+{
+public:
+    WarpRenderer();
+    ~WarpRenderer();
+
+    // Unpack buffer ring used when GL_AMD_pinned_memory is not available; takes effect on the next init()
+    void setUploadRing(int depth, UnpackBufferRing::Mode mode) { mUploadRingDepth = depth; mUploadRingMode = mode; }
+
+    // Limits of the mesh size in each direction
+    enum { MinMeshSize = 2, MaxMeshSize = 256 };
+
+    // How the distortion mesh is laid out in its buffers
+    enum MeshLayout {
+        MeshTriangles = 0,      // 5 floats (20 bytes) per vertex, 6 32-bit indices per quad, GL_TRIANGLES
+        MeshStrips              // 12 byte normalised short vertices, a GL_TRIANGLE_STRIP per row and
+                                // diagonal direction joined by primitive restart, 16-bit indices up to
+                                // 65535 vertices (the default)
+    };
+    static bool isValidMeshSize(int width, int height);
+
+    // Vertices per eye of the distortion mesh.  The mesh is built by init(); once initialised (with the
+    // rendering context current) a new size also replaces the mesh in the existing vertex and index
+    // buffers, and the next drawFrame() uses it.
+    void setMeshSize(int width, int height);
+    int meshWidth() const { return m_meshWidth; }
+    int meshHeight() const { return m_meshHeight; }
+
+    // Buffer layout of the mesh, applied like setMeshSize().  Strips fall back to triangles when the
+    // context has no primitive restart (OpenGL 3.1).
+    void setMeshLayout(MeshLayout layout);
+    MeshLayout meshLayout() const { return m_meshLayout; }
+
+    // Viewer and phone the mesh is computed for, applied like setMeshSize()
+    void setProfile(const CardboardViewer& viewer, const Device& device);
+    // How the mesh undoes the lens distortion, applied like setMeshSize()
+    void setDistortionInverse(DeviceInfo::InverseMode mode);
+    DeviceInfo::InverseMode distortionInverse() const { return m_deviceInfo->getInverseMode(); }
+    CardboardViewer viewer() const { return m_deviceInfo->getViewer(); }
+    Device device() const { return m_deviceInfo->getDevice(); }
+
+    // Fragment program of the warp.  init() builds every variant for the colour matrix, so a switch
+    // while capturing only swaps programs; like setMeshLayout() it is applied by the render thread
+    // between frames.  After setColourMatrix() the selected variant is compiled, or its cached binary
+    // loaded, when it is applied, which stalls that frame.
+    enum WarpShader {
+        ShaderGather = 0,       // four texelFetch() of the UYVY texture per fragment, each macropixel
+                                // converted to RGB before a bilinear mix in the shader (the default)
+        ShaderTwoPlane,         // one filtered sample each of an R8 luma plane and an RG8 chroma plane,
+                                // converted once; the planes are split from the uploaded UYVY texture
+                                // by a render pass on the GPU
+        ShaderCount
+    };
+    void setWarpShader(WarpShader shader);
+    WarpShader warpShader() const { return mWarpShader; }
+    // The shader frames are warped with: the requested one, or the gather shader when that cannot be built
+    WarpShader drawShader() const { return mDrawShader; }
+
+    static const char* warpShaderName(WarpShader shader);
+    static bool warpShaderFromName(const char* name, WarpShader& shader);
+
+    // YCbCr to RGB conversion of the shaders, a variant of each; applied like setWarpShader()
+    enum ColourMatrix {
+        ColourRec709 = 0,       // HD (the default)
+        ColourRec601            // SD
+    };
+    void setColourMatrix(ColourMatrix matrix);
+    ColourMatrix colourMatrix() const { return mColourMatrix; }
+
+    static const char* colourMatrixName(ColourMatrix matrix);
+    static bool colourMatrixFromName(const char* name, ColourMatrix& matrix);
+
+    static const char* meshLayoutName(MeshLayout layout);
+    static bool meshLayoutFromName(const char* name, MeshLayout& layout);
+    // Vertex and index buffer sizes of a mesh in the given layout
+    static void meshBufferSizes(MeshLayout layout, int width, int height, int& vertexBytes, int& indexBytes);
+
+    // Where computed meshes are kept (MeshCache::defaultDirectory() by default), empty for nowhere;
+    // takes effect with the next mesh
+    void setMeshCacheDirectory(const QString& directory) { m_meshCache.setDirectory(directory); }
+    // Where program binaries are kept (ShaderManager::defaultDirectory() by default), empty for nowhere;
+    // takes effect with the next program built
+    void setShaderCacheDirectory(const QString& directory) { mShaderManager.setCacheDirectory(directory); }
+
+    bool init(unsigned frameWidth, unsigned frameHeight, int targetCount, PinnedMemoryAllocator* allocator, QString& error);
+    void cleanup();
+
+    // Copy the frame into the video texture, and split it into the planes of the two-plane shader
+    // when that is in use.  Takes over the caller's reference on frame.
+    void uploadFrame(IDeckLinkVideoInputFrame* frame);
+    // Release frames whose pinned uploads have completed
+    void retireUploads();
+
+    // Warp the video texture into colour target index, or draw a cross when there is no input
+    void drawFrame(int target, bool hasNoInputSource);
+
+    const std::vector<GLuint>& targetTextures() const { return mColorTextures; }
+    unsigned frameWidth() const { return mFrameWidth; }
+    unsigned frameHeight() const { return mFrameHeight; }
+
+private:
+    bool CheckOpenGLExtensions(QString& error);
+    GLuint program(WarpShader shader, QString& error);
+    GLuint planeProgram(bool chroma, QString& error);
+    void selectProgram();
+    void splitPlanes();
+
+    // VR
+    void setTextureBounds();
+    void computeMeshVertices(int width, int height);
+    static void computeMeshIndices(int width, int height, std::vector<unsigned int>& indices);
+    static void computeMeshStripIndices(int width, int height, std::vector<unsigned int>& indices);
+    void uploadMesh();
+    void buildMesh(std::vector<unsigned char>& vertexData, std::vector<unsigned char>& indexData, MeshCache::Mesh& mesh);
+    bool isValidMesh(const MeshCache::Mesh& mesh);
+
+private:
+    PinnedMemoryAllocator*                  mCaptureAllocator;
+    unsigned                                mFrameWidth;
+    unsigned                                mFrameHeight;
+
+    // OpenGL data
+    bool                                    mPinnedMemoryExtensionAvailable;
+    GLuint                                  mTexture;
+    GLuint                                  mLumaTexture;       // planes of ShaderTwoPlane, split from
+    GLuint                                  mChromaTexture;     // mTexture by mPlaneFrameBuf's programs
+    GLuint                                  mPlaneFrameBuf;
+    GLuint                                  mLumaProgram;
+    GLuint                                  mChromaProgram;
+    UnpackBufferRing                        mUnpackRing;
+    int                                     mUploadRingDepth;
+    UnpackBufferRing::Mode                  mUploadRingMode;
+    UploadScheduler                         mUploadScheduler;   // pinned uploads awaiting their fence
+    GLuint                                  mIdFrameBuf;
+    std::vector<GLuint>                     mColorTextures;
+    GLuint                                  mIdDepthBuf;
+    ShaderManager                           mShaderManager;     // owns the programs
+    GLuint                                  mProgram;           // of mDrawShader
+    WarpShader                              mWarpShader;        // requested
+    WarpShader                              mDrawShader;        // in use
+    ColourMatrix                            mColourMatrix;
+
+    // VR
+    int                                     m_meshWidth, m_meshHeight;
+    MeshLayout                              m_meshLayout;       // requested
+    MeshLayout                              m_drawLayout;       // in the buffers
+    float                                   m_bufferScale;
+    float                                   m_viewportOffsetScale[8];
+    DeviceInfo*                             m_deviceInfo;
+    unsigned int                            m_vbo;
+    unsigned int                            m_ibo;
+    GLsizeiptr                              m_vboBytes;     // storage allocated for m_vbo and m_ibo
+    GLsizeiptr                              m_iboBytes;
+    std::vector<float>                      m_vertices;         // of the mesh being built
+    MeshCache                               m_meshCache;
+    GLenum                                  m_indexType;
+    GLsizei                                 m_indexCount;
+    float                                   m_positionScale;    // packed positions are divided by it
+    GLint                                   m_positionAttrib;
+    GLint                                   m_texCoordAttrib;
+};
+
+#endif
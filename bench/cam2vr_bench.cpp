@@ -0,0 +1,485 @@
+// Offscreen benchmark of the capture -> upload -> warp -> present pipeline.
+//
+// Drives OpenGLCapture with the synthetic frame source running unpaced, so frames are produced as fast
+// as the pipeline takes them, for every combination of the requested resolutions, distortion mesh
+// sizes and layouts, warp shaders and upload modes, and prints one JSON document with the results.
+// With --compare-shaders it first warps one frame of noise per resolution with every shader and
+// reports how far each result is from the gather shader's.  When both shaders are swept, the GPU
+// upload and warp times of every two-plane run are set against the matching gather run's, as the
+// two-plane shader moves work from the warp into the upload, where its planes are split.  By default Qt's offscreen platform is
+// used, so no display is needed (with Mesa, LIBGL_ALWAYS_SOFTWARE=1 selects llvmpipe).
+
+#include "OpenGLCapture.h"
+#include "SyntheticFrameSource.h"
+#include "FramePacer.h"
+#include "LatencyStats.h"
+
+#include <QApplication>
+#include <QCommandLineParser>
+#include <QEventLoop>
+#include <QOffscreenSurface>
+#include <QOpenGLContext>
+#include <QTimer>
+#include <QStringList>
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include <sys/resource.h>
+#include <unistd.h>
+
+struct BenchConfig
+{
+    std::string             mode;
+    int                     meshWidth;
+    int                     meshHeight;
+    WarpRenderer::MeshLayout meshLayout;
+    WarpRenderer::WarpShader shader;
+    UnpackBufferRing::Mode  uploadMode;
+};
+
+// Mean GPU times of a run, in ms, for comparing the shaders
+struct RunTimes
+{
+    BenchConfig             config;
+    WarpRenderer::WarpShader shader;        // the one used
+    double                  uploadMs;
+    double                  warpMs;
+};
+
+// Process CPU time in ns
+static BMDTimeValue cpuTime()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return ((BMDTimeValue)usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000000LL
+           + ((BMDTimeValue)usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1000LL;
+}
+
+// Resident set size in MiB, current and peak
+static double residentMemory()
+{
+    long pages = 0, resident = 0;
+    FILE* statm = fopen("/proc/self/statm", "r");
+    if (statm)
+    {
+        if (fscanf(statm, "%ld %ld", &pages, &resident) != 2)
+            resident = 0;
+        fclose(statm);
+    }
+    return (double)resident * sysconf(_SC_PAGESIZE) / (1024.0 * 1024.0);
+}
+
+static double peakResidentMemory()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss / 1024.0;
+}
+
+static void runEventLoop(double seconds)
+{
+    QEventLoop loop;
+    QTimer::singleShot((int)(seconds * 1000), &loop, SLOT(quit()));
+    loop.exec();
+}
+
+static void appendHistogram(std::string& out, const char* name, const LatencyHistogram& histogram)
+{
+    char buffer[256];
+    snprintf(buffer, sizeof(buffer), ", \"%s\": {\"mean\": %.3f, \"p50\": %.3f, \"p99\": %.3f, \"max\": %.3f}",
+             name, histogram.mean() / 1e6, histogram.percentile(0.5) / 1e6,
+             histogram.percentile(0.99) / 1e6, histogram.max() / 1e6);
+    out += buffer;
+}
+
+static bool runConfig(OpenGLCapture* capture, const BenchConfig& config, int viewWidth, int viewHeight,
+                      double warmup, double seconds, std::string& out, RunTimes& times)
+{
+    int mode = SyntheticFrameSource::modeFromName(config.mode);
+    if (mode < 0)
+    {
+        fprintf(stderr, "Unknown synthetic mode '%s'\n", config.mode.c_str());
+        return false;
+    }
+
+    SyntheticFrameSource* source = new SyntheticFrameSource();
+    source->setRate(0);
+    capture->setFrameSource(source);
+    capture->setUploadRing(3, config.uploadMode);
+    capture->setMeshSize(config.meshWidth, config.meshHeight);
+    capture->setMeshLayout(config.meshLayout);
+    capture->setWarpShader(config.shader);
+
+    if (! capture->InitDeckLink(0, mode))
+        return false;
+    // InitDeckLink() sizes the window for viewing; blit to the requested size instead
+    capture->resize(viewWidth, viewHeight);
+    if (! capture->Start())
+        return false;
+
+    runEventLoop(warmup);
+
+    LatencyStats& stats = capture->latencyStats();
+    stats.reset();
+    BMDTimeValue cpuStart = cpuTime();
+    BMDTimeValue wallStart = FramePacer::now();
+
+    runEventLoop(seconds);
+
+    BMDTimeValue cpu = cpuTime() - cpuStart;
+    double elapsed = (FramePacer::now() - wallStart) / 1e9;
+    LatencyHistogram render = stats.total(LatencyStats::StageRender);
+    LatencyHistogram upload = stats.total(LatencyStats::StageUpload);
+    LatencyHistogram warp = stats.total(LatencyStats::StageWarp);
+    LatencyHistogram blit = stats.total(LatencyStats::StageBlit);
+    LatencyHistogram total = stats.total(LatencyStats::StageTotal);
+    unsigned long long rendered = render.count();
+    unsigned long long presented = stats.eventCount(LatencyStats::EventPresented);
+    // The requested shader may have fallen back to the gather one
+    WarpRenderer::WarpShader shader = capture->drawShader();
+    int meshVertexBytes, meshIndexBytes;
+    WarpRenderer::meshBufferSizes(config.meshLayout, config.meshWidth, config.meshHeight, meshVertexBytes, meshIndexBytes);
+
+    char buffer[768];
+    snprintf(buffer, sizeof(buffer),
+             "    {\"mode\": \"%s\", \"width\": %u, \"height\": %u, \"mesh\": \"%dx%d\", \"mesh_layout\": \"%s\", \"shader\": \"%s\", \"requested_shader\": \"%s\", "
+             "\"mesh_vertex_bytes\": %d, \"mesh_index_bytes\": %d, \"upload_mode\": \"%s\", \"seconds\": %.3f, "
+             "\"frames_captured\": %llu, \"frames_rendered\": %llu, \"frames_presented\": %llu, \"frames_dropped\": %llu, "
+             "\"rendered_fps\": %.2f, \"presented_fps\": %.2f, \"process_cpu_ms_per_frame\": %.3f, "
+             "\"rss_mib\": %.1f, \"peak_rss_mib\": %.1f",
+             config.mode.c_str(), source->getFrameWidth(), source->getFrameHeight(), config.meshWidth, config.meshHeight,
+             WarpRenderer::meshLayoutName(config.meshLayout), WarpRenderer::warpShaderName(shader), WarpRenderer::warpShaderName(config.shader),
+             meshVertexBytes, meshIndexBytes,
+             UnpackBufferRing::modeName(config.uploadMode), elapsed,
+             stats.eventCount(LatencyStats::EventCaptured), rendered, presented,
+             stats.eventCount(LatencyStats::EventQueueDropped),
+             rendered / elapsed, presented / elapsed, rendered ? cpu / 1e6 / rendered : 0.0,
+             residentMemory(), peakResidentMemory());
+    out += buffer;
+    appendHistogram(out, "render_ms", render);
+    appendHistogram(out, "upload_gpu_ms", upload);
+    appendHistogram(out, "warp_gpu_ms", warp);
+    appendHistogram(out, "blit_gpu_ms", blit);
+    appendHistogram(out, "latency_ms", total);
+    out += "}";
+
+    times.config = config;
+    times.shader = shader;
+    times.uploadMs = upload.mean() / 1e6;
+    times.warpMs = warp.mean() / 1e6;
+
+    capture->Stop();
+    return true;
+}
+
+// For every run with another shader than gather, its upload and warp GPU times against those of the
+// gather run of the same mode, mesh and upload mode, appended to out
+static void compareShaderTimes(const std::vector<RunTimes>& runs, std::string& out)
+{
+    for (size_t i = 0; i < runs.size(); i++)
+    {
+        if (runs[i].shader == WarpRenderer::ShaderGather)
+            continue;
+
+        for (size_t j = 0; j < runs.size(); j++)
+        {
+            const BenchConfig& a = runs[i].config;
+            const BenchConfig& b = runs[j].config;
+            if (runs[j].shader != WarpRenderer::ShaderGather || a.mode != b.mode || a.meshWidth != b.meshWidth
+                || a.meshHeight != b.meshHeight || a.meshLayout != b.meshLayout || a.uploadMode != b.uploadMode)
+                continue;
+
+            char line[512];
+            snprintf(line, sizeof(line),
+                     "%s    {\"mode\": \"%s\", \"mesh\": \"%dx%d\", \"mesh_layout\": \"%s\", \"upload_mode\": \"%s\", "
+                     "\"shader\": \"%s\", \"reference\": \"%s\", \"upload_ms\": %.3f, \"reference_upload_ms\": %.3f, "
+                     "\"warp_ms\": %.3f, \"reference_warp_ms\": %.3f, \"upload_warp_ms_change\": %.3f}",
+                     out.empty() ? "" : ",\n", a.mode.c_str(), a.meshWidth, a.meshHeight,
+                     WarpRenderer::meshLayoutName(a.meshLayout), UnpackBufferRing::modeName(a.uploadMode),
+                     WarpRenderer::warpShaderName(runs[i].shader), WarpRenderer::warpShaderName(WarpRenderer::ShaderGather),
+                     runs[i].uploadMs, runs[j].uploadMs, runs[i].warpMs, runs[j].warpMs,
+                     runs[i].uploadMs + runs[i].warpMs - runs[j].uploadMs - runs[j].warpMs);
+            out += line;
+            break;
+        }
+    }
+}
+
+// Warp one frame of noise with every shader in a context of its own and append, for each shader but
+// the gather one, how far its pixels are from the gather shader's.  Noise is the worst case for the
+// two-plane shader, whose filter weights have the hardware's precision.
+static bool compareShaders(const std::string& modeName, std::string& out)
+{
+    SyntheticFrameSource source;
+    int mode = SyntheticFrameSource::modeFromName(modeName);
+    if (mode < 0 || ! source.Open(0, mode))
+    {
+        fprintf(stderr, "Unknown synthetic mode '%s'\n", modeName.c_str());
+        return false;
+    }
+    unsigned width = source.getFrameWidth();
+    unsigned height = source.getFrameHeight();
+
+    QOffscreenSurface surface;
+    surface.create();
+    QOpenGLContext context;
+    if (! context.create() || ! context.makeCurrent(&surface) || ! ResolveGLExtensions(&context))
+    {
+        fprintf(stderr, "Cannot create an OpenGL context to compare the shaders\n");
+        return false;
+    }
+
+    PinnedMemoryAllocator* allocator = new PinnedMemoryAllocator("Compare", 1);
+    WarpRenderer* renderer = new WarpRenderer();
+    QString error;
+    if (! renderer->init(width, height, WarpRenderer::ShaderCount, allocator, error))
+    {
+        fprintf(stderr, "%s\n", qPrintable(error));
+        delete renderer;
+        allocator->Release();
+        return false;
+    }
+
+    // Legal range: Y (odd bytes) 16 to 235, Cb and Cr 16 to 240
+    void* buffer = NULL;
+    allocator->AllocateBuffer(width * 2 * height, &buffer);
+    unsigned char* bytes = (unsigned char*)buffer;
+    srand(1);
+    for (unsigned i = 0; i < width * 2 * height; i++)
+        bytes[i] = 16 + rand() % (i & 1 ? 220 : 225);
+
+    QAtomicInt framesInFlight(1);
+    SyntheticVideoFrame* frame = new SyntheticVideoFrame(allocator, buffer, &framesInFlight, width, height, 0, 0, 1, 1);
+
+    std::vector<std::vector<unsigned char> > images(WarpRenderer::ShaderCount);
+    for (int s = 0; s < WarpRenderer::ShaderCount; s++)
+    {
+        renderer->setWarpShader((WarpRenderer::WarpShader)s);
+        frame->AddRef();                    // taken over by uploadFrame()
+        renderer->uploadFrame(frame);
+        renderer->drawFrame(s, false);
+
+        images[s].resize(width * height * 4);
+        glBindTexture(GL_TEXTURE_2D, renderer->targetTextures()[s]);
+        glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_BYTE, &images[s][0]);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+
+    renderer->cleanup();
+    frame->Release();
+    delete renderer;
+    allocator->Decommit();
+    allocator->releaseUnpinnedBuffers();
+    allocator->Release();
+    context.doneCurrent();
+
+    const std::vector<unsigned char>& reference = images[WarpRenderer::ShaderGather];
+    for (int s = 0; s < WarpRenderer::ShaderCount; s++)
+    {
+        if (s == WarpRenderer::ShaderGather)
+            continue;
+
+        // Colour channels only, alpha is constant
+        int maxDifference = 0;
+        unsigned long long sum = 0, beyondOne = 0, channels = 0;
+        for (size_t i = 0; i < reference.size(); i++)
+        {
+            if (i % 4 == 3)
+                continue;
+            int difference = abs((int)images[s][i] - (int)reference[i]);
+            maxDifference = std::max(maxDifference, difference);
+            sum += difference;
+            beyondOne += difference > 1;
+            channels++;
+        }
+
+        char line[384];
+        snprintf(line, sizeof(line),
+                 "%s    {\"mode\": \"%s\", \"width\": %u, \"height\": %u, \"shader\": \"%s\", \"reference\": \"%s\", "
+                 "\"max_difference\": %d, \"mean_difference\": %.4f, \"beyond_1_percent\": %.4f}",
+                 out.empty() ? "" : ",\n", modeName.c_str(), width, height,
+                 WarpRenderer::warpShaderName((WarpRenderer::WarpShader)s),
+                 WarpRenderer::warpShaderName(WarpRenderer::ShaderGather),
+                 maxDifference, channels ? (double)sum / channels : 0.0, channels ? 100.0 * beyondOne / channels : 0.0);
+        out += line;
+    }
+    return true;
+}
+
+static bool parseMeshSize(const QString& text, int& width, int& height)
+{
+    QStringList parts = text.split('x');
+    bool okWidth = false, okHeight = false;
+    width = parts[0].toInt(&okWidth);
+    height = parts.size() > 1 ? parts[1].toInt(&okHeight) : width;
+    if (parts.size() == 1)
+        okHeight = okWidth;
+    return okWidth && okHeight && width >= 2 && height >= 2 && parts.size() <= 2;
+}
+
+int main(int argc, char *argv[])
+{
+    // No window system needed unless asked for
+    if (qgetenv("QT_QPA_PLATFORM").isEmpty())
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+
+    QApplication app(argc, argv);
+    QApplication::setApplicationName("cam2vr_bench");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Benchmark of the cam2vr capture, warp and present pipeline on synthetic frames.");
+    parser.addHelpOption();
+    QCommandLineOption modesOption("modes", "Comma separated synthetic modes.", "modes", "720p60,1080p60,2160p30");
+    QCommandLineOption meshesOption("meshes", "Comma separated distortion mesh sizes per eye, N or WxH.", "sizes", "10,20,40,80");
+    QCommandLineOption meshLayoutsOption("mesh-layouts", "Comma separated distortion mesh layouts: triangles or strips.", "layouts", "triangles,strips");
+    QCommandLineOption shadersOption("shaders", "Comma separated warp shaders: gather or two-plane.", "shaders", "gather,two-plane");
+    QCommandLineOption compareShadersOption("compare-shaders", "First warp one frame of noise per mode with every shader and report the differences to the gather shader.");
+    QCommandLineOption uploadModesOption("upload-modes", "Comma separated unpack buffer modes: persistent, orphan or auto.", "modes", "persistent,orphan");
+    QCommandLineOption secondsOption("seconds", "Measured duration of every run.", "seconds", "5");
+    QCommandLineOption warmupOption("warmup", "Unmeasured duration before every run.", "seconds", "1");
+    QCommandLineOption sizeOption("size", "Size of the presenting window.", "WxH", "1920x1080");
+    QCommandLineOption outputOption("output", "Write the JSON results to a file instead of stdout.", "file");
+    parser.addOption(modesOption);
+    parser.addOption(meshesOption);
+    parser.addOption(meshLayoutsOption);
+    parser.addOption(shadersOption);
+    parser.addOption(compareShadersOption);
+    parser.addOption(uploadModesOption);
+    parser.addOption(secondsOption);
+    parser.addOption(warmupOption);
+    parser.addOption(sizeOption);
+    parser.addOption(outputOption);
+    parser.process(app);
+
+    std::vector<BenchConfig> configs;
+    QStringList modes = parser.value(modesOption).split(',');
+    QStringList meshes = parser.value(meshesOption).split(',');
+    QStringList meshLayouts = parser.value(meshLayoutsOption).split(',');
+    QStringList shaders = parser.value(shadersOption).split(',');
+    QStringList uploadModes = parser.value(uploadModesOption).split(',');
+    for (int m = 0; m < modes.size(); m++)
+    {
+        for (int s = 0; s < meshes.size(); s++)
+        {
+            for (int l = 0; l < meshLayouts.size(); l++)
+            {
+                for (int w = 0; w < shaders.size(); w++)
+                {
+                    for (int u = 0; u < uploadModes.size(); u++)
+                    {
+                        BenchConfig config;
+                        config.mode = modes[m].toStdString();
+                        if (! parseMeshSize(meshes[s], config.meshWidth, config.meshHeight))
+                        {
+                            fprintf(stderr, "Invalid mesh size '%s'\n", qPrintable(meshes[s]));
+                            return 1;
+                        }
+                        if (! WarpRenderer::meshLayoutFromName(qPrintable(meshLayouts[l]), config.meshLayout))
+                        {
+                            fprintf(stderr, "Unknown mesh layout '%s'\n", qPrintable(meshLayouts[l]));
+                            return 1;
+                        }
+                        if (! WarpRenderer::warpShaderFromName(qPrintable(shaders[w]), config.shader))
+                        {
+                            fprintf(stderr, "Unknown warp shader '%s'\n", qPrintable(shaders[w]));
+                            return 1;
+                        }
+                        if (! UnpackBufferRing::modeFromName(qPrintable(uploadModes[u]), config.uploadMode))
+                        {
+                            fprintf(stderr, "Unknown upload mode '%s'\n", qPrintable(uploadModes[u]));
+                            return 1;
+                        }
+                        configs.push_back(config);
+                    }
+                }
+            }
+        }
+    }
+
+    int viewWidth = 1920, viewHeight = 1080;
+    if (! parseMeshSize(parser.value(sizeOption), viewWidth, viewHeight))
+    {
+        fprintf(stderr, "Invalid window size '%s'\n", qPrintable(parser.value(sizeOption)));
+        return 1;
+    }
+
+    OpenGLCapture* capture = new OpenGLCapture();
+    capture->setFrameQueue(2, FrameQueue::PolicyBlock);     // measure throughput, not drops
+    capture->setPacing(false);                              // the offscreen platform has no vsync to pace to
+    capture->resize(viewWidth, viewHeight);
+    capture->show();
+
+    capture->makeCurrent();
+    std::string out = "{\n";
+    char buffer[512];
+    snprintf(buffer, sizeof(buffer), "  \"platform\": \"%s\",\n  \"gl_vendor\": \"%s\",\n  \"gl_renderer\": \"%s\",\n  \"gl_version\": \"%s\",\n",
+             qPrintable(QGuiApplication::platformName()), (const char*)glGetString(GL_VENDOR),
+             (const char*)glGetString(GL_RENDERER), (const char*)glGetString(GL_VERSION));
+    out += buffer;
+    snprintf(buffer, sizeof(buffer), "  \"window\": \"%dx%d\",\n", viewWidth, viewHeight);
+    out += buffer;
+
+    int failed = 0;
+    if (parser.isSet(compareShadersOption))
+    {
+        std::string comparisons;
+        for (int m = 0; m < modes.size(); m++)
+        {
+            fprintf(stderr, "Comparing the warp shaders at %s\n", qPrintable(modes[m]));
+            if (! compareShaders(modes[m].toStdString(), comparisons))
+                failed++;
+        }
+        out += "  \"shader_comparison\": [\n" + comparisons + "\n  ],\n";
+        capture->makeCurrent();
+    }
+
+    out += "  \"runs\": [\n";
+    std::vector<RunTimes> runTimes;
+    for (size_t i = 0; i < configs.size(); i++)
+    {
+        fprintf(stderr, "Run %d/%d: %s, mesh %dx%d %s, %s shader, %s uploads\n", (int)i + 1, (int)configs.size(), configs[i].mode.c_str(),
+                configs[i].meshWidth, configs[i].meshHeight, WarpRenderer::meshLayoutName(configs[i].meshLayout),
+                WarpRenderer::warpShaderName(configs[i].shader), UnpackBufferRing::modeName(configs[i].uploadMode));
+
+        std::string run;
+        RunTimes times;
+        if (! runConfig(capture, configs[i], viewWidth, viewHeight, parser.value(warmupOption).toDouble(), parser.value(secondsOption).toDouble(), run, times))
+        {
+            failed++;
+            continue;
+        }
+        if (out[out.size() - 1] == '}')
+            out += ",\n";
+        out += run;
+        runTimes.push_back(times);
+    }
+    out += "\n  ]";
+
+    std::string costs;
+    compareShaderTimes(runTimes, costs);
+    if (! costs.empty())
+        out += ",\n  \"shader_times\": [\n" + costs + "\n  ]";
+    out += "\n}\n";
+
+    delete capture;
+
+    if (parser.isSet(outputOption))
+    {
+        FILE* file = fopen(qPrintable(parser.value(outputOption)), "w");
+        if (! file)
+        {
+            fprintf(stderr, "Cannot write %s\n", qPrintable(parser.value(outputOption)));
+            return 1;
+        }
+        fputs(out.c_str(), file);
+        fclose(file);
+    }
+    else
+    {
+        fputs(out.c_str(), stdout);
+    }
+
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,7 @@
+TEMPLATE  	= app
+LANGUAGE  	= C++
+TARGET		= cam2vr_bench
+
+include(../cam2vr.pri)
+
+SOURCES 	+= 	cam2vr_bench.cpp
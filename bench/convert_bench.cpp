@@ -0,0 +1,134 @@
+// Microbenchmark of the CPU UYVY conversion kernels.
+//
+// Converts one frame repeatedly with every instruction set the CPU supports, checks that each one
+// produces exactly the output of the scalar kernel and prints one JSON document with the throughput
+// in Gpixel/s per format and instruction set.
+
+#include "UyvyConverter.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <time.h>
+
+enum Format {
+    FormatRGBA = 0,
+    FormatBGRA,
+    FormatNV12
+};
+
+const char* kFormatNames[] = { "rgba", "bgra", "nv12" };
+
+static double monotonicSeconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void convert(const UyvyConverter& converter, Format format, const std::vector<unsigned char>& src,
+                    unsigned width, unsigned height, std::vector<unsigned char>& dst)
+{
+    switch (format)
+    {
+    case FormatRGBA:
+        converter.toRGBA(&src[0], width * 2, width, height, &dst[0], width * 4);
+        break;
+    case FormatBGRA:
+        converter.toBGRA(&src[0], width * 2, width, height, &dst[0], width * 4);
+        break;
+    case FormatNV12:
+        converter.toNV12(&src[0], width * 2, width, height, &dst[0], width, &dst[width * height], width);
+        break;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned width = 1920, height = 1080;
+    double seconds = 1.0;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--size") == 0 && i + 1 < argc)
+        {
+            if (sscanf(argv[++i], "%ux%u", &width, &height) != 2 || width < 2 || height < 1 || (width & 1))
+            {
+                fprintf(stderr, "Invalid frame size '%s', the width must be even\n", argv[i]);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--seconds") == 0 && i + 1 < argc)
+        {
+            seconds = atof(argv[++i]);
+        }
+        else
+        {
+            fprintf(stderr, "Usage: %s [--size WxH] [--seconds S]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    // Random pixels, so no kernel gets an easy ride from constant data
+    std::vector<unsigned char> src((size_t)width * height * 2);
+    srand(1);
+    for (size_t i = 0; i < src.size(); i++)
+        src[i] = (unsigned char)(rand() >> 7);
+
+    std::string out = "{\n";
+    char buffer[256];
+    snprintf(buffer, sizeof(buffer), "  \"width\": %u,\n  \"height\": %u,\n  \"runs\": [\n", width, height);
+    out += buffer;
+
+    int mismatches = 0;
+    for (int f = FormatRGBA; f <= FormatNV12; f++)
+    {
+        Format format = (Format)f;
+        std::vector<unsigned char> reference((size_t)width * height * 4);
+        convert(UyvyConverter(UyvyConverter::IsaScalar), format, src, width, height, reference);
+
+        for (int i = UyvyConverter::IsaScalar; i <= UyvyConverter::IsaAVX2; i++)
+        {
+            UyvyConverter::Isa isa = (UyvyConverter::Isa)i;
+            if (! UyvyConverter::isaSupported(isa))
+                continue;
+
+            UyvyConverter converter(isa);
+            std::vector<unsigned char> dst(reference.size());
+            convert(converter, format, src, width, height, dst);
+            bool identical = dst == reference;
+            if (! identical)
+            {
+                fprintf(stderr, "%s output of the %s kernel differs from the scalar kernel\n",
+                        kFormatNames[format], UyvyConverter::isaName(isa));
+                mismatches++;
+            }
+
+            // Frames in batches, so reading the clock does not count
+            unsigned long long frames = 0;
+            double start = monotonicSeconds();
+            double elapsed = 0;
+            do
+            {
+                for (int n = 0; n < 8; n++)
+                    convert(converter, format, src, width, height, dst);
+                frames += 8;
+                elapsed = monotonicSeconds() - start;
+            }
+            while (elapsed < seconds);
+
+            if (out[out.size() - 2] == '}')
+                out.insert(out.size() - 1, ",");
+            snprintf(buffer, sizeof(buffer),
+                     "    {\"format\": \"%s\", \"isa\": \"%s\", \"frames\": %llu, \"gpixels_per_second\": %.3f, \"ms_per_frame\": %.3f, \"identical\": %s}\n",
+                     kFormatNames[format], UyvyConverter::isaName(isa), frames,
+                     (double)frames * width * height / elapsed / 1e9, elapsed * 1e3 / frames, identical ? "true" : "false");
+            out += buffer;
+        }
+    }
+    out += "  ]\n}\n";
+    fputs(out.c_str(), stdout);
+
+    return mismatches ? 1 : 0;
+}
@@ -0,0 +1,12 @@
+TEMPLATE  	= app
+LANGUAGE  	= C++
+TARGET		= convert_bench
+CONFIG		-= qt
+CONFIG		+= release
+
+INCLUDEPATH +=	..
+
+HEADERS 	+=	../UyvyConverter.h
+
+SOURCES 	+= 	../UyvyConverter.cpp \
+                        convert_bench.cpp
@@ -0,0 +1,129 @@
+// Microbenchmark of the distortion inverse methods used to build the warp mesh.
+//
+// For every method of DeviceInfo::setInverseMode() and a few mesh densities, inverts the radii of
+// both eyes' mesh grids as WarpRenderer::computeMeshVertices() does, repeatedly, and prints one JSON
+// document with the time per mesh, the time to set the method up (the table is built then) and the
+// method's largest error against the exact inverse: over the mesh's radii, and over the table's whole
+// range, which reaches beyond the corner of the field of view.
+
+#include "DeviceInfo.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <time.h>
+
+using namespace cam2vr;
+
+static double monotonicSeconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Radii of one eye's grid of width x height vertices, like computeMeshVertices()
+static void meshRadii(DeviceInfo& deviceInfo, int width, int height, std::vector<float>& radii)
+{
+    float lensFrustum[4];
+    deviceInfo.getLeftEyeVisibleTanAngles(lensFrustum);
+
+    radii.resize(width * height);
+    for (int j = 0, k = 0; j < height; j++)
+    {
+        for (int i = 0; i < width; i++, k++)
+        {
+            float x = lensFrustum[0] + (lensFrustum[2] - lensFrustum[0]) * i / (width - 1);
+            float y = lensFrustum[3] + (lensFrustum[1] - lensFrustum[3]) * j / (height - 1);
+            radii[k] = sqrt(x * x + y * y);
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    std::string viewerId = "CardboardV2";
+    double seconds = 0.5;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--viewer") == 0 && i + 1 < argc)
+        {
+            viewerId = argv[++i];
+        }
+        else if (strcmp(argv[i], "--seconds") == 0 && i + 1 < argc)
+        {
+            seconds = atof(argv[++i]);
+        }
+        else
+        {
+            fprintf(stderr, "Usage: %s [--viewer CardboardV1|CardboardV2] [--seconds S]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    DeviceInfo deviceInfo;
+    const CardboardViewer* viewer = deviceInfo.findViewer(viewerId);
+    if (! viewer)
+    {
+        fprintf(stderr, "Unknown viewer '%s'\n", viewerId.c_str());
+        return 1;
+    }
+    deviceInfo.setViewer(*viewer);
+
+    static const int sizes[] = { 20, 40, 64 };
+    const int sizeCount = sizeof(sizes) / sizeof(sizes[0]);
+
+    std::string out = "{\n";
+    char buffer[256];
+    snprintf(buffer, sizeof(buffer), "  \"viewer\": \"%s\",\n  \"mesh_radius\": %.3f,\n  \"inverse_range\": %.3f,\n  \"runs\": [\n",
+             viewerId.c_str(), deviceInfo.getMeshRadius(), deviceInfo.getInverseRange());
+    out += buffer;
+
+    for (int m = DeviceInfo::InverseSecant; m <= DeviceInfo::InverseTable; m++)
+    {
+        DeviceInfo::InverseMode mode = (DeviceInfo::InverseMode)m;
+
+        double start = monotonicSeconds();
+        deviceInfo.setInverseMode(mode);
+        double setupSeconds = monotonicSeconds() - start;
+
+        for (int s = 0; s < sizeCount; s++)
+        {
+            std::vector<float> radii;
+            meshRadii(deviceInfo, sizes[s], sizes[s], radii);
+            std::vector<float> undistorted(radii.size());
+
+            // Meshes in batches, so reading the clock does not count; a mesh is both eyes
+            unsigned long long meshes = 0;
+            double elapsed = 0;
+            start = monotonicSeconds();
+            do
+            {
+                for (int n = 0; n < 8; n++)
+                {
+                    for (int e = 0; e < 2; e++)
+                        deviceInfo.distortInverse(&radii[0], &undistorted[0], radii.size());
+                }
+                meshes += 8;
+                elapsed = monotonicSeconds() - start;
+            }
+            while (elapsed < seconds);
+
+            if (out[out.size() - 2] == '}')
+                out.insert(out.size() - 1, ",");
+            snprintf(buffer, sizeof(buffer),
+                     "    {\"method\": \"%s\", \"mesh\": \"%dx%d\", \"radii\": %d, \"us_per_mesh\": %.2f, \"setup_ms\": %.3f, "
+                     "\"max_error\": %.3g, \"max_error_inverse_range\": %.3g}\n",
+                     DeviceInfo::inverseModeName(mode), sizes[s], sizes[s], 2 * (int)radii.size(), elapsed * 1e6 / meshes,
+                     setupSeconds * 1e3, deviceInfo.getInverseErrorBound(), deviceInfo.getInverseRangeErrorBound());
+            out += buffer;
+        }
+    }
+    out += "  ]\n}\n";
+    fputs(out.c_str(), stdout);
+
+    return 0;
+}
@@ -0,0 +1,12 @@
+TEMPLATE  	= app
+LANGUAGE  	= C++
+TARGET		= distortion_bench
+CONFIG		-= qt
+CONFIG		+= release
+
+INCLUDEPATH +=	..
+
+HEADERS 	+=	../DeviceInfo.h
+
+SOURCES 	+= 	../DeviceInfo.cpp \
+                        distortion_bench.cpp
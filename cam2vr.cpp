@@ -26,18 +26,53 @@
  */
 
 #include "cam2vr.h"
+#include "CaptureRecorder.h"
 #include "OpenGLCapture.h"
+#include "StatsServer.h"
 
 #include <QtWidgets>
 #include <QDebug>
 #include <QInputDialog>
 
-Cam2VR::Cam2VR() : QMainWindow(), pOpenGLCapture(NULL), m_device(DEFAULT_DEVICE), m_mode(DEFAULT_MODE)
+Cam2VR::Cam2VR(const Cam2VROptions& options) : QMainWindow(), pOpenGLCapture(NULL), m_statsServer(NULL), m_device(options.device), m_mode(options.mode)
 {
     createActions();
     createMenus();
 
     pOpenGLCapture = new OpenGLCapture(this);
+    if (options.source)
+        pOpenGLCapture->setFrameSource(options.source);
+    pOpenGLCapture->setUploadRing(options.uploadRingDepth, options.uploadRingMode);
+    pOpenGLCapture->setFrameQueue(options.frameQueueDepth, options.frameQueuePolicy);
+    pOpenGLCapture->setPacingLog(options.pacingLog);
+    if (options.meshWidth > 0)
+        pOpenGLCapture->setMeshSize(options.meshWidth, options.meshHeight);
+    pOpenGLCapture->setMeshLayout(options.meshLayout);
+    pOpenGLCapture->setWarpShader(options.warpShader);
+    pOpenGLCapture->setColourMatrix(options.colourMatrix);
+    pOpenGLCapture->setDistortionInverse(options.distortionInverse);
+    if (! options.meshCacheDirectory.isNull())
+        pOpenGLCapture->setMeshCacheDirectory(options.meshCacheDirectory);
+    if (! options.shaderCacheDirectory.isNull())
+        pOpenGLCapture->setShaderCacheDirectory(options.shaderCacheDirectory);
+    for (size_t i = 0; i < options.viewers.size(); i++)
+        pOpenGLCapture->addViewer(options.viewers[i]);
+    for (size_t i = 0; i < options.devices.size(); i++)
+        pOpenGLCapture->addDevice(options.devices[i]);
+    if (! options.viewer.empty())
+        pOpenGLCapture->setViewer(options.viewer);
+    if (! options.phone.empty())
+        pOpenGLCapture->setDevice(options.phone);
+    if (! options.recordPath.empty())
+        pOpenGLCapture->setRecorder(new CaptureRecorder(options.recordPath, options.recordQueueDepth));
+    if (options.statsPort > 0)
+    {
+        m_statsServer = new StatsServer(&pOpenGLCapture->latencyStats(), this);
+        m_statsServer->setControl(pOpenGLCapture);
+        m_statsServer->listen(options.statsPort);
+    }
+    if (m_mode < 0)
+        m_mode = pOpenGLCapture->frameSource()->getDefaultMode();
 
     setCentralWidget(pOpenGLCapture);
 
@@ -52,6 +87,10 @@ Cam2VR::Cam2VR() : QMainWindow(), pOpenGLCapture(NULL), m_device(DEFAULT_DEVICE)
 
 Cam2VR::~Cam2VR()
 {
+    // The server reads the capture's statistics
+    delete m_statsServer;
+    m_statsServer = NULL;
+
     if (pOpenGLCapture)
 	{
         pOpenGLCapture->Stop();
@@ -97,6 +136,29 @@ void Cam2VR::createActions()
     fullscreenAct1 = new QAction(tr("Fullscreen &1"), this);
     fullscreenAct1->setStatusTip(tr("Go fullscreen 1"));
     connect(fullscreenAct1, &QAction::triggered, this, &Cam2VR::goFullScreen1);
+
+    statsOverlayAct = new QAction(tr("&Statistics overlay"), this);
+    statsOverlayAct->setStatusTip(tr("Show GPU and latency statistics over the video"));
+    statsOverlayAct->setCheckable(true);
+    connect(statsOverlayAct, &QAction::triggered, this, &Cam2VR::toggleStatsOverlay);
+
+    // Vertices per eye of the distortion mesh, in each direction
+    static const int meshDensities[] = { 10, 20, 40, 80 };
+    meshDensityGroup = new QActionGroup(this);
+    for (size_t i = 0; i < sizeof(meshDensities) / sizeof(meshDensities[0]); i++)
+    {
+        QAction* action = new QAction(tr("%1 x %1").arg(meshDensities[i]), meshDensityGroup);
+        action->setStatusTip(tr("Warp through a %1 x %1 vertex mesh per eye").arg(meshDensities[i]));
+        action->setCheckable(true);
+        action->setData(meshDensities[i]);
+    }
+    connect(meshDensityGroup, &QActionGroup::triggered, this, &Cam2VR::selectMeshDensity);
+
+    // Filled in from the capture's profiles whenever the menus are shown
+    viewerGroup = new QActionGroup(this);
+    connect(viewerGroup, &QActionGroup::triggered, this, &Cam2VR::selectViewer);
+    deviceGroup = new QActionGroup(this);
+    connect(deviceGroup, &QActionGroup::triggered, this, &Cam2VR::selectDevice);
 }
 
 void Cam2VR::createMenus()
@@ -111,6 +173,18 @@ void Cam2VR::createMenus()
     showMenu = menuBar()->addMenu(tr("&Show"));
     showMenu->addAction(fullscreenAct0);
     showMenu->addAction(fullscreenAct1);
+    showMenu->addSeparator();
+    showMenu->addAction(statsOverlayAct);
+
+    // The mesh may also have been changed through the control endpoint
+    meshDensityMenu = showMenu->addMenu(tr("&Mesh density"));
+    meshDensityMenu->addActions(meshDensityGroup->actions());
+    connect(meshDensityMenu, &QMenu::aboutToShow, this, &Cam2VR::updateMeshDensityMenu);
+
+    viewerMenu = showMenu->addMenu(tr("&Viewer"));
+    connect(viewerMenu, &QMenu::aboutToShow, this, &Cam2VR::updateViewerMenu);
+    deviceMenu = showMenu->addMenu(tr("&Phone"));
+    connect(deviceMenu, &QMenu::aboutToShow, this, &Cam2VR::updateDeviceMenu);
 }
 
 void Cam2VR::updateTitle()
@@ -213,6 +287,106 @@ void Cam2VR::goFullScreen1()
     showFullScreen();
 }
 
+void Cam2VR::toggleStatsOverlay()
+{
+    pOpenGLCapture->setStatsOverlay(!pOpenGLCapture->statsOverlay());
+    statsOverlayAct->setChecked(pOpenGLCapture->statsOverlay());
+}
+
+void Cam2VR::selectMeshDensity(QAction* action)
+{
+    int density = action->data().toInt();
+    pOpenGLCapture->setMeshSize(density, density);
+    updateMeshDensityMenu();
+}
+
+void Cam2VR::updateMeshDensityMenu()
+{
+    QList<QAction*> actions = meshDensityGroup->actions();
+    for (int i = 0; i < actions.size(); i++)
+    {
+        int density = actions[i]->data().toInt();
+        actions[i]->setChecked(density == pOpenGLCapture->meshWidth() && density == pOpenGLCapture->meshHeight());
+    }
+}
+
+// Multiply both mesh dimensions by factor, within the renderer's limits
+void Cam2VR::scaleMeshDensity(double factor)
+{
+    int width = qBound((int)WarpRenderer::MinMeshSize, (int)(pOpenGLCapture->meshWidth() * factor + 0.5), (int)WarpRenderer::MaxMeshSize);
+    int height = qBound((int)WarpRenderer::MinMeshSize, (int)(pOpenGLCapture->meshHeight() * factor + 0.5), (int)WarpRenderer::MaxMeshSize);
+    qDebug() << "mesh density" << width << "x" << height;
+    pOpenGLCapture->setMeshSize(width, height);
+}
+
+void Cam2VR::selectViewer(QAction* action)
+{
+    pOpenGLCapture->setViewer(action->data().toString().toStdString());
+}
+
+void Cam2VR::selectDevice(QAction* action)
+{
+    pOpenGLCapture->setDevice(action->data().toString().toStdString());
+}
+
+void Cam2VR::updateViewerMenu()
+{
+    const DeviceInfo& profiles = pOpenGLCapture->profiles();
+    QStringList ids, labels;
+    for (size_t i = 0; i < profiles.getViewers().size(); i++)
+    {
+        ids << QString::fromStdString(profiles.getViewers()[i].id);
+        labels << QString::fromStdString(profiles.getViewers()[i].label);
+    }
+    fillProfileMenu(viewerMenu, viewerGroup, ids, labels, QString::fromStdString(profiles.getViewer().id));
+}
+
+void Cam2VR::updateDeviceMenu()
+{
+    const DeviceInfo& profiles = pOpenGLCapture->profiles();
+    QStringList ids, labels;
+    for (size_t i = 0; i < profiles.getDevices().size(); i++)
+    {
+        const Device& device = profiles.getDevices()[i];
+        ids << QString::fromStdString(device.id);
+        labels << tr("%1 (%2 x %3 mm)").arg(QString::fromStdString(device.label))
+                  .arg(device.widthMeters * 1000, 0, 'f', 1).arg(device.heightMeters * 1000, 0, 'f', 1);
+    }
+    fillProfileMenu(deviceMenu, deviceGroup, ids, labels, QString::fromStdString(profiles.getDevice().id));
+}
+
+// Replace the actions of a profile menu, checking the selected profile; profiles may have been added
+// or selected through the control endpoint since the menu was last shown
+void Cam2VR::fillProfileMenu(QMenu* menu, QActionGroup* group, const QStringList& ids, const QStringList& labels, const QString& selected)
+{
+    qDeleteAll(group->actions());
+    for (int i = 0; i < ids.size(); i++)
+    {
+        QAction* action = new QAction(labels[i].isEmpty() ? ids[i] : labels[i], group);
+        action->setCheckable(true);
+        action->setChecked(ids[i] == selected);
+        action->setData(ids[i]);
+    }
+    menu->addActions(group->actions());
+}
+
+// Switch to the viewer after the selected one, for the full screen view without a menu bar
+void Cam2VR::nextViewer()
+{
+    const DeviceInfo& profiles = pOpenGLCapture->profiles();
+    const std::vector<CardboardViewer>& viewers = profiles.getViewers();
+    for (size_t i = 0; i < viewers.size(); i++)
+    {
+        if (viewers[i].id == profiles.getViewer().id)
+        {
+            std::string id = viewers[(i + 1) % viewers.size()].id;
+            qDebug() << "viewer" << QString::fromStdString(id);
+            pOpenGLCapture->setViewer(id);
+            return;
+        }
+    }
+}
+
 void Cam2VR::keyPressEvent(QKeyEvent *event)
 {
     qDebug() << "key pressed" << event->key();
@@ -222,6 +396,20 @@ void Cam2VR::keyPressEvent(QKeyEvent *event)
         start();
         break;
 
+    case Qt::Key_P:
+        toggleStatsOverlay();
+        break;
+    case Qt::Key_Plus:
+    case Qt::Key_Equal:
+        scaleMeshDensity(2.0);
+        break;
+    case Qt::Key_Minus:
+        scaleMeshDensity(0.5);
+        break;
+    case Qt::Key_V:
+        nextViewer();
+        break;
+
     case Qt::Key_Escape:
     case Qt::Key_N:
         showNormal();
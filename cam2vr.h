@@ -30,20 +30,63 @@
 #define __LOOP_THROUGH_WITH_OPENGL_COMPOSITING_H__
 
 #include "DeckLinkAPI.h"
+#include "FrameQueue.h"
+#include "FrameSource.h"
+#include "UnpackBufferRing.h"
+#include "WarpRenderer.h"
 
 #include <QDialog>
 #include <QAction>
+#include <QActionGroup>
 #include <QMainWindow>
 
 #include <vector>
 #include <string>
 
 class OpenGLCapture;
+class StatsServer;
+
+// Start-up configuration, filled in from the command line
+struct Cam2VROptions
+{
+    Cam2VROptions() :
+        source(NULL), device(DEFAULT_DEVICE), mode(-1),
+        uploadRingDepth(3), uploadRingMode(UnpackBufferRing::ModeAuto),
+        frameQueueDepth(2), frameQueuePolicy(FrameQueue::PolicyDropOldest),
+        pacingLog(false), statsPort(0), meshWidth(0), meshHeight(0),
+        meshLayout(WarpRenderer::MeshStrips), warpShader(WarpRenderer::ShaderGather),
+        colourMatrix(WarpRenderer::ColourRec709), distortionInverse(DeviceInfo::InverseTable),
+        recordQueueDepth(8) {}
+
+    FrameSource*            source;         // NULL for a DeckLink card, otherwise owned by Cam2VR
+    int                     device;
+    int                     mode;           // negative selects the source's default mode
+    int                     uploadRingDepth;
+    UnpackBufferRing::Mode  uploadRingMode;
+    int                     frameQueueDepth;
+    FrameQueue::Policy      frameQueuePolicy;
+    bool                    pacingLog;
+    int                     statsPort;      // local HTTP statistics endpoint, 0 for none
+    int                     meshWidth;      // distortion mesh vertices per eye, 0 for the default
+    int                     meshHeight;
+    WarpRenderer::MeshLayout meshLayout;
+    WarpRenderer::WarpShader warpShader;
+    WarpRenderer::ColourMatrix colourMatrix;
+    DeviceInfo::InverseMode distortionInverse;
+    QString                 meshCacheDirectory; // null for the default location, empty for no cache
+    QString                 shaderCacheDirectory; // likewise
+    std::vector<CardboardViewer> viewers;   // user-defined profiles, in addition to DeviceInfo's
+    std::vector<Device>     devices;
+    std::string             viewer;         // id of the viewer and phone to start with, empty for the default
+    std::string             phone;
+    std::string             recordPath;     // raw capture recording, empty for none
+    int                     recordQueueDepth;
+};
 
 class Cam2VR : public QMainWindow
 {
 public:
-    Cam2VR();
+    Cam2VR(const Cam2VROptions& options = Cam2VROptions());
     ~Cam2VR();
 
 	void start();
@@ -58,14 +101,25 @@ private slots:
     void captureStop();
     void goFullScreen0();
     void goFullScreen1();
+    void toggleStatsOverlay();
+    void selectMeshDensity(QAction* action);
+    void updateMeshDensityMenu();
+    void selectViewer(QAction* action);
+    void selectDevice(QAction* action);
+    void updateViewerMenu();
+    void updateDeviceMenu();
 
 private:
     void createActions();
     void createMenus();
     void updateTitle();
+    void scaleMeshDensity(double factor);
+    void nextViewer();
+    void fillProfileMenu(QMenu* menu, QActionGroup* group, const QStringList& ids, const QStringList& labels, const QString& selected);
 
 private:
     OpenGLCapture*	pOpenGLCapture;
+    StatsServer*    m_statsServer;
 
     //capture
     int m_device;
@@ -83,6 +137,15 @@ private:
     QMenu *showMenu;
     QAction *fullscreenAct0;
     QAction *fullscreenAct1;
+    QAction *statsOverlayAct;
+
+    QMenu *meshDensityMenu;
+    QActionGroup *meshDensityGroup;
+
+    QMenu *viewerMenu;
+    QActionGroup *viewerGroup;
+    QMenu *deviceMenu;
+    QActionGroup *deviceGroup;
 };
 
 #endif // __LOOP_THROUGH_WITH_OPENGL_COMPOSITING_H__
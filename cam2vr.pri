@@ -0,0 +1,69 @@
+# Capture, warp and presentation pipeline shared by cam2vr and cam2vr_bench
+CONFIG		+= qt opengl
+QT		+= opengl network
+INCLUDEPATH +=	$$PWD $$PWD/include
+LIBS		+= -lGLU -ldl
+
+HEADERS 	+=	$$PWD/include/DeckLinkAPIDispatch.cpp \
+                        $$PWD/OpenGLCapture.h \
+                        $$PWD/GLExtensions.h \
+                        $$PWD/DeviceInfo.h \
+                        $$PWD/FrameSource.h \
+                        $$PWD/SyntheticFrameSource.h \
+                        $$PWD/RecordedFrameSource.h \
+                        $$PWD/UnpackBufferRing.h \
+                        $$PWD/UploadScheduler.h \
+                        $$PWD/FrameQueue.h \
+                        $$PWD/WarpRenderer.h \
+                        $$PWD/RenderThread.h \
+                        $$PWD/FramePacer.h \
+                        $$PWD/LatencyStats.h \
+                        $$PWD/GpuTimer.h \
+                        $$PWD/StatsServer.h \
+                        $$PWD/PipelineControl.h \
+                        $$PWD/FrameSink.h \
+                        $$PWD/HeadlessCapture.h \
+                        $$PWD/UyvyConverter.h \
+                        $$PWD/CpuWarper.h \
+                        $$PWD/MeshCache.h \
+                        $$PWD/ShaderManager.h \
+                        $$PWD/PlayoutSink.h \
+                        $$PWD/ReadbackRing.h \
+                        $$PWD/CaptureRecorder.h \
+                        $$PWD/ViewerProfile.h
+
+SOURCES 	+= 	$$PWD/include/DeckLinkAPIDispatch.cpp \
+                        $$PWD/OpenGLCapture.cpp \
+                        $$PWD/GLExtensions.cpp \
+                        $$PWD/DeviceInfo.cpp \
+                        $$PWD/FrameSource.cpp \
+                        $$PWD/SyntheticFrameSource.cpp \
+                        $$PWD/RecordedFrameSource.cpp \
+                        $$PWD/UnpackBufferRing.cpp \
+                        $$PWD/UploadScheduler.cpp \
+                        $$PWD/FrameQueue.cpp \
+                        $$PWD/WarpRenderer.cpp \
+                        $$PWD/RenderThread.cpp \
+                        $$PWD/FramePacer.cpp \
+                        $$PWD/LatencyStats.cpp \
+                        $$PWD/GpuTimer.cpp \
+                        $$PWD/StatsServer.cpp \
+                        $$PWD/FrameSink.cpp \
+                        $$PWD/HeadlessCapture.cpp \
+                        $$PWD/UyvyConverter.cpp \
+                        $$PWD/CpuWarper.cpp \
+                        $$PWD/MeshCache.cpp \
+                        $$PWD/ShaderManager.cpp \
+                        $$PWD/PlayoutSink.cpp \
+                        $$PWD/ReadbackRing.cpp \
+                        $$PWD/CaptureRecorder.cpp \
+                        $$PWD/ViewerProfile.cpp
+
+# Encoding sinks (h264:<url>, hevc:<url>), with FFmpeg's development packages: qmake CONFIG+=ffmpeg
+ffmpeg {
+    DEFINES     += CAM2VR_HAVE_FFMPEG
+    CONFIG      += link_pkgconfig
+    PKGCONFIG   += libavformat libavcodec libswscale libavutil
+    HEADERS     += $$PWD/EncodeSink.h
+    SOURCES     += $$PWD/EncodeSink.cpp
+}
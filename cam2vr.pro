@@ -1,21 +1,11 @@
 TEMPLATE  	= app
 LANGUAGE  	= C++
-CONFIG		+= qt opengl
-QT		+= opengl
-INCLUDEPATH =	include 
-LIBS		+= -lGLU -ldl
 
-HEADERS 	=	include/DeckLinkAPIDispatch.cpp \
-                        cam2vr.h \
-                        OpenGLCapture.h \
-                        GLExtensions.h \
-                        DeviceInfo.h
+include(cam2vr.pri)
 
-SOURCES 	= 	main.cpp \
-                        include/DeckLinkAPIDispatch.cpp \
-                        cam2vr.cpp \
-                        OpenGLCapture.cpp \
-                        GLExtensions.cpp \
-                        DeviceInfo.cpp
+HEADERS 	+=	cam2vr.h
+
+SOURCES 	+= 	main.cpp \
+                        cam2vr.cpp
 
 FORMS 		= 
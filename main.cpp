@@ -26,16 +26,389 @@
  */
 
 #include <QApplication>
+#include <QCommandLineParser>
+#include <QScopedPointer>
+#include <QTimer>
+#include <stdio.h>
+#include <string.h>
 #include "cam2vr.h"
+#include "CaptureRecorder.h"
 #include "OpenGLCapture.h"
+#include "FrameSink.h"
+#include "HeadlessCapture.h"
+#include "LatencyStats.h"
+#include "StatsServer.h"
+#include "RecordedFrameSource.h"
+#include "SyntheticFrameSource.h"
+#include "ViewerProfile.h"
+#include "WarpRenderer.h"
+
+static bool hasArgument(int argc, char *argv[], const char* name)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], name) == 0)
+            return true;
+    }
+    return false;
+}
+
+// Mesh size given as N (N x N) or WxH
+static bool parseMeshSize(const QString& text, int& width, int& height)
+{
+    QStringList parts = text.split('x');
+    bool okWidth = false, okHeight = true;
+    width = parts[0].toInt(&okWidth);
+    height = width;
+    if (parts.size() > 1)
+        height = parts[1].toInt(&okHeight);
+    return okWidth && okHeight && parts.size() <= 2 && WarpRenderer::isValidMeshSize(width, height);
+}
+
+// A phone screen given as width,height,bevel in millimetres
+static bool parsePhone(const QString& text, Device& device)
+{
+    QStringList parts = text.split(',');
+    if (parts.size() != 3)
+        return false;
+
+    float size[3];
+    for (int i = 0; i < 3; i++)
+    {
+        bool ok = false;
+        size[i] = parts[i].toFloat(&ok) / 1000;
+        if (! ok || size[i] < 0 || (i < 2 && size[i] == 0))
+            return false;
+    }
+    device = Device(size[0], size[1], size[2]);
+    device.id = "custom";
+    device.label = "Custom phone";
+    return true;
+}
+
+// Run the pipeline without a window, delivering warped frames to sinks, for duration seconds or until
+// killed.  cpuThreads < 0 warps with OpenGL, otherwise on the CPU with that many threads (0: one per core).
+// A source other than the DeckLink card is handed to the capture once it is set up, and deleted
+// with source if that fails first.
+static int runHeadless(QGuiApplication& app, const Cam2VROptions& options, QScopedPointer<FrameSource>& source,
+                       const QStringList& sinkSpecs, double duration, int cpuThreads,
+                       WarpedFrame::Format readbackFormat, int readbackDepth)
+{
+    HeadlessCapture capture;
+    if (cpuThreads >= 0)
+        capture.setCpuWarp(true, cpuThreads);
+    capture.setReadback(readbackFormat, readbackDepth);
+
+    QString error;
+    if (! capture.init(error))
+    {
+        fprintf(stderr, "%s\n", qPrintable(error));
+        return 1;
+    }
+
+    if (source)
+        capture.setFrameSource(source.take());
+    capture.setUploadRing(options.uploadRingDepth, options.uploadRingMode);
+    capture.setFrameQueue(options.frameQueueDepth, options.frameQueuePolicy);
+    capture.setPacingLog(options.pacingLog);
+    if (options.meshWidth > 0)
+        capture.setMeshSize(options.meshWidth, options.meshHeight);
+    capture.setMeshLayout(options.meshLayout);
+    capture.setWarpShader(options.warpShader);
+    capture.setColourMatrix(options.colourMatrix);
+    capture.setDistortionInverse(options.distortionInverse);
+    if (! options.meshCacheDirectory.isNull())
+        capture.setMeshCacheDirectory(options.meshCacheDirectory);
+    if (! options.shaderCacheDirectory.isNull())
+        capture.setShaderCacheDirectory(options.shaderCacheDirectory);
+    for (size_t i = 0; i < options.viewers.size(); i++)
+        capture.addViewer(options.viewers[i]);
+    for (size_t i = 0; i < options.devices.size(); i++)
+        capture.addDevice(options.devices[i]);
+    if (! options.viewer.empty())
+        capture.setViewer(options.viewer);
+    if (! options.phone.empty())
+        capture.setDevice(options.phone);
+    if (! options.recordPath.empty())
+        capture.setRecorder(new CaptureRecorder(options.recordPath, options.recordQueueDepth));
+
+    for (int i = 0; i < sinkSpecs.size(); i++)
+    {
+        FrameSink* sink = FrameSink::create(sinkSpecs[i].toStdString());
+        if (! sink)
+        {
+            fprintf(stderr, "Unknown sink '%s'\n", qPrintable(sinkSpecs[i]));
+            return 1;
+        }
+        capture.addSink(sink);
+    }
+
+    StatsServer statsServer(&capture.latencyStats());
+    statsServer.setControl(&capture);
+    if (options.statsPort > 0)
+        statsServer.listen(options.statsPort);
+
+    int mode = options.mode < 0 ? capture.frameSource()->getDefaultMode() : options.mode;
+    if (! capture.InitDeckLink(options.device, mode) || ! capture.Start())
+        return 1;
+
+    if (duration > 0)
+        QTimer::singleShot((int)(duration * 1000), &app, SLOT(quit()));
+
+    int result = app.exec();
+    capture.Stop();
+    return result;
+}
 
 int main(int argc, char *argv[])
 {
-	QApplication app(argc, argv);
+    // A headless run must not need a window system, so only then is a widget application avoided
+    bool headless = hasArgument(argc, argv, "--headless") || hasArgument(argc, argv, "--cpu-warp");
+    if (headless && qgetenv("QT_QPA_PLATFORM").isEmpty())
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+
+    QScopedPointer<QGuiApplication> app(headless ? new QGuiApplication(argc, argv) : new QApplication(argc, argv));
+    QGuiApplication::setApplicationName("cam2vr");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("3D camera to VR (Google Cardboard) warp");
+    parser.addHelpOption();
+    QCommandLineOption sourceOption("source", "Frame source: decklink (default), synthetic, or replay:<file> to play back a --record recording.", "source", "decklink");
+    QCommandLineOption deviceOption("device", "Capture device index.", "index", QString::number(DEFAULT_DEVICE));
+    QCommandLineOption modeOption("mode", "Display mode index, or for the synthetic source a name such as 1080p60 or 2160p30.", "mode");
+    QCommandLineOption patternOption("pattern", "Synthetic test pattern: bars, ramp or box.", "pattern", "bars");
+    QCommandLineOption rateOption("rate", "Synthetic or replay frame rate in fps; 0 delivers frames as fast as they are consumed. A replay also takes original, the recorded cadence (default), or max, the same as 0.", "fps");
+    QCommandLineOption replayLoopsOption("replay-loops", "Times the recording is replayed, 0 for over and over; a headless run quits after the last.", "count", "1");
+    QCommandLineOption replayPreloadOption("replay-preload", "Read the whole recording into memory before replaying it, so no frame waits for the disk.");
+    QCommandLineOption uploadRingOption("upload-ring", "Number of pixel unpack buffers used for uploads without pinned memory.", "count", "3");
+    QCommandLineOption uploadModeOption("upload-mode", "Unpack buffer mode: auto, persistent or orphan.", "mode", "auto");
+    QCommandLineOption queueDepthOption("queue-depth", "Number of captured frames that may wait for the render thread.", "count", "2");
+    QCommandLineOption queuePolicyOption("queue-policy", "What to do with a frame when the queue is full: drop-oldest, drop-newest or block.", "policy", "drop-oldest");
+    QCommandLineOption pacingLogOption("log-pacing", "Print the frame pacer's decision for every frame.");
+    QCommandLineOption statsPortOption("stats-port", "Serve latency statistics on http://127.0.0.1:<port>/stats (JSON) and /metrics (Prometheus), and the /mesh and /profile controls.", "port", "0");
+    QCommandLineOption meshOption("mesh", "Distortion mesh vertices per eye, N or WxH; also changed at run time with the +/- keys, Show > Mesh density or POST /mesh on the stats port.", "size", "20");
+    QCommandLineOption meshLayoutOption("mesh-layout", "Distortion mesh buffers: strips (packed vertices, 16-bit indices, primitive restart) or triangles.", "layout", "strips");
+    QCommandLineOption shaderOption("shader", "Warp fragment shader: gather (four texel fetches and conversions per pixel) or two-plane (filtered luma and chroma planes split from the frame on the GPU, one conversion).", "shader", "gather");
+    QCommandLineOption distortionInverseOption("distortion-inverse", "How the distortion mesh inverts the lens distortion: table (cubic interpolation of exact solutions), secant (iterated per vertex) or polynomial (the viewer's inverse coefficients).", "method", "table");
+    QCommandLineOption colourMatrixOption("colour-matrix", "YCbCr to RGB conversion of the captured video: 709 (HD) or 601 (SD).", "matrix", "709");
+    QCommandLineOption shaderCacheOption("shader-cache", "Directory of linked shader program binaries, reused by later starts; none to always compile the shaders.", "dir", ShaderManager::defaultDirectory());
+    QCommandLineOption meshCacheOption("mesh-cache", "Directory of computed distortion meshes, reused by later starts; none to always compute them.", "dir", MeshCache::defaultDirectory());
+    QCommandLineOption viewerOption("viewer", "Cardboard viewer the lens warp is computed for: CardboardV1, CardboardV2 or the id of a --viewer-profile; also changed at run time with the V key, Show > Viewer or POST /profile on the stats port.", "id", "CardboardV2");
+    QCommandLineOption viewerProfileOption("viewer-profile", "Add a viewer, may be repeated: the URL of a Cardboard viewer QR code (http://google.com/cardboard/cfg?p=...), or a file with such a URL, Cardboard device parameters or JSON. The last one is selected unless --viewer names another.", "url|file");
+    QCommandLineOption phoneOption("phone", "Phone screen of the viewer: DefaultAndroid, DefaultIOS or width,height,bevel in millimetres.", "id", "DefaultAndroid");
+    QCommandLineOption recordOption("record", "Record the raw captured UYVY frames to file, page aligned and with O_DIRECT, and their timestamps to file.idx.", "file");
+    QCommandLineOption recordQueueOption("record-queue", "Captured frames that may wait for the recording's disk writes before frames are dropped from it.", "count", "8");
+    QCommandLineOption headlessOption("headless", "Run without a window, rendering offscreen and writing warped frames to the sinks.");
+    QCommandLineOption sinkOption("sink", "Headless frame sink, may be repeated: null (default), raw:<file> with - for stdout (frames in the --readback-format), decklink:<index> to play out on the output of a DeckLink device, playout-sim[:<log file>] to simulate that playout, logging every scheduled frame, or in builds with FFmpeg h264:<url> or hevc:<url> to encode and publish to rtmp://, srt:// or HLS (a .m3u8 path).", "sink");
+    QCommandLineOption readbackFormatOption("readback-format", "Pixel format of the frames read back for the sinks: rgba, uyvy or nv12, converted on the GPU with the --colour-matrix and read back at half or three eighths of the RGBA size.", "format", "rgba");
+    QCommandLineOption readbackRingOption("readback-ring", "Number of pixel pack buffers the headless frames are read back through asynchronously.", "count", "3");
+    QCommandLineOption durationOption("duration", "Headless run time in seconds; 0 runs until killed.", "seconds", "0");
+    QCommandLineOption cpuWarpOption("cpu-warp", "Run headless, warping on the CPU instead of with OpenGL.");
+    QCommandLineOption cpuThreadsOption("cpu-threads", "Threads of the CPU warp; 0 for one per core.", "threads", "0");
+    parser.addOption(sourceOption);
+    parser.addOption(deviceOption);
+    parser.addOption(modeOption);
+    parser.addOption(patternOption);
+    parser.addOption(rateOption);
+    parser.addOption(replayLoopsOption);
+    parser.addOption(replayPreloadOption);
+    parser.addOption(uploadRingOption);
+    parser.addOption(uploadModeOption);
+    parser.addOption(queueDepthOption);
+    parser.addOption(queuePolicyOption);
+    parser.addOption(pacingLogOption);
+    parser.addOption(statsPortOption);
+    parser.addOption(meshOption);
+    parser.addOption(meshLayoutOption);
+    parser.addOption(shaderOption);
+    parser.addOption(colourMatrixOption);
+    parser.addOption(distortionInverseOption);
+    parser.addOption(shaderCacheOption);
+    parser.addOption(meshCacheOption);
+    parser.addOption(viewerOption);
+    parser.addOption(viewerProfileOption);
+    parser.addOption(phoneOption);
+    parser.addOption(recordOption);
+    parser.addOption(recordQueueOption);
+    parser.addOption(headlessOption);
+    parser.addOption(sinkOption);
+    parser.addOption(readbackFormatOption);
+    parser.addOption(readbackRingOption);
+    parser.addOption(durationOption);
+    parser.addOption(cpuWarpOption);
+    parser.addOption(cpuThreadsOption);
+    parser.process(*app);
+
+    Cam2VROptions options;
+    options.device = parser.value(deviceOption).toInt();
+    options.uploadRingDepth = parser.value(uploadRingOption).toInt();
+    if (! UnpackBufferRing::modeFromName(qPrintable(parser.value(uploadModeOption)), options.uploadRingMode))
+    {
+        fprintf(stderr, "Unknown upload mode '%s'\n", qPrintable(parser.value(uploadModeOption)));
+        return 1;
+    }
+    options.frameQueueDepth = parser.value(queueDepthOption).toInt();
+    options.pacingLog = parser.isSet(pacingLogOption);
+    options.statsPort = parser.value(statsPortOption).toInt();
+    if (parser.isSet(meshOption) && ! parseMeshSize(parser.value(meshOption), options.meshWidth, options.meshHeight))
+    {
+        fprintf(stderr, "Invalid mesh size '%s', each side must be %d to %d\n", qPrintable(parser.value(meshOption)),
+                (int)WarpRenderer::MinMeshSize, (int)WarpRenderer::MaxMeshSize);
+        return 1;
+    }
+    if (! FrameQueue::policyFromName(qPrintable(parser.value(queuePolicyOption)), options.frameQueuePolicy))
+    {
+        fprintf(stderr, "Unknown queue policy '%s'\n", qPrintable(parser.value(queuePolicyOption)));
+        return 1;
+    }
+    if (! WarpRenderer::meshLayoutFromName(qPrintable(parser.value(meshLayoutOption)), options.meshLayout))
+    {
+        fprintf(stderr, "Unknown mesh layout '%s'\n", qPrintable(parser.value(meshLayoutOption)));
+        return 1;
+    }
+    if (! WarpRenderer::warpShaderFromName(qPrintable(parser.value(shaderOption)), options.warpShader))
+    {
+        fprintf(stderr, "Unknown warp shader '%s'\n", qPrintable(parser.value(shaderOption)));
+        return 1;
+    }
+    if (! WarpRenderer::colourMatrixFromName(qPrintable(parser.value(colourMatrixOption)), options.colourMatrix))
+    {
+        fprintf(stderr, "Unknown colour matrix '%s'\n", qPrintable(parser.value(colourMatrixOption)));
+        return 1;
+    }
+    if (! DeviceInfo::inverseModeFromName(qPrintable(parser.value(distortionInverseOption)), options.distortionInverse))
+    {
+        fprintf(stderr, "Unknown distortion inverse '%s'\n", qPrintable(parser.value(distortionInverseOption)));
+        return 1;
+    }
+    if (parser.isSet(meshCacheOption))
+        options.meshCacheDirectory = parser.value(meshCacheOption) == "none" ? QString("") : parser.value(meshCacheOption);
+    if (parser.isSet(shaderCacheOption))
+        options.shaderCacheDirectory = parser.value(shaderCacheOption) == "none" ? QString("") : parser.value(shaderCacheOption);
+
+    options.recordPath = parser.value(recordOption).toStdString();
+    options.recordQueueDepth = parser.value(recordQueueOption).toInt();
+
+    DeviceInfo profiles;
+    QStringList viewerSpecs = parser.values(viewerProfileOption);
+    for (int i = 0; i < viewerSpecs.size(); i++)
+    {
+        CardboardViewer viewer;
+        QString error;
+        if (! ViewerProfile::load(viewerSpecs[i], viewer, error))
+        {
+            fprintf(stderr, "%s\n", qPrintable(error));
+            return 1;
+        }
+        profiles.addViewer(viewer);
+        options.viewers.push_back(viewer);
+    }
+
+    Device phone;
+    options.viewer = parser.value(viewerOption).toStdString();
+    if (! parser.isSet(viewerOption) && ! options.viewers.empty())
+        options.viewer = options.viewers.back().id;
+    options.phone = parser.value(phoneOption).toStdString();
+    if (parsePhone(parser.value(phoneOption), phone))
+    {
+        options.devices.push_back(phone);
+        options.phone = phone.id;
+    }
+    else if (! profiles.findDevice(options.phone))
+    {
+        fprintf(stderr, "Unknown phone '%s'\n", options.phone.c_str());
+        return 1;
+    }
+    if (! profiles.findViewer(options.viewer))
+    {
+        fprintf(stderr, "Unknown viewer '%s'\n", options.viewer.c_str());
+        return 1;
+    }
+
+    // Owns a synthetic or replay source until it is handed over, so an invalid option does not leak it
+    QScopedPointer<FrameSource> source;
+    if (parser.value(sourceOption) == "synthetic")
+    {
+        SyntheticFrameSource* synthetic = new SyntheticFrameSource();
+        source.reset(synthetic);
+
+        SyntheticFrameSource::Pattern pattern;
+        if (! SyntheticFrameSource::patternFromName(parser.value(patternOption).toStdString(), pattern))
+        {
+            fprintf(stderr, "Unknown pattern '%s'\n", qPrintable(parser.value(patternOption)));
+            return 1;
+        }
+        synthetic->setPattern(pattern);
+
+        if (parser.isSet(rateOption))
+            synthetic->setRate(parser.value(rateOption).toDouble());
+
+        if (parser.isSet(modeOption))
+        {
+            options.mode = SyntheticFrameSource::modeFromName(parser.value(modeOption).toStdString());
+            if (options.mode < 0)
+            {
+                fprintf(stderr, "Unknown synthetic mode '%s'\n", qPrintable(parser.value(modeOption)));
+                return 1;
+            }
+        }
+    }
+    else if (parser.value(sourceOption).startsWith("replay:") && parser.value(sourceOption).size() > 7)
+    {
+        RecordedFrameSource* replay = new RecordedFrameSource(parser.value(sourceOption).mid(7).toStdString());
+        source.reset(replay);
+
+        if (parser.isSet(rateOption))
+        {
+            double rate;
+            if (! RecordedFrameSource::rateFromName(parser.value(rateOption).toStdString(), rate))
+            {
+                fprintf(stderr, "Unknown replay rate '%s'\n", qPrintable(parser.value(rateOption)));
+                return 1;
+            }
+            replay->setRate(rate);
+        }
+
+        int loops = parser.value(replayLoopsOption).toInt();
+        if (loops < 0)
+        {
+            fprintf(stderr, "Invalid replay loop count %d\n", loops);
+            return 1;
+        }
+        replay->setLoops(loops);
+        replay->setPreload(parser.isSet(replayPreloadOption));
+        replay->setQuitAtEnd(headless);
+    }
+    else if (parser.value(sourceOption) != "decklink")
+    {
+        fprintf(stderr, "Unknown frame source '%s'\n", qPrintable(parser.value(sourceOption)));
+        return 1;
+    }
+    else if (parser.isSet(modeOption))
+    {
+        options.mode = parser.value(modeOption).toInt();
+    }
+
+    if (headless)
+    {
+        QStringList sinks = parser.values(sinkOption);
+        if (sinks.isEmpty())
+            sinks << "null";
+        int cpuThreads = parser.isSet(cpuWarpOption) ? parser.value(cpuThreadsOption).toInt() : -1;
+        WarpedFrame::Format readbackFormat;
+        if (! WarpedFrame::formatFromName(qPrintable(parser.value(readbackFormatOption)), readbackFormat))
+        {
+            fprintf(stderr, "Unknown readback format '%s'\n", qPrintable(parser.value(readbackFormatOption)));
+            return 1;
+        }
+        return runHeadless(*app, options, source, sinks, parser.value(durationOption).toDouble(), cpuThreads,
+                           readbackFormat, parser.value(readbackRingOption).toInt());
+    }
 
-    Cam2VR cam2vr;
+    options.source = source.take();
+    Cam2VR cam2vr(options);
     cam2vr.show();
     //cam2vr.start();
 
-	return app.exec();
+	return app->exec();
 }